@@ -0,0 +1,398 @@
+#!/usr/bin/env python3
+#
+# mock_mapi.py
+#       a stand-in MonetDB server for benchmarking monetdb_fdw
+#
+# Speaks enough of the MAPI protocol (version 9) for libmapi to log in and
+# run the queries monetdb_fdw sends for a scan, and answers them with a
+# synthetic table instead of real data, so that the wrapper's throughput
+# can be measured without a MonetDB installation and without MonetDB's own
+# execution time in the figures.
+#
+# The table has --rows rows and one column per entry of --types, named c0,
+# c1, ...; c0 holds the row number, the others values of their type that
+# repeat every --distinct rows.  Every query is answered from that table,
+# whatever the name in its FROM clause:
+#
+#   - the select list is the quoted column names it mentions ("c0", ...),
+#     or a single constant column if it mentions none;
+#   - WHERE conditions comparing "c0" to an integer are applied, and any
+#     other condition is ignored (a warning is printed once);
+#   - LIMIT and OFFSET are applied, ORDER BY is ignored (rows come in c0
+#     order);
+#   - SELECT count(*) returns the number of rows the conditions keep.
+#
+# Statements that are not queries are accepted and do nothing.  That
+# includes the COPY ... BINARY ... ON CLIENT of transfer_mode 'binary':
+# the mock doesn't implement the file transfer it asks the client for, so
+# binary scans can't be measured against it.
+#
+# --latency delays every response, and --bandwidth caps the bytes sent per
+# second on each connection, to mimic a remote server.
+#
+# Copyright (c) 2013, Satoshi Nagayasu
+#
+# IDENTIFICATION
+#       contrib/monetdb_fdw/bench/mock_mapi.py
+#
+
+import argparse
+import re
+import socketserver
+import struct
+import sys
+import threading
+import time
+
+BLOCK_SIZE = 8190           # payload of a MAPI block, as libmapi sends it
+
+CHALLENGE = "mockmapisalt:mserver:9:RIPEMD160,SHA512,SHA384,SHA256,SHA224,SHA1:LIT:SHA512:\n"
+
+# type name announced to the client, and length column of the header
+TYPES = {
+    "int": ("int", 11),
+    "bigint": ("bigint", 20),
+    "double": ("double", 24),
+    "decimal": ("decimal", 18),
+    "varchar": ("varchar", 0),
+    "date": ("date", 10),
+    "timestamp": ("timestamp", 26),
+    "boolean": ("boolean", 5),
+}
+
+C0_COND = re.compile(r'"c0"\s*(<=|>=|=|<|>)\s*\(?(-?\d+)\)?')
+COLUMN = re.compile(r'"(c\d+)"')
+LIMIT = re.compile(r'\bLIMIT\s+(\d+)', re.IGNORECASE)
+OFFSET = re.compile(r'\bOFFSET\s+(\d+)', re.IGNORECASE)
+
+warned = set()
+warned_lock = threading.Lock()
+
+
+def warn_once(msg):
+    with warned_lock:
+        if msg not in warned:
+            warned.add(msg)
+            print("mock_mapi: " + msg, file=sys.stderr, flush=True)
+
+
+def format_value(typ, i, width):
+    """Text of a value of type typ for variant i, as MonetDB sends it."""
+    if typ == "int":
+        return str(i * 7 % 1000003)
+    if typ == "bigint":
+        return str(i * 1000000007)
+    if typ == "double":
+        return repr(i * 0.25)
+    if typ == "decimal":
+        return "%d.%02d" % (i // 100, i % 100)
+    if typ == "varchar":
+        return '"' + (("v%d_" % i) * width)[:width] + '"'
+    if typ == "date":
+        return "%04d-%02d-%02d" % (2000 + i % 20, 1 + i % 12, 1 + i % 28)
+    if typ == "timestamp":
+        return "%04d-%02d-%02d %02d:%02d:%02d.000000" % (
+            2000 + i % 20, 1 + i % 12, 1 + i % 28, i % 24, i % 60, (i * 7) % 60)
+    if typ == "boolean":
+        return "true" if i % 2 else "false"
+    raise ValueError("unknown type " + typ)
+
+
+class Table:
+    """The synthetic table every query reads."""
+
+    def __init__(self, args):
+        self.rows = args.rows
+        self.types = args.types
+        self.width = args.width
+        self.distinct = max(1, args.distinct)
+        self.null_every = args.null_every
+
+        # formatted values of each column but c0, one per variant
+        self.values = [[format_value(t, i, self.width)
+                        for i in range(self.distinct)]
+                       for t in self.types]
+        if self.null_every > 0:
+            for col in self.values[1:]:
+                for i in range(0, self.distinct, self.null_every):
+                    col[i] = "NULL"
+
+
+class Result:
+    """An open result set: rows lo..hi-1 of the table, some columns."""
+
+    def __init__(self, table, columns, lo, hi):
+        self.table = table
+        self.columns = columns
+        self.lo = lo
+        self.count = max(0, hi - lo)
+
+        # pre-joined tails of the rows (every column but c0), per variant
+        others = [c for c in columns if c != 0]
+        if others:
+            self.tails = [",\t".join(table.values[c][v] for c in others)
+                          for v in range(table.distinct)]
+        else:
+            self.tails = None
+
+    def header(self, kind, result_id, offset, nrows):
+        cols = self.columns
+        if kind == 1:
+            names = [("c%d" % c) if c >= 0 else "%1" for c in cols]
+            types = [TYPES[self.table.types[c]][0] if c >= 0 else "tinyint"
+                     for c in cols]
+            lengths = [str(TYPES[self.table.types[c]][1] or self.table.width)
+                       if c >= 0 else "1" for c in cols]
+            return ("&1 %d %d %d %d\n"
+                    "%% %s # table_name\n"
+                    "%% %s # name\n"
+                    "%% %s # type\n"
+                    "%% %s # length\n") % (
+                        result_id, self.count, len(cols), nrows,
+                        ",\t".join("sys.bench" for _ in cols),
+                        ",\t".join(names), ",\t".join(types),
+                        ",\t".join(lengths))
+        return "&6 %d %d %d %d\n" % (result_id, len(cols), nrows, offset)
+
+    def lines(self, offset, nrows):
+        """Text of rows offset..offset+nrows-1 of the result."""
+        distinct = self.table.distinct
+        has_c0 = 0 in self.columns
+        tails = self.tails
+        out = []
+        for r in range(self.lo + offset, self.lo + offset + nrows):
+            if self.columns == [-1]:
+                out.append("[ 1\t]\n")
+            elif tails is None:
+                out.append("[ %d\t]\n" % r)
+            elif has_c0:
+                out.append("[ %d,\t%s\t]\n" % (r, tails[r % distinct]))
+            else:
+                out.append("[ %s\t]\n" % tails[r % distinct])
+        return "".join(out)
+
+
+def parse_query(table, sql):
+    """Return (kind, payload) for a statement: a Result, a count, or None."""
+    text = sql.strip().rstrip(";").strip()
+    upper = text.upper()
+
+    if upper == "SELECT TRUE":
+        return ("bool", None)
+    if not upper.startswith("SELECT"):
+        return ("none", None)
+
+    from_pos = upper.find(" FROM ")
+    if from_pos < 0:
+        return ("none", None)
+    select_list = text[6:from_pos]
+    rest = text[from_pos:]
+
+    lo, hi = 0, table.rows
+    where_pos = rest.upper().find(" WHERE ")
+    if where_pos >= 0:
+        where = re.split(r'\b(?:ORDER BY|LIMIT|OFFSET|GROUP BY)\b', rest[where_pos + 7:],
+                         flags=re.IGNORECASE)[0]
+        for op, num in C0_COND.findall(where):
+            v = int(num)
+            if op == "<":
+                hi = min(hi, v)
+            elif op == "<=":
+                hi = min(hi, v + 1)
+            elif op == ">":
+                lo = max(lo, v + 1)
+            elif op == ">=":
+                lo = max(lo, v)
+            elif op == "=":
+                lo, hi = max(lo, v), min(hi, v + 1)
+        rest_conds = C0_COND.sub("", where)
+        if COLUMN.search(rest_conds):
+            warn_once("ignoring conditions other than on \"c0\": " + where.strip())
+
+    offset = OFFSET.search(rest)
+    if offset:
+        lo += int(offset.group(1))
+    limit = LIMIT.search(rest)
+    if limit:
+        hi = min(hi, lo + int(limit.group(1)))
+    hi = max(lo, hi)
+
+    if re.match(r'\s*count\(\*\)\s*$', select_list, re.IGNORECASE):
+        return ("count", hi - lo)
+
+    columns = []
+    for name in COLUMN.findall(select_list):
+        c = int(name[1:])
+        if c >= len(table.types):
+            raise ValueError("no such column: " + name)
+        columns.append(c)
+    if not columns:
+        columns = [-1]
+
+    return ("result", Result(table, columns, lo, hi))
+
+
+def single_value(typ, length, value):
+    """A result of one row with one unnamed column."""
+    return ("&1 0 1 1 1\n"
+            "%% .%%1 # table_name\n"
+            "%% %%1 # name\n"
+            "%% %s # type\n"
+            "%% %d # length\n"
+            "[ %s\t]\n") % (typ, length, value)
+
+
+class Handler(socketserver.BaseRequestHandler):
+
+    def setup(self):
+        self.reply_size = 100
+        self.results = {}
+        self.next_id = 0
+
+    # --- MAPI blocks ---
+
+    def read_message(self):
+        data = []
+        while True:
+            hdr = self.recv_exact(2)
+            if hdr is None:
+                return None
+            (h,) = struct.unpack("<H", hdr)
+            length, last = h >> 1, h & 1
+            if length:
+                chunk = self.recv_exact(length)
+                if chunk is None:
+                    return None
+                data.append(chunk)
+            if last:
+                return b"".join(data).decode("utf-8", "replace")
+
+    def recv_exact(self, n):
+        buf = b""
+        while len(buf) < n:
+            chunk = self.request.recv(n - len(buf))
+            if not chunk:
+                return None
+            buf += chunk
+        return buf
+
+    def send_message(self, text):
+        """Send text as one message; the last block ends it (the prompt)."""
+        args = self.server.args
+        data = text.encode("utf-8")
+        pos = 0
+        while True:
+            chunk = data[pos:pos + BLOCK_SIZE]
+            pos += len(chunk)
+            last = 1 if pos >= len(data) else 0
+            self.request.sendall(struct.pack("<H", (len(chunk) << 1) | last) + chunk)
+            if args.bandwidth > 0:
+                time.sleep((len(chunk) + 2) / args.bandwidth)
+            if last:
+                break
+
+    def respond(self, text):
+        if self.server.args.latency > 0:
+            time.sleep(self.server.args.latency / 1000.0)
+        self.send_message(text)
+
+    # --- the session ---
+
+    def handle(self):
+        self.send_message(CHALLENGE)
+        if self.read_message() is None:
+            return
+        # any user and password will do
+        self.send_message("")
+
+        while True:
+            msg = self.read_message()
+            if msg is None:
+                return
+            try:
+                if msg.startswith("s"):
+                    self.respond(self.query(msg[1:]))
+                elif msg.startswith("X"):
+                    self.respond(self.command(msg[1:].strip()))
+                else:
+                    self.respond("")
+            except (ValueError, KeyError) as e:
+                self.respond("!42000!%s\n" % e)
+
+    def query(self, sql):
+        kind, payload = parse_query(self.server.table, sql)
+        if kind == "none":
+            return ""
+        if kind == "bool":
+            return single_value("boolean", 5, "true")
+        if kind == "count":
+            return single_value("bigint", 20, str(payload))
+
+        result = payload
+        self.next_id += 1
+        result_id = self.next_id
+        nrows = result.count if self.reply_size < 0 else min(result.count, self.reply_size)
+        if nrows < result.count:
+            self.results[result_id] = result
+        return result.header(1, result_id, 0, nrows) + result.lines(0, nrows)
+
+    def command(self, cmd):
+        words = cmd.split()
+        if not words:
+            return ""
+        if words[0] == "reply_size" and len(words) > 1:
+            self.reply_size = int(words[1])
+        elif words[0] == "export" and len(words) >= 3:
+            result = self.results[int(words[1])]
+            offset = int(words[2])
+            count = int(words[3]) if len(words) > 3 else self.reply_size
+            nrows = max(0, min(count, result.count - offset))
+            return result.header(6, int(words[1]), offset, nrows) + result.lines(offset, nrows)
+        elif words[0] == "close" and len(words) > 1:
+            self.results.pop(int(words[1]), None)
+        return ""
+
+
+class Server(socketserver.ThreadingTCPServer):
+    allow_reuse_address = True
+    daemon_threads = True
+
+
+def main():
+    p = argparse.ArgumentParser(description="Stand-in MonetDB server for monetdb_fdw benchmarks.")
+    p.add_argument("--host", default="127.0.0.1")
+    p.add_argument("--port", type=int, default=50001)
+    p.add_argument("--rows", type=int, default=1000000,
+                   help="rows in the table (default %(default)s)")
+    p.add_argument("--types", default="int,bigint,double,varchar,date",
+                   help="comma-separated column types, c0 first; c0 is the row "
+                        "number whatever its type (default %(default)s)")
+    p.add_argument("--width", type=int, default=32,
+                   help="length of varchar values (default %(default)s)")
+    p.add_argument("--distinct", type=int, default=1024,
+                   help="rows after which values of c1.. repeat (default %(default)s)")
+    p.add_argument("--null-every", type=int, default=0,
+                   help="make every n-th value of c1.. NULL (default none)")
+    p.add_argument("--latency", type=float, default=0.0,
+                   help="milliseconds to wait before each response")
+    p.add_argument("--bandwidth", type=float, default=0.0,
+                   help="bytes per second sent on each connection (default unlimited)")
+    args = p.parse_args()
+
+    args.types = [t.strip() for t in args.types.split(",") if t.strip()]
+    for t in args.types:
+        if t not in TYPES:
+            p.error("unknown type %s; known types are %s" % (t, ", ".join(sorted(TYPES))))
+
+    server = Server((args.host, args.port), Handler)
+    server.args = args
+    server.table = Table(args)
+    print("mock_mapi: listening on %s:%d" % (args.host, args.port), file=sys.stderr, flush=True)
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,301 @@
+#!/usr/bin/env python3
+#
+# run_bench.py
+#       throughput benchmarks of monetdb_fdw against a stand-in MonetDB
+#
+# Starts mock_mapi.py with a synthetic table, creates a foreign server and
+# a foreign table "bench" for it in the database psql connects to (set it
+# up with the usual PGHOST, PGPORT, PGDATABASE, ... variables; the role
+# needs to be a superuser, to create the extension and to read the
+# backend's memory use), and runs these scans of the table:
+#
+#   full        SELECT * FROM bench
+#   projected   SELECT c0 FROM bench
+#   filtered    SELECT * FROM bench WHERE c0 < rows/10, done by MonetDB
+#   rescan      the table scanned again for each of 3 outer rows
+#
+# Each scan runs under EXPLAIN ANALYZE, once with timing to get the time to
+# connect, to the first row and spent converting fields, then --repeat
+# times without, for the execution time.  Every scan is written as a line
+# of JSON to stdout, or to --output, with the median and smallest
+# execution time, rows and bytes per second, and the peak memory of the
+# backend that ran it.
+#
+# To compare two builds, run the suite with each, and then
+#
+#   run_bench.py --compare before.jsonl after.jsonl
+#
+# --server runs the scans against a server already running instead, such
+# as a real MonetDB with a table "bench" of the same shape.  The table
+# uses the default text transfer: the mock can't answer the binary COPY
+# that transfer_mode 'binary' sends, so that takes a real MonetDB.
+#
+# --decode picks how the text rows are converted: a block and a column at
+# a time ("batch", the default), or a row at a time ("row"), through the
+# monetdb_fdw.batch_decode setting.  With "both", every scan is run each
+# way, and the conversion times are compared at the end: a micro-benchmark
+# of the decoder, best run with --repeat 1 and a single scenario.
+#
+# Copyright (c) 2013, Satoshi Nagayasu
+#
+# IDENTIFICATION
+#       contrib/monetdb_fdw/bench/run_bench.py
+#
+
+import argparse
+import json
+import os
+import socket
+import statistics
+import subprocess
+import sys
+import time
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+
+PG_TYPES = {
+    "int": "integer",
+    "bigint": "bigint",
+    "double": "double precision",
+    "decimal": "numeric(18,2)",
+    "varchar": "varchar(%(width)d)",
+    "date": "date",
+    "timestamp": "timestamp",
+    "boolean": "boolean",
+}
+
+SCENARIOS = {
+    "full": ("SELECT * FROM bench", ""),
+    "projected": ("SELECT c0 FROM bench", ""),
+    "filtered": ("SELECT * FROM bench WHERE c0 < %(tenth)d", ""),
+    # OFFSET 0 keeps the subquery, which refers to the outer row, from
+    # being pulled up, so the foreign scan is rescanned for every g
+    "rescan": ("SELECT count(*) FROM generate_series(1, 3) g, "
+               "LATERAL (SELECT b.c0, g.g AS x FROM bench b OFFSET 0) s",
+               "SET enable_hashjoin = off; SET enable_mergejoin = off;"),
+}
+
+MARK = "@@monetdb_fdw_bench@@"
+
+
+def psql(script):
+    """Run script in one psql session; return the output of each query."""
+    proc = subprocess.run(["psql", "-X", "-q", "-A", "-t",
+                           "-v", "ON_ERROR_STOP=1", "-f", "-"],
+                          input=script, capture_output=True, text=True)
+    if proc.returncode != 0:
+        sys.exit("run_bench: psql failed:\n" + proc.stderr)
+    return [part.strip() for part in proc.stdout.split(MARK)]
+
+
+def wait_for_port(host, port, timeout=10.0):
+    deadline = time.time() + timeout
+    while time.time() < deadline:
+        try:
+            with socket.create_connection((host, port), timeout=1):
+                return
+        except OSError:
+            time.sleep(0.1)
+    sys.exit("run_bench: nothing is listening on %s:%d" % (host, port))
+
+
+def setup(args, host, port):
+    columns = ",\n  ".join(
+        "c%d %s" % (i, PG_TYPES[t] % {"width": args.width})
+        for i, t in enumerate(args.types))
+    psql("""
+CREATE EXTENSION IF NOT EXISTS monetdb_fdw;
+DROP SERVER IF EXISTS monetdb_bench CASCADE;
+CREATE SERVER monetdb_bench FOREIGN DATA WRAPPER monetdb_fdw
+  OPTIONS (host '%s', port '%d', dbname 'bench');
+CREATE USER MAPPING FOR current_user SERVER monetdb_bench
+  OPTIONS (user 'monetdb', passwd 'monetdb');
+CREATE FOREIGN TABLE bench (
+  %s
+) SERVER monetdb_bench OPTIONS (table 'bench', fetch_size '%d');
+""" % (host, port, columns, args.fetch_size))
+
+
+def find_scan(plan):
+    """The first foreign scan of an EXPLAIN (FORMAT JSON) plan."""
+    if plan.get("Node Type") == "Foreign Scan":
+        return plan
+    for child in plan.get("Plans", []):
+        found = find_scan(child)
+        if found:
+            return found
+    return None
+
+
+def peak_rss_kb(status):
+    for line in status.splitlines():
+        if line.startswith("VmHWM:"):
+            return int(line.split()[1])
+    return None
+
+
+def run_scenario(args, name, decode):
+    query, settings = SCENARIOS[name]
+    query = query % {"tenth": args.rows // 10}
+
+    script = [settings]
+    script.append("SET monetdb_fdw.batch_decode = %s;" % ("on" if decode == "batch" else "off"))
+    script.append("EXPLAIN (ANALYZE, VERBOSE, FORMAT JSON) %s;" % query)
+    for _ in range(args.repeat):
+        script.append("\\echo %s" % MARK)
+        script.append("EXPLAIN (ANALYZE, VERBOSE, TIMING OFF, FORMAT JSON) %s;" % query)
+    script.append("\\echo %s" % MARK)
+    script.append("SELECT pg_read_file('/proc/' || pg_backend_pid() || '/status');")
+    out = psql("\n".join(script))
+
+    timed = json.loads(out[0])[0]
+    timed_scan = find_scan(timed["Plan"])
+    runs = [json.loads(o)[0] for o in out[1:-1]]
+    exec_ms = [r["Execution Time"] for r in runs]
+    scan = find_scan(runs[-1]["Plan"])
+    median_ms = statistics.median(exec_ms)
+    secs = median_ms / 1000.0 if median_ms > 0 else float("nan")
+
+    return {
+        "label": args.label,
+        "scenario": name,
+        "decode": decode,
+        "query": query,
+        "rows": args.rows,
+        "types": ",".join(args.types),
+        "width": args.width,
+        "fetch_size": args.fetch_size,
+        "latency_ms": args.latency,
+        "bandwidth": args.bandwidth,
+        "repeat": args.repeat,
+        "exec_ms_median": median_ms,
+        "exec_ms_min": min(exec_ms),
+        "rows_fetched": scan.get("Rows Fetched"),
+        "rows_returned": scan.get("Rows Returned"),
+        "bytes_received": scan.get("Bytes Received"),
+        "round_trips": scan.get("Remote Round Trips"),
+        "rows_per_s": scan.get("Rows Fetched", 0) / secs,
+        "bytes_per_s": scan.get("Bytes Received", 0) / secs,
+        "connect_ms": timed_scan.get("Connect Time"),
+        "first_row_ms": timed_scan.get("Remote Time to First Row"),
+        "conversion_ms": timed_scan.get("Conversion Time"),
+        "peak_rss_kb": peak_rss_kb(out[-1]),
+    }
+
+
+def compare(before_file, after_file):
+    """Print how each scenario of after_file did against before_file.
+
+    A scenario run with each decoder is compared decoder by decoder;
+    results from before --decode existed were run with "batch".
+    """
+    def load(path):
+        with open(path) as f:
+            return {(r["scenario"], r.get("decode", "batch")): r
+                    for r in map(json.loads, filter(str.strip, f))}
+
+    before, after = load(before_file), load(after_file)
+    metrics = [("rows_per_s", "rows/s"), ("exec_ms_median", "ms"),
+               ("first_row_ms", "first row ms"), ("conversion_ms", "convert ms"),
+               ("peak_rss_kb", "peak kB")]
+    print("%-10s %-6s %-14s %14s %14s %8s" %
+          ("scenario", "decode", "metric", "before", "after", "change"))
+    for key in before:
+        if key not in after:
+            continue
+        for metric, title in metrics:
+            b, a = before[key].get(metric), after[key].get(metric)
+            if b is None or a is None:
+                continue
+            change = "%+7.1f%%" % ((a - b) * 100.0 / b) if b else "-"
+            print("%-10s %-6s %-14s %14.2f %14.2f %8s" % (key + (title, b, a, change)))
+
+
+def compare_decoders(results):
+    """Print the conversion time of each scenario, by row and by batch."""
+    print("%-10s %14s %14s %8s" % ("scenario", "row ms", "batch ms", "speedup"),
+          file=sys.stderr)
+    for name in dict.fromkeys(r["scenario"] for r in results):
+        by = {r["decode"]: r for r in results if r["scenario"] == name}
+        row, batch = by["row"]["conversion_ms"], by["batch"]["conversion_ms"]
+        if row is None or batch is None:
+            continue
+        speedup = "%7.2fx" % (row / batch) if batch else "-"
+        print("%-10s %14.2f %14.2f %8s" % (name, row, batch, speedup),
+              file=sys.stderr)
+
+
+def main():
+    p = argparse.ArgumentParser(description="Benchmark monetdb_fdw scans against a stand-in MonetDB.")
+    p.add_argument("--rows", type=int, default=1000000)
+    p.add_argument("--types", default="int,bigint,double,varchar,date")
+    p.add_argument("--width", type=int, default=32)
+    p.add_argument("--fetch-size", type=int, default=10000)
+    p.add_argument("--latency", type=float, default=0.0,
+                   help="milliseconds the mock waits before each response")
+    p.add_argument("--bandwidth", type=float, default=0.0,
+                   help="bytes per second the mock sends (default unlimited)")
+    p.add_argument("--repeat", type=int, default=5)
+    p.add_argument("--scenarios", default=",".join(SCENARIOS))
+    p.add_argument("--decode", choices=("batch", "row", "both"), default="batch",
+                   help="how text rows are converted; both compares the two")
+    p.add_argument("--label", default="",
+                   help="recorded with the results, e.g. the build tested")
+    p.add_argument("--output", help="append the results to this file")
+    p.add_argument("--mock-port", type=int, default=50001)
+    p.add_argument("--server", metavar="HOST:PORT",
+                   help="use this server instead of starting the mock")
+    p.add_argument("--compare", nargs=2, metavar=("BEFORE", "AFTER"),
+                   help="compare two result files, and exit")
+    args = p.parse_args()
+
+    if args.compare:
+        compare(*args.compare)
+        return
+
+    args.types = [t.strip() for t in args.types.split(",") if t.strip()]
+    for t in args.types:
+        if t not in PG_TYPES:
+            p.error("unknown type %s" % t)
+    scenarios = [s.strip() for s in args.scenarios.split(",") if s.strip()]
+    for s in scenarios:
+        if s not in SCENARIOS:
+            p.error("unknown scenario %s" % s)
+
+    mock = None
+    if args.server:
+        host, port = args.server.rsplit(":", 1)
+        port = int(port)
+    else:
+        host, port = "127.0.0.1", args.mock_port
+        mock = subprocess.Popen([sys.executable, os.path.join(HERE, "mock_mapi.py"),
+                                 "--host", host, "--port", str(port),
+                                 "--rows", str(args.rows),
+                                 "--types", ",".join(args.types),
+                                 "--width", str(args.width),
+                                 "--latency", str(args.latency),
+                                 "--bandwidth", str(args.bandwidth)])
+    try:
+        wait_for_port(host, port)
+        setup(args, host, port)
+
+        decoders = ("row", "batch") if args.decode == "both" else (args.decode,)
+        results = []
+        out = open(args.output, "a") if args.output else sys.stdout
+        for name in scenarios:
+            for decode in decoders:
+                result = run_scenario(args, name, decode)
+                results.append(result)
+                print(json.dumps(result), file=out, flush=True)
+        if args.output:
+            out.close()
+        if args.decode == "both":
+            compare_decoders(results)
+    finally:
+        if mock:
+            mock.terminate()
+            mock.wait()
+
+
+if __name__ == "__main__":
+    main()
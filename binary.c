@@ -0,0 +1,461 @@
+/*-------------------------------------------------------------------------
+ *
+ * binary.c
+ *                read a MonetDB result sent in its binary format
+ *
+ * A text result has MonetDB format every value, and us parse it back,
+ * which is most of the work of a big scan.  With transfer_mode 'binary',
+ * a scan asks for its result with "COPY SELECT ... INTO BINARY ... ON
+ * CLIENT" instead (see monetdbDeparseBinaryCopySql): MonetDB sends each
+ * column as a file of fixed-width values, or of zero-terminated strings,
+ * and libmapi hands the files to the callback here.  The columns are
+ * decoded into datums a column at a time, fetch_size rows at once.
+ *
+ * The whole result is kept in memory until the scan ends, so a rescan
+ * just starts over.  It may take up to work_mem; a bigger one is aborted
+ * while it is received.  If that happens, or MonetDB can't do it (servers
+ * before the binary COPY INTO, or a column it can't cast), the caller
+ * falls back to text, whose memory use is bounded by fetch_size.
+ *
+ * Copyright (c) 2010-2013, PostgreSQL Global Development Group
+ * Copyright (c) 2013, Satoshi Nagayasu
+ *
+ * IDENTIFICATION
+ *                contrib/monetdb_fdw/binary.c
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include "monetdb_fdw.h"
+
+#include "catalog/pg_type.h"
+#include "miscadmin.h"
+#include "utils/memutils.h"
+
+#include <math.h>
+
+/* MonetDB marks a NULL string with this byte */
+#define MONETDB_STR_NIL		'\200'
+
+/*
+ * One column of the result: the file MonetDB sent for it, and the datums
+ * of the rows of the current batch.
+ */
+typedef struct BinaryColumn
+{
+	MonetdbFdwConverter *conv;
+	int			width;			/* bytes per value, or 0 for strings */
+	char	   *data;
+	size_t		len;
+	size_t		size;
+	size_t		pos;			/* strings: where the next row's value is */
+	Datum	   *values;
+	bool	   *isnull;
+} BinaryColumn;
+
+struct MonetdbBinaryResult
+{
+	MemoryContext cxt;			/* holds this struct and the files */
+	MemoryContext batch_cxt;	/* holds the datums of the current batch */
+	int			ncols;
+	BinaryColumn *cols;
+	int			current;		/* column being received, or -1 */
+	const char *error;			/* why receiving failed, or NULL */
+	int64		bytes;			/* received */
+	int64		max_bytes;		/* most that may be received (work_mem) */
+
+	int64		nrows;
+	int64		next_row;		/* first row of the next batch */
+	int			batch_rows;		/* rows decoded at once */
+	int			batch_len;		/* rows in the current batch */
+	int			batch_pos;		/* next row of it */
+};
+
+static char *put_file(void *priv, const char *filename, bool binary,
+					  const void *data, size_t size);
+static bool count_rows(MonetdbBinaryResult *res);
+static void decode_batch(MonetdbBinaryResult *res);
+
+
+/*
+ * Return the MonetDB type a column of type typid is cast to, to be sent in
+ * binary, or NULL if it can't be.
+ */
+const char *
+monetdbBinaryRemoteType(Oid typid)
+{
+	switch (typid)
+	{
+		case INT2OID:
+			return "SMALLINT";
+		case INT4OID:
+			return "INT";
+		case INT8OID:
+			return "BIGINT";
+		case FLOAT4OID:
+			return "REAL";
+		case FLOAT8OID:
+			return "DOUBLE";
+		case TEXTOID:
+		case VARCHAROID:
+			return "CLOB";
+		default:
+			return NULL;
+	}
+}
+
+/*
+ * Run the binary COPY statement sql, whose columns are stored with convs,
+ * and receive its result.  Rows are decoded batch_rows at a time.  The
+ * result is allocated in a context of its own under CurrentMemoryContext.
+ *
+ * Return NULL if MonetDB failed to send it; the caller runs the text query
+ * instead, which reports the error if there is a real one.
+ */
+MonetdbBinaryResult *
+monetdbBinaryQuery(Mapi dbh, const char *sql, MonetdbFdwConverter *convs,
+				   int nconvs, int batch_rows)
+{
+	MemoryContext cxt;
+	MonetdbBinaryResult *res;
+	MapiHdl		hdl;
+	const char *error;
+	int			i;
+
+	cxt = AllocSetContextCreate(CurrentMemoryContext,
+								"monetdb_fdw binary result",
+								ALLOCSET_DEFAULT_SIZES);
+	res = (MonetdbBinaryResult *) MemoryContextAllocZero(cxt, sizeof(MonetdbBinaryResult));
+	res->cxt = cxt;
+	res->batch_cxt = AllocSetContextCreate(cxt,
+										   "monetdb_fdw binary batch",
+										   ALLOCSET_DEFAULT_SIZES);
+	res->ncols = nconvs;
+	res->cols = (BinaryColumn *) MemoryContextAllocZero(cxt, Max(nconvs, 1) * sizeof(BinaryColumn));
+	res->current = -1;
+	res->max_bytes = (int64) work_mem * 1024;
+	res->batch_rows = batch_rows;
+
+	for (i = 0; i < nconvs; i++)
+	{
+		BinaryColumn *col = &res->cols[i];
+
+		col->conv = &convs[i];
+		switch (col->conv->kind)
+		{
+			case MONETDB_CONV_INT2:
+				col->width = sizeof(int16);
+				break;
+			case MONETDB_CONV_INT4:
+			case MONETDB_CONV_FLOAT4:
+				col->width = sizeof(int32);
+				break;
+			case MONETDB_CONV_INT8:
+			case MONETDB_CONV_FLOAT8:
+				col->width = sizeof(int64);
+				break;
+			case MONETDB_CONV_TEXT:
+				col->width = 0;
+				break;
+			default:
+				/* the column's type changed since the plan was made */
+				MemoryContextDelete(cxt);
+				return NULL;
+		}
+		col->values = (Datum *) MemoryContextAlloc(cxt, batch_rows * sizeof(Datum));
+		col->isnull = (bool *) MemoryContextAlloc(cxt, batch_rows * sizeof(bool));
+	}
+
+	mapi_setfilecallback2(dbh, NULL, put_file, res);
+	hdl = mapi_query(dbh, sql);
+	mapi_setfilecallback2(dbh, NULL, NULL, NULL);
+
+	if (res->error)
+		error = res->error;
+	else if (hdl == NULL || mapi_error(dbh) != MOK)
+		error = mapi_error_str(dbh);
+	else
+		error = mapi_result_error(hdl);
+	if (error == NULL && !count_rows(res))
+		error = "columns of different lengths";
+	if (hdl)
+		mapi_close_handle(hdl);
+
+	if (error)
+	{
+		elog(DEBUG1, "monetdb_fdw: binary transfer failed, using text: %s",
+			 error);
+		MemoryContextDelete(cxt);
+		return NULL;
+	}
+
+	return res;
+}
+
+/*
+ * Callback libmapi calls with the files of the result: first with the
+ * name of a file, then with its data, in parts, and with no data at its
+ * end.  Return an error message to abort the transfer, or NULL.
+ *
+ * It runs inside mapi_query(), so it mustn't throw an error.
+ */
+static char *
+put_file(void *priv, const char *filename, bool binary, const void *data,
+		 size_t size)
+{
+	MonetdbBinaryResult *res = (MonetdbBinaryResult *) priv;
+	BinaryColumn *col;
+
+	if (filename != NULL)
+	{
+		char	   *endp;
+		long		i;
+
+		i = (filename[0] == 'c') ? strtol(filename + 1, &endp, 10) : -1;
+		if (i < 0 || i >= res->ncols || *endp != '\0' || !binary)
+			return (char *) (res->error = "unexpected file");
+		res->current = (int) i;
+	}
+	else if (data == NULL)
+	{
+		res->current = -1;
+		return NULL;
+	}
+
+	if (res->current < 0)
+		return (char *) (res->error = "data outside of a file");
+	if (data == NULL || size == 0)
+		return NULL;
+
+	if (res->bytes + (int64) size > res->max_bytes)
+		return (char *) (res->error = "result larger than work_mem");
+
+	col = &res->cols[res->current];
+	if (col->len + size > col->size)
+	{
+		size_t		newsize = Max(col->size * 2, col->len + size);
+		char	   *newdata;
+
+		newsize = Max(newsize, 65536);
+		/* don't grow past what the rest of the result may take */
+		newsize = Min(newsize, col->len + (size_t) (res->max_bytes - res->bytes));
+		newdata = MemoryContextAllocExtended(res->cxt, newsize,
+											 MCXT_ALLOC_HUGE | MCXT_ALLOC_NO_OOM);
+		if (newdata == NULL)
+			return (char *) (res->error = "out of memory");
+		if (col->data)
+		{
+			memcpy(newdata, col->data, col->len);
+			pfree(col->data);
+		}
+		col->data = newdata;
+		col->size = newsize;
+	}
+
+	memcpy(col->data + col->len, data, size);
+	col->len += size;
+	res->bytes += size;
+
+	return NULL;
+}
+
+/*
+ * Find the number of rows of the result.  Return false if the columns
+ * don't agree on it, or one ends in the middle of a value.
+ */
+static bool
+count_rows(MonetdbBinaryResult *res)
+{
+	int			i;
+
+	for (i = 0; i < res->ncols; i++)
+	{
+		BinaryColumn *col = &res->cols[i];
+		int64		n = 0;
+
+		if (col->width > 0)
+		{
+			if (col->len % col->width != 0)
+				return false;
+			n = col->len / col->width;
+		}
+		else
+		{
+			const char *p = col->data;
+			const char *end = col->data + col->len;
+
+			if (col->len > 0 && end[-1] != '\0')
+				return false;
+			while (p < end)
+			{
+				p = (const char *) memchr(p, '\0', end - p) + 1;
+				n++;
+			}
+		}
+
+		if (i == 0)
+			res->nrows = n;
+		else if (n != res->nrows)
+			return false;
+	}
+
+	return true;
+}
+
+/*
+ * Decode the next batch of rows, a column at a time.  MonetDB stands for
+ * a NULL with the smallest value of an integer type, NaN for a floating
+ * point one, and a string of its own.
+ */
+static void
+decode_batch(MonetdbBinaryResult *res)
+{
+	MemoryContext oldcontext;
+	int			n = (int) Min(res->batch_rows, res->nrows - res->next_row);
+	int			i;
+	int			r;
+
+	MemoryContextReset(res->batch_cxt);
+	oldcontext = MemoryContextSwitchTo(res->batch_cxt);
+
+	for (i = 0; i < res->ncols; i++)
+	{
+		BinaryColumn *col = &res->cols[i];
+		const char *p = col->data + (size_t) res->next_row * col->width;
+
+		switch (col->conv->kind)
+		{
+			case MONETDB_CONV_INT2:
+				for (r = 0; r < n; r++, p += sizeof(int16))
+				{
+					int16		v;
+
+					memcpy(&v, p, sizeof(v));
+					col->isnull[r] = (v == PG_INT16_MIN);
+					col->values[r] = Int16GetDatum(v);
+				}
+				break;
+			case MONETDB_CONV_INT4:
+				for (r = 0; r < n; r++, p += sizeof(int32))
+				{
+					int32		v;
+
+					memcpy(&v, p, sizeof(v));
+					col->isnull[r] = (v == PG_INT32_MIN);
+					col->values[r] = Int32GetDatum(v);
+				}
+				break;
+			case MONETDB_CONV_INT8:
+				for (r = 0; r < n; r++, p += sizeof(int64))
+				{
+					int64		v;
+
+					memcpy(&v, p, sizeof(v));
+					col->isnull[r] = (v == PG_INT64_MIN);
+					col->values[r] = col->isnull[r] ? (Datum) 0 : Int64GetDatum(v);
+				}
+				break;
+			case MONETDB_CONV_FLOAT4:
+				for (r = 0; r < n; r++, p += sizeof(float4))
+				{
+					float4		v;
+
+					memcpy(&v, p, sizeof(v));
+					col->isnull[r] = isnan(v);
+					col->values[r] = Float4GetDatum(v);
+				}
+				break;
+			case MONETDB_CONV_FLOAT8:
+				for (r = 0; r < n; r++, p += sizeof(float8))
+				{
+					float8		v;
+
+					memcpy(&v, p, sizeof(v));
+					col->isnull[r] = isnan(v);
+					col->values[r] = col->isnull[r] ? (Datum) 0 : Float8GetDatum(v);
+				}
+				break;
+			default:
+				for (r = 0; r < n; r++)
+				{
+					char	   *s = col->data + col->pos;
+					size_t		len = strlen(s);
+
+					col->pos += len + 1;
+					col->isnull[r] = (len == 1 && s[0] == MONETDB_STR_NIL);
+					col->values[r] = col->isnull[r] ? (Datum) 0 :
+						monetdbConvertValue(col->conv, s, len);
+				}
+				break;
+		}
+	}
+
+	MemoryContextSwitchTo(oldcontext);
+
+	res->next_row += n;
+	res->batch_len = n;
+	res->batch_pos = 0;
+}
+
+/*
+ * Store the next row into values and isnull, which are indexed by
+ * attribute number; the columns the result doesn't have are left alone.
+ * The values are valid until the next call.
+ *
+ * Return false at the end of the result.
+ */
+bool
+monetdbBinaryNextRow(MonetdbBinaryResult *res, Datum *values, bool *isnull)
+{
+	int			i;
+
+	if (res->batch_pos == res->batch_len)
+	{
+		if (res->next_row >= res->nrows)
+			return false;
+		decode_batch(res);
+	}
+
+	for (i = 0; i < res->ncols; i++)
+	{
+		BinaryColumn *col = &res->cols[i];
+		int			attnum = col->conv->attnum;
+
+		values[attnum - 1] = col->values[res->batch_pos];
+		isnull[attnum - 1] = col->isnull[res->batch_pos];
+	}
+	res->batch_pos++;
+
+	return true;
+}
+
+/*
+ * Go back to the first row.
+ */
+void
+monetdbBinaryRewind(MonetdbBinaryResult *res)
+{
+	int			i;
+
+	for (i = 0; i < res->ncols; i++)
+		res->cols[i].pos = 0;
+	res->next_row = 0;
+	res->batch_len = 0;
+	res->batch_pos = 0;
+}
+
+/*
+ * Bytes of the files MonetDB sent.
+ */
+int64
+monetdbBinaryBytes(MonetdbBinaryResult *res)
+{
+	return res->bytes;
+}
+
+void
+monetdbBinaryFree(MonetdbBinaryResult *res)
+{
+	MemoryContextDelete(res->cxt);
+}
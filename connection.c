@@ -0,0 +1,896 @@
+/*-------------------------------------------------------------------------
+ *
+ * connection.c
+ *                connection management functions for monetdb_fdw
+ *
+ * Logging in to MonetDB costs a TCP handshake and a challenge/response
+ * round trip, so connections are cached for the life of the backend and
+ * shared by every scan that uses the same server and user mapping.
+ *
+ * Statements that modify a foreign table run in a remote transaction,
+ * opened on the first of them and committed or rolled back together with
+ * the local transaction; a local subtransaction has a remote savepoint.
+ * Scans run before that, in MonetDB's autocommit mode.
+ *
+ * Copyright (c) 2010-2013, PostgreSQL Global Development Group
+ * Copyright (c) 2013, Satoshi Nagayasu
+ *
+ * IDENTIFICATION
+ *                contrib/monetdb_fdw/connection.c
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include "monetdb_fdw.h"
+
+#include "access/htup_details.h"
+#include "access/xact.h"
+#include "catalog/pg_user_mapping.h"
+#include "commands/defrem.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "utils/builtins.h"
+#include "utils/hsearch.h"
+#include "utils/inval.h"
+#include "utils/memutils.h"
+#include "utils/syscache.h"
+
+#include <stdio.h>
+#include <mapi.h>
+
+/*
+ * Connection cache hash table entry
+ *
+ * The lookup key in this hash table is the user mapping OID.  We use just
+ * one connection per user mapping, so the local users a public mapping
+ * applies to share its connection.
+ */
+typedef Oid ConnCacheKey;
+
+typedef struct ConnCacheEntry
+{
+	ConnCacheKey key;			/* hash key (must be first) */
+	Mapi		conn;			/* connection to MonetDB, or NULL */
+	Oid			serverid;		/* OID of foreign server */
+	int			in_use;			/* number of scans using the connection */
+	int			xact_depth;		/* 0 = no remote transaction, 1 = one is
+								 * open, 2 = a savepoint too, etc. */
+	bool		xact_aborted;	/* can the remote transaction only roll back? */
+	bool		xact_checked;	/* health-checked in this transaction? */
+	bool		invalidated;	/* true if reconnect is pending */
+	int			fetch_size;		/* reply_size last sent, or 0 if unknown */
+	List	   *prepared;		/* ids of the statements scans prepared */
+	MonetdbPrefetch *prefetch;	/* thread reading from conn, or NULL */
+	uint32		server_hashvalue;	/* hash value of foreign server OID */
+	uint32		mapping_hashvalue;	/* hash value of user mapping OID */
+} ConnCacheEntry;
+
+/*
+ * The cache entry of each open connection, for the functions given just
+ * the connection
+ */
+typedef struct ConnHandleEntry
+{
+	Mapi		conn;			/* hash key (must be first) */
+	ConnCacheEntry *entry;		/* its entry in ConnectionHash */
+} ConnHandleEntry;
+
+/*
+ * Connection cache (initialized on first use)
+ */
+static HTAB *ConnectionHash = NULL;
+static HTAB *ConnectionByHandle = NULL;
+
+PG_FUNCTION_INFO_V1(monetdb_fdw_get_connections);
+PG_FUNCTION_INFO_V1(monetdb_fdw_disconnect);
+PG_FUNCTION_INFO_V1(monetdb_fdw_disconnect_all);
+
+static ConnCacheEntry *find_conn_entry(Mapi conn);
+static Mapi connect_monetdb_server(ForeignServer *server, UserMapping *user);
+static void disconnect_monetdb_server(ConnCacheEntry *entry);
+static void do_remote_command(Mapi conn, const char *sql);
+static bool try_remote_command(Mapi conn, const char *sql);
+static void monetdb_xact_callback(XactEvent event, void *arg);
+static void monetdb_subxact_callback(SubXactEvent event,
+									 SubTransactionId mySubid,
+									 SubTransactionId parentSubid,
+									 void *arg);
+static void monetdb_inval_callback(Datum arg, int cacheid, uint32 hashvalue);
+static bool disconnect_cached_connections(Oid serverid);
+
+
+/*
+ * Get a connection which can be used to execute queries on the MonetDB
+ * server with the user's authorization.  A new connection is established
+ * if we don't already have a suitable one.
+ *
+ * Every call must be paired with a monetdbReleaseConnection() call once
+ * the caller is done with the connection.
+ */
+Mapi
+monetdbGetConnection(UserMapping *user)
+{
+	bool		found;
+	ConnCacheEntry *entry;
+	ConnCacheKey key;
+
+	/* First time through, initialize connection cache hashtable */
+	if (ConnectionHash == NULL)
+	{
+		HASHCTL		ctl;
+
+		ctl.keysize = sizeof(ConnCacheKey);
+		ctl.entrysize = sizeof(ConnCacheEntry);
+		ConnectionHash = hash_create("monetdb_fdw connections", 8,
+									 &ctl,
+									 HASH_ELEM | HASH_BLOBS);
+
+		ctl.keysize = sizeof(Mapi);
+		ctl.entrysize = sizeof(ConnHandleEntry);
+		ConnectionByHandle = hash_create("monetdb_fdw connection handles", 8,
+										 &ctl,
+										 HASH_ELEM | HASH_BLOBS);
+
+		/*
+		 * Register some callback functions that manage connection cleanup.
+		 * This should be done just once in each backend.
+		 */
+		RegisterXactCallback(monetdb_xact_callback, NULL);
+		RegisterSubXactCallback(monetdb_subxact_callback, NULL);
+		CacheRegisterSyscacheCallback(FOREIGNSERVEROID,
+									  monetdb_inval_callback, (Datum) 0);
+		CacheRegisterSyscacheCallback(USERMAPPINGOID,
+									  monetdb_inval_callback, (Datum) 0);
+	}
+
+	/* Create hash key for the entry */
+	key = user->umid;
+
+	entry = hash_search(ConnectionHash, &key, HASH_ENTER, &found);
+	if (!found)
+	{
+		/*
+		 * We need only clear "conn" and "xact_aborted" here; remaining fields
+		 * will be filled later when "conn" is set.
+		 */
+		entry->conn = NULL;
+		entry->xact_aborted = false;
+	}
+
+	/*
+	 * A scan may be reading ahead on the connection in a thread; the
+	 * connection has to be ours again before we use it.
+	 */
+	if (entry->conn != NULL && entry->prefetch != NULL)
+		monetdbPrefetchStop(entry->prefetch);
+
+	/*
+	 * If the connection needs to be remade due to invalidation, or it was
+	 * found broken by the health check below, disconnect as soon as nobody
+	 * else is using it and it holds no remote transaction.
+	 */
+	if (entry->conn != NULL && entry->invalidated && entry->in_use == 0 &&
+		entry->xact_depth == 0)
+	{
+		elog(DEBUG3, "monetdb_fdw: closing connection %p for option changes to take effect",
+			 entry->conn);
+		disconnect_monetdb_server(entry);
+	}
+
+	/*
+	 * Check a cached connection the first time we use it in a transaction:
+	 * MonetDB may have been restarted, or an idle timeout may have closed
+	 * the socket, since we last talked to it.
+	 */
+	if (entry->conn != NULL && !entry->xact_checked && entry->in_use == 0)
+	{
+		if (!mapi_is_connected(entry->conn) || mapi_ping(entry->conn) != MOK)
+		{
+			elog(DEBUG3, "monetdb_fdw: connection %p is broken, reconnecting",
+				 entry->conn);
+			disconnect_monetdb_server(entry);
+		}
+		else
+			entry->xact_checked = true;
+	}
+
+	/*
+	 * If cache entry doesn't have a connection, we have to establish a new
+	 * connection.
+	 */
+	if (entry->conn == NULL)
+	{
+		ForeignServer *server = GetForeignServer(user->serverid);
+
+		entry->serverid = user->serverid;
+		entry->in_use = 0;
+		entry->xact_depth = 0;
+		entry->invalidated = false;
+		entry->server_hashvalue =
+			GetSysCacheHashValue1(FOREIGNSERVEROID,
+								  ObjectIdGetDatum(server->serverid));
+		entry->mapping_hashvalue =
+			GetSysCacheHashValue1(USERMAPPINGOID,
+								  ObjectIdGetDatum(user->umid));
+
+		entry->conn = connect_monetdb_server(server, user);
+		((ConnHandleEntry *) hash_search(ConnectionByHandle, &entry->conn,
+										 HASH_ENTER, NULL))->entry = entry;
+		entry->xact_checked = true;
+		entry->fetch_size = 0;
+		entry->prepared = NIL;
+		entry->prefetch = NULL;
+
+		elog(DEBUG3, "monetdb_fdw: new connection %p for server \"%s\"",
+			 entry->conn, server->servername);
+		monetdbStatsRecordConnection(user->serverid, true);
+	}
+	else
+		monetdbStatsRecordConnection(user->serverid, false);
+
+	entry->in_use++;
+
+	return entry->conn;
+}
+
+/*
+ * Release connection reference count created by calling
+ * monetdbGetConnection.  The connection itself stays in the cache.
+ */
+void
+monetdbReleaseConnection(Mapi conn)
+{
+	ConnCacheEntry *entry = find_conn_entry(conn);
+
+	if (entry && entry->in_use > 0)
+		entry->in_use--;
+}
+
+/*
+ * Set the number of rows MonetDB sends per block on this connection.
+ *
+ * mapi_cache_limit() costs a round trip of its own (it sends Xreply_size),
+ * so it is only issued when the value actually changes; connections shared
+ * by tables with the same fetch_size pay for it once.
+ */
+void
+monetdbSetFetchSize(Mapi conn, int fetch_size)
+{
+	ConnCacheEntry *entry = find_conn_entry(conn);
+
+	Assert(entry != NULL);
+
+	if (entry->fetch_size != fetch_size)
+	{
+		if (mapi_cache_limit(conn, fetch_size) != MOK)
+			monetdbReportError(conn, NULL, InvalidOid);
+		entry->fetch_size = fetch_size;
+	}
+}
+
+/*
+ * Record that a scan prepared the statement prep_id on the connection.  If
+ * the scan doesn't get to deallocate it, because of an error or a cancel,
+ * monetdb_xact_callback() does at the end of the transaction.
+ */
+void
+monetdbRememberPrepared(Mapi conn, int prep_id)
+{
+	ConnCacheEntry *entry = find_conn_entry(conn);
+	MemoryContext oldcontext;
+
+	Assert(entry != NULL);
+
+	oldcontext = MemoryContextSwitchTo(TopMemoryContext);
+	entry->prepared = lappend_int(entry->prepared, prep_id);
+	MemoryContextSwitchTo(oldcontext);
+}
+
+/*
+ * Record that the statement prep_id was deallocated.
+ */
+void
+monetdbForgetPrepared(Mapi conn, int prep_id)
+{
+	ConnCacheEntry *entry = find_conn_entry(conn);
+
+	if (entry)
+		entry->prepared = list_delete_int(entry->prepared, prep_id);
+}
+
+/*
+ * Make sure the connection is in a remote transaction, with a savepoint
+ * for each level of local subtransaction, before a statement modifying a
+ * foreign table is sent on it.  monetdb_xact_callback() commits or rolls
+ * the transaction back when the local one ends.
+ */
+void
+monetdbBeginRemoteXact(Mapi conn)
+{
+	ConnCacheEntry *entry = find_conn_entry(conn);
+	int			curlevel = GetCurrentTransactionNestLevel();
+
+	Assert(entry != NULL);
+
+	/* see monetdb_subxact_callback() */
+	if (entry->xact_aborted)
+		ereport(ERROR,
+				(errcode(ERRCODE_IN_FAILED_SQL_TRANSACTION),
+				 errmsg("monetdb_fdw: the remote transaction could not be rolled back to a savepoint"),
+				 errhint("Roll back the local transaction.")));
+
+	if (entry->xact_depth <= 0)
+	{
+		elog(DEBUG3, "monetdb_fdw: starting remote transaction on connection %p",
+			 conn);
+		do_remote_command(conn, "START TRANSACTION");
+		entry->xact_depth = 1;
+	}
+
+	while (entry->xact_depth < curlevel)
+	{
+		char		sql[64];
+
+		snprintf(sql, sizeof(sql), "SAVEPOINT s%d", entry->xact_depth + 1);
+		do_remote_command(conn, sql);
+		entry->xact_depth++;
+	}
+}
+
+/*
+ * Find the cache entry of a connection, or return NULL.
+ */
+static ConnCacheEntry *
+find_conn_entry(Mapi conn)
+{
+	ConnHandleEntry *hentry;
+
+	if (ConnectionByHandle == NULL || conn == NULL)
+		return NULL;
+
+	hentry = hash_search(ConnectionByHandle, &conn, HASH_FIND, NULL);
+
+	return hentry ? hentry->entry : NULL;
+}
+
+/*
+ * Return the number of scans and modifications using the connection.
+ */
+int
+monetdbConnectionUsers(Mapi conn)
+{
+	ConnCacheEntry *entry = find_conn_entry(conn);
+
+	return entry ? entry->in_use : 0;
+}
+
+/*
+ * Record that a prefetch thread reads from the connection, or with pf
+ * NULL, that it no longer does.  monetdbGetConnection() stops it before
+ * handing out the connection again.
+ */
+void
+monetdbSetConnectionPrefetch(Mapi conn, MonetdbPrefetch *pf)
+{
+	ConnCacheEntry *entry = find_conn_entry(conn);
+
+	if (entry)
+		entry->prefetch = pf;
+}
+
+/*
+ * Connect to the MonetDB server described by the server's and the user
+ * mapping's options.
+ */
+static Mapi
+connect_monetdb_server(ForeignServer *server, UserMapping *user)
+{
+	char	   *host = NULL;
+	char	   *port = NULL;
+	char	   *dbname = NULL;
+	char	   *username = NULL;
+	char	   *passwd = NULL;
+	ListCell   *lc;
+	Mapi		conn;
+
+	foreach(lc, server->options)
+	{
+		DefElem    *def = (DefElem *) lfirst(lc);
+
+		if (strcmp(def->defname, "host") == 0)
+			host = defGetString(def);
+		else if (strcmp(def->defname, "port") == 0)
+			port = defGetString(def);
+		else if (strcmp(def->defname, "dbname") == 0)
+			dbname = defGetString(def);
+	}
+	foreach(lc, user->options)
+	{
+		DefElem    *def = (DefElem *) lfirst(lc);
+
+		if (strcmp(def->defname, "user") == 0)
+			username = defGetString(def);
+		else if (strcmp(def->defname, "passwd") == 0)
+			passwd = defGetString(def);
+	}
+
+	/*
+	 * Check required option(s) here.
+	 */
+	if (host == NULL)
+		elog(ERROR, "monetdb_fdw: host is required for monetdb_fdw servers");
+	if (port == NULL)
+		elog(ERROR, "monetdb_fdw: port is required for monetdb_fdw servers");
+	if (dbname == NULL)
+		elog(ERROR, "monetdb_fdw: dbname is required for monetdb_fdw servers");
+	if (username == NULL)
+		elog(ERROR, "monetdb_fdw: user is required for monetdb_fdw user mappings");
+	if (passwd == NULL)
+		elog(ERROR, "monetdb_fdw: passwd is required for monetdb_fdw user mappings");
+
+	conn = mapi_connect(host, atoi(port), username, passwd, "sql", dbname);
+	if (conn == NULL || mapi_error(conn))
+	{
+		char	   *err = NULL;
+
+		if (conn != NULL && mapi_error_str(conn))
+			err = pstrdup(mapi_error_str(conn));
+		if (conn != NULL)
+		{
+			mapi_explain(conn, stderr);
+			mapi_destroy(conn);
+		}
+
+		monetdbStatsRecordError(server->serverid, InvalidOid,
+								err ? err : "unknown error.");
+		elog(ERROR, "monetdb_fdw: %s", err ? err : "unknown error.");
+	}
+
+	return conn;
+}
+
+/*
+ * Run a statement returning no rows on MonetDB, and report its error, if
+ * any.
+ */
+static void
+do_remote_command(Mapi conn, const char *sql)
+{
+	MapiHdl		hdl;
+
+	if ((hdl = mapi_query(conn, sql)) == NULL || mapi_error(conn) != MOK)
+		monetdbReportError(conn, hdl, InvalidOid);
+	mapi_close_handle(hdl);
+}
+
+/*
+ * The same, for the end of a transaction, where we must not throw an
+ * error: return whether the statement succeeded.
+ */
+static bool
+try_remote_command(Mapi conn, const char *sql)
+{
+	MapiHdl		hdl;
+	bool		ok;
+
+	hdl = mapi_query(conn, sql);
+	ok = (hdl != NULL && mapi_error(conn) == MOK &&
+		  mapi_result_error(hdl) == NULL);
+	if (hdl != NULL)
+		mapi_close_handle(hdl);
+
+	return ok;
+}
+
+/*
+ * Close any open connection of the given cache entry.
+ */
+static void
+disconnect_monetdb_server(ConnCacheEntry *entry)
+{
+	if (entry->conn != NULL)
+	{
+		hash_search(ConnectionByHandle, &entry->conn, HASH_REMOVE, NULL);
+		mapi_destroy(entry->conn);
+		entry->conn = NULL;
+	}
+	list_free(entry->prepared);
+	entry->prepared = NIL;
+	entry->in_use = 0;
+	entry->xact_depth = 0;
+}
+
+/*
+ * Report an error we got from MonetDB and close the query handle, if any.
+ * The error is counted in the statistics of the foreign table relid, or of
+ * the connection's server if relid is InvalidOid.
+ *
+ * The connection stays in the cache; if it was lost, the next
+ * monetdbGetConnection() notices and reconnects.
+ */
+void
+monetdbReportError(Mapi dbh, MapiHdl hdl, Oid relid)
+{
+	char *err;
+	ConnCacheEntry *entry;
+
+	if (hdl != NULL && mapi_result_error(hdl))
+		err = pstrdup(mapi_result_error(hdl));
+	else if (dbh != NULL && mapi_error_str(dbh))
+		err = pstrdup(mapi_error_str(dbh));
+	else
+		err = "unknown error.";
+
+	if (hdl != NULL) {
+		mapi_explain_query(hdl, stderr);
+		do {
+			if (mapi_result_error(hdl) != NULL)
+				mapi_explain_result(hdl, stderr);
+		} while (mapi_next_result(hdl) == 1);
+		mapi_close_handle(hdl);
+	} else if (dbh != NULL) {
+		mapi_explain(dbh, stderr);
+	}
+
+	if ((entry = find_conn_entry(dbh)) != NULL)
+		monetdbStatsRecordError(entry->serverid, relid, err);
+
+	elog(ERROR, "monetdb_fdw: %s", err);
+}
+
+/*
+ * monetdb_xact_callback --- cleanup at main-transaction end.
+ *
+ * Remote transactions are committed just before the local one, so that an
+ * error, such as a write conflict MonetDB only detects at COMMIT, aborts
+ * the local transaction too; they are rolled back when it aborts.
+ *
+ * A scan that was still running when the transaction aborted never got to
+ * close its query handle, and MonetDB may still be streaming its result.
+ * Rather than try to resynchronize, drop such connections, which also
+ * rolls back their remote transaction; idle ones are kept for the next
+ * transaction, after the statements such scans prepared are deallocated.
+ */
+static void
+monetdb_xact_callback(XactEvent event, void *arg)
+{
+	HASH_SEQ_STATUS scan;
+	ConnCacheEntry *entry;
+
+	/* Quick exit if no connections were touched in this transaction. */
+	if (ConnectionHash == NULL)
+		return;
+
+	if (event == XACT_EVENT_PRE_COMMIT || event == XACT_EVENT_PRE_PREPARE)
+	{
+		hash_seq_init(&scan, ConnectionHash);
+		while ((entry = (ConnCacheEntry *) hash_seq_search(&scan)))
+		{
+			if (entry->xact_aborted)
+			{
+				hash_seq_term(&scan);
+				ereport(ERROR,
+						(errcode(ERRCODE_IN_FAILED_SQL_TRANSACTION),
+						 errmsg("monetdb_fdw: the remote transaction could not be rolled back to a savepoint")));
+			}
+
+			if (entry->conn == NULL || entry->xact_depth <= 0)
+				continue;
+
+			if (event == XACT_EVENT_PRE_PREPARE)
+			{
+				hash_seq_term(&scan);
+				ereport(ERROR,
+						(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+						 errmsg("cannot PREPARE a transaction that has modified MonetDB tables")));
+			}
+
+			if (entry->prefetch != NULL)
+				monetdbPrefetchStop(entry->prefetch);
+
+			/*
+			 * The COMMIT may fail; end the scan of the hash first, and start
+			 * it again after, skipping the connections committed already.
+			 */
+			elog(DEBUG3, "monetdb_fdw: committing remote transaction on connection %p",
+				 entry->conn);
+			hash_seq_term(&scan);
+			entry->xact_depth = 0;
+			do_remote_command(entry->conn, "COMMIT");
+			hash_seq_init(&scan, ConnectionHash);
+		}
+		return;
+	}
+
+	if (event != XACT_EVENT_COMMIT &&
+		event != XACT_EVENT_PARALLEL_COMMIT &&
+		event != XACT_EVENT_ABORT &&
+		event != XACT_EVENT_PARALLEL_ABORT)
+		return;
+
+	hash_seq_init(&scan, ConnectionHash);
+	while ((entry = (ConnCacheEntry *) hash_seq_search(&scan)))
+	{
+		entry->xact_aborted = false;
+
+		if (entry->conn == NULL)
+			continue;
+
+		/* no thread may be left reading from the connection */
+		if (entry->prefetch != NULL)
+			monetdbPrefetchStop(entry->prefetch);
+
+		if (entry->in_use > 0 || entry->invalidated ||
+			(entry->xact_depth > 0 &&
+			 !try_remote_command(entry->conn, "ROLLBACK")))
+		{
+			elog(DEBUG3, "monetdb_fdw: discarding connection %p", entry->conn);
+			disconnect_monetdb_server(entry);
+		}
+		entry->xact_depth = 0;
+
+		/* the statements of the scans that failed */
+		if (entry->conn != NULL && entry->prepared != NIL)
+		{
+			ListCell   *lc;
+
+			foreach(lc, entry->prepared)
+			{
+				char		sql[64];
+
+				snprintf(sql, sizeof(sql), "DEALLOCATE %d", lfirst_int(lc));
+				(void) try_remote_command(entry->conn, sql);
+			}
+			list_free(entry->prepared);
+			entry->prepared = NIL;
+		}
+
+		/* Check health again at the start of the next transaction */
+		entry->xact_checked = false;
+	}
+}
+
+/*
+ * monetdb_subxact_callback --- release or roll back the remote savepoints
+ * of a local subtransaction at its end.
+ *
+ * If a savepoint can't be rolled back to, the changes made since can't be
+ * undone alone: the local transaction can then only be rolled back, and
+ * the whole remote transaction with it.
+ */
+static void
+monetdb_subxact_callback(SubXactEvent event, SubTransactionId mySubid,
+						 SubTransactionId parentSubid, void *arg)
+{
+	HASH_SEQ_STATUS scan;
+	ConnCacheEntry *entry;
+	int			curlevel;
+
+	if (ConnectionHash == NULL)
+		return;
+
+	if (event != SUBXACT_EVENT_PRE_COMMIT_SUB &&
+		event != SUBXACT_EVENT_ABORT_SUB)
+		return;
+
+	curlevel = GetCurrentTransactionNestLevel();
+	hash_seq_init(&scan, ConnectionHash);
+	while ((entry = (ConnCacheEntry *) hash_seq_search(&scan)))
+	{
+		char		sql[64];
+
+		/* only connections with a savepoint for this level */
+		if (entry->conn == NULL || entry->xact_depth < curlevel)
+			continue;
+
+		if (entry->xact_depth > curlevel)
+		{
+			hash_seq_term(&scan);
+			elog(ERROR, "monetdb_fdw: missed cleaning up remote subtransaction at level %d",
+				 entry->xact_depth);
+		}
+
+		if (entry->prefetch != NULL)
+			monetdbPrefetchStop(entry->prefetch);
+
+		entry->xact_depth--;
+		if (event == SUBXACT_EVENT_PRE_COMMIT_SUB)
+		{
+			/* as for COMMIT above, in case the RELEASE fails */
+			snprintf(sql, sizeof(sql), "RELEASE SAVEPOINT s%d", curlevel);
+			hash_seq_term(&scan);
+			do_remote_command(entry->conn, sql);
+			hash_seq_init(&scan, ConnectionHash);
+		}
+		else
+		{
+			/*
+			 * A scan the subtransaction left open still holds the result
+			 * it was reading; no statement can be sent before it is gone.
+			 */
+			snprintf(sql, sizeof(sql), "ROLLBACK TO SAVEPOINT s%d", curlevel);
+			if (entry->in_use > 0 || !try_remote_command(entry->conn, sql))
+				entry->xact_aborted = true;
+		}
+	}
+}
+
+/*
+ * Connection invalidation callback function
+ *
+ * After a change to a pg_foreign_server or pg_user_mapping catalog entry,
+ * close connections depending on that entry immediately if idle, or mark
+ * them for reconnection once the current scans are done.
+ *
+ * Although most cache invalidation callbacks blow away all the related
+ * stuff regardless of the given hashvalue, connections are expensive
+ * enough that it's worth trying to avoid that.
+ */
+static void
+monetdb_inval_callback(Datum arg, int cacheid, uint32 hashvalue)
+{
+	HASH_SEQ_STATUS scan;
+	ConnCacheEntry *entry;
+
+	Assert(cacheid == FOREIGNSERVEROID || cacheid == USERMAPPINGOID);
+
+	/* ConnectionHash must exist already, if we're registered */
+	hash_seq_init(&scan, ConnectionHash);
+	while ((entry = (ConnCacheEntry *) hash_seq_search(&scan)))
+	{
+		/* Ignore invalid entries */
+		if (entry->conn == NULL)
+			continue;
+
+		/* hashvalue == 0 means a cache reset, must clear all state */
+		if (hashvalue == 0 ||
+			(cacheid == FOREIGNSERVEROID &&
+			 entry->server_hashvalue == hashvalue) ||
+			(cacheid == USERMAPPINGOID &&
+			 entry->mapping_hashvalue == hashvalue))
+		{
+			if (entry->in_use == 0 && entry->xact_depth == 0)
+				disconnect_monetdb_server(entry);
+			else
+				entry->invalidated = true;
+		}
+	}
+}
+
+/*
+ * List cached connections.
+ *
+ * Returns one row per open connection: the foreign server name, the local
+ * user of the user mapping the connection was made for ("public" for a
+ * public mapping), and whether it is still valid (false once the server or
+ * user mapping was changed or dropped while the connection was in use).
+ */
+Datum
+monetdb_fdw_get_connections(PG_FUNCTION_ARGS)
+{
+#define MONETDB_FDW_GET_CONNECTIONS_COLS	3
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	HASH_SEQ_STATUS scan;
+	ConnCacheEntry *entry;
+
+	InitMaterializedSRF(fcinfo, 0);
+
+	/* If cache doesn't exist, we return no records */
+	if (ConnectionHash == NULL)
+		PG_RETURN_VOID();
+
+	hash_seq_init(&scan, ConnectionHash);
+	while ((entry = (ConnCacheEntry *) hash_seq_search(&scan)))
+	{
+		ForeignServer *server;
+		HeapTuple	tp;
+		char	   *username = NULL;
+		Datum		values[MONETDB_FDW_GET_CONNECTIONS_COLS];
+		bool		nulls[MONETDB_FDW_GET_CONNECTIONS_COLS];
+
+		/* We only look for open connections */
+		if (entry->conn == NULL)
+			continue;
+
+		memset(values, 0, sizeof(values));
+		memset(nulls, 0, sizeof(nulls));
+
+		server = GetForeignServerExtended(entry->serverid, FSV_MISSING_OK);
+		if (server)
+			values[0] = CStringGetTextDatum(server->servername);
+		else
+			nulls[0] = true;
+
+		/* the user of the mapping, or "public" for a public mapping */
+		tp = SearchSysCache1(USERMAPPINGOID, ObjectIdGetDatum(entry->key));
+		if (HeapTupleIsValid(tp))
+		{
+			Oid			umuser = ((Form_pg_user_mapping) GETSTRUCT(tp))->umuser;
+
+			username = OidIsValid(umuser) ?
+				GetUserNameFromId(umuser, true) : pstrdup("public");
+			ReleaseSysCache(tp);
+		}
+		if (username)
+			values[1] = CStringGetTextDatum(username);
+		else
+			nulls[1] = true;
+
+		values[2] = BoolGetDatum(server != NULL && !entry->invalidated);
+
+		tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc, values, nulls);
+	}
+
+	PG_RETURN_VOID();
+}
+
+/*
+ * Disconnect the cached connections to the given foreign server.
+ *
+ * Returns true if at least one connection was closed.  Connections in use
+ * by a running scan are left alone.
+ */
+Datum
+monetdb_fdw_disconnect(PG_FUNCTION_ARGS)
+{
+	ForeignServer *server;
+	char	   *servername;
+
+	servername = text_to_cstring(PG_GETARG_TEXT_PP(0));
+	server = GetForeignServerByName(servername, false);
+
+	PG_RETURN_BOOL(disconnect_cached_connections(server->serverid));
+}
+
+/*
+ * Disconnect all the cached connections.
+ */
+Datum
+monetdb_fdw_disconnect_all(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_BOOL(disconnect_cached_connections(InvalidOid));
+}
+
+/*
+ * Workhorse to disconnect cached connections.  InvalidOid means all
+ * servers.
+ */
+static bool
+disconnect_cached_connections(Oid serverid)
+{
+	HASH_SEQ_STATUS scan;
+	ConnCacheEntry *entry;
+	bool		result = false;
+
+	if (ConnectionHash == NULL)
+		return false;
+
+	hash_seq_init(&scan, ConnectionHash);
+	while ((entry = (ConnCacheEntry *) hash_seq_search(&scan)))
+	{
+		if (entry->conn == NULL)
+			continue;
+
+		if (OidIsValid(serverid) && entry->serverid != serverid)
+			continue;
+
+		if (entry->in_use > 0)
+		{
+			ereport(WARNING,
+					(errmsg("cannot close a monetdb_fdw connection in use by the current query")));
+			continue;
+		}
+		if (entry->xact_depth > 0)
+		{
+			ereport(WARNING,
+					(errmsg("cannot close a monetdb_fdw connection in use by the current transaction")));
+			continue;
+		}
+
+		disconnect_monetdb_server(entry);
+		result = true;
+	}
+
+	return result;
+}
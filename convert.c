@@ -0,0 +1,550 @@
+/*-------------------------------------------------------------------------
+ *
+ * convert.c
+ *                conversion of MonetDB result fields to Datums
+ *
+ * MAPI hands us every field as a C string.  Going through the type's
+ * input function for each of them is correct but slow, so the common
+ * types MonetDB produces are parsed here directly; anything unusual
+ * falls back to the input function, which also produces the proper
+ * error messages for bad input.
+ *
+ * monetdbConvertColumn() does the same for all the values of a column of
+ * a block of rows, so that the loop over them is specific to the type.
+ *
+ * Copyright (c) 2010-2013, PostgreSQL Global Development Group
+ * Copyright (c) 2013, Satoshi Nagayasu
+ *
+ * IDENTIFICATION
+ *                contrib/monetdb_fdw/convert.c
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include "monetdb_fdw.h"
+
+#include "catalog/pg_type.h"
+#include "datatype/timestamp.h"
+#include "utils/builtins.h"
+#include "utils/date.h"
+#include "utils/datetime.h"
+#include "utils/float.h"
+#include "utils/lsyscache.h"
+#include "utils/numeric.h"
+#include "utils/timestamp.h"
+
+#include <math.h>
+
+/* Longest run of decimal digits that always fits in an int64 */
+#define MAX_INT64_DIGITS	18
+
+static bool parse_date_fields(const char *str, int *year, int *month, int *day);
+static bool convert_date(const char *str, size_t len, Datum *result);
+static bool convert_timestamp(const char *str, size_t len, Datum *result);
+static bool convert_numeric(const char *str, int32 typmod, Datum *result);
+static Datum convert_float4(char *str);
+static inline bool parse_int64(const char *str, size_t len, int64 *result);
+static void convert_text_column(MonetdbFdwConverter *conv, char **fields,
+								size_t *lens, int nrows, Datum *values,
+								int *row);
+
+
+/*
+ * Set up the converters for the columns of a remote result.
+ *
+ * retrieved_attrs lists the attribute numbers the result columns are
+ * stored into, in result order.  This does the catalog lookups once per
+ * scan instead of once per row.
+ */
+MonetdbFdwConverter *
+monetdbMakeConverters(TupleDesc tupdesc, List *retrieved_attrs)
+{
+	MonetdbFdwConverter *convs;
+	ListCell   *lc;
+	int			i = 0;
+
+	convs = (MonetdbFdwConverter *)
+		palloc0(sizeof(MonetdbFdwConverter) * Max(list_length(retrieved_attrs), 1));
+
+	foreach(lc, retrieved_attrs)
+	{
+		int			attnum = lfirst_int(lc);
+		Form_pg_attribute attr = TupleDescAttr(tupdesc, attnum - 1);
+		MonetdbFdwConverter *conv = &convs[i++];
+		Oid			infuncid;
+
+		conv->attnum = attnum;
+		conv->typmod = attr->atttypmod;
+
+		getTypeInputInfo(attr->atttypid, &infuncid, &conv->typioparam);
+		fmgr_info(infuncid, &conv->infunc);
+
+		switch (attr->atttypid)
+		{
+			case INT2OID:
+				conv->kind = MONETDB_CONV_INT2;
+				break;
+			case INT4OID:
+				conv->kind = MONETDB_CONV_INT4;
+				break;
+			case INT8OID:
+				conv->kind = MONETDB_CONV_INT8;
+				break;
+			case FLOAT4OID:
+				conv->kind = MONETDB_CONV_FLOAT4;
+				break;
+			case FLOAT8OID:
+				conv->kind = MONETDB_CONV_FLOAT8;
+				break;
+			case NUMERICOID:
+				conv->kind = MONETDB_CONV_NUMERIC;
+				break;
+			case DATEOID:
+				conv->kind = MONETDB_CONV_DATE;
+				break;
+			case TIMESTAMPOID:
+				/* rounding to a shorter precision is left to timestamp_in */
+				conv->kind = (conv->typmod < 0 ||
+							  conv->typmod == MAX_TIMESTAMP_PRECISION) ?
+					MONETDB_CONV_TIMESTAMP : MONETDB_CONV_INPUT_FUNC;
+				break;
+			case TEXTOID:
+			case VARCHAROID:
+				conv->kind = MONETDB_CONV_TEXT;
+				break;
+			default:
+				conv->kind = MONETDB_CONV_INPUT_FUNC;
+				break;
+		}
+	}
+
+	return convs;
+}
+
+/*
+ * Convert one non-NULL field of length len into a Datum of the column's
+ * type.  The result is allocated in the current memory context.
+ */
+Datum
+monetdbConvertValue(MonetdbFdwConverter *conv, char *value, size_t len)
+{
+	Datum		result;
+
+	switch (conv->kind)
+	{
+		case MONETDB_CONV_INT2:
+			return Int16GetDatum(pg_strtoint16(value));
+
+		case MONETDB_CONV_INT4:
+			return Int32GetDatum(pg_strtoint32(value));
+
+		case MONETDB_CONV_INT8:
+			return Int64GetDatum(pg_strtoint64(value));
+
+		case MONETDB_CONV_FLOAT4:
+			return convert_float4(value);
+
+		case MONETDB_CONV_FLOAT8:
+			return Float8GetDatum(float8in_internal(value, NULL,
+													"double precision",
+													value));
+
+		case MONETDB_CONV_NUMERIC:
+			if (convert_numeric(value, conv->typmod, &result))
+				return result;
+			break;
+
+		case MONETDB_CONV_DATE:
+			if (convert_date(value, len, &result))
+				return result;
+			break;
+
+		case MONETDB_CONV_TIMESTAMP:
+			if (convert_timestamp(value, len, &result))
+				return result;
+			break;
+
+		case MONETDB_CONV_TEXT:
+			/*
+			 * A varchar(n) value can only need truncation or a length
+			 * error if it has more than n bytes.
+			 */
+			if (conv->typmod < 0 || len <= (size_t) (conv->typmod - VARHDRSZ))
+				return PointerGetDatum(cstring_to_text_with_len(value, len));
+			break;
+
+		case MONETDB_CONV_INPUT_FUNC:
+			break;
+	}
+
+	return InputFunctionCall(&conv->infunc, value,
+							 conv->typioparam, conv->typmod);
+}
+
+/*
+ * Convert the fields of one column of a block of nrows rows into values
+ * and isnull; a field is fields[i], of length lens[i], or NULL.  The
+ * results are those of monetdbConvertValue(), allocated in the current
+ * memory context.  *row is kept set to the row being converted, for the
+ * error context.
+ */
+void
+monetdbConvertColumn(MonetdbFdwConverter *conv, char **fields, size_t *lens,
+					 int nrows, Datum *values, bool *isnull, int *row)
+{
+	int			i;
+
+	for (i = 0; i < nrows; i++)
+	{
+		isnull[i] = (fields[i] == NULL);
+		values[i] = (Datum) 0;
+	}
+
+	switch (conv->kind)
+	{
+		case MONETDB_CONV_INT2:
+		case MONETDB_CONV_INT4:
+		case MONETDB_CONV_INT8:
+			{
+				int64		min = (conv->kind == MONETDB_CONV_INT2) ? PG_INT16_MIN :
+					(conv->kind == MONETDB_CONV_INT4) ? PG_INT32_MIN : PG_INT64_MIN;
+				int64		max = (conv->kind == MONETDB_CONV_INT2) ? PG_INT16_MAX :
+					(conv->kind == MONETDB_CONV_INT4) ? PG_INT32_MAX : PG_INT64_MAX;
+
+				for (i = 0; i < nrows; i++)
+				{
+					int64		v;
+
+					if (isnull[i])
+						continue;
+					*row = i;
+					/* out of range or unusual: let the slow path complain */
+					if (!parse_int64(fields[i], lens[i], &v) || v < min || v > max)
+						values[i] = monetdbConvertValue(conv, fields[i], lens[i]);
+					else if (conv->kind == MONETDB_CONV_INT2)
+						values[i] = Int16GetDatum((int16) v);
+					else if (conv->kind == MONETDB_CONV_INT4)
+						values[i] = Int32GetDatum((int32) v);
+					else
+						values[i] = Int64GetDatum(v);
+				}
+			}
+			break;
+
+		case MONETDB_CONV_DATE:
+			{
+				/* dates tend to come in runs; convert each run once */
+				char	   *prev = NULL;
+				Datum		prev_value = (Datum) 0;
+
+				for (i = 0; i < nrows; i++)
+				{
+					if (isnull[i])
+						continue;
+					*row = i;
+					if (prev && lens[i] == 10 && memcmp(fields[i], prev, 10) == 0)
+						values[i] = prev_value;
+					else
+					{
+						values[i] = monetdbConvertValue(conv, fields[i], lens[i]);
+						if (lens[i] == 10)
+						{
+							prev = fields[i];
+							prev_value = values[i];
+						}
+					}
+				}
+			}
+			break;
+
+		case MONETDB_CONV_TEXT:
+			convert_text_column(conv, fields, lens, nrows, values, row);
+			break;
+
+		default:
+			for (i = 0; i < nrows; i++)
+			{
+				if (isnull[i])
+					continue;
+				*row = i;
+				values[i] = monetdbConvertValue(conv, fields[i], lens[i]);
+			}
+			break;
+	}
+}
+
+/*
+ * Parse "[-]digits" of up to MAX_INT64_DIGITS digits.  Runs of eight digits
+ * are checked and converted at once, in a 64-bit word, the way simdjson and
+ * fast_float do; that needs the first character in the lowest byte.
+ */
+static inline bool
+parse_int64(const char *str, size_t len, int64 *result)
+{
+	const char *p = str;
+	const char *end = str + len;
+	bool		neg = false;
+	uint64		val = 0;
+
+	if (p < end && *p == '-')
+	{
+		neg = true;
+		p++;
+	}
+	if (p == end || end - p > MAX_INT64_DIGITS)
+		return false;
+
+#ifndef WORDS_BIGENDIAN
+	while (end - p >= 8)
+	{
+		uint64		chunk;
+
+		memcpy(&chunk, p, sizeof(chunk));
+		if (((chunk + UINT64CONST(0x4646464646464646)) |
+			 (chunk - UINT64CONST(0x3030303030303030))) &
+			UINT64CONST(0x8080808080808080))
+			return false;
+
+		chunk -= UINT64CONST(0x3030303030303030);
+		chunk = (chunk * 10) + (chunk >> 8);
+		chunk = (((chunk & UINT64CONST(0x000000FF000000FF)) *
+				  UINT64CONST(0x000F424000000064)) +
+				 (((chunk >> 16) & UINT64CONST(0x000000FF000000FF)) *
+				  UINT64CONST(0x0000271000000001))) >> 32;
+
+		val = val * 100000000 + (uint32) chunk;
+		p += 8;
+	}
+#endif
+
+	for (; p < end; p++)
+	{
+		if (*p < '0' || *p > '9')
+			return false;
+		val = val * 10 + (*p - '0');
+	}
+
+	*result = neg ? -(int64) val : (int64) val;
+	return true;
+}
+
+/*
+ * The lengths of the fields are known, so the text values of a column are
+ * built in a single allocation, instead of one per value.  The ones a
+ * varchar(n) may have to reject or truncate go the slow way.
+ */
+static void
+convert_text_column(MonetdbFdwConverter *conv, char **fields, size_t *lens,
+					int nrows, Datum *values, int *row)
+{
+	int32		maxlen = (conv->typmod < 0) ? -1 : conv->typmod - VARHDRSZ;
+	Size		total = 0;
+	char	   *buf;
+	int			i;
+
+	for (i = 0; i < nrows; i++)
+	{
+		if (fields[i] != NULL && (maxlen < 0 || lens[i] <= (size_t) maxlen))
+			total += INTALIGN(VARHDRSZ + lens[i]);
+	}
+	if (total == 0)
+		buf = NULL;
+	else
+		buf = MemoryContextAllocHuge(CurrentMemoryContext, total);
+
+	for (i = 0; i < nrows; i++)
+	{
+		if (fields[i] == NULL)
+			continue;
+		*row = i;
+		if (maxlen < 0 || lens[i] <= (size_t) maxlen)
+		{
+			text	   *t = (text *) buf;
+
+			SET_VARSIZE(t, VARHDRSZ + lens[i]);
+			memcpy(VARDATA(t), fields[i], lens[i]);
+			values[i] = PointerGetDatum(t);
+			buf += INTALIGN(VARHDRSZ + lens[i]);
+		}
+		else
+			values[i] = monetdbConvertValue(conv, fields[i], lens[i]);
+	}
+}
+
+/*
+ * float8in_internal() does the parsing; PostgreSQL has no float4
+ * counterpart, so check the range the way float4in() does.
+ */
+static Datum
+convert_float4(char *str)
+{
+	double		val = float8in_internal(str, NULL, "real", str);
+	float4		result = (float4) val;
+
+	if ((isinf(result) && !isinf(val)) || (result == 0.0 && val != 0.0))
+		ereport(ERROR,
+				(errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
+				 errmsg("\"%s\" is out of range for type real", str)));
+
+	return Float4GetDatum(result);
+}
+
+/*
+ * Parse n decimal digits at str into *val.
+ */
+static inline bool
+parse_digits(const char *str, int n, int *val)
+{
+	int			v = 0;
+	int			i;
+
+	for (i = 0; i < n; i++)
+	{
+		if (str[i] < '0' || str[i] > '9')
+			return false;
+		v = v * 10 + (str[i] - '0');
+	}
+	*val = v;
+	return true;
+}
+
+/*
+ * Parse the "YYYY-MM-DD" MonetDB uses for dates.  Only four-digit years
+ * are handled here, which keeps us well inside the valid date range.
+ */
+static bool
+parse_date_fields(const char *str, int *year, int *month, int *day)
+{
+	if (str[4] != '-' || str[7] != '-')
+		return false;
+	if (!parse_digits(str, 4, year) ||
+		!parse_digits(str + 5, 2, month) ||
+		!parse_digits(str + 8, 2, day))
+		return false;
+
+	if (*year < 1 || *month < 1 || *month > MONTHS_PER_YEAR || *day < 1 ||
+		*day > day_tab[isleap(*year)][*month - 1])
+		return false;
+
+	return true;
+}
+
+static bool
+convert_date(const char *str, size_t len, Datum *result)
+{
+	int			year,
+				month,
+				day;
+
+	if (len != 10 || !parse_date_fields(str, &year, &month, &day))
+		return false;
+
+	*result = DateADTGetDatum(date2j(year, month, day) - POSTGRES_EPOCH_JDATE);
+	return true;
+}
+
+/*
+ * Parse "YYYY-MM-DD HH:MM:SS[.ffffff]".
+ */
+static bool
+convert_timestamp(const char *str, size_t len, Datum *result)
+{
+	int			year,
+				month,
+				day,
+				hour,
+				min,
+				sec,
+				fsec = 0;
+	int			nfrac;
+	Timestamp	ts;
+
+	if (len < 19 || str[10] != ' ' || str[13] != ':' || str[16] != ':')
+		return false;
+	if (!parse_date_fields(str, &year, &month, &day))
+		return false;
+	if (!parse_digits(str + 11, 2, &hour) || hour >= HOURS_PER_DAY ||
+		!parse_digits(str + 14, 2, &min) || min >= MINS_PER_HOUR ||
+		!parse_digits(str + 17, 2, &sec) || sec >= SECS_PER_MINUTE)
+		return false;
+
+	if (len > 19)
+	{
+		nfrac = len - 20;
+		if (str[19] != '.' || nfrac < 1 || nfrac > MAX_TIMESTAMP_PRECISION ||
+			!parse_digits(str + 20, nfrac, &fsec))
+			return false;
+		for (; nfrac < MAX_TIMESTAMP_PRECISION; nfrac++)
+			fsec *= 10;
+	}
+
+	ts = (Timestamp) (date2j(year, month, day) - POSTGRES_EPOCH_JDATE) * USECS_PER_DAY +
+		((((hour * MINS_PER_HOUR) + min) * SECS_PER_MINUTE) + sec) * USECS_PER_SEC +
+		fsec;
+
+	*result = TimestampGetDatum(ts);
+	return true;
+}
+
+/*
+ * Build a numeric from "[-]digits[.digits]" when the value, scaled to an
+ * integer, fits in an int64 and fits the column's typmod as is.
+ */
+static bool
+convert_numeric(const char *str, int32 typmod, Datum *result)
+{
+	const char *p = str;
+	bool		neg = false;
+	int64		val = 0;
+	int			intdigits = 0;
+	int			fracdigits = 0;
+	int			scale;
+
+	if (*p == '-')
+	{
+		neg = true;
+		p++;
+	}
+
+	/* leading zeros don't count against the precision */
+	while (*p == '0' && p[1] >= '0' && p[1] <= '9')
+		p++;
+	for (; *p >= '0' && *p <= '9'; p++, intdigits++)
+		val = val * 10 + (*p - '0');
+	if (intdigits == 0 || intdigits > MAX_INT64_DIGITS)
+		return false;
+
+	if (*p == '.')
+	{
+		for (p++; *p >= '0' && *p <= '9'; p++, fracdigits++)
+		{
+			if (intdigits + fracdigits >= MAX_INT64_DIGITS)
+				return false;
+			val = val * 10 + (*p - '0');
+		}
+		if (fracdigits == 0)
+			return false;
+	}
+	if (*p != '\0')
+		return false;
+
+	scale = fracdigits;
+	if (typmod >= (int32) VARHDRSZ)
+	{
+		int			precision = ((typmod - VARHDRSZ) >> 16) & 0xffff;
+		int			typscale = (((typmod - VARHDRSZ) & 0x7ff) ^ 1024) - 1024;
+
+		/* let numeric_in round, or reject, anything that doesn't fit */
+		if (typscale < fracdigits ||
+			(val != 0 && intdigits > precision - typscale) ||
+			intdigits + typscale > MAX_INT64_DIGITS)
+			return false;
+
+		for (; scale < typscale; scale++)
+			val *= 10;
+	}
+
+	*result = NumericGetDatum(int64_div_fast_to_numeric(neg ? -val : val, scale));
+	return true;
+}
@@ -0,0 +1,2256 @@
+/*-------------------------------------------------------------------------
+ *
+ * deparse.c
+ *                query deparser for monetdb_fdw
+ *
+ * This file includes functions that examine query WHERE clauses to see
+ * whether they're safe to send to MonetDB for execution, as well as
+ * functions to construct the query text to be sent.
+ *
+ * Copyright (c) 2010-2013, PostgreSQL Global Development Group
+ * Copyright (c) 2013, Satoshi Nagayasu
+ *
+ * IDENTIFICATION
+ *                contrib/monetdb_fdw/deparse.c
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include <ctype.h>
+#include <math.h>
+
+#include "monetdb_fdw.h"
+
+#include "access/stratnum.h"
+#include "access/sysattr.h"
+#include "access/table.h"
+#include "access/transam.h"
+#include "catalog/pg_aggregate.h"
+#include "catalog/pg_type.h"
+#include "commands/defrem.h"
+#include "nodes/makefuncs.h"
+#include "nodes/nodeFuncs.h"
+#include "optimizer/optimizer.h"
+#include "optimizer/tlist.h"
+#include "parser/scansup.h"
+#include "utils/array.h"
+#include "utils/builtins.h"
+#include "utils/date.h"
+#include "utils/datetime.h"
+#include "utils/fmgroids.h"
+#include "utils/lsyscache.h"
+#include "utils/numeric.h"
+#include "utils/pg_locale.h"
+#include "utils/rel.h"
+#include "utils/timestamp.h"
+
+/*
+ * Global context for foreign_expr_walker's search of an expression
+ * tree.
+ */
+typedef struct foreign_glob_cxt
+{
+	PlannerInfo *root;			/* global planner state */
+	RelOptInfo *foreignrel;		/* the foreign relation we are planning for */
+	Relids		relids;			/* relids of base relations in the underlying
+								 * scan */
+} foreign_glob_cxt;
+
+/*
+ * Context for deparseExpr
+ */
+typedef struct deparse_expr_cxt
+{
+	PlannerInfo *root;			/* global planner state */
+	RelOptInfo *foreignrel;		/* the foreign relation we are planning for */
+	RelOptInfo *scanrel;		/* the underlying scan relation; same as
+								 * foreignrel unless that is an upper rel */
+	StringInfo	buf;			/* output buffer to append to */
+	List	  **params_list;	/* exprs that will become remote Params */
+} deparse_expr_cxt;
+
+/* Column references in joins are qualified with this prefix and the relid */
+#define REL_ALIAS_PREFIX	"r"
+
+/*
+ * Built-in operators MonetDB evaluates exactly like PostgreSQL does.
+ * Division and modulo are left out on purpose: MonetDB picks a different
+ * result scale for decimals, so shipping them could change the answer.
+ * The arithmetic operators are only shipped for numbers; see
+ * is_arithmetic_operator.
+ */
+static const char *const shippable_operators[] = {
+	"=", "<>", "<", "<=", ">", ">=",
+	"+", "-", "*",
+	"~~", "!~~", "~~*", "!~~*",
+	"||",
+	NULL
+};
+
+static bool foreign_expr_walker(Node *node, foreign_glob_cxt *glob_cxt);
+static bool is_builtin(Oid objectid);
+static bool is_shippable_type(Oid type);
+static const char *param_remote_type(Oid type);
+static bool is_shippable_const(Const *node);
+static bool is_shippable_value(Datum value, Oid type);
+static bool is_shippable_operator(OpExpr *node, Oid serverid);
+static bool is_ordering_operator(const char *oprname);
+static bool is_arithmetic_operator(const char *oprname);
+static bool is_numeric_type(Oid type);
+static bool is_shippable_aggregate(Aggref *agg);
+static const char *date_trunc_unit(FuncExpr *node);
+
+static void deparseTargetList(StringInfo buf,
+							  PlannerInfo *root,
+							  Index rtindex,
+							  Relation rel,
+							  Bitmapset *attrs_used,
+							  List **retrieved_attrs);
+static void deparseExplicitTargetList(List *tlist,
+									  List **retrieved_attrs,
+									  deparse_expr_cxt *context);
+static void deparseFromExprForRel(StringInfo buf, PlannerInfo *root,
+								  RelOptInfo *foreignrel, bool use_alias);
+static void appendConditions(List *exprs, const char *keyword,
+							 deparse_expr_cxt *context);
+static void appendGroupByClause(List *tlist, deparse_expr_cxt *context);
+static void appendOrderByClause(List *pathkeys, deparse_expr_cxt *context);
+static void appendLimitClause(deparse_expr_cxt *context);
+static Expr *find_pathkey_expr(PlannerInfo *root, EquivalenceClass *ec,
+							   RelOptInfo *rel);
+static void appendQueryText(StringInfo buf, const char *query);
+static void deparseExpr(Expr *expr, deparse_expr_cxt *context);
+static void deparseVar(Var *node, deparse_expr_cxt *context);
+static void deparseConst(Const *node, deparse_expr_cxt *context);
+static void deparseDatum(Datum value, Oid type, deparse_expr_cxt *context);
+static char *deparseValueText(Datum value, Oid type);
+static void check_storable_value(Datum value, Oid type);
+static void deparseFuncExpr(FuncExpr *node, deparse_expr_cxt *context);
+static void deparseOpExpr(OpExpr *node, deparse_expr_cxt *context);
+static void deparseTranslation(const char *remote, List *args,
+							   deparse_expr_cxt *context);
+static void deparseScalarArrayOpExpr(ScalarArrayOpExpr *node,
+									 deparse_expr_cxt *context);
+static void deparseBoolExpr(BoolExpr *node, deparse_expr_cxt *context);
+static void deparseNullTest(NullTest *node, deparse_expr_cxt *context);
+static void deparseRelabelType(RelabelType *node, deparse_expr_cxt *context);
+static void deparseAggref(Aggref *node, deparse_expr_cxt *context);
+static void deparseColumnName(StringInfo buf, Oid relid, AttrNumber attnum);
+static void deparseColumnRef(StringInfo buf, Index varno, AttrNumber varattno,
+							 PlannerInfo *root, bool qualify_col);
+static void deparseIdentifier(StringInfo buf, const char *ident);
+
+
+/*
+ * Examine each qual clause in input_conds, and classify them into two
+ * groups, which are returned as two lists:
+ *	- remote_conds contains expressions that can be evaluated remotely
+ *	- local_conds contains expressions that can't be evaluated remotely
+ */
+void
+monetdbClassifyConditions(PlannerInfo *root,
+						  RelOptInfo *baserel,
+						  List *input_conds,
+						  List **remote_conds,
+						  List **local_conds)
+{
+	ListCell   *lc;
+
+	*remote_conds = NIL;
+	*local_conds = NIL;
+
+	foreach(lc, input_conds)
+	{
+		RestrictInfo *ri = lfirst_node(RestrictInfo, lc);
+
+		if (monetdbIsForeignExpr(root, baserel, ri->clause))
+			*remote_conds = lappend(*remote_conds, ri);
+		else
+			*local_conds = lappend(*local_conds, ri);
+	}
+}
+
+/*
+ * Returns true if given expr is safe to evaluate on MonetDB.
+ */
+bool
+monetdbIsForeignExpr(PlannerInfo *root,
+					 RelOptInfo *baserel,
+					 Expr *expr)
+{
+	foreign_glob_cxt glob_cxt;
+	MonetdbFdwPlanState *fpinfo = (MonetdbFdwPlanState *) baserel->fdw_private;
+
+	glob_cxt.root = root;
+	glob_cxt.foreignrel = baserel;
+
+	/*
+	 * For an upper relation, the Vars belong to the relation it is computed
+	 * from.
+	 */
+	if (IS_UPPER_REL(baserel))
+		glob_cxt.relids = fpinfo->outerrel->relids;
+	else
+		glob_cxt.relids = baserel->relids;
+
+	if (!foreign_expr_walker((Node *) expr, &glob_cxt))
+		return false;
+
+	/*
+	 * An expression which includes any mutable functions can't be sent over
+	 * because its result is not stable.  A translated function of the
+	 * monetdb_fdw_pushdown table may be one, so this check matters.
+	 */
+	if (contain_mutable_functions((Node *) expr))
+		return false;
+
+	return true;
+}
+
+/*
+ * Check if expression is safe to execute remotely, and return true if so.
+ *
+ * We accept column references of the scanned relation, constants of the
+ * types MonetDB shares with us, a handful of built-in operators and
+ * constructs (AND/OR/NOT, IS [NOT] NULL, IN lists, LIKE), and the functions
+ * and operators that have a translation for MonetDB (see shippable.c).
+ * BETWEEN needs
+ * no special handling: the parser has already expanded it into a pair of
+ * comparisons.  When planning an upper relation, the aggregates MonetDB
+ * computes the same way are accepted too.
+ */
+static bool
+foreign_expr_walker(Node *node, foreign_glob_cxt *glob_cxt)
+{
+	MonetdbFdwPlanState *fpinfo =
+		(MonetdbFdwPlanState *) glob_cxt->foreignrel->fdw_private;
+
+	if (node == NULL)
+		return true;
+
+	switch (nodeTag(node))
+	{
+		case T_Var:
+			{
+				Var		   *var = (Var *) node;
+
+				if (var->varlevelsup != 0)
+					return false;
+
+				/*
+				 * Only plain user columns of the foreign table itself can be
+				 * shipped; system columns cannot.  A column of another
+				 * relation, which a parameterized scan of a base relation
+				 * has in its join clauses, is sent as a parameter whose
+				 * value is bound when the scan runs.  Its type must be one
+				 * whose every value MonetDB can store; otherwise an outer
+				 * row holding, say, NaN would make the scan fail, where a
+				 * join checking the clause locally would not.
+				 */
+				if (bms_is_member(var->varno, glob_cxt->relids))
+				{
+					if (var->varattno <= 0)
+						return false;
+				}
+				else if (!IS_SIMPLE_REL(glob_cxt->foreignrel) ||
+						 param_remote_type(var->vartype) == NULL)
+					return false;
+
+				if (!is_shippable_type(var->vartype))
+					return false;
+			}
+			break;
+		case T_Const:
+			if (!is_shippable_const((Const *) node))
+				return false;
+			break;
+		case T_OpExpr:
+			{
+				OpExpr	   *oe = (OpExpr *) node;
+
+				if (!is_shippable_operator(oe, fpinfo->serverid))
+					return false;
+
+				if (!is_shippable_type(oe->opresulttype))
+					return false;
+
+				if (!foreign_expr_walker((Node *) oe->args, glob_cxt))
+					return false;
+			}
+			break;
+		case T_FuncExpr:
+			{
+				FuncExpr   *fe = (FuncExpr *) node;
+
+				if (fe->funcretset)
+					return false;
+
+				if (monetdbRemoteFunction(fpinfo->serverid, fe->funcid) == NULL)
+					return false;
+
+				if (fe->funcid == F_DATE_TRUNC_TEXT_TIMESTAMP &&
+					date_trunc_unit(fe) == NULL)
+					return false;
+
+				if (!is_shippable_type(fe->funcresulttype))
+					return false;
+
+				if (!foreign_expr_walker((Node *) fe->args, glob_cxt))
+					return false;
+			}
+			break;
+		case T_ScalarArrayOpExpr:
+			{
+				ScalarArrayOpExpr *oe = (ScalarArrayOpExpr *) node;
+				Node	   *arrayarg = (Node *) lsecond(oe->args);
+				char	   *oprname;
+				Const	   *c;
+				ArrayType  *array;
+				Oid			elemtype;
+				int16		elmlen;
+				bool		elmbyval;
+				char		elmalign;
+				Datum	   *elems;
+				bool	   *nulls;
+				int			nelems;
+				int			i;
+
+				/*
+				 * We can only express "x = ANY(array)" as "x IN (...)" and
+				 * "x <> ALL(array)" as "x NOT IN (...)", and only when the
+				 * array is a non-empty constant we can expand in place.
+				 */
+				if (!is_builtin(oe->opno))
+					return false;
+				oprname = get_opname(oe->opno);
+				if (oprname == NULL)
+					return false;
+				if (oe->useOr ? strcmp(oprname, "=") != 0
+					: strcmp(oprname, "<>") != 0)
+					return false;
+
+				if (!IsA(arrayarg, Const))
+					return false;
+				c = (Const *) arrayarg;
+				if (c->constisnull)
+					return false;
+				array = DatumGetArrayTypeP(c->constvalue);
+				if (ArrayGetNItems(ARR_NDIM(array), ARR_DIMS(array)) == 0)
+					return false;
+				elemtype = get_element_type(c->consttype);
+				if (!is_shippable_type(elemtype))
+					return false;
+
+				/* every element has to be a MonetDB literal, like a Const */
+				get_typlenbyvalalign(elemtype, &elmlen, &elmbyval, &elmalign);
+				deconstruct_array(array, elemtype, elmlen, elmbyval, elmalign,
+								  &elems, &nulls, &nelems);
+				for (i = 0; i < nelems; i++)
+				{
+					if (!nulls[i] && !is_shippable_value(elems[i], elemtype))
+						return false;
+				}
+
+				if (!foreign_expr_walker((Node *) linitial(oe->args), glob_cxt))
+					return false;
+			}
+			break;
+		case T_BoolExpr:
+			{
+				BoolExpr   *b = (BoolExpr *) node;
+
+				if (!foreign_expr_walker((Node *) b->args, glob_cxt))
+					return false;
+			}
+			break;
+		case T_NullTest:
+			{
+				NullTest   *nt = (NullTest *) node;
+
+				if (nt->argisrow)
+					return false;
+
+				if (!foreign_expr_walker((Node *) nt->arg, glob_cxt))
+					return false;
+			}
+			break;
+		case T_RelabelType:
+			{
+				RelabelType *r = (RelabelType *) node;
+
+				if (!is_shippable_type(r->resulttype))
+					return false;
+
+				if (!foreign_expr_walker((Node *) r->arg, glob_cxt))
+					return false;
+			}
+			break;
+		case T_Aggref:
+			{
+				Aggref	   *agg = (Aggref *) node;
+				ListCell   *lc;
+
+				/* Aggregates only make sense when grouping */
+				if (!IS_UPPER_REL(glob_cxt->foreignrel))
+					return false;
+
+				/*
+				 * Partial aggregation, ordered-set aggregates and ORDER BY
+				 * inside the call are not supported.
+				 */
+				if (agg->aggsplit != AGGSPLIT_SIMPLE ||
+					agg->aggkind != AGGKIND_NORMAL ||
+					agg->aggorder != NIL ||
+					agg->aggvariadic)
+					return false;
+
+				if (!is_shippable_aggregate(agg))
+					return false;
+
+				if (!is_shippable_type(agg->aggtype))
+					return false;
+
+				foreach(lc, agg->args)
+				{
+					TargetEntry *tle = lfirst_node(TargetEntry, lc);
+
+					if (!foreign_expr_walker((Node *) tle->expr, glob_cxt))
+						return false;
+				}
+
+				if (!foreign_expr_walker((Node *) agg->aggfilter, glob_cxt))
+					return false;
+			}
+			break;
+		case T_List:
+			{
+				List	   *l = (List *) node;
+				ListCell   *lc;
+
+				foreach(lc, l)
+				{
+					if (!foreign_expr_walker((Node *) lfirst(lc), glob_cxt))
+						return false;
+				}
+			}
+			break;
+		default:
+
+			/*
+			 * If it's anything else, assume it's unsafe.  This list can be
+			 * expanded later, but don't forget to add deparse support below.
+			 */
+			return false;
+	}
+
+	return true;
+}
+
+/*
+ * Return true if given object is one of PostgreSQL's built-in objects.
+ *
+ * We use FirstGenbkiObjectId as the cutoff, so that we only consider
+ * objects with hand-assigned OIDs to be "built in", not for instance any
+ * function or type defined in the information_schema.
+ */
+static bool
+is_builtin(Oid objectid)
+{
+	return (objectid < FirstGenbkiObjectId);
+}
+
+/*
+ * Return true if values of given type mean the same thing on MonetDB, and
+ * we know how to write them as MonetDB literals.
+ */
+static bool
+is_shippable_type(Oid type)
+{
+	switch (type)
+	{
+		case BOOLOID:
+		case INT2OID:
+		case INT4OID:
+		case INT8OID:
+		case FLOAT4OID:
+		case FLOAT8OID:
+		case NUMERICOID:
+		case TEXTOID:
+		case VARCHAROID:
+		case BPCHAROID:
+		case DATEOID:
+		case TIMEOID:
+		case TIMESTAMPOID:
+			return true;
+		default:
+			return false;
+	}
+}
+
+/*
+ * Return the MonetDB type a parameter of given type is cast to, or NULL if
+ * not every value of the type can be sent to MonetDB as a parameter; see
+ * monetdbBindParams.
+ */
+static const char *
+param_remote_type(Oid type)
+{
+	switch (type)
+	{
+		case BOOLOID:
+			return "BOOLEAN";
+		case INT2OID:
+			return "SMALLINT";
+		case INT4OID:
+			return "INT";
+		case INT8OID:
+			return "BIGINT";
+		case TEXTOID:
+		case VARCHAROID:
+		case BPCHAROID:
+			return "CLOB";
+		default:
+			return NULL;
+	}
+}
+
+/*
+ * Return true if the constant can be written as a MonetDB literal that
+ * denotes the same value.  NaN, infinities and BC dates have no MonetDB
+ * counterpart.
+ */
+static bool
+is_shippable_const(Const *node)
+{
+	if (!is_shippable_type(node->consttype))
+		return false;
+
+	if (node->constisnull)
+		return true;
+
+	return is_shippable_value(node->constvalue, node->consttype);
+}
+
+/*
+ * Return true if the non-null value of a shippable type has a MonetDB
+ * counterpart.
+ */
+static bool
+is_shippable_value(Datum value, Oid type)
+{
+	switch (type)
+	{
+		case FLOAT4OID:
+			{
+				float4		val = DatumGetFloat4(value);
+
+				return !isnan(val) && !isinf(val);
+			}
+		case FLOAT8OID:
+			{
+				float8		val = DatumGetFloat8(value);
+
+				return !isnan(val) && !isinf(val);
+			}
+		case NUMERICOID:
+			return !numeric_is_nan(DatumGetNumeric(value)) &&
+				!numeric_is_inf(DatumGetNumeric(value));
+		case DATEOID:
+			{
+				DateADT		val = DatumGetDateADT(value);
+
+				return !DATE_NOT_FINITE(val) &&
+					val >= date2j(1, 1, 1) - POSTGRES_EPOCH_JDATE;
+			}
+		case TIMESTAMPOID:
+			{
+				Timestamp	val = DatumGetTimestamp(value);
+
+				return !TIMESTAMP_NOT_FINITE(val) &&
+					val >= (Timestamp) (date2j(1, 1, 1) - POSTGRES_EPOCH_JDATE) * USECS_PER_DAY;
+			}
+		default:
+			return true;
+	}
+}
+
+/*
+ * Return true if the operator has a translation for MonetDB, or is a
+ * built-in one that MonetDB implements with the same semantics.
+ */
+static bool
+is_shippable_operator(OpExpr *node, Oid serverid)
+{
+	char	   *oprname;
+	int			i;
+
+	if (monetdbRemoteOperator(serverid, node->opno) != NULL)
+		return true;
+
+	if (!is_builtin(node->opno))
+		return false;
+
+	oprname = get_opname(node->opno);
+	if (oprname == NULL)
+		return false;
+
+	for (i = 0; shippable_operators[i] != NULL; i++)
+	{
+		if (strcmp(oprname, shippable_operators[i]) == 0)
+			break;
+	}
+	if (shippable_operators[i] == NULL)
+		return false;
+
+	/*
+	 * MonetDB compares strings byte-wise, so ordering operators only agree
+	 * with ours under the C collation.  Equality and LIKE are unaffected.
+	 */
+	if (is_ordering_operator(oprname) &&
+		OidIsValid(node->inputcollid) &&
+		!lc_collate_is_c(node->inputcollid))
+		return false;
+
+	/*
+	 * MonetDB has no date - date returning days, nor date + integer, and
+	 * its date and time arithmetic works on intervals of its own; only
+	 * arithmetic on numbers means the same there.
+	 */
+	if (is_arithmetic_operator(oprname))
+	{
+		Oid			lefttype;
+		Oid			righttype;
+
+		op_input_types(node->opno, &lefttype, &righttype);
+		if ((OidIsValid(lefttype) && !is_numeric_type(lefttype)) ||
+			!is_numeric_type(righttype))
+			return false;
+	}
+
+	return true;
+}
+
+static bool
+is_ordering_operator(const char *oprname)
+{
+	return (strcmp(oprname, "<") == 0 ||
+			strcmp(oprname, "<=") == 0 ||
+			strcmp(oprname, ">") == 0 ||
+			strcmp(oprname, ">=") == 0);
+}
+
+static bool
+is_arithmetic_operator(const char *oprname)
+{
+	return (strcmp(oprname, "+") == 0 ||
+			strcmp(oprname, "-") == 0 ||
+			strcmp(oprname, "*") == 0);
+}
+
+static bool
+is_numeric_type(Oid type)
+{
+	switch (type)
+	{
+		case INT2OID:
+		case INT4OID:
+		case INT8OID:
+		case FLOAT4OID:
+		case FLOAT8OID:
+		case NUMERICOID:
+			return true;
+		default:
+			return false;
+	}
+}
+
+/*
+ * Return true if MonetDB computes the aggregate exactly as we do.
+ *
+ * count, min and max always agree (min and max on strings only under the C
+ * collation, see is_shippable_operator).  sum is only shipped for smallint,
+ * integer and float arguments: sum of a bigint or a numeric is an
+ * unbounded numeric for us, but MonetDB's decimals top out at 18 digits
+ * without hugeint, so it could overflow there.  MonetDB computes
+ * avg in double precision, so it only matches ours for float arguments.
+ */
+static bool
+is_shippable_aggregate(Aggref *agg)
+{
+	char	   *aggname;
+	Oid			argtype = InvalidOid;
+
+	if (!is_builtin(agg->aggfnoid))
+		return false;
+
+	aggname = get_func_name(agg->aggfnoid);
+	if (aggname == NULL)
+		return false;
+
+	if (list_length(agg->args) > 1)
+		return false;
+	if (agg->args != NIL)
+		argtype = exprType((Node *) linitial_node(TargetEntry, agg->args)->expr);
+
+	if (strcmp(aggname, "count") == 0)
+		return true;
+	if (strcmp(aggname, "sum") == 0)
+		return argtype == INT2OID || argtype == INT4OID ||
+			argtype == FLOAT4OID || argtype == FLOAT8OID;
+	if (strcmp(aggname, "avg") == 0)
+		return argtype == FLOAT4OID || argtype == FLOAT8OID;
+	if (strcmp(aggname, "min") == 0 || strcmp(aggname, "max") == 0)
+		return !OidIsValid(agg->inputcollid) ||
+			lc_collate_is_c(agg->inputcollid);
+
+	return false;
+}
+
+/*
+ * Return the unit of a call of date_trunc(text, timestamp) as MonetDB
+ * spells it, or NULL if it isn't a constant MonetDB knows.  We accept any
+ * case, abbreviations and plurals; MonetDB only its own lower-case names.
+ */
+static const char *
+date_trunc_unit(FuncExpr *node)
+{
+	static const char *const units[] = {
+		"millennium", "century", "decade", "year", "quarter", "month",
+		"week", "day", "hour", "minute", "second", "milliseconds",
+		"microseconds", NULL
+	};
+	Const	   *c = (Const *) linitial(node->args);
+	char	   *unit;
+	int			i;
+
+	if (!IsA(c, Const) || c->constisnull)
+		return NULL;
+
+	unit = TextDatumGetCString(c->constvalue);
+	unit = downcase_truncate_identifier(unit, strlen(unit), false);
+	for (i = 0; units[i] != NULL; i++)
+	{
+		if (strcmp(unit, units[i]) == 0)
+			return units[i];
+	}
+
+	return NULL;
+}
+
+/*
+ * Construct a SELECT statement for the foreign relation rel and append it
+ * to buf.  *retrieved_attrs receives the attribute numbers of the columns
+ * the statement returns, in order.
+ *
+ * For a base relation, the columns in attrs_used are retrieved from the
+ * foreign table, restricted by remote_conds, a list of RestrictInfos that
+ * passed monetdbClassifyConditions().  With the "query" option the
+ * pre-defined query is sent as-is; its columns are matched by position, so
+ * nothing can be pushed into it and all columns come back.
+ *
+ * For a join or upper (grouped) relation, tlist gives the expressions to
+ * compute (see monetdbBuildTlistToDeparse).  A join's remote_conds go into
+ * the WHERE clause.  For a grouped relation the relation it is computed
+ * from supplies the FROM and WHERE clauses, and remote_conds become the
+ * HAVING clause.  An ordered or final relation is the query of the
+ * relation below it with ORDER BY and LIMIT added; a base relation below
+ * one returns tlist instead of attrs_used.
+ *
+ * pathkeys, if not NIL, give the ORDER BY clause.  has_limit adds the
+ * query's LIMIT and OFFSET, which must be constants.
+ *
+ * The columns of other relations that the join clauses of a parameterized
+ * scan refer to are written as "CAST(? AS type)" placeholders, and
+ * returned in order as *params_list, which may be NULL if there can be
+ * none.
+ */
+void
+monetdbDeparseSelectSql(StringInfo buf,
+						PlannerInfo *root,
+						RelOptInfo *foreignrel,
+						List *tlist,
+						List *remote_conds,
+						List *pathkeys,
+						bool has_limit,
+						List **retrieved_attrs,
+						List **params_list)
+{
+	MonetdbFdwPlanState *fdw_private = (MonetdbFdwPlanState *) foreignrel->fdw_private;
+	RelOptInfo *scanrel;
+	deparse_expr_cxt context;
+
+	if (IS_UPPER_REL(foreignrel) && fdw_private->stage != UPPERREL_GROUP_AGG)
+	{
+		foreignrel = fdw_private->outerrel;
+		fdw_private = (MonetdbFdwPlanState *) foreignrel->fdw_private;
+		remote_conds = fdw_private->remote_conds;
+	}
+
+	/* the relation the FROM clause is made of */
+	scanrel = IS_UPPER_REL(foreignrel) ? fdw_private->outerrel : foreignrel;
+
+	context.root = root;
+	context.foreignrel = foreignrel;
+	context.scanrel = scanrel;
+	context.buf = buf;
+	context.params_list = params_list;
+
+	if (IS_JOIN_REL(foreignrel) || IS_UPPER_REL(foreignrel))
+	{
+		MonetdbFdwPlanState *ofpinfo = (MonetdbFdwPlanState *) scanrel->fdw_private;
+
+		appendStringInfoString(buf, "SELECT ");
+		deparseExplicitTargetList(tlist, retrieved_attrs, &context);
+		appendStringInfoString(buf, " FROM ");
+		deparseFromExprForRel(buf, root, scanrel, IS_JOIN_REL(scanrel));
+
+		if (IS_UPPER_REL(foreignrel))
+		{
+			appendConditions(ofpinfo->remote_conds, " WHERE ", &context);
+			appendGroupByClause(tlist, &context);
+			appendConditions(remote_conds, " HAVING ", &context);
+		}
+		else
+			appendConditions(remote_conds, " WHERE ", &context);
+	}
+	else
+	{
+		RangeTblEntry *rte = planner_rt_fetch(foreignrel->relid, root);
+		Relation	rel;
+
+		/*
+		 * Core code already has some lock on each rel being planned, so we
+		 * can use NoLock here.
+		 */
+		rel = table_open(rte->relid, NoLock);
+
+		if (fdw_private->query)
+		{
+			TupleDesc	tupdesc = RelationGetDescr(rel);
+			int			i;
+
+			Assert(remote_conds == NIL && pathkeys == NIL && !has_limit);
+			appendStringInfoString(buf, fdw_private->query);
+
+			*retrieved_attrs = NIL;
+			for (i = 1; i <= tupdesc->natts; i++)
+			{
+				if (!TupleDescAttr(tupdesc, i - 1)->attisdropped)
+					*retrieved_attrs = lappend_int(*retrieved_attrs, i);
+			}
+
+			table_close(rel, NoLock);
+			return;
+		}
+
+		appendStringInfoString(buf, "SELECT ");
+		if (tlist != NIL)
+			deparseExplicitTargetList(tlist, retrieved_attrs, &context);
+		else
+			deparseTargetList(buf, root, foreignrel->relid, rel,
+							  fdw_private->attrs_used, retrieved_attrs);
+		appendStringInfo(buf, " FROM %s", fdw_private->table);
+
+		table_close(rel, NoLock);
+
+		appendConditions(remote_conds, " WHERE ", &context);
+	}
+
+	if (pathkeys != NIL)
+		appendOrderByClause(pathkeys, &context);
+	if (has_limit)
+		appendLimitClause(&context);
+}
+
+/*
+ * Return true if MonetDB can sort the rows of rel by pathkey, the same
+ * way we would.
+ *
+ * MonetDB compares strings byte-wise, so string keys are only accepted
+ * under the C collation, as for the ordering operators.
+ */
+bool
+monetdbIsForeignPathKey(PlannerInfo *root, RelOptInfo *rel, PathKey *pathkey)
+{
+	EquivalenceClass *ec = pathkey->pk_eclass;
+
+	if (ec->ec_has_volatile)
+		return false;
+
+	if (!is_builtin(pathkey->pk_opfamily))
+		return false;
+
+	if (OidIsValid(ec->ec_collation) && !lc_collate_is_c(ec->ec_collation))
+		return false;
+
+	return find_pathkey_expr(root, ec, rel) != NULL;
+}
+
+/*
+ * Find an expression of the equivalence class that rel can compute and
+ * MonetDB can evaluate, or return NULL if there is none.
+ *
+ * For a grouped relation, that is an expression of its target list; for a
+ * scan or join, one that uses only columns of the relations scanned.
+ */
+static Expr *
+find_pathkey_expr(PlannerInfo *root, EquivalenceClass *ec, RelOptInfo *rel)
+{
+	ListCell   *lc;
+
+	foreach(lc, ec->ec_members)
+	{
+		EquivalenceMember *em = (EquivalenceMember *) lfirst(lc);
+
+		if (em->em_is_const)
+			continue;
+
+		if (IS_UPPER_REL(rel))
+		{
+			if (!list_member(rel->reltarget->exprs, em->em_expr))
+				continue;
+		}
+		else if (bms_is_empty(em->em_relids) ||
+				 !bms_is_subset(em->em_relids, rel->relids))
+			continue;
+
+		if (monetdbIsForeignExpr(root, rel, em->em_expr))
+			return em->em_expr;
+	}
+
+	return NULL;
+}
+
+/*
+ * Construct a statement that counts the rows of the foreign relation which
+ * satisfy remote_conds, for use_remote_estimate.
+ */
+void
+monetdbDeparseCountSql(StringInfo buf,
+					   PlannerInfo *root,
+					   RelOptInfo *foreignrel,
+					   List *remote_conds)
+{
+	MonetdbFdwPlanState *fdw_private = (MonetdbFdwPlanState *) foreignrel->fdw_private;
+	deparse_expr_cxt context;
+
+	if (fdw_private->query)
+	{
+		Assert(remote_conds == NIL);
+		appendStringInfoString(buf, "SELECT count(*) FROM (");
+		appendQueryText(buf, fdw_private->query);
+		appendStringInfoString(buf, ") AS q");
+		return;
+	}
+
+	if (IS_UPPER_REL(foreignrel))
+	{
+		StringInfoData sql;
+		List	   *retrieved_attrs;
+
+		/* count the groups the grouped query returns */
+		initStringInfo(&sql);
+		monetdbDeparseSelectSql(&sql, root, foreignrel,
+								fdw_private->grouped_tlist, remote_conds,
+								NIL, false, &retrieved_attrs, NULL);
+		appendStringInfo(buf, "SELECT count(*) FROM (%s) AS q", sql.data);
+		return;
+	}
+
+	context.root = root;
+	context.foreignrel = foreignrel;
+	context.scanrel = foreignrel;
+	context.buf = buf;
+	context.params_list = NULL;
+
+	appendStringInfoString(buf, "SELECT count(*) FROM ");
+	deparseFromExprForRel(buf, root, foreignrel, IS_JOIN_REL(foreignrel));
+	appendConditions(remote_conds, " WHERE ", &context);
+}
+
+/*
+ * Construct the statements ANALYZE uses on a foreign table: one counting
+ * its rows (if count_buf isn't NULL), and one fetching all of its columns,
+ * to which the caller adds the sampling clause.  The attribute numbers of
+ * the columns fetched are returned as *retrieved_attrs.
+ */
+void
+monetdbDeparseAnalyzeSql(StringInfo count_buf, StringInfo buf, Relation rel,
+						 MonetdbFdwPlanState *fdw_private,
+						 List **retrieved_attrs)
+{
+	TupleDesc	tupdesc = RelationGetDescr(rel);
+	StringInfoData from;
+	bool		first = true;
+	int			i;
+
+	initStringInfo(&from);
+	if (fdw_private->query)
+	{
+		appendStringInfoChar(&from, '(');
+		appendQueryText(&from, fdw_private->query);
+		appendStringInfoString(&from, ") AS q");
+	}
+	else
+		appendStringInfoString(&from, fdw_private->table);
+
+	if (count_buf)
+		appendStringInfo(count_buf, "SELECT count(*) FROM %s", from.data);
+
+	*retrieved_attrs = NIL;
+
+	/* the columns of a query are taken by position, as for a scan */
+	if (fdw_private->query)
+	{
+		appendStringInfo(buf, "SELECT * FROM %s", from.data);
+		for (i = 1; i <= tupdesc->natts; i++)
+		{
+			if (!TupleDescAttr(tupdesc, i - 1)->attisdropped)
+				*retrieved_attrs = lappend_int(*retrieved_attrs, i);
+		}
+		return;
+	}
+
+	appendStringInfoString(buf, "SELECT ");
+	for (i = 1; i <= tupdesc->natts; i++)
+	{
+		if (TupleDescAttr(tupdesc, i - 1)->attisdropped)
+			continue;
+
+		if (!first)
+			appendStringInfoString(buf, ", ");
+		first = false;
+
+		deparseColumnName(buf, RelationGetRelid(rel), i);
+		*retrieved_attrs = lappend_int(*retrieved_attrs, i);
+	}
+
+	/* as in deparseTargetList, MonetDB won't take an empty target list */
+	if (first)
+		appendStringInfoString(buf, "1");
+
+	appendStringInfo(buf, " FROM %s", from.data);
+}
+
+/*
+ * Append the column list of target_attrs, in parentheses.
+ */
+static void
+deparseColumnList(StringInfo buf, Relation rel, List *target_attrs)
+{
+	ListCell   *lc;
+	bool		first = true;
+
+	appendStringInfoChar(buf, '(');
+	foreach(lc, target_attrs)
+	{
+		if (!first)
+			appendStringInfoString(buf, ", ");
+		first = false;
+
+		deparseColumnName(buf, RelationGetRelid(rel), lfirst_int(lc));
+	}
+	appendStringInfoChar(buf, ')');
+}
+
+/*
+ * Construct the start of an INSERT of the columns target_attrs into a
+ * foreign table, up to the VALUES keyword; the caller appends the rows.
+ */
+void
+monetdbDeparseInsertSql(StringInfo buf, Relation rel,
+						MonetdbFdwPlanState *fdw_private, List *target_attrs)
+{
+	appendStringInfo(buf, "INSERT INTO %s ", fdw_private->table);
+	deparseColumnList(buf, rel, target_attrs);
+	appendStringInfoString(buf, " VALUES");
+}
+
+/*
+ * Construct the rest of a "COPY n RECORDS" statement loading the columns
+ * target_attrs of a foreign table from the data that follows it.  Fields
+ * are separated by commas and always quoted (see monetdbDeparseCopyField),
+ * so that an empty unquoted field can stand for NULL.
+ */
+void
+monetdbDeparseCopySql(StringInfo buf, Relation rel,
+					  MonetdbFdwPlanState *fdw_private, List *target_attrs)
+{
+	appendStringInfo(buf, "INTO %s ", fdw_private->table);
+	deparseColumnList(buf, rel, target_attrs);
+	appendStringInfoString(buf,
+						   " FROM STDIN USING DELIMITERS ',', E'\\n', '\"' NULL AS ''");
+}
+
+/*
+ * Construct a statement having MonetDB send the result of sql, whose
+ * columns are stored into the attributes retrieved_attrs of rel, in its
+ * binary format: column i goes to a "file" named ci, which libmapi hands
+ * us (ON CLIENT).  Each column is cast to the type whose layout binary.c
+ * reads for the attribute.
+ *
+ * Return false if an attribute has a type that isn't read in binary.
+ */
+bool
+monetdbDeparseBinaryCopySql(StringInfo buf, Relation rel, const char *sql,
+							List *retrieved_attrs)
+{
+	TupleDesc	tupdesc = RelationGetDescr(rel);
+	ListCell   *lc;
+	int			i;
+
+	if (retrieved_attrs == NIL)
+		return false;
+
+	appendStringInfoString(buf, "COPY SELECT ");
+	i = 0;
+	foreach(lc, retrieved_attrs)
+	{
+		Form_pg_attribute attr = TupleDescAttr(tupdesc, lfirst_int(lc) - 1);
+		const char *type = monetdbBinaryRemoteType(attr->atttypid);
+
+		if (type == NULL)
+			return false;
+		if (i > 0)
+			appendStringInfoString(buf, ", ");
+		appendStringInfo(buf, "CAST(c%d AS %s)", i, type);
+		i++;
+	}
+
+	appendStringInfoString(buf, " FROM (");
+	appendQueryText(buf, sql);
+	appendStringInfoString(buf, ") AS t (");
+	for (i = 0; i < list_length(retrieved_attrs); i++)
+		appendStringInfo(buf, "%sc%d", i > 0 ? ", " : "", i);
+
+#ifdef WORDS_BIGENDIAN
+	appendStringInfoString(buf, ") INTO BIG ENDIAN BINARY ");
+#else
+	appendStringInfoString(buf, ") INTO LITTLE ENDIAN BINARY ");
+#endif
+	for (i = 0; i < list_length(retrieved_attrs); i++)
+		appendStringInfo(buf, "%s'c%d'", i > 0 ? ", " : "", i);
+	appendStringInfoString(buf, " ON CLIENT");
+
+	return true;
+}
+
+/*
+ * Construct an UPDATE or DELETE of the rows of a foreign table satisfying
+ * remote_conds, for a modification MonetDB does by itself.  An UPDATE sets
+ * the columns target_attrs to the expressions target_exprs.
+ */
+void
+monetdbDeparseDirectModifySql(StringInfo buf, PlannerInfo *root,
+							  RelOptInfo *foreignrel, CmdType operation,
+							  List *target_attrs, List *target_exprs,
+							  List *remote_conds)
+{
+	MonetdbFdwPlanState *fpinfo = (MonetdbFdwPlanState *) foreignrel->fdw_private;
+	deparse_expr_cxt context;
+
+	context.root = root;
+	context.foreignrel = foreignrel;
+	context.scanrel = foreignrel;
+	context.buf = buf;
+	context.params_list = NULL;
+
+	if (operation == CMD_UPDATE)
+	{
+		ListCell   *lc,
+				   *lc2;
+		bool		first = true;
+
+		appendStringInfo(buf, "UPDATE %s SET ", fpinfo->table);
+		forboth(lc, target_attrs, lc2, target_exprs)
+		{
+			if (!first)
+				appendStringInfoString(buf, ", ");
+			first = false;
+
+			deparseColumnRef(buf, foreignrel->relid, lfirst_int(lc), root, false);
+			appendStringInfoString(buf, " = ");
+			deparseExpr((Expr *) lfirst(lc2), &context);
+		}
+	}
+	else
+	{
+		Assert(operation == CMD_DELETE);
+		appendStringInfo(buf, "DELETE FROM %s", fpinfo->table);
+	}
+
+	appendConditions(remote_conds, " WHERE ", &context);
+}
+
+/*
+ * Construct the SELECT that fetches the columns attrs_used of the rows a
+ * direct UPDATE or DELETE modifies, for its RETURNING list; MonetDB has no
+ * RETURNING of its own.  For an UPDATE, the columns it sets are computed
+ * from target_exprs, so that the rows come back as the UPDATE leaves them.
+ * The attribute numbers of the columns fetched are returned as
+ * *retrieved_attrs.
+ */
+void
+monetdbDeparseReturningSql(StringInfo buf, PlannerInfo *root,
+						   RelOptInfo *foreignrel, Bitmapset *attrs_used,
+						   List *target_attrs, List *target_exprs,
+						   List *remote_conds, List **retrieved_attrs)
+{
+	MonetdbFdwPlanState *fpinfo = (MonetdbFdwPlanState *) foreignrel->fdw_private;
+	RangeTblEntry *rte = planner_rt_fetch(foreignrel->relid, root);
+	deparse_expr_cxt context;
+	Relation	rel;
+	TupleDesc	tupdesc;
+	bool		have_wholerow;
+	bool		first = true;
+	int			i;
+
+	context.root = root;
+	context.foreignrel = foreignrel;
+	context.scanrel = foreignrel;
+	context.buf = buf;
+	context.params_list = NULL;
+
+	/*
+	 * Core code already has some lock on each rel being planned, so we can
+	 * use NoLock here.
+	 */
+	rel = table_open(rte->relid, NoLock);
+	tupdesc = RelationGetDescr(rel);
+
+	have_wholerow = bms_is_member(0 - FirstLowInvalidHeapAttributeNumber,
+								  attrs_used);
+
+	*retrieved_attrs = NIL;
+	appendStringInfoString(buf, "SELECT ");
+	for (i = 1; i <= tupdesc->natts; i++)
+	{
+		Expr	   *target_expr = NULL;
+		ListCell   *lc,
+				   *lc2;
+
+		if (TupleDescAttr(tupdesc, i - 1)->attisdropped)
+			continue;
+		if (!have_wholerow &&
+			!bms_is_member(i - FirstLowInvalidHeapAttributeNumber, attrs_used))
+			continue;
+
+		if (!first)
+			appendStringInfoString(buf, ", ");
+		first = false;
+
+		forboth(lc, target_attrs, lc2, target_exprs)
+		{
+			if (lfirst_int(lc) == i)
+				target_expr = (Expr *) lfirst(lc2);
+		}
+
+		if (target_expr)
+			deparseExpr(target_expr, &context);
+		else
+			deparseColumnRef(buf, foreignrel->relid, i, root, false);
+
+		*retrieved_attrs = lappend_int(*retrieved_attrs, i);
+	}
+
+	table_close(rel, NoLock);
+
+	/* as in deparseTargetList, MonetDB won't take an empty target list */
+	if (first)
+		appendStringInfoString(buf, "1");
+
+	appendStringInfo(buf, " FROM %s", fpinfo->table);
+	appendConditions(remote_conds, " WHERE ", &context);
+}
+
+/*
+ * Append the name of the column a parallel scan of a foreign table splits
+ * the table by.
+ */
+void
+monetdbDeparsePartitionColumn(StringInfo buf, PlannerInfo *root,
+							  RelOptInfo *baserel, AttrNumber attnum)
+{
+	deparseColumnRef(buf, baserel->relid, attnum, root, false);
+}
+
+/*
+ * Construct a statement that finds the smallest and largest value of the
+ * partition column among the rows satisfying remote_conds, for a parallel
+ * scan splitting the table into ranges.
+ */
+void
+monetdbDeparseBoundsSql(StringInfo buf, PlannerInfo *root,
+						RelOptInfo *baserel, AttrNumber attnum,
+						List *remote_conds)
+{
+	deparse_expr_cxt context;
+
+	context.root = root;
+	context.foreignrel = baserel;
+	context.scanrel = baserel;
+	context.buf = buf;
+	context.params_list = NULL;
+
+	appendStringInfoString(buf, "SELECT min(");
+	deparseColumnRef(buf, baserel->relid, attnum, root, false);
+	appendStringInfoString(buf, "), max(");
+	deparseColumnRef(buf, baserel->relid, attnum, root, false);
+	appendStringInfoString(buf, ") FROM ");
+	deparseFromExprForRel(buf, root, baserel, false);
+	appendConditions(remote_conds, " WHERE ", &context);
+}
+
+/*
+ * Build the target list a join or upper relation has MonetDB compute: the
+ * grouped target list for a grouped relation; for a join, the columns
+ * needed above the join and by the conditions we check locally.  An
+ * ordered or final relation returns what the relation below it does.
+ */
+List *
+monetdbBuildTlistToDeparse(RelOptInfo *foreignrel)
+{
+	MonetdbFdwPlanState *fpinfo = (MonetdbFdwPlanState *) foreignrel->fdw_private;
+	List	   *tlist = NIL;
+	ListCell   *lc;
+
+	if (IS_UPPER_REL(foreignrel))
+	{
+		if (fpinfo->stage != UPPERREL_GROUP_AGG)
+			return monetdbBuildTlistToDeparse(fpinfo->outerrel);
+		return fpinfo->grouped_tlist;
+	}
+
+	tlist = add_to_flat_tlist(tlist,
+							  pull_var_clause((Node *) foreignrel->reltarget->exprs,
+											  PVC_RECURSE_PLACEHOLDERS));
+	foreach(lc, fpinfo->local_conds)
+	{
+		RestrictInfo *rinfo = lfirst_node(RestrictInfo, lc);
+
+		tlist = add_to_flat_tlist(tlist,
+								  pull_var_clause((Node *) rinfo->clause,
+												  PVC_RECURSE_PLACEHOLDERS));
+	}
+
+	return tlist;
+}
+
+/*
+ * Append the FROM clause item for foreignrel to buf: the table name, with
+ * an "r<relid>" alias if use_alias, or for a join, the parenthesized join
+ * of its two sides.
+ */
+static void
+deparseFromExprForRel(StringInfo buf, PlannerInfo *root,
+					  RelOptInfo *foreignrel, bool use_alias)
+{
+	MonetdbFdwPlanState *fpinfo = (MonetdbFdwPlanState *) foreignrel->fdw_private;
+
+	if (IS_JOIN_REL(foreignrel))
+	{
+		deparse_expr_cxt context;
+
+		context.root = root;
+		context.foreignrel = foreignrel;
+		context.scanrel = foreignrel;
+		context.buf = buf;
+		context.params_list = NULL;
+
+		appendStringInfoChar(buf, '(');
+		deparseFromExprForRel(buf, root, fpinfo->outerrel, true);
+		appendStringInfo(buf, " %s JOIN ",
+						 monetdbGetJoinTypeName(fpinfo->jointype));
+		deparseFromExprForRel(buf, root, fpinfo->innerrel, true);
+
+		if (fpinfo->joinclauses)
+			appendConditions(fpinfo->joinclauses, " ON ", &context);
+		else
+			appendStringInfoString(buf, " ON (TRUE)");
+		appendStringInfoChar(buf, ')');
+	}
+	else
+	{
+		appendStringInfoString(buf, fpinfo->table);
+		if (use_alias)
+			appendStringInfo(buf, " %s%d", REL_ALIAS_PREFIX, foreignrel->relid);
+	}
+}
+
+/*
+ * Return the SQL keyword for a join type we push down.
+ */
+const char *
+monetdbGetJoinTypeName(JoinType jointype)
+{
+	switch (jointype)
+	{
+		case JOIN_INNER:
+			return "INNER";
+		case JOIN_LEFT:
+			return "LEFT";
+		case JOIN_RIGHT:
+			return "RIGHT";
+		case JOIN_FULL:
+			return "FULL";
+		default:
+			elog(ERROR, "monetdb_fdw: unsupported join type %d", (int) jointype);
+			return NULL;		/* keep compiler quiet */
+	}
+}
+
+/*
+ * Append the conditions in exprs, a list of RestrictInfos, to buf as a
+ * WHERE or HAVING clause introduced by keyword.
+ */
+static void
+appendConditions(List *exprs, const char *keyword, deparse_expr_cxt *context)
+{
+	StringInfo	buf = context->buf;
+	ListCell   *lc;
+	bool		is_first = true;
+
+	foreach(lc, exprs)
+	{
+		RestrictInfo *ri = lfirst_node(RestrictInfo, lc);
+
+		appendStringInfoString(buf, is_first ? keyword : " AND ");
+		appendStringInfoChar(buf, '(');
+		deparseExpr(ri->clause, context);
+		appendStringInfoChar(buf, ')');
+
+		is_first = false;
+	}
+}
+
+/*
+ * Append the GROUP BY clause of the query being planned.  The grouping
+ * expressions are plain columns (see foreign_grouping_ok), written out in
+ * full since MonetDB doesn't take column positions there.
+ */
+static void
+appendGroupByClause(List *tlist, deparse_expr_cxt *context)
+{
+	StringInfo	buf = context->buf;
+	Query	   *query = context->root->parse;
+	ListCell   *lc;
+	bool		first = true;
+
+	if (query->groupClause == NIL)
+		return;
+
+	appendStringInfoString(buf, " GROUP BY ");
+	foreach(lc, query->groupClause)
+	{
+		SortGroupClause *grp = lfirst_node(SortGroupClause, lc);
+		TargetEntry *tle = get_sortgroupref_tle(grp->tleSortGroupRef, tlist);
+
+		if (!first)
+			appendStringInfoString(buf, ", ");
+		first = false;
+
+		deparseExpr(tle->expr, context);
+	}
+}
+
+/*
+ * Append an ORDER BY clause sorting by pathkeys.  MonetDB's default
+ * placement of NULLs differs from ours, so it is always spelled out.
+ */
+static void
+appendOrderByClause(List *pathkeys, deparse_expr_cxt *context)
+{
+	StringInfo	buf = context->buf;
+	ListCell   *lc;
+	const char *delim = " ";
+
+	appendStringInfoString(buf, " ORDER BY");
+	foreach(lc, pathkeys)
+	{
+		PathKey    *pathkey = (PathKey *) lfirst(lc);
+		Expr	   *em_expr;
+
+		em_expr = find_pathkey_expr(context->root, pathkey->pk_eclass,
+									context->foreignrel);
+		if (em_expr == NULL)
+			elog(ERROR, "monetdb_fdw: could not find pathkey item to sort");
+
+		appendStringInfoString(buf, delim);
+		deparseExpr(em_expr, context);
+		if (pathkey->pk_strategy == BTLessStrategyNumber)
+			appendStringInfoString(buf, " ASC");
+		else
+			appendStringInfoString(buf, " DESC");
+		if (pathkey->pk_nulls_first)
+			appendStringInfoString(buf, " NULLS FIRST");
+		else
+			appendStringInfoString(buf, " NULLS LAST");
+
+		delim = ", ";
+	}
+}
+
+/*
+ * Append the query's LIMIT and OFFSET.  The caller has checked that they
+ * are constants; a NULL limit means no limit.
+ */
+static void
+appendLimitClause(deparse_expr_cxt *context)
+{
+	StringInfo	buf = context->buf;
+	Query	   *query = context->root->parse;
+	Const	   *count = (Const *) query->limitCount;
+	Const	   *offset = (Const *) query->limitOffset;
+
+	if (count && !count->constisnull)
+		appendStringInfo(buf, " LIMIT " INT64_FORMAT,
+						 DatumGetInt64(count->constvalue));
+	if (offset && !offset->constisnull)
+		appendStringInfo(buf, " OFFSET " INT64_FORMAT,
+						 DatumGetInt64(offset->constvalue));
+}
+
+/*
+ * Append a user-supplied query, minus any trailing semicolon, so that it
+ * can be used as a subquery.
+ */
+static void
+appendQueryText(StringInfo buf, const char *query)
+{
+	int			len = strlen(query);
+
+	while (len > 0 && (query[len - 1] == ';' || isspace((unsigned char) query[len - 1])))
+		len--;
+
+	appendBinaryStringInfo(buf, query, len);
+}
+
+/*
+ * Emit a target list that retrieves the columns specified in attrs_used.
+ * The attribute numbers of the columns emitted are returned as
+ * *retrieved_attrs.
+ */
+static void
+deparseTargetList(StringInfo buf,
+				  PlannerInfo *root,
+				  Index rtindex,
+				  Relation rel,
+				  Bitmapset *attrs_used,
+				  List **retrieved_attrs)
+{
+	TupleDesc	tupdesc = RelationGetDescr(rel);
+	bool		have_wholerow;
+	bool		first;
+	int			i;
+
+	*retrieved_attrs = NIL;
+
+	/* If there's a whole-row reference, we'll need all the columns. */
+	have_wholerow = bms_is_member(0 - FirstLowInvalidHeapAttributeNumber,
+								  attrs_used);
+
+	first = true;
+	for (i = 1; i <= tupdesc->natts; i++)
+	{
+		Form_pg_attribute attr = TupleDescAttr(tupdesc, i - 1);
+
+		/* Ignore dropped attributes. */
+		if (attr->attisdropped)
+			continue;
+
+		if (have_wholerow ||
+			bms_is_member(i - FirstLowInvalidHeapAttributeNumber,
+						  attrs_used))
+		{
+			if (!first)
+				appendStringInfoString(buf, ", ");
+			first = false;
+
+			deparseColumnRef(buf, rtindex, i, root, false);
+
+			*retrieved_attrs = lappend_int(*retrieved_attrs, i);
+		}
+	}
+
+	/*
+	 * MonetDB won't accept an empty target list; fetch a constant when no
+	 * column is needed (e.g. for count(*)).
+	 */
+	if (first)
+		appendStringInfoString(buf, "1");
+}
+
+/*
+ * Emit the expressions of an explicit target list, as used for joins and
+ * upper relations.  The result columns are numbered in tlist order.
+ */
+static void
+deparseExplicitTargetList(List *tlist,
+						  List **retrieved_attrs,
+						  deparse_expr_cxt *context)
+{
+	StringInfo	buf = context->buf;
+	ListCell   *lc;
+	int			i = 0;
+
+	*retrieved_attrs = NIL;
+
+	foreach(lc, tlist)
+	{
+		TargetEntry *tle = lfirst_node(TargetEntry, lc);
+
+		if (i > 0)
+			appendStringInfoString(buf, ", ");
+		deparseExpr(tle->expr, context);
+
+		*retrieved_attrs = lappend_int(*retrieved_attrs, i + 1);
+		i++;
+	}
+
+	if (i == 0)
+		appendStringInfoString(buf, "1");
+}
+
+/*
+ * Deparse given expression into context->buf.
+ *
+ * This function must support all the same node types that
+ * foreign_expr_walker accepts.
+ */
+static void
+deparseExpr(Expr *node, deparse_expr_cxt *context)
+{
+	if (node == NULL)
+		return;
+
+	switch (nodeTag(node))
+	{
+		case T_Var:
+			deparseVar((Var *) node, context);
+			break;
+		case T_Const:
+			deparseConst((Const *) node, context);
+			break;
+		case T_FuncExpr:
+			deparseFuncExpr((FuncExpr *) node, context);
+			break;
+		case T_OpExpr:
+			deparseOpExpr((OpExpr *) node, context);
+			break;
+		case T_ScalarArrayOpExpr:
+			deparseScalarArrayOpExpr((ScalarArrayOpExpr *) node, context);
+			break;
+		case T_BoolExpr:
+			deparseBoolExpr((BoolExpr *) node, context);
+			break;
+		case T_NullTest:
+			deparseNullTest((NullTest *) node, context);
+			break;
+		case T_RelabelType:
+			deparseRelabelType((RelabelType *) node, context);
+			break;
+		case T_Aggref:
+			deparseAggref((Aggref *) node, context);
+			break;
+		default:
+			elog(ERROR, "monetdb_fdw: unsupported expression type for deparse: %d",
+				 (int) nodeTag(node));
+			break;
+	}
+}
+
+static void
+deparseVar(Var *node, deparse_expr_cxt *context)
+{
+	/* in a join, columns are qualified by the alias of their relation */
+	bool		qualify_col = IS_JOIN_REL(context->scanrel);
+
+	/* a column of another relation is a parameter of the scan */
+	if (!bms_is_member(node->varno, context->scanrel->relids))
+	{
+		if (context->params_list == NULL)
+			elog(ERROR, "monetdb_fdw: unexpected outer reference in remote query");
+
+		/*
+		 * MonetDB's PREPARE can't tell the type of a bare placeholder in
+		 * many places, such as "? IS NULL" or a function argument.
+		 */
+		*context->params_list = lappend(*context->params_list, node);
+		appendStringInfo(context->buf, "CAST(? AS %s)",
+						 param_remote_type(node->vartype));
+		return;
+	}
+
+	deparseColumnRef(context->buf, node->varno, node->varattno, context->root,
+					 qualify_col);
+}
+
+static void
+deparseConst(Const *node, deparse_expr_cxt *context)
+{
+	if (node->constisnull)
+	{
+		appendStringInfoString(context->buf, "NULL");
+		return;
+	}
+
+	deparseDatum(node->constvalue, node->consttype, context);
+}
+
+/*
+ * Write a non-null value of a shippable type as a MonetDB literal.
+ */
+static void
+deparseDatum(Datum value, Oid type, deparse_expr_cxt *context)
+{
+	StringInfo	buf = context->buf;
+	char	   *extval = deparseValueText(value, type);
+
+	switch (type)
+	{
+		case BOOLOID:
+			appendStringInfoString(buf, extval);
+			break;
+		case INT2OID:
+		case INT4OID:
+		case INT8OID:
+		case NUMERICOID:
+			/*
+			 * Parenthesize negative numbers, so that "a - -1" doesn't turn
+			 * into a comment.
+			 */
+			if (extval[0] == '-')
+				appendStringInfo(buf, "(%s)", extval);
+			else
+				appendStringInfoString(buf, extval);
+			break;
+		case FLOAT4OID:
+		case FLOAT8OID:
+			/*
+			 * MonetDB reads a bare "1.5" as a decimal, so spell out the type
+			 * to keep float semantics.
+			 */
+			appendStringInfoString(buf, "CAST(");
+			monetdbDeparseStringLiteral(buf, extval);
+			appendStringInfo(buf, " AS %s)",
+							 type == FLOAT4OID ? "REAL" : "DOUBLE");
+			break;
+		case TEXTOID:
+		case VARCHAROID:
+		case BPCHAROID:
+			monetdbDeparseStringLiteral(buf, extval);
+			break;
+		case DATEOID:
+			appendStringInfo(buf, "DATE '%s'", extval);
+			break;
+		case TIMEOID:
+			appendStringInfo(buf, "TIME '%s'", extval);
+			break;
+		case TIMESTAMPOID:
+			appendStringInfo(buf, "TIMESTAMP '%s'", extval);
+			break;
+		default:
+			elog(ERROR, "monetdb_fdw: unsupported constant type %u", type);
+			break;
+	}
+}
+
+/*
+ * Return a non-null value as MonetDB reads it, without any quoting.
+ *
+ * Booleans are spelled out, character(n) values lose their padding (it is
+ * insignificant, and MonetDB doesn't pad its CHAR values), and dates and
+ * times are formatted here in ISO style rather than through the type
+ * output functions, so the result doesn't depend on DateStyle.  A
+ * timestamp with time zone is written in UTC, with an explicit offset.
+ * Intervals are refused: their text depends on IntervalStyle, and none of
+ * its formats is one MonetDB reads.  Anything else is what the type's
+ * output function prints.
+ */
+static char *
+deparseValueText(Datum value, Oid type)
+{
+	switch (type)
+	{
+		case BOOLOID:
+			return pstrdup(DatumGetBool(value) ? "true" : "false");
+		case BPCHAROID:
+			{
+				char	   *extval = TextDatumGetCString(value);
+				int			len = strlen(extval);
+
+				while (len > 0 && extval[len - 1] == ' ')
+					len--;
+				extval[len] = '\0';
+				return extval;
+			}
+		case DATEOID:
+			{
+				int			year,
+							month,
+							day;
+
+				j2date(DatumGetDateADT(value) + POSTGRES_EPOCH_JDATE,
+					   &year, &month, &day);
+				return psprintf("%04d-%02d-%02d", year, month, day);
+			}
+		case TIMEOID:
+			{
+				struct pg_tm tt,
+						   *tm = &tt;
+				fsec_t		fsec;
+				char		extval[MAXDATELEN + 1];
+
+				time2tm(DatumGetTimeADT(value), tm, &fsec);
+				EncodeTimeOnly(tm, fsec, false, 0, USE_ISO_DATES, extval);
+				return pstrdup(extval);
+			}
+		case TIMESTAMPOID:
+			{
+				struct pg_tm tt,
+						   *tm = &tt;
+				fsec_t		fsec;
+				char		extval[MAXDATELEN + 1];
+
+				if (timestamp2tm(DatumGetTimestamp(value), NULL, tm, &fsec,
+								 NULL, NULL) != 0)
+					ereport(ERROR,
+							(errcode(ERRCODE_DATETIME_VALUE_OUT_OF_RANGE),
+							 errmsg("timestamp out of range")));
+				EncodeDateTime(tm, fsec, false, 0, NULL, USE_ISO_DATES, extval);
+				return pstrdup(extval);
+			}
+		case TIMESTAMPTZOID:
+			{
+				TimestampTz val = DatumGetTimestampTz(value);
+				struct pg_tm tt,
+						   *tm = &tt;
+				fsec_t		fsec;
+				char		extval[MAXDATELEN + 1];
+
+				/* without a time zone, the fields are those of UTC */
+				if (TIMESTAMP_NOT_FINITE(val) ||
+					timestamp2tm(val, NULL, tm, &fsec, NULL, NULL) != 0)
+					ereport(ERROR,
+							(errcode(ERRCODE_FDW_INVALID_DATA_TYPE),
+							 errmsg("monetdb_fdw: timestamp with time zone value \"%s\" cannot be stored in MonetDB",
+									DatumGetCString(DirectFunctionCall1(timestamptz_out,
+																		value)))));
+				EncodeDateTime(tm, fsec, false, 0, NULL, USE_ISO_DATES, extval);
+				return psprintf("%s+00:00", extval);
+			}
+		case INTERVALOID:
+			ereport(ERROR,
+					(errcode(ERRCODE_FDW_INVALID_DATA_TYPE),
+					 errmsg("monetdb_fdw: interval values cannot be stored in MonetDB")));
+			return NULL;		/* keep compiler quiet */
+		default:
+			{
+				Oid			typoutput;
+				bool		typIsVarlena;
+
+				getTypeOutputInfo(type, &typoutput, &typIsVarlena);
+				return OidOutputFunctionCall(typoutput, value);
+			}
+	}
+}
+
+/*
+ * Complain about a value to be stored in MonetDB that it has no
+ * counterpart for.
+ */
+static void
+check_storable_value(Datum value, Oid type)
+{
+	if (is_shippable_type(type) && !is_shippable_value(value, type))
+		ereport(ERROR,
+				(errcode(ERRCODE_FDW_INVALID_DATA_TYPE),
+				 errmsg("monetdb_fdw: %s value \"%s\" cannot be stored in MonetDB",
+						format_type_be(type), deparseValueText(value, type))));
+}
+
+/*
+ * Append a non-null value as a MonetDB literal, for the VALUES list of an
+ * INSERT.  Values of types MonetDB has no literals for are sent as
+ * strings, for MonetDB to convert to the column's type.
+ */
+void
+monetdbDeparseLiteral(StringInfo buf, Datum value, Oid type)
+{
+	deparse_expr_cxt context;
+
+	check_storable_value(value, type);
+
+	if (!is_shippable_type(type))
+	{
+		monetdbDeparseStringLiteral(buf, deparseValueText(value, type));
+		return;
+	}
+
+	context.root = NULL;
+	context.foreignrel = NULL;
+	context.scanrel = NULL;
+	context.buf = buf;
+	context.params_list = NULL;
+	deparseDatum(value, type, &context);
+}
+
+/*
+ * Append a non-null value as a field of the data of a COPY INTO, quoted
+ * with double quotes; see monetdbDeparseCopySql.
+ */
+void
+monetdbDeparseCopyField(StringInfo buf, Datum value, Oid type)
+{
+	const char *p;
+
+	check_storable_value(value, type);
+
+	appendStringInfoChar(buf, '"');
+	for (p = deparseValueText(value, type); *p; p++)
+	{
+		if (*p == '\n')
+			appendStringInfoString(buf, "\\n");
+		else
+		{
+			if (*p == '"' || *p == '\\')
+				appendStringInfoChar(buf, '\\');
+			appendStringInfoChar(buf, *p);
+		}
+	}
+	appendStringInfoChar(buf, '"');
+}
+
+/*
+ * Deparse a function call as its translation for MonetDB.
+ */
+static void
+deparseFuncExpr(FuncExpr *node, deparse_expr_cxt *context)
+{
+	MonetdbFdwPlanState *fpinfo =
+		(MonetdbFdwPlanState *) context->foreignrel->fdw_private;
+	char	   *remote = monetdbRemoteFunction(fpinfo->serverid, node->funcid);
+	List	   *args = node->args;
+
+	if (remote == NULL)
+		elog(ERROR, "monetdb_fdw: no translation for function %u",
+			 node->funcid);
+
+	/* the unit of date_trunc is sent in the spelling MonetDB knows */
+	if (node->funcid == F_DATE_TRUNC_TEXT_TIMESTAMP)
+	{
+		const char *unit = date_trunc_unit(node);
+		Const	   *c = (Const *) linitial(args);
+
+		args = list_copy(args);
+		linitial(args) = makeConst(TEXTOID, -1, c->constcollid, -1,
+								   CStringGetTextDatum(unit), false, false);
+	}
+
+	deparseTranslation(remote, args, context);
+}
+
+/*
+ * Deparse given operator expression.  An operator with a translation for
+ * MonetDB is written as that; all the other operators we ship are spelled
+ * the same in MonetDB, except for the LIKE family.
+ */
+static void
+deparseOpExpr(OpExpr *node, deparse_expr_cxt *context)
+{
+	StringInfo	buf = context->buf;
+	MonetdbFdwPlanState *fpinfo =
+		(MonetdbFdwPlanState *) context->foreignrel->fdw_private;
+	char	   *remote = monetdbRemoteOperator(fpinfo->serverid, node->opno);
+	char	   *oprname;
+	const char *remote_opr;
+	bool		is_like = false;
+
+	if (remote != NULL)
+	{
+		deparseTranslation(remote, node->args, context);
+		return;
+	}
+
+	oprname = get_opname(node->opno);
+	remote_opr = oprname;
+	if (strcmp(oprname, "~~") == 0)
+		remote_opr = "LIKE";
+	else if (strcmp(oprname, "!~~") == 0)
+		remote_opr = "NOT LIKE";
+	else if (strcmp(oprname, "~~*") == 0)
+		remote_opr = "ILIKE";
+	else if (strcmp(oprname, "!~~*") == 0)
+		remote_opr = "NOT ILIKE";
+	is_like = (remote_opr != oprname);
+
+	appendStringInfoChar(buf, '(');
+
+	if (list_length(node->args) == 1)
+	{
+		/* prefix operator */
+		appendStringInfo(buf, "%s ", remote_opr);
+		deparseExpr(linitial(node->args), context);
+	}
+	else
+	{
+		deparseExpr(linitial(node->args), context);
+		appendStringInfo(buf, " %s ", remote_opr);
+		deparseExpr(lsecond(node->args), context);
+
+		/* Our LIKE treats backslash as the escape character; say so. */
+		if (is_like)
+			appendStringInfoString(buf, " ESCAPE E'\\\\'");
+	}
+
+	appendStringInfoChar(buf, ')');
+}
+
+/*
+ * Write the template of a translation, with $n replaced by the n-th
+ * argument.
+ */
+static void
+deparseTranslation(const char *remote, List *args, deparse_expr_cxt *context)
+{
+	StringInfo	buf = context->buf;
+	const char *p;
+
+	for (p = remote; *p; p++)
+	{
+		int			n = 0;
+
+		if (*p != '$' || !isdigit((unsigned char) p[1]))
+		{
+			appendStringInfoChar(buf, *p);
+			continue;
+		}
+
+		while (isdigit((unsigned char) p[1]) && n <= list_length(args))
+			n = n * 10 + (*++p - '0');
+		if (n < 1 || n > list_length(args))
+			elog(ERROR, "monetdb_fdw: translation \"%s\" refers to argument %d of %d",
+				 remote, n, list_length(args));
+
+		deparseExpr((Expr *) list_nth(args, n - 1), context);
+	}
+}
+
+/*
+ * Deparse "x = ANY(const array)" as "x IN (...)" and "x <> ALL(const
+ * array)" as "x NOT IN (...)".  SQL gives NULL elements the same meaning in
+ * both forms.
+ */
+static void
+deparseScalarArrayOpExpr(ScalarArrayOpExpr *node, deparse_expr_cxt *context)
+{
+	StringInfo	buf = context->buf;
+	Const	   *arrayconst = lsecond_node(Const, node->args);
+	ArrayType  *array = DatumGetArrayTypeP(arrayconst->constvalue);
+	Oid			elemtype = ARR_ELEMTYPE(array);
+	int16		elmlen;
+	bool		elmbyval;
+	char		elmalign;
+	Datum	   *elems;
+	bool	   *nulls;
+	int			nelems;
+	int			i;
+
+	get_typlenbyvalalign(elemtype, &elmlen, &elmbyval, &elmalign);
+	deconstruct_array(array, elemtype, elmlen, elmbyval, elmalign,
+					  &elems, &nulls, &nelems);
+
+	appendStringInfoChar(buf, '(');
+	deparseExpr(linitial(node->args), context);
+	appendStringInfoString(buf, node->useOr ? " IN (" : " NOT IN (");
+	for (i = 0; i < nelems; i++)
+	{
+		if (i > 0)
+			appendStringInfoString(buf, ", ");
+		if (nulls[i])
+			appendStringInfoString(buf, "NULL");
+		else
+			deparseDatum(elems[i], elemtype, context);
+	}
+	appendStringInfoString(buf, "))");
+}
+
+static void
+deparseBoolExpr(BoolExpr *node, deparse_expr_cxt *context)
+{
+	StringInfo	buf = context->buf;
+	const char *op = NULL;
+	bool		first;
+	ListCell   *lc;
+
+	switch (node->boolop)
+	{
+		case AND_EXPR:
+			op = "AND";
+			break;
+		case OR_EXPR:
+			op = "OR";
+			break;
+		case NOT_EXPR:
+			appendStringInfoString(buf, "(NOT ");
+			deparseExpr(linitial(node->args), context);
+			appendStringInfoChar(buf, ')');
+			return;
+	}
+
+	appendStringInfoChar(buf, '(');
+	first = true;
+	foreach(lc, node->args)
+	{
+		if (!first)
+			appendStringInfo(buf, " %s ", op);
+		deparseExpr((Expr *) lfirst(lc), context);
+		first = false;
+	}
+	appendStringInfoChar(buf, ')');
+}
+
+static void
+deparseNullTest(NullTest *node, deparse_expr_cxt *context)
+{
+	StringInfo	buf = context->buf;
+
+	appendStringInfoChar(buf, '(');
+	deparseExpr(node->arg, context);
+	if (node->nulltesttype == IS_NULL)
+		appendStringInfoString(buf, " IS NULL)");
+	else
+		appendStringInfoString(buf, " IS NOT NULL)");
+}
+
+/*
+ * A RelabelType is a binary-compatible coercion (varchar to text, say);
+ * MonetDB doesn't need to see it.
+ */
+static void
+deparseRelabelType(RelabelType *node, deparse_expr_cxt *context)
+{
+	deparseExpr(node->arg, context);
+}
+
+/*
+ * Deparse an aggregate call.  MonetDB has no FILTER clause, so
+ * "agg(x) FILTER (WHERE cond)" is sent as "agg(CASE WHEN cond THEN x END)",
+ * which is equivalent since all the aggregates we ship ignore NULLs.
+ */
+static void
+deparseAggref(Aggref *node, deparse_expr_cxt *context)
+{
+	StringInfo	buf = context->buf;
+
+	appendStringInfo(buf, "%s(", get_func_name(node->aggfnoid));
+
+	if (node->aggdistinct != NIL)
+		appendStringInfoString(buf, "DISTINCT ");
+
+	if (node->aggfilter)
+	{
+		appendStringInfoString(buf, "CASE WHEN ");
+		deparseExpr(node->aggfilter, context);
+		appendStringInfoString(buf, " THEN ");
+		if (node->aggstar)
+			appendStringInfoString(buf, "1");
+		else
+			deparseExpr(linitial_node(TargetEntry, node->args)->expr, context);
+		appendStringInfoString(buf, " END");
+	}
+	else if (node->aggstar)
+		appendStringInfoChar(buf, '*');
+	else
+		deparseExpr(linitial_node(TargetEntry, node->args)->expr, context);
+
+	appendStringInfoChar(buf, ')');
+}
+
+/*
+ * Construct the name of a column of the foreign table, qualified with the
+ * relation's alias if qualify_col.  The column_name FDW option, if present,
+ * gives the name of the column on MonetDB.
+ */
+static void
+deparseColumnRef(StringInfo buf, Index varno, AttrNumber varattno,
+				 PlannerInfo *root, bool qualify_col)
+{
+	RangeTblEntry *rte = planner_rt_fetch(varno, root);
+
+	if (qualify_col)
+		appendStringInfo(buf, "%s%d.", REL_ALIAS_PREFIX, varno);
+	deparseColumnName(buf, rte->relid, varattno);
+}
+
+/*
+ * Append the MonetDB name of column attnum of the foreign table relid.
+ */
+static void
+deparseColumnName(StringInfo buf, Oid relid, AttrNumber attnum)
+{
+	char	   *colname = NULL;
+	List	   *options;
+	ListCell   *lc;
+
+	options = GetForeignColumnOptions(relid, attnum);
+	foreach(lc, options)
+	{
+		DefElem    *def = (DefElem *) lfirst(lc);
+
+		if (strcmp(def->defname, "column_name") == 0)
+		{
+			colname = defGetString(def);
+			break;
+		}
+	}
+
+	if (colname == NULL)
+		colname = get_attname(relid, attnum, false);
+
+	deparseIdentifier(buf, colname);
+}
+
+/*
+ * Append an identifier, always double-quoted.  MonetDB folds unquoted names
+ * to lower case just as we do, but its list of reserved words is different.
+ */
+static void
+deparseIdentifier(StringInfo buf, const char *ident)
+{
+	const char *p;
+
+	appendStringInfoChar(buf, '"');
+	for (p = ident; *p; p++)
+	{
+		if (*p == '"')
+			appendStringInfoChar(buf, '"');
+		appendStringInfoChar(buf, *p);
+	}
+	appendStringInfoChar(buf, '"');
+}
+
+/*
+ * Append a SQL string literal representing "val" to buf.  Backslashes are
+ * escape characters in MonetDB's E'' strings, so use that form only when
+ * we have to.
+ */
+void
+monetdbDeparseStringLiteral(StringInfo buf, const char *val)
+{
+	const char *valptr;
+
+	if (strchr(val, '\\') != NULL)
+		appendStringInfoChar(buf, 'E');
+	appendStringInfoChar(buf, '\'');
+	for (valptr = val; *valptr; valptr++)
+	{
+		char		ch = *valptr;
+
+		if (ch == '\'' || ch == '\\')
+			appendStringInfoChar(buf, ch);
+		appendStringInfoChar(buf, ch);
+	}
+	appendStringInfoChar(buf, '\'');
+}
@@ -0,0 +1,116 @@
+/* contrib/monetdb_fdw/monetdb_fdw--0.1.sql */
+
+-- complain if script is sourced in psql, rather than via CREATE EXTENSION
+\echo Use "CREATE EXTENSION monetdb_fdw" to load this file. \quit
+
+CREATE FUNCTION monetdb_fdw_handler()
+RETURNS fdw_handler
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT;
+
+CREATE FUNCTION monetdb_fdw_validator(text[], oid)
+RETURNS void
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT;
+
+CREATE FOREIGN DATA WRAPPER monetdb_fdw
+  HANDLER monetdb_fdw_handler
+  VALIDATOR monetdb_fdw_validator;
+
+CREATE FUNCTION monetdb_fdw_get_connections (OUT server_name text,
+    OUT user_name text, OUT valid boolean)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT PARALLEL RESTRICTED;
+
+CREATE FUNCTION monetdb_fdw_disconnect (text)
+RETURNS bool
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT PARALLEL RESTRICTED;
+
+CREATE FUNCTION monetdb_fdw_disconnect_all ()
+RETURNS bool
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT PARALLEL RESTRICTED;
+
+-- Cumulative statistics; monetdb_fdw must be in shared_preload_libraries.
+CREATE FUNCTION monetdb_fdw_stat_tables (OUT dbid oid, OUT serverid oid,
+    OUT relid oid, OUT scans int8, OUT rows_fetched int8,
+    OUT bytes_received int8, OUT connections_opened int8,
+    OUT connections_reused int8, OUT remote_time float8, OUT errors int8,
+    OUT last_error text, OUT last_error_time timestamptz)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT VOLATILE PARALLEL SAFE;
+
+CREATE FUNCTION monetdb_fdw_stat_reset ()
+RETURNS void
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT PARALLEL SAFE;
+
+-- last_error holds remote SQL and data values, so only roles allowed to
+-- read all statistics may see the entries
+REVOKE ALL ON FUNCTION monetdb_fdw_stat_tables () FROM PUBLIC;
+GRANT EXECUTE ON FUNCTION monetdb_fdw_stat_tables () TO pg_read_all_stats;
+REVOKE ALL ON FUNCTION monetdb_fdw_stat_reset () FROM PUBLIC;
+
+-- One row per foreign table of the current database
+CREATE VIEW monetdb_fdw_stat_tables AS
+  SELECT s.serverid, srv.srvname AS server_name,
+         s.relid, s.relid::regclass AS relname,
+         s.scans, s.rows_fetched, s.bytes_received, s.remote_time,
+         s.errors, s.last_error, s.last_error_time
+    FROM monetdb_fdw_stat_tables() s
+         LEFT JOIN pg_foreign_server srv ON srv.oid = s.serverid
+   WHERE s.dbid = (SELECT oid FROM pg_database
+                    WHERE datname = current_database())
+     AND s.relid IS NOT NULL;
+
+-- One row per foreign server used from the current database
+CREATE VIEW monetdb_fdw_stat_servers AS
+  SELECT s.serverid, srv.srvname AS server_name,
+         sum(s.scans) AS scans, sum(s.rows_fetched) AS rows_fetched,
+         sum(s.bytes_received) AS bytes_received,
+         sum(s.connections_opened) AS connections_opened,
+         sum(s.connections_reused) AS connections_reused,
+         sum(s.remote_time) AS remote_time, sum(s.errors) AS errors,
+         (array_agg(s.last_error ORDER BY s.last_error_time DESC NULLS LAST))[1]
+           AS last_error,
+         max(s.last_error_time) AS last_error_time
+    FROM monetdb_fdw_stat_tables() s
+         LEFT JOIN pg_foreign_server srv ON srv.oid = s.serverid
+   WHERE s.dbid = (SELECT oid FROM pg_database
+                    WHERE datname = current_database())
+   GROUP BY s.serverid, srv.srvname;
+
+REVOKE ALL ON monetdb_fdw_stat_tables, monetdb_fdw_stat_servers FROM PUBLIC;
+GRANT SELECT ON monetdb_fdw_stat_tables, monetdb_fdw_stat_servers
+  TO pg_read_all_stats;
+
+-- Translations of functions and operators for MonetDB, used to push down
+-- the expressions calling them.  In remote, $1, $2, ... stand for the
+-- arguments; a row replaces the built-in translation of its function or
+-- operator, if there is one.  The function must be immutable.
+CREATE TABLE monetdb_fdw_pushdown (
+    func regprocedure UNIQUE,
+    oper regoperator UNIQUE,
+    remote text NOT NULL,
+    CHECK ((func IS NULL) <> (oper IS NULL))
+);
+
+SELECT pg_catalog.pg_extension_config_dump('monetdb_fdw_pushdown', '');
+
+GRANT SELECT ON monetdb_fdw_pushdown TO PUBLIC;
+
+CREATE FUNCTION monetdb_fdw_pushdown_trigger ()
+RETURNS trigger
+AS 'MODULE_PATHNAME'
+LANGUAGE C;
+
+CREATE TRIGGER monetdb_fdw_pushdown_check
+  BEFORE INSERT OR UPDATE ON monetdb_fdw_pushdown
+  FOR EACH ROW EXECUTE FUNCTION monetdb_fdw_pushdown_trigger();
+
+CREATE TRIGGER monetdb_fdw_pushdown_changed
+  AFTER INSERT OR UPDATE OR DELETE OR TRUNCATE ON monetdb_fdw_pushdown
+  FOR EACH STATEMENT EXECUTE FUNCTION monetdb_fdw_pushdown_trigger();
@@ -13,42 +13,106 @@
  */
 #include "postgres.h"
 
+#include "monetdb_fdw.h"
+
+#include "access/htup_details.h"
+#include "access/parallel.h"
 #include "access/reloptions.h"
+#include "access/stratnum.h"
+#include "access/table.h"
+#include "catalog/pg_attribute.h"
+#include "catalog/pg_foreign_server.h"
 #include "catalog/pg_foreign_table.h"
+#include "catalog/pg_type.h"
+#include "catalog/pg_user_mapping.h"
 #include "commands/defrem.h"
 #include "commands/explain.h"
+#include "commands/vacuum.h"
+#include "executor/execAsync.h"
+#include "executor/executor.h"
+#include "executor/instrument.h"
 #include "foreign/fdwapi.h"
 #include "foreign/foreign.h"
 #include "funcapi.h"
 #include "miscadmin.h"
+#include "nodes/makefuncs.h"
+#include "nodes/nodeFuncs.h"
+#include "optimizer/cost.h"
+#include "optimizer/inherit.h"
+#include "optimizer/optimizer.h"
 #include "optimizer/pathnode.h"
+#include "optimizer/paths.h"
 #include "optimizer/planmain.h"
+#include "optimizer/prep.h"
 #include "optimizer/restrictinfo.h"
+#include "optimizer/tlist.h"
+#include "port/atomics.h"
 #include "utils/builtins.h"
+#include "utils/guc.h"
+#include "utils/hsearch.h"
+#include "utils/inval.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
 #include "utils/rel.h"
+#include "utils/sampling.h"
+#include "utils/selfuncs.h"
+#include "utils/syscache.h"
+#include "utils/tuplestore.h"
 
-#include <stdio.h>
-#include <mapi.h>
+#include <limits.h>
+#include <math.h>
 
 PG_MODULE_MAGIC;
 
+void		_PG_init(void);
+
 //#define _DEBUG 1
 
-typedef struct MonetdbFdwPlanState
-{
-	char *host;          /* host */
-	char *port;          /* port */
-	char *user;          /* user name */
-	char *passwd;        /* password */
-	char *dbname;        /* database name */
-	char *table;         /* target table name */
-	char *query;         /* pre-defined query */
-	char *monetdb_opt6;              /* required option 2 */
-	List *options;                    /* other options */
-	
-	BlockNumber pages;                      /* estimate of file's physical size */
-	double          ntuples;                /* estimate of number of rows in file */
-} MonetdbFdwPlanState;
+/* Default CPU cost to start up a foreign query. */
+#define DEFAULT_FDW_STARTUP_COST	100.0
+
+/* Default CPU cost to process 1 row (above and beyond cpu_tuple_cost). */
+#define DEFAULT_FDW_TUPLE_COST		0.01
+
+/* Default number of rows per block; the same as MAPI's own default. */
+#define DEFAULT_FDW_FETCH_SIZE		100
+
+/* Default number of rows sent per INSERT; like postgres_fdw, no batching */
+#define DEFAULT_FDW_BATCH_SIZE		1
+
+/*
+ * Cost of having MonetDB sort the rows, relative to an unsorted scan or
+ * join.  Without remote estimates there is nothing better to go on.
+ */
+#define DEFAULT_FDW_SORT_MULTIPLIER	1.2
+
+/* Default number of chunks a parallel scan splits the table into */
+#define DEFAULT_FDW_PARTITION_COUNT	8
+
+/*
+ * Default number of rows a scan is estimated to return for transfer_mode
+ * 'binary' to be used; below it, the text result is quick enough.
+ */
+#define DEFAULT_FDW_BINARY_THRESHOLD	100000
+
+/*
+ * Convert the rows of a text result a block and a column at a time, or one
+ * row at a time, as before; the latter is kept to compare the two.
+ */
+static bool monetdb_batch_decode = true;
+
+/*
+ * State shared by the processes of a parallel scan, in the DSM segment.
+ * The chunks of the table are handed out one at a time, in order, to
+ * whichever process asks next.
+ */
+typedef struct MonetdbFdwParallelState
+{
+	pg_atomic_uint32 next_chunk;	/* next chunk to hand out */
+	int			nchunks;		/* number of chunks */
+	int64		lower;			/* range: smallest value of the column */
+	int64		upper;			/* range: largest value of the column */
+} MonetdbFdwParallelState;
 
 typedef struct MonetdbFdwExecutionState
 {
@@ -64,10 +128,178 @@ typedef struct MonetdbFdwExecutionState
 	Mapi dbh;
 	MapiHdl hdl;
 
-	Relation rel;
+	char *query;         /* remote query, deparsed at plan time */
+	List *retrieved_attrs;    /* attnums of the columns the query returns */
+
+	/* per-column converters, one for each of retrieved_attrs */
+	MonetdbFdwConverter *convs;
+	int nconvs;
+
+	/*
+	 * Context holding the data of the current row; it is reset before each
+	 * row is fetched, so a scan needs the same memory however many rows it
+	 * returns.
+	 */
+	MemoryContext temp_cxt;
+
+	char *relname;            /* foreign table, for error messages */
+	Oid relid;                /* and for the statistics, with its server */
+	Oid serverid;
+	TupleDesc tupdesc;        /* shape of the rows returned */
 	int linecount;
+
+	/*
+	 * MonetDB sends a result in blocks of fetch_size rows, and MAPI asks for
+	 * the next block (Xexport) once the rows of the current one are used up.
+	 * The counters below follow that, for EXPLAIN ANALYZE.
+	 */
+	int fetch_size;           /* rows per block */
+	int block_rows;           /* rows consumed from the current block */
+	int round_trips;          /* query plus block requests sent */
+
+	/*
+	 * What the scan cost on the wire and in conversion, for EXPLAIN ANALYZE.
+	 * The times are only taken when the query is run with timing on.
+	 */
+	bool track_timing;
+	instr_time connect_time;  /* spent getting the connection */
+	instr_time query_start;   /* when the first query was sent */
+	instr_time first_row_time;  /* from then until its first row came */
+	bool got_first_row;
+	instr_time convert_time;  /* spent converting fields into datums */
+	int64 rows_fetched;       /* rows received from MonetDB */
+	int64 bytes_received;     /* length of the text of their fields */
+
+	/* time spent waiting on MonetDB, if the statistics are kept */
+	bool track_remote;
+	instr_time remote_time;
+
+	/*
+	 * With prefetch_depth, a thread reads the next blocks of the result
+	 * while the rows of the current one are converted.  It is started once
+	 * per result, when the scan is the only user of the connection.
+	 */
+	int prefetch_depth;       /* blocks read ahead, or 0 */
+	MonetdbPrefetch *prefetch;  /* the thread of the current result, or NULL */
+	bool prefetch_tried;      /* was one started for the current result? */
+	double prefetch_stall;    /* ms waited on threads of earlier results */
+
+	/*
+	 * With transfer_mode 'binary', the scan first asks MonetDB for the
+	 * result in its binary format; if that fails, it goes on with the text
+	 * query for the rest of the scan.
+	 */
+	char *binary_query;       /* the COPY INTO BINARY statement, or "" */
+	MonetdbBinaryResult *binres;  /* its result, while it is being read */
+	bool binary_failed;       /* did MonetDB refuse it? */
+	bool used_binary;         /* was it used at all, for EXPLAIN */
+
+	/*
+	 * With monetdb_fdw.batch_decode, the rows of a text result are fetched
+	 * a block at a time, and converted a column at a time, into the arrays
+	 * below, indexed [column * fetch_size + row].
+	 */
+	bool batch_decode;
+	StringInfoData batch_text;  /* text of the fields of the block */
+	size_t *batch_offs;       /* where a field is in it, or SIZE_MAX */
+	size_t *batch_lens;
+	char **batch_fields;
+	Datum *batch_values;
+	bool *batch_isnull;
+	MemoryContext batch_cxt;  /* holds the values of the block */
+	int batch_len;            /* rows in the block */
+	int batch_pos;            /* next row to return */
+	int batch_row;            /* row being converted, or -1 */
+
+	bool eof;                 /* result used up, or closed by a Limit above */
+	bool response_pending;    /* query sent, but its response not read yet */
+
+	/*
+	 * A scan that may be rescanned with the same parameters (the executor
+	 * passed EXEC_FLAG_REWIND) keeps its result open when it is used up, and
+	 * starts over by seeking back to its first row instead of running the
+	 * query again.  With the rescan_cache option, it keeps the rows it has
+	 * fetched in a tuplestore instead, which spills to disk beyond work_mem,
+	 * and rescans replay them without asking MonetDB for anything.
+	 */
+	bool rewind;              /* may a rescan start the result over? */
+	Tuplestorestate *cache;   /* rows fetched so far, or NULL */
+	TupleTableSlot *cache_slot;  /* to read cached rows into */
+	bool cache_complete;      /* does the cache hold the whole result? */
+
+	/*
+	 * Parallel scans only.  Each process runs the query once per chunk it
+	 * claims, restricted to the rows of that chunk.
+	 */
+	MonetdbFdwParallelState *pstate;  /* NULL if not a parallel scan */
+	char *partition_column;   /* deparsed column the chunks are split by */
+	bool has_where;           /* does the query have a WHERE clause? */
+	char *bounds_query;       /* range: finds the column's bounds */
+	int partition_count;      /* chunks, when setting up pstate */
+	StringInfoData chunk_query;  /* query for the current chunk */
+
+	/*
+	 * Parameterized scans only.  The query is prepared by MonetDB when it
+	 * first runs, and each run executes it with the current values of the
+	 * parameters.
+	 */
+	List *param_exprs;        /* ExprStates computing the values */
+	Oid *param_types;         /* and their types */
+	ExprContext *econtext;    /* to evaluate them in */
+	int prep_id;              /* id of the prepared query, or -1 */
+	StringInfoData exec_query;  /* EXEC of the prepared query */
 } MonetdbFdwExecutionState;
 
+/*
+ * Execution state of an INSERT into a foreign table, or of a COPY FROM or
+ * tuple routing into one.
+ */
+typedef struct MonetdbFdwModifyState
+{
+	Mapi dbh;                 /* connection to MonetDB */
+	char *relname;            /* for error messages */
+	TupleDesc tupdesc;        /* descriptor of the rows inserted */
+
+	/*
+	 * With use_copy, the rows are loaded with "COPY n RECORDS" followed by
+	 * sql; otherwise sql is an INSERT up to the VALUES keyword.
+	 */
+	char *sql;
+	bool use_copy;
+	List *target_attrs;       /* attribute numbers of the columns sent */
+	int batch_size;           /* rows sent per statement */
+
+	StringInfoData buf;       /* statement being built */
+	MemoryContext temp_cxt;   /* for the text of the values of a batch */
+} MonetdbFdwModifyState;
+
+/*
+ * Execution state of an UPDATE or DELETE that MonetDB does in a single
+ * statement.
+ */
+typedef struct MonetdbFdwDirectModifyState
+{
+	Mapi dbh;                 /* connection to MonetDB */
+	char *relname;            /* for error messages */
+	char *sql;                /* the UPDATE or DELETE */
+	char *returning_sql;      /* SELECT of the rows for RETURNING, or NULL */
+	List *retrieved_attrs;    /* attnums of the columns it returns */
+	bool set_processed;       /* count the rows for the command tag? */
+
+	bool executed;            /* has the statement been run yet? */
+	int64 num_tuples;         /* rows updated or deleted */
+
+	/*
+	 * RETURNING only.  The rows are fetched before the statement runs, so
+	 * they are kept here until the executor asks for them.
+	 */
+	MonetdbFdwConverter *convs;
+	int nconvs;
+	Tuplestorestate *returning_rows;
+	TupleTableSlot *returning_slot;
+	MemoryContext temp_cxt;   /* for the data of the row being converted */
+} MonetdbFdwDirectModifyState;
+
 struct MonetdbFdwOption
 {
   const char *optname;
@@ -81,14 +313,40 @@ PG_FUNCTION_INFO_V1(monetdb_fdw_handler);
 PG_FUNCTION_INFO_V1(monetdb_fdw_validator);
 
 static const struct MonetdbFdwOption valid_options[] = {
-  {"host", ForeignTableRelationId},
-  {"port", ForeignTableRelationId},
-  {"user", ForeignTableRelationId},
-  {"passwd", ForeignTableRelationId},
-  {"dbname", ForeignTableRelationId},
+  {"host", ForeignServerRelationId},
+  {"port", ForeignServerRelationId},
+  {"dbname", ForeignServerRelationId},
+  {"user", UserMappingRelationId},
+  {"passwd", UserMappingRelationId},
   {"table", ForeignTableRelationId},
   {"query", ForeignTableRelationId},
   {"monetdb_opt6", ForeignTableRelationId},
+  {"use_remote_estimate", ForeignServerRelationId},
+  {"use_remote_estimate", ForeignTableRelationId},
+  {"fdw_startup_cost", ForeignServerRelationId},
+  {"fdw_startup_cost", ForeignTableRelationId},
+  {"fdw_tuple_cost", ForeignServerRelationId},
+  {"fdw_tuple_cost", ForeignTableRelationId},
+  {"fetch_size", ForeignServerRelationId},
+  {"fetch_size", ForeignTableRelationId},
+  {"async_capable", ForeignServerRelationId},
+  {"async_capable", ForeignTableRelationId},
+  {"rescan_cache", ForeignServerRelationId},
+  {"rescan_cache", ForeignTableRelationId},
+  {"prefetch_depth", ForeignServerRelationId},
+  {"prefetch_depth", ForeignTableRelationId},
+  {"transfer_mode", ForeignServerRelationId},
+  {"transfer_mode", ForeignTableRelationId},
+  {"binary_threshold", ForeignServerRelationId},
+  {"binary_threshold", ForeignTableRelationId},
+  {"batch_size", ForeignServerRelationId},
+  {"batch_size", ForeignTableRelationId},
+  {"analyze_sampling", ForeignServerRelationId},
+  {"analyze_sampling", ForeignTableRelationId},
+  {"partition_column", ForeignTableRelationId},
+  {"partition_method", ForeignTableRelationId},
+  {"partition_count", ForeignTableRelationId},
+  {"column_name", AttributeRelationId},
 
   /* Sentinel */
   {NULL, InvalidOid}
@@ -97,11 +355,76 @@ static const struct MonetdbFdwOption valid_options[] = {
 static void monetdbGetForeignRelSize(PlannerInfo *, RelOptInfo *, Oid);
 static void monetdbGetForeignPaths(PlannerInfo *, RelOptInfo *, Oid);
 static ForeignScan *monetdbGetForeignPlan(PlannerInfo *, RelOptInfo *, Oid, ForeignPath *, List *, List *);
+static void monetdbGetForeignJoinPaths(PlannerInfo *, RelOptInfo *, RelOptInfo *, RelOptInfo *, JoinType, JoinPathExtraData *);
+static void monetdbGetForeignUpperPaths(PlannerInfo *, UpperRelationKind, RelOptInfo *, RelOptInfo *, void *);
 static void monetdbExplainForeignScan(ForeignScanState *, ExplainState *);
 static void monetdbBeginForeignScan(ForeignScanState *, int);
 static TupleTableSlot *monetdbIterateForeignScan(ForeignScanState *);
 static void monetdbEndForeignScan(ForeignScanState *);
 static void monetdbReScanForeignScan(ForeignScanState *);
+static void monetdbShutdownForeignScan(ForeignScanState *);
+static bool monetdbIsForeignScanParallelSafe(PlannerInfo *, RelOptInfo *, RangeTblEntry *);
+static Size monetdbEstimateDSMForeignScan(ForeignScanState *, ParallelContext *);
+static void monetdbInitializeDSMForeignScan(ForeignScanState *, ParallelContext *, void *);
+static void monetdbReInitializeDSMForeignScan(ForeignScanState *, ParallelContext *, void *);
+static void monetdbInitializeWorkerForeignScan(ForeignScanState *, shm_toc *, void *);
+static bool monetdbIsForeignPathAsyncCapable(ForeignPath *);
+static void monetdbForeignAsyncRequest(AsyncRequest *);
+static void monetdbForeignAsyncConfigureWait(AsyncRequest *);
+static void monetdbForeignAsyncNotify(AsyncRequest *);
+static int monetdbIsForeignRelUpdatable(Relation);
+static List *monetdbPlanForeignModify(PlannerInfo *, ModifyTable *, Index, int);
+static void monetdbBeginForeignModify(ModifyTableState *, ResultRelInfo *, List *, int, int);
+static TupleTableSlot *monetdbExecForeignInsert(EState *, ResultRelInfo *, TupleTableSlot *, TupleTableSlot *);
+static TupleTableSlot **monetdbExecForeignBatchInsert(EState *, ResultRelInfo *, TupleTableSlot **, TupleTableSlot **, int *);
+static TupleTableSlot *monetdbExecForeignUpdate(EState *, ResultRelInfo *, TupleTableSlot *, TupleTableSlot *);
+static TupleTableSlot *monetdbExecForeignDelete(EState *, ResultRelInfo *, TupleTableSlot *, TupleTableSlot *);
+static int monetdbGetForeignModifyBatchSize(ResultRelInfo *);
+static void monetdbEndForeignModify(EState *, ResultRelInfo *);
+static void monetdbBeginForeignInsert(ModifyTableState *, ResultRelInfo *);
+static void monetdbEndForeignInsert(EState *, ResultRelInfo *);
+static void monetdbExplainForeignModify(ModifyTableState *, ResultRelInfo *, List *, int, ExplainState *);
+static bool monetdbPlanDirectModify(PlannerInfo *, ModifyTable *, Index, int);
+static void monetdbBeginDirectModify(ForeignScanState *, int);
+static TupleTableSlot *monetdbIterateDirectModify(ForeignScanState *);
+static void monetdbEndDirectModify(ForeignScanState *);
+static void monetdbExplainDirectModify(ForeignScanState *, ExplainState *);
+static bool monetdbAnalyzeForeignTable(Relation, AcquireSampleRowsFunc *, BlockNumber *);
+static int monetdbAcquireSampleRowsFunc(Relation, int, HeapTuple *, int, double *, double *);
+
+static bool monetdbBeginQuery(MonetdbFdwExecutionState *festate, bool send_only);
+static const char *monetdbBindParams(MonetdbFdwExecutionState *festate);
+
+static void add_paths_with_pathkeys(PlannerInfo *root, RelOptInfo *rel,
+									MonetdbFdwPlanState *fpinfo);
+static AttrNumber get_partition_attnum(Oid foreigntableid,
+									   MonetdbFdwPlanState *fpinfo);
+static void add_foreign_partial_path(PlannerInfo *root, RelOptInfo *baserel,
+									 Oid foreigntableid,
+									 MonetdbFdwPlanState *fpinfo);
+static void add_foreign_param_paths(PlannerInfo *root, RelOptInfo *baserel,
+									MonetdbFdwPlanState *fpinfo);
+
+/*
+ * Module load callback.  The statistics need shared memory, which only a
+ * library in shared_preload_libraries can have.
+ */
+void
+_PG_init(void)
+{
+	DefineCustomBoolVariable("monetdb_fdw.batch_decode",
+							 "Converts the rows of a remote result a block at a time.",
+							 NULL,
+							 &monetdb_batch_decode,
+							 true,
+							 PGC_USERSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL);
+
+	monetdbStatsInit();
+}
 
 /*
  * Foreign-data wrapper handler function: return a struct with pointers
@@ -120,156 +443,413 @@ monetdb_fdw_handler(PG_FUNCTION_ARGS)
   fdwroutine->IterateForeignScan = monetdbIterateForeignScan;
   fdwroutine->EndForeignScan     = monetdbEndForeignScan;
   fdwroutine->ReScanForeignScan  = monetdbReScanForeignScan;
-  //  fdwroutine->AnalyzeForeignTable = fileAnalyzeForeignTable;
+  fdwroutine->ShutdownForeignScan = monetdbShutdownForeignScan;
+  fdwroutine->IsForeignScanParallelSafe = monetdbIsForeignScanParallelSafe;
+  fdwroutine->EstimateDSMForeignScan = monetdbEstimateDSMForeignScan;
+  fdwroutine->InitializeDSMForeignScan = monetdbInitializeDSMForeignScan;
+  fdwroutine->ReInitializeDSMForeignScan = monetdbReInitializeDSMForeignScan;
+  fdwroutine->InitializeWorkerForeignScan = monetdbInitializeWorkerForeignScan;
+  fdwroutine->IsForeignPathAsyncCapable = monetdbIsForeignPathAsyncCapable;
+  fdwroutine->ForeignAsyncRequest = monetdbForeignAsyncRequest;
+  fdwroutine->ForeignAsyncConfigureWait = monetdbForeignAsyncConfigureWait;
+  fdwroutine->ForeignAsyncNotify = monetdbForeignAsyncNotify;
+  fdwroutine->GetForeignJoinPaths = monetdbGetForeignJoinPaths;
+  fdwroutine->GetForeignUpperPaths = monetdbGetForeignUpperPaths;
+  fdwroutine->AnalyzeForeignTable = monetdbAnalyzeForeignTable;
+  fdwroutine->IsForeignRelUpdatable = monetdbIsForeignRelUpdatable;
+  fdwroutine->PlanForeignModify = monetdbPlanForeignModify;
+  fdwroutine->BeginForeignModify = monetdbBeginForeignModify;
+  fdwroutine->ExecForeignInsert = monetdbExecForeignInsert;
+  fdwroutine->ExecForeignBatchInsert = monetdbExecForeignBatchInsert;
+  fdwroutine->ExecForeignUpdate = monetdbExecForeignUpdate;
+  fdwroutine->ExecForeignDelete = monetdbExecForeignDelete;
+  fdwroutine->GetForeignModifyBatchSize = monetdbGetForeignModifyBatchSize;
+  fdwroutine->EndForeignModify = monetdbEndForeignModify;
+  fdwroutine->BeginForeignInsert = monetdbBeginForeignInsert;
+  fdwroutine->EndForeignInsert = monetdbEndForeignInsert;
+  fdwroutine->ExplainForeignModify = monetdbExplainForeignModify;
+  fdwroutine->PlanDirectModify = monetdbPlanDirectModify;
+  fdwroutine->BeginDirectModify = monetdbBeginDirectModify;
+  fdwroutine->IterateDirectModify = monetdbIterateDirectModify;
+  fdwroutine->EndDirectModify = monetdbEndDirectModify;
+  fdwroutine->ExplainDirectModify = monetdbExplainDirectModify;
 
   PG_RETURN_POINTER(fdwroutine);
 }
 
+/*
+ * Look up the options of a monetdb_fdw foreign table in the catalogs, and
+ * store them in *opts.
+ *
+ * Options given on the foreign table override the ones given on the
+ * server or the wrapper.
+ */
 static void
-monetdbGetOptions(Oid foreigntableid, char **host, char **port,
-				  char **user, char **passwd,
-				  char **dbname, char **tablename, char **query)
+resolve_options(Oid foreigntableid, MonetdbFdwPlanState *opts)
 {
 	ForeignTable *table;
 	ForeignServer *server;
 	ForeignDataWrapper *wrapper;
 
 	List	   *options;
-	ListCell   *cell, *prev;
+	List	   *other_options = NIL;
+	ListCell   *cell;
 
 	/*
-	 * Extract options from FDW objects.  We ignore user mappings because
-	 * file_fdw doesn't have any options that can be specified there.
-	 *
-	 * (XXX Actually, given the current contents of valid_options[], there's
-	 * no point in examining anything except the foreign table's own options.
-	 * Simplify?)
+	 * Extract options from FDW objects.  Connection options live on the
+	 * server and the user mapping, and are dealt with in connection.c.
 	 */
 	table = GetForeignTable(foreigntableid);
 	server = GetForeignServer(table->serverid);
 	wrapper = GetForeignDataWrapper(server->fdwid);
 
+	opts->serverid = server->serverid;
+
 	options = NIL;
 	options = list_concat(options, wrapper->options);
 	options = list_concat(options, server->options);
 	options = list_concat(options, table->options);
 
-	*host = NULL;
-	*port = NULL;
-	*user = NULL;
-	*passwd = NULL;
-	*dbname = NULL;
-	*tablename = NULL;
-	*query = NULL;
+	opts->table = NULL;
+	opts->query = NULL;
+	opts->use_remote_estimate = false;
+	opts->async_capable = false;
+	opts->rescan_cache = false;
+	opts->prefetch_depth = 0;
+	opts->binary_transfer = false;
+	opts->binary_threshold = DEFAULT_FDW_BINARY_THRESHOLD;
+	opts->analyze_sampling = MONETDB_SAMPLE_SAMPLE;
+	opts->fdw_startup_cost = DEFAULT_FDW_STARTUP_COST;
+	opts->fdw_tuple_cost = DEFAULT_FDW_TUPLE_COST;
+	opts->fetch_size = DEFAULT_FDW_FETCH_SIZE;
+	opts->batch_size = DEFAULT_FDW_BATCH_SIZE;
+	opts->partition_column = NULL;
+	opts->partition_by_range = false;
+	opts->partition_count = DEFAULT_FDW_PARTITION_COUNT;
 #ifdef NOT_USED
-	monetdb_opt6 = NULL;
+	opts->monetdb_opt6 = NULL;
 #endif
 
- retry:
-	prev = NULL;
 	foreach(cell, options)
 	{
 		DefElem    *def = (DefElem *) lfirst(cell);
 
-		if (strcmp(def->defname, "host") == 0)
-		{
-			*host = defGetString(def);
-			options = list_delete_cell(options, cell, prev);
-			goto retry;
-		}
-		else if (strcmp(def->defname, "port") == 0)
-		{
-			*port = defGetString(def);
-			options = list_delete_cell(options, cell, prev);
-			goto retry;
-		}
-		else if (strcmp(def->defname, "user") == 0)
-		{
-			*user = defGetString(def);
-			options = list_delete_cell(options, cell, prev);
-			goto retry;
-		}
-		else if (strcmp(def->defname, "passwd") == 0)
-		{
-			*passwd = defGetString(def);
-			options = list_delete_cell(options, cell, prev);
-			goto retry;
-		}
-		else if (strcmp(def->defname, "dbname") == 0)
-		{
-			*dbname = defGetString(def);
-			options = list_delete_cell(options, cell, prev);
-			goto retry;
-		}
-		else if (strcmp(def->defname, "table") == 0)
-		{
-			*tablename = defGetString(def);
-			options = list_delete_cell(options, cell, prev);
-			goto retry;
-		}
+		if (strcmp(def->defname, "table") == 0)
+			opts->table = defGetString(def);
 		else if (strcmp(def->defname, "query") == 0)
+			opts->query = defGetString(def);
+		else if (strcmp(def->defname, "use_remote_estimate") == 0)
+			opts->use_remote_estimate = defGetBoolean(def);
+		else if (strcmp(def->defname, "fdw_startup_cost") == 0)
+			opts->fdw_startup_cost = strtod(defGetString(def), NULL);
+		else if (strcmp(def->defname, "fdw_tuple_cost") == 0)
+			opts->fdw_tuple_cost = strtod(defGetString(def), NULL);
+		else if (strcmp(def->defname, "fetch_size") == 0)
+			opts->fetch_size = strtol(defGetString(def), NULL, 10);
+		else if (strcmp(def->defname, "batch_size") == 0)
+			opts->batch_size = strtol(defGetString(def), NULL, 10);
+		else if (strcmp(def->defname, "async_capable") == 0)
+			opts->async_capable = defGetBoolean(def);
+		else if (strcmp(def->defname, "rescan_cache") == 0)
+			opts->rescan_cache = defGetBoolean(def);
+		else if (strcmp(def->defname, "prefetch_depth") == 0)
+			opts->prefetch_depth = strtol(defGetString(def), NULL, 10);
+		else if (strcmp(def->defname, "transfer_mode") == 0)
+			opts->binary_transfer = (strcmp(defGetString(def), "binary") == 0);
+		else if (strcmp(def->defname, "binary_threshold") == 0)
+			opts->binary_threshold = strtol(defGetString(def), NULL, 10);
+		else if (strcmp(def->defname, "analyze_sampling") == 0)
 		{
-			*query = defGetString(def);
-			options = list_delete_cell(options, cell, prev);
-			goto retry;
+			char	   *value = defGetString(def);
+
+			if (strcmp(value, "off") == 0)
+				opts->analyze_sampling = MONETDB_SAMPLE_OFF;
+			else if (strcmp(value, "random") == 0)
+				opts->analyze_sampling = MONETDB_SAMPLE_RANDOM;
+			else
+				opts->analyze_sampling = MONETDB_SAMPLE_SAMPLE;
 		}
+		else if (strcmp(def->defname, "partition_column") == 0)
+			opts->partition_column = defGetString(def);
+		else if (strcmp(def->defname, "partition_method") == 0)
+			opts->partition_by_range = (strcmp(defGetString(def), "range") == 0);
+		else if (strcmp(def->defname, "partition_count") == 0)
+			opts->partition_count = strtol(defGetString(def), NULL, 10);
 #ifdef NOT_USED
 		else if (strcmp(def->defname, "monetdb_opt6") == 0)
-		{
-			monetdb_opt6 = defGetString(def);
-			options = list_delete_cell(options, cell, prev);
-			goto retry;
-		}
+			opts->monetdb_opt6 = defGetString(def);
 #endif
 		else
-		  prev = cell;
+			other_options = lappend(other_options, def);
+	}
+
+	/* Other options */
+	opts->options = other_options;
+}
+
+/*
+ * Options of the foreign tables used in this backend, resolved from the
+ * wrapper, server and table options.  Planning a query on a foreign table
+ * needs them, and so do its execution and any modification of the table,
+ * so caching them saves the catalog lookups and the merging of the option
+ * lists every time a prepared statement is replanned.  An entry is marked
+ * invalid when the table, its server or the wrapper is altered.
+ */
+typedef struct OptionsCacheEntry
+{
+	Oid			relid;			/* foreign table OID (hash key, must be first) */
+	bool		valid;			/* false once the options may have changed */
+	uint32		table_hashvalue;	/* hash value of the foreign table OID */
+	uint32		server_hashvalue;	/* hash value of the server OID */
+	MemoryContext cxt;			/* holds the strings and lists of opts */
+	MonetdbFdwPlanState opts;	/* the options; other fields are unset */
+} OptionsCacheEntry;
+
+static HTAB *OptionsHash = NULL;
+
+static void
+options_inval_callback(Datum arg, int cacheid, uint32 hashvalue)
+{
+	HASH_SEQ_STATUS scan;
+	OptionsCacheEntry *entry;
+
+	/*
+	 * Entries are only marked invalid, never removed here: the callback may
+	 * run while monetdbGetOptions() is filling in one of them.
+	 */
+	hash_seq_init(&scan, OptionsHash);
+	while ((entry = (OptionsCacheEntry *) hash_seq_search(&scan)))
+	{
+		/* hashvalue == 0 means a cache reset, and a wrapper affects all */
+		if (hashvalue == 0 || cacheid == FOREIGNDATAWRAPPEROID ||
+			(cacheid == FOREIGNTABLEREL &&
+			 entry->table_hashvalue == hashvalue) ||
+			(cacheid == FOREIGNSERVEROID &&
+			 entry->server_hashvalue == hashvalue))
+			entry->valid = false;
+	}
+}
+
+/*
+ * Replace the strings and lists of *opts by copies in the current memory
+ * context.
+ */
+static void
+copy_option_values(MonetdbFdwPlanState *opts)
+{
+	if (opts->table)
+		opts->table = pstrdup(opts->table);
+	if (opts->query)
+		opts->query = pstrdup(opts->query);
+	if (opts->monetdb_opt6)
+		opts->monetdb_opt6 = pstrdup(opts->monetdb_opt6);
+	if (opts->partition_column)
+		opts->partition_column = pstrdup(opts->partition_column);
+	opts->options = copyObject(opts->options);
+}
+
+/*
+ * Fetch the options for a monetdb_fdw foreign table into *opts, from the
+ * backend's cache if they are there.  The caller gets its own copy, which
+ * stays valid even if the cache entry is refilled meanwhile.
+ */
+static void
+monetdbGetOptions(Oid foreigntableid, MonetdbFdwPlanState *opts)
+{
+	OptionsCacheEntry *entry;
+	bool		found;
+
+	if (OptionsHash == NULL)
+	{
+		HASHCTL		ctl;
+
+		ctl.keysize = sizeof(Oid);
+		ctl.entrysize = sizeof(OptionsCacheEntry);
+		OptionsHash = hash_create("monetdb_fdw options", 64, &ctl,
+								  HASH_ELEM | HASH_BLOBS);
+
+		CacheRegisterSyscacheCallback(FOREIGNTABLEREL,
+									  options_inval_callback, (Datum) 0);
+		CacheRegisterSyscacheCallback(FOREIGNSERVEROID,
+									  options_inval_callback, (Datum) 0);
+		CacheRegisterSyscacheCallback(FOREIGNDATAWRAPPEROID,
+									  options_inval_callback, (Datum) 0);
 	}
 
+	entry = hash_search(OptionsHash, &foreigntableid, HASH_ENTER, &found);
+	if (!found)
+	{
+		entry->valid = false;
+		memset(&entry->opts, 0, sizeof(entry->opts));
+		entry->cxt = AllocSetContextCreate(CacheMemoryContext,
+										   "monetdb_fdw options",
+										   ALLOCSET_SMALL_SIZES);
+	}
+
+	if (!entry->valid)
+	{
+		MonetdbFdwPlanState resolved;
+		MemoryContext oldcontext;
+
+		/*
+		 * The catalog lookups may process invalidations, which clear valid
+		 * again if they concern this table; the entry is then refilled the
+		 * next time.
+		 */
+		entry->valid = true;
+		entry->table_hashvalue =
+			GetSysCacheHashValue1(FOREIGNTABLEREL,
+								  ObjectIdGetDatum(foreigntableid));
+
+		memset(&resolved, 0, sizeof(resolved));
+		resolve_options(foreigntableid, &resolved);
+
+		entry->server_hashvalue =
+			GetSysCacheHashValue1(FOREIGNSERVEROID,
+								  ObjectIdGetDatum(resolved.serverid));
+
+		MemoryContextReset(entry->cxt);
+		oldcontext = MemoryContextSwitchTo(entry->cxt);
+		copy_option_values(&resolved);
+		MemoryContextSwitchTo(oldcontext);
+		entry->opts = resolved;
+	}
+
+	*opts = entry->opts;
+	copy_option_values(opts);
+
 	/*
 	 * Check required option(s) here.
 	 */
-	if (host == NULL)
-		elog(ERROR, "monetdb_fdw: host is required for monetdb_fdw foreign tables");
-	if (port == NULL)
-		elog(ERROR, "monetdb_fdw: port is required for monetdb_fdw foreign tables");
-	if (user == NULL)
-		elog(ERROR, "monetdb_fdw: user is required for monetdb_fdw foreign tables");
-	if (passwd == NULL)
-		elog(ERROR, "monetdb_fdw: passwd is required for monetdb_fdw foreign tables");
-	if (dbname == NULL)
-		elog(ERROR, "monetdb_fdw: dbname is required for monetdb_fdw foreign tables");
-	if (tablename == NULL && query == NULL)
+	if (opts->table == NULL && opts->query == NULL)
 		elog(ERROR, "monetdb_fdw: table or query is required for monetdb_fdw foreign tables");
 #ifdef NOT_USED
-	if (monetdb_opt6 == NULL)
+	if (opts->monetdb_opt6 == NULL)
 		elog(ERROR, "monetdb_fdw: monetdb_opt6 is required for monetdb_fdw foreign tables");
 #endif
 
 #ifdef _DEBUG
-	elog(NOTICE, "monetdb_fdw: host=%s, port=%d, user=%s, pass=XXX, dbname=%s, table=%s, query=%s",
-		 *host,
-		 atoi(*port),
-		 *user,
-		 *dbname,
-		 *tablename,
-		 *query);
+	elog(NOTICE, "monetdb_fdw: server=%u, table=%s, query=%s",
+		 opts->serverid,
+		 opts->table,
+		 opts->query);
 #endif
+}
 
-	/* Other options */
-//	options = options;
+/*
+ * Run a statement that returns no rows.
+ */
+static void
+execute_remote_command(Mapi dbh, const char *sql)
+{
+	MapiHdl		hdl;
+
+	if ((hdl = mapi_query(dbh, sql)) == NULL || mapi_error(dbh) != MOK)
+		monetdbReportError(dbh, hdl, InvalidOid);
+	mapi_close_handle(hdl);
 }
 
+/*
+ * Run a "SELECT count(*)" statement on MonetDB and return the result.
+ */
 static double
+monetdbGetRemoteRowCount(UserMapping *user, const char *sql)
+{
+	Mapi		dbh;
+	MapiHdl		hdl = NULL;
+	char	   *count;
+	double		rows = 0;
+
+	dbh = monetdbGetConnection(user);
+
+	if ((hdl = mapi_query(dbh, sql)) == NULL || mapi_error(dbh) != MOK)
+		monetdbReportError(dbh, hdl, InvalidOid);
+
+	if (mapi_fetch_row(hdl) && (count = mapi_fetch_field(hdl, 0)) != NULL)
+		rows = strtod(count, NULL);
+
+	mapi_close_handle(hdl);
+	monetdbReleaseConnection(dbh);
+
+	return rows;
+}
+
+/*
+ * monetdbEstimateRowsImpl
+ *
+ * Estimate the number of rows the scan returns, their width, and the cost
+ * of the scan, and save them in fdw_private.
+ *
+ * With use_remote_estimate, MonetDB counts the rows that satisfy the
+ * pushed-down conditions; on a column store that is cheap.  Otherwise we
+ * work from the reltuples ANALYZE stored locally, or from a default guess
+ * if the table has never been analyzed.  Either way, local_conds are
+ * applied with our own selectivity estimates.
+ */
+static void
 monetdbEstimateRowsImpl(PlannerInfo *root,
 			 RelOptInfo *baserel,
 			 MonetdbFdwPlanState *fdw_private)
 {
-  //  estimate_size(root, baserel, fdw_private);
+	Selectivity local_selectivity;
+	QualCost	local_cost;
+	Cost		run_cost;
+	Cost		cpu_per_tuple;
 
-  /*
-   * TODO: Implement this function to estimate number of rows.
-   */
-  return atoi(fdw_private->port);
+	/*
+	 * If the table has never been analyzed, assume it has 10 pages, the
+	 * same guess the core planner uses for never-vacuumed heap tables.
+	 */
+	if (baserel->tuples < 0)
+	{
+		baserel->pages = 10;
+		baserel->tuples =
+			(10 * BLCKSZ) / (baserel->reltarget->width +
+							 MAXALIGN(SizeofHeapTupleHeader));
+	}
+
+	/* Estimate baserel size (rows and width) as best we can locally */
+	set_baserel_size_estimates(root, baserel);
+
+	local_selectivity = clauselist_selectivity(root,
+											   fdw_private->local_conds,
+											   baserel->relid,
+											   JOIN_INNER,
+											   NULL);
+
+	if (fdw_private->use_remote_estimate)
+	{
+		StringInfoData sql;
+
+		initStringInfo(&sql);
+		monetdbDeparseCountSql(&sql, root, baserel, fdw_private->remote_conds);
+		fdw_private->retrieved_rows =
+			clamp_row_est(monetdbGetRemoteRowCount(fdw_private->user, sql.data));
+		baserel->rows = clamp_row_est(fdw_private->retrieved_rows *
+									  local_selectivity);
+	}
+	else
+		fdw_private->retrieved_rows =
+			clamp_row_est(baserel->tuples *
+						  clauselist_selectivity(root,
+												 fdw_private->remote_conds,
+												 baserel->relid,
+												 JOIN_INNER,
+												 NULL));
+
+	/*
+	 * Cost the scan: a fixed connection/query overhead, then per row the
+	 * transfer cost plus our own per-tuple and local qual overhead.
+	 */
+	cost_qual_eval(&local_cost, fdw_private->local_conds, root);
+
+	cpu_per_tuple = cpu_tuple_cost + fdw_private->fdw_tuple_cost +
+		local_cost.per_tuple;
+	run_cost = cpu_per_tuple * fdw_private->retrieved_rows;
+
+	fdw_private->startup_cost = fdw_private->fdw_startup_cost +
+		local_cost.startup;
+	fdw_private->total_cost = fdw_private->startup_cost + run_cost;
 }
 
 /*
@@ -287,26 +867,61 @@ monetdbGetForeignRelSize(PlannerInfo *root,
 			  Oid foreigntableid)
 {
   MonetdbFdwPlanState *fdw_private;
+  ListCell   *lc;
 
   /*
    * Fetch options.  We only need filename at this point, but we might as
    * well get everything and not need to re-fetch it later in planning.
    */
-  fdw_private = (MonetdbFdwPlanState *) palloc(sizeof(MonetdbFdwPlanState));
+  fdw_private = (MonetdbFdwPlanState *) palloc0(sizeof(MonetdbFdwPlanState));
  
-  monetdbGetOptions(foreigntableid,
-					&fdw_private->host,
-					&fdw_private->port,
-					&fdw_private->user,
-					&fdw_private->passwd,
-					&fdw_private->dbname,
-					&fdw_private->table,
-					&fdw_private->query);
+  monetdbGetOptions(foreigntableid, fdw_private);
+
+  /*
+   * The user mapping to connect with, should we need to ask MonetDB for
+   * estimates.  Permissions are checked as the user the query runs as.
+   */
+  fdw_private->user = GetUserMapping(OidIsValid(baserel->userid) ?
+									 baserel->userid : GetUserId(),
+									 fdw_private->serverid);
 
   baserel->fdw_private = (void *) fdw_private;
 
-  /* Estimate relation size */
-  baserel->rows = monetdbEstimateRowsImpl(root, baserel, fdw_private);
+  /*
+   * Identify which baserestrictinfo clauses can be sent to MonetDB and
+   * which can't.  A pre-defined query is sent verbatim, so everything has
+   * to be checked locally in that case.
+   */
+  fdw_private->pushdown_safe = (fdw_private->query == NULL);
+  if (fdw_private->query)
+  {
+	  fdw_private->remote_conds = NIL;
+	  fdw_private->local_conds = baserel->baserestrictinfo;
+  }
+  else
+	  monetdbClassifyConditions(root, baserel, baserel->baserestrictinfo,
+								&fdw_private->remote_conds,
+								&fdw_private->local_conds);
+
+  /*
+   * Identify which attributes will need to be retrieved from MonetDB.
+   * These include all attrs needed for joins or final output, plus all
+   * attrs used in the local_conds.  Columns referenced only by remote_conds
+   * never have to be transferred.
+   */
+  fdw_private->attrs_used = NULL;
+  pull_varattnos((Node *) baserel->reltarget->exprs, baserel->relid,
+				 &fdw_private->attrs_used);
+  foreach(lc, fdw_private->local_conds)
+  {
+	  RestrictInfo *rinfo = lfirst_node(RestrictInfo, lc);
+
+	  pull_varattnos((Node *) rinfo->clause, baserel->relid,
+					 &fdw_private->attrs_used);
+  }
+
+  /* Estimate relation size and scan cost */
+  monetdbEstimateRowsImpl(root, baserel, fdw_private);
 }
 
 static void
@@ -331,10 +946,9 @@ monetdbGetForeignPaths(PlannerInfo *root,
 				      (Node *) columns));
 
 #endif
-  /* Estimate costs */
-  //  estimate_costs(root, baserel, fdw_private,
-  //		 &startup_cost, &total_cost);
-  total_cost = 0;
+  /* Costs were estimated in monetdbGetForeignRelSize() */
+  startup_cost = fdw_private->startup_cost;
+  total_cost = fdw_private->total_cost;
 
   /*
    * Create a ForeignPath node and add it as only possible path.  We use the
@@ -343,318 +957,3488 @@ monetdbGetForeignPaths(PlannerInfo *root,
    */
   add_path(baserel, (Path *)
 	   create_foreignscan_path(root, baserel,
+				   NULL,          /* default pathtarget */
 				   baserel->rows,
 				   startup_cost,
 				   total_cost,
 				   NIL,           /* no pathkeys */
 				   NULL,          /* no outer rel either */
+				   NULL,          /* no extra plan */
 				   coptions));
 
-  /*
-   * If data file was sorted, and we knew it somehow, we could insert
-   * appropriate pathkeys into the ForeignPath node to tell the planner
-   * that.
-   */
+  /* Add paths that have MonetDB sort the rows */
+  add_paths_with_pathkeys(root, baserel, fdw_private);
+
+  /* Add a path splitting the scan across parallel workers */
+  add_foreign_partial_path(root, baserel, foreigntableid, fdw_private);
+
+  /* Add paths for nested loops that pass the outer row's values down */
+  add_foreign_param_paths(root, baserel, fdw_private);
 }
 
-static ForeignScan *
-monetdbGetForeignPlan(PlannerInfo *root,
-		       RelOptInfo *baserel,
-		       Oid foreigntableid,
-		       ForeignPath *best_path,
-		       List *tlist,
-		       List *scan_clauses)
+/*
+ * Look up the partition_column of a foreign table.  It must be an integer
+ * column, as the table is split by the column's value.
+ */
+static AttrNumber
+get_partition_attnum(Oid foreigntableid, MonetdbFdwPlanState *fpinfo)
 {
-  Index           scan_relid = baserel->relid;
+	AttrNumber	attnum;
+	Oid			atttype;
+
+	attnum = get_attnum(foreigntableid, fpinfo->partition_column);
+	if (attnum == InvalidAttrNumber)
+		elog(ERROR, "monetdb_fdw: partition_column \"%s\" does not exist",
+			 fpinfo->partition_column);
+
+	atttype = get_atttype(foreigntableid, attnum);
+	if (atttype != INT2OID && atttype != INT4OID && atttype != INT8OID)
+		elog(ERROR, "monetdb_fdw: partition_column \"%s\" must be of an integer type",
+			 fpinfo->partition_column);
+
+	return attnum;
+}
+
+/*
+ * Add a partial path for a table with a partition_column.  The table is
+ * split into partition_count chunks by the column's value; each process of
+ * the parallel scan runs the query once for each chunk it claims.  Every
+ * chunk is a query of its own, so each costs fdw_startup_cost again.
+ */
+static void
+add_foreign_partial_path(PlannerInfo *root, RelOptInfo *baserel,
+						 Oid foreigntableid, MonetdbFdwPlanState *fpinfo)
+{
+	ForeignPath *path;
+	int			parallel_workers;
+	double		parallel_divisor;
+	double		leader_contribution;
+	Cost		run_cost;
+
+	if (fpinfo->partition_column == NULL || !fpinfo->pushdown_safe ||
+		!baserel->consider_parallel || baserel->lateral_relids)
+		return;
+
+	(void) get_partition_attnum(foreigntableid, fpinfo);
+
+	parallel_workers = Min(max_parallel_workers_per_gather,
+						   fpinfo->partition_count - 1);
+	if (parallel_workers <= 0)
+		return;
+
+	/* as in costsize.c, the leader spends some of its time on the Gather */
+	parallel_divisor = parallel_workers;
+	leader_contribution = 1.0 - (0.3 * parallel_workers);
+	if (parallel_leader_participation && leader_contribution > 0)
+		parallel_divisor += leader_contribution;
+
+	run_cost = (fpinfo->total_cost - fpinfo->startup_cost) +
+		fpinfo->fdw_startup_cost * (fpinfo->partition_count - 1);
+
+	path = create_foreignscan_path(root, baserel,
+								   NULL,
+								   clamp_row_est(baserel->rows / parallel_divisor),
+								   fpinfo->startup_cost,
+								   fpinfo->startup_cost + run_cost / parallel_divisor,
+								   NIL,
+								   NULL,
+								   NULL,
+								   NIL);
+	path->path.parallel_aware = true;
+	path->path.parallel_workers = parallel_workers;
+
+	add_partial_path(baserel, (Path *) path);
+}
+
+/*
+ * Argument of ec_member_matches_foreign: the expression of the foreign
+ * relation looked for in this round, and those already looked for.
+ */
+typedef struct
+{
+	Expr	   *current;
+	List	   *already_used;
+} ec_member_foreign_arg;
+
+/*
+ * Callback for generate_implied_equalities_for_column: pick the members of
+ * the equivalence classes that are one expression of the foreign relation,
+ * a different one in each round.
+ */
+static bool
+ec_member_matches_foreign(PlannerInfo *root, RelOptInfo *rel,
+						  EquivalenceClass *ec, EquivalenceMember *em,
+						  void *arg)
+{
+	ec_member_foreign_arg *state = (ec_member_foreign_arg *) arg;
+	Expr	   *expr = em->em_expr;
+
+	/* once an expression is picked, match only that one this round */
+	if (state->current != NULL)
+		return equal(expr, state->current);
+
+	if (list_member(state->already_used, expr))
+		return false;
+
+	state->current = expr;
+	return true;
+}
+
+/*
+ * If rinfo is a join clause MonetDB can check, add the ParamPathInfo for
+ * the outer relations it needs to *ppi_list.
+ */
+static void
+add_param_path_info(PlannerInfo *root, RelOptInfo *baserel,
+					RestrictInfo *rinfo, List **ppi_list)
+{
+	Relids		required_outer;
+
+	if (!join_clause_is_movable_to(rinfo, baserel))
+		return;
+
+	if (!monetdbIsForeignExpr(root, baserel, rinfo->clause))
+		return;
+
+	required_outer = bms_union(rinfo->clause_relids, baserel->lateral_relids);
+	required_outer = bms_del_member(required_outer, baserel->relid);
+	if (bms_is_empty(required_outer))
+		return;
+
+	*ppi_list = list_append_unique_ptr(*ppi_list,
+									   get_baserel_parampathinfo(root, baserel,
+																 required_outer));
+}
+
+/*
+ * Add paths that take the values of columns of other relations as
+ * parameters, and have MonetDB check the join clauses comparing them.
+ * In a nested loop, such a scan returns only the rows matching the outer
+ * row at hand, instead of the whole table for the join to be done here.
+ *
+ * The join clauses come from joininfo, and from the equivalence classes
+ * for the equalities those imply.
+ */
+static void
+add_foreign_param_paths(PlannerInfo *root, RelOptInfo *baserel,
+						MonetdbFdwPlanState *fpinfo)
+{
+	List	   *ppi_list = NIL;
+	ListCell   *lc;
+
+	if (!fpinfo->pushdown_safe)
+		return;
+
+	foreach(lc, baserel->joininfo)
+		add_param_path_info(root, baserel, lfirst_node(RestrictInfo, lc),
+							&ppi_list);
+
+	if (baserel->has_eclass_joins)
+	{
+		ec_member_foreign_arg arg;
+
+		arg.already_used = NIL;
+		for (;;)
+		{
+			List	   *clauses;
+
+			arg.current = NULL;
+			clauses = generate_implied_equalities_for_column(root, baserel,
+															 ec_member_matches_foreign,
+															 (void *) &arg,
+															 baserel->lateral_referencers);
+
+			/* done when no expression of the relation is left */
+			if (arg.current == NULL)
+				break;
+
+			foreach(lc, clauses)
+				add_param_path_info(root, baserel, lfirst_node(RestrictInfo, lc),
+									&ppi_list);
+
+			arg.already_used = lappend(arg.already_used, arg.current);
+		}
+	}
+
+	/*
+	 * Cost each path like the unparameterized one, with the shippable join
+	 * clauses counted as remote conditions.  Every rescan is a query of its
+	 * own, so fdw_startup_cost is paid once per outer row.
+	 */
+	foreach(lc, ppi_list)
+	{
+		ParamPathInfo *param_info = (ParamPathInfo *) lfirst(lc);
+		List	   *remote_conds = list_copy(fpinfo->remote_conds);
+		List	   *local_conds = list_copy(fpinfo->local_conds);
+		ListCell   *lc2;
+		QualCost	local_cost;
+		double		retrieved_rows;
+		Cost		startup_cost;
+		Cost		total_cost;
+
+		foreach(lc2, param_info->ppi_clauses)
+		{
+			RestrictInfo *rinfo = lfirst_node(RestrictInfo, lc2);
+
+			if (monetdbIsForeignExpr(root, baserel, rinfo->clause))
+				remote_conds = lappend(remote_conds, rinfo);
+			else
+				local_conds = lappend(local_conds, rinfo);
+		}
+
+		retrieved_rows =
+			clamp_row_est(baserel->tuples *
+						  clauselist_selectivity(root, remote_conds,
+												 baserel->relid,
+												 JOIN_INNER, NULL));
+		cost_qual_eval(&local_cost, local_conds, root);
+
+		startup_cost = fpinfo->fdw_startup_cost + local_cost.startup;
+		total_cost = startup_cost + retrieved_rows *
+			(cpu_tuple_cost + fpinfo->fdw_tuple_cost + local_cost.per_tuple);
+
+		add_path(baserel, (Path *)
+				 create_foreignscan_path(root, baserel,
+										 NULL,
+										 param_info->ppi_rows,
+										 startup_cost,
+										 total_cost,
+										 NIL,
+										 param_info->ppi_req_outer,
+										 NULL,
+										 NIL));
+	}
+}
+
+/*
+ * Return the orderings of rel's rows that the rest of the query can use
+ * and MonetDB can produce: the query's own ordering (for ORDER BY, or
+ * GROUP BY done locally), and the single keys of merge joins with other
+ * relations.
+ */
+static List *
+get_useful_pathkeys_for_relation(PlannerInfo *root, RelOptInfo *rel)
+{
+	List	   *useful_pathkeys_list = NIL;
+	ListCell   *lc;
+
+	if (root->query_pathkeys)
+	{
+		bool		query_pathkeys_ok = true;
+
+		foreach(lc, root->query_pathkeys)
+		{
+			if (!monetdbIsForeignPathKey(root, rel, (PathKey *) lfirst(lc)))
+			{
+				query_pathkeys_ok = false;
+				break;
+			}
+		}
+
+		if (query_pathkeys_ok)
+			useful_pathkeys_list = list_make1(list_copy(root->query_pathkeys));
+	}
+
+	if (!rel->has_eclass_joins)
+		return useful_pathkeys_list;
+
+	foreach(lc, root->eq_classes)
+	{
+		EquivalenceClass *ec = (EquivalenceClass *) lfirst(lc);
+		PathKey    *pathkey;
+
+		if (!eclass_useful_for_merging(root, ec, rel))
+			continue;
+
+		pathkey = make_canonical_pathkey(root, ec,
+										 linitial_oid(ec->ec_opfamilies),
+										 BTLessStrategyNumber,
+										 false);
+
+		/* already added if it is the whole query ordering */
+		if (root->query_pathkeys &&
+			linitial(root->query_pathkeys) == pathkey &&
+			list_length(root->query_pathkeys) == 1)
+			continue;
+
+		if (monetdbIsForeignPathKey(root, rel, pathkey))
+			useful_pathkeys_list = lappend(useful_pathkeys_list,
+										   list_make1(pathkey));
+	}
+
+	return useful_pathkeys_list;
+}
+
+/*
+ * Add a sorted path to the scan or join rel for each useful ordering.
+ * The ORDER BY is added to the remote query by monetdbGetForeignPlan(),
+ * from the path's pathkeys.
+ */
+static void
+add_paths_with_pathkeys(PlannerInfo *root, RelOptInfo *rel,
+						MonetdbFdwPlanState *fpinfo)
+{
+	ListCell   *lc;
+
+	if (!fpinfo->pushdown_safe)
+		return;
+
+	foreach(lc, get_useful_pathkeys_for_relation(root, rel))
+	{
+		List	   *pathkeys = (List *) lfirst(lc);
+		Cost		startup_cost = fpinfo->startup_cost * DEFAULT_FDW_SORT_MULTIPLIER;
+		Cost		total_cost = fpinfo->total_cost * DEFAULT_FDW_SORT_MULTIPLIER;
+
+		if (IS_JOIN_REL(rel))
+			add_path(rel, (Path *)
+					 create_foreign_join_path(root, rel,
+											  NULL,
+											  rel->rows,
+											  startup_cost,
+											  total_cost,
+											  pathkeys,
+											  rel->lateral_relids,
+											  NULL,
+											  NIL));
+		else
+			add_path(rel, (Path *)
+					 create_foreignscan_path(root, rel,
+											 NULL,
+											 rel->rows,
+											 startup_cost,
+											 total_cost,
+											 pathkeys,
+											 NULL,
+											 NULL,
+											 NIL));
+	}
+}
+
+/*
+ * Decide whether the join of outerrel and innerrel can be done by MonetDB,
+ * and if so, fill in the join's fdw_private.
+ *
+ * Both sides must be scans, or joins we already pushed down, on the same
+ * server, and must check no conditions locally: a row that fails one of
+ * them might already have been joined by MonetDB.
+ */
+static bool
+foreign_join_ok(PlannerInfo *root, RelOptInfo *joinrel, JoinType jointype,
+				RelOptInfo *outerrel, RelOptInfo *innerrel,
+				JoinPathExtraData *extra)
+{
+	MonetdbFdwPlanState *fpinfo = (MonetdbFdwPlanState *) joinrel->fdw_private;
+	MonetdbFdwPlanState *fpinfo_o = (MonetdbFdwPlanState *) outerrel->fdw_private;
+	MonetdbFdwPlanState *fpinfo_i = (MonetdbFdwPlanState *) innerrel->fdw_private;
+	ListCell   *lc;
+	List	   *joinclauses = NIL;
+
+	if (jointype != JOIN_INNER && jointype != JOIN_LEFT &&
+		jointype != JOIN_RIGHT && jointype != JOIN_FULL)
+		return false;
+
+	if (fpinfo_o == NULL || fpinfo_i == NULL ||
+		!fpinfo_o->pushdown_safe || !fpinfo_i->pushdown_safe)
+		return false;
+
+	if (fpinfo_o->local_conds || fpinfo_i->local_conds)
+		return false;
+
+	if (fpinfo_o->serverid != fpinfo_i->serverid ||
+		fpinfo_o->user->umid != fpinfo_i->user->umid)
+		return false;
+
+	/*
+	 * Split the restrictlist.  For an outer join, the clauses of the join
+	 * itself belong in the ON clause and have to be pushed down; any other
+	 * clause is applied to the join result, remotely or locally.
+	 */
+	foreach(lc, extra->restrictlist)
+	{
+		RestrictInfo *rinfo = lfirst_node(RestrictInfo, lc);
+		bool		is_remote_clause = monetdbIsForeignExpr(root, joinrel,
+															rinfo->clause);
+
+		if (IS_OUTER_JOIN(jointype) &&
+			!RINFO_IS_PUSHED_DOWN(rinfo, joinrel->relids))
+		{
+			if (!is_remote_clause)
+				return false;
+			joinclauses = lappend(joinclauses, rinfo);
+		}
+		else
+		{
+			if (is_remote_clause)
+				fpinfo->remote_conds = lappend(fpinfo->remote_conds, rinfo);
+			else
+				fpinfo->local_conds = lappend(fpinfo->local_conds, rinfo);
+		}
+	}
+
+	/*
+	 * A PlaceHolderVar evaluated at this join, or a whole-row or system
+	 * column reference, would need an expression MonetDB can't give us.
+	 */
+	foreach(lc, root->placeholder_list)
+	{
+		PlaceHolderInfo *phinfo = lfirst(lc);
+		Relids		relids;
+
+		relids = IS_OTHER_REL(joinrel) ? joinrel->top_parent_relids :
+			joinrel->relids;
+		if (bms_is_subset(phinfo->ph_eval_at, relids) &&
+			bms_nonempty_difference(relids, phinfo->ph_eval_at))
+			return false;
+	}
+
+	foreach(lc, pull_var_clause((Node *) joinrel->reltarget->exprs,
+								PVC_RECURSE_PLACEHOLDERS))
+	{
+		Var		   *var = (Var *) lfirst(lc);
+
+		if (!IsA(var, Var) || var->varattno <= 0)
+			return false;
+	}
+
+	/*
+	 * The inputs' WHERE conditions have to go somewhere in the join.  For
+	 * an inner join they simply apply to the result.  On the nullable side
+	 * of an outer join they move into the ON clause; on the other side they
+	 * still filter the result.  A full join has no such place, so we only
+	 * push it down between unfiltered relations.
+	 */
+	switch (jointype)
+	{
+		case JOIN_INNER:
+			fpinfo->remote_conds = list_concat(fpinfo->remote_conds,
+											   fpinfo_i->remote_conds);
+			fpinfo->remote_conds = list_concat(fpinfo->remote_conds,
+											   fpinfo_o->remote_conds);
+			break;
+
+		case JOIN_LEFT:
+			joinclauses = list_concat(joinclauses, fpinfo_i->remote_conds);
+			fpinfo->remote_conds = list_concat(fpinfo->remote_conds,
+											   fpinfo_o->remote_conds);
+			break;
+
+		case JOIN_RIGHT:
+			joinclauses = list_concat(joinclauses, fpinfo_o->remote_conds);
+			fpinfo->remote_conds = list_concat(fpinfo->remote_conds,
+											   fpinfo_i->remote_conds);
+			break;
+
+		case JOIN_FULL:
+			if (fpinfo_o->remote_conds || fpinfo_i->remote_conds)
+				return false;
+			break;
+
+		default:
+			elog(ERROR, "monetdb_fdw: unsupported join type %d", (int) jointype);
+	}
+
+	/*
+	 * For an inner join all conditions are equivalent; put them in the ON
+	 * clause, where a reader of the remote query expects them.
+	 */
+	if (jointype == JOIN_INNER)
+	{
+		joinclauses = fpinfo->remote_conds;
+		fpinfo->remote_conds = NIL;
+	}
+
+	fpinfo->joinclauses = joinclauses;
+	fpinfo->pushdown_safe = true;
+
+	return true;
+}
+
+/*
+ * monetdbGetForeignJoinPaths
+ *
+ * Add a path that has MonetDB do the join of two foreign tables, or of
+ * joins we already pushed down, on the same server.
+ */
+static void
+monetdbGetForeignJoinPaths(PlannerInfo *root,
+						   RelOptInfo *joinrel,
+						   RelOptInfo *outerrel,
+						   RelOptInfo *innerrel,
+						   JoinType jointype,
+						   JoinPathExtraData *extra)
+{
+	MonetdbFdwPlanState *fpinfo_o = (MonetdbFdwPlanState *) outerrel->fdw_private;
+	MonetdbFdwPlanState *fpinfo;
+	ForeignPath *joinpath;
+	Selectivity local_selectivity;
+	QualCost	local_cost;
+	Cost		startup_cost;
+	Cost		run_cost;
+
+	/*
+	 * The join is considered once per pair of inputs; its paths are all the
+	 * same for us, so one is enough.
+	 */
+	if (joinrel->fdw_private)
+		return;
+
+	/*
+	 * We can't recheck a joined row from MonetDB when a concurrent update
+	 * is found (EvalPlanQual), so leave locking joins to the executor.
+	 */
+	if (root->parse->commandType != CMD_SELECT || root->parse->rowMarks)
+		return;
+
+	/*
+	 * Mark the join as considered before anything can fail; a join we can't
+	 * push down stays marked unsafe, so no join above it is pushed either.
+	 */
+	fpinfo = (MonetdbFdwPlanState *) palloc0(sizeof(MonetdbFdwPlanState));
+	fpinfo->pushdown_safe = false;
+	joinrel->fdw_private = fpinfo;
+
+	if (fpinfo_o == NULL)
+		return;
+
+	/* The join uses the connection and cost options of its outer side */
+	fpinfo->serverid = fpinfo_o->serverid;
+	fpinfo->user = fpinfo_o->user;
+	fpinfo->options = fpinfo_o->options;
+	fpinfo->use_remote_estimate = fpinfo_o->use_remote_estimate;
+	fpinfo->fdw_startup_cost = fpinfo_o->fdw_startup_cost;
+	fpinfo->fdw_tuple_cost = fpinfo_o->fdw_tuple_cost;
+	fpinfo->fetch_size = fpinfo_o->fetch_size;
+	fpinfo->async_capable = fpinfo_o->async_capable;
+	fpinfo->rescan_cache = fpinfo_o->rescan_cache;
+	fpinfo->prefetch_depth = fpinfo_o->prefetch_depth;
+	fpinfo->binary_transfer = fpinfo_o->binary_transfer;
+	fpinfo->binary_threshold = fpinfo_o->binary_threshold;
+	fpinfo->outerrel = outerrel;
+	fpinfo->innerrel = innerrel;
+	fpinfo->jointype = jointype;
+
+	if (!foreign_join_ok(root, joinrel, jointype, outerrel, innerrel, extra))
+		return;
+
+	/*
+	 * Estimate the rows MonetDB sends back; joinrel->rows, computed by the
+	 * core planner, is what remains after local_conds.
+	 */
+	local_selectivity = clauselist_selectivity(root, fpinfo->local_conds, 0,
+											   JOIN_INNER, NULL);
+	if (fpinfo->use_remote_estimate)
+	{
+		StringInfoData sql;
+
+		initStringInfo(&sql);
+		monetdbDeparseCountSql(&sql, root, joinrel, fpinfo->remote_conds);
+		fpinfo->retrieved_rows =
+			clamp_row_est(monetdbGetRemoteRowCount(fpinfo->user, sql.data));
+		joinrel->rows = clamp_row_est(fpinfo->retrieved_rows *
+									  local_selectivity);
+	}
+	else
+		fpinfo->retrieved_rows = clamp_row_est(joinrel->rows /
+											   Max(local_selectivity, 1e-10));
+
+	/*
+	 * MonetDB reads both inputs and joins them; only the result crosses
+	 * the network.
+	 */
+	cost_qual_eval(&local_cost, fpinfo->local_conds, root);
+	startup_cost = fpinfo->fdw_startup_cost + local_cost.startup;
+	run_cost = cpu_tuple_cost * (outerrel->rows + innerrel->rows);
+	run_cost += (cpu_tuple_cost + fpinfo->fdw_tuple_cost +
+				 local_cost.per_tuple) * fpinfo->retrieved_rows;
+
+	fpinfo->startup_cost = startup_cost;
+	fpinfo->total_cost = startup_cost + run_cost;
+
+	joinpath = create_foreign_join_path(root,
+										joinrel,
+										NULL,	/* default pathtarget */
+										joinrel->rows,
+										fpinfo->startup_cost,
+										fpinfo->total_cost,
+										NIL,	/* no pathkeys */
+										joinrel->lateral_relids,
+										NULL,	/* no EPQ plan */
+										NIL);	/* no fdw_private */
+
+	add_path(joinrel, (Path *) joinpath);
+
+	/* Add paths that have MonetDB sort the result of the join */
+	add_paths_with_pathkeys(root, joinrel, fpinfo);
+}
+
+/*
+ * Decide whether the grouping and aggregation of grouped_rel can be done
+ * by MonetDB.  If so, build the target list MonetDB has to return in
+ * fpinfo->grouped_tlist, and split the HAVING clause into the conditions
+ * MonetDB evaluates and the ones we check locally.
+ */
+static bool
+foreign_grouping_ok(PlannerInfo *root, RelOptInfo *grouped_rel,
+					Node *havingQual)
+{
+	Query	   *query = root->parse;
+	PathTarget *grouping_target = grouped_rel->reltarget;
+	MonetdbFdwPlanState *fpinfo = (MonetdbFdwPlanState *) grouped_rel->fdw_private;
+	MonetdbFdwPlanState *ofpinfo = (MonetdbFdwPlanState *) fpinfo->outerrel->fdw_private;
+	List	   *tlist = NIL;
+	ListCell   *lc;
+	int			i;
+
+	/* We don't do grouping sets */
+	if (query->groupingSets)
+		return false;
+
+	/*
+	 * Rows that fail local_conds would be aggregated by MonetDB before we
+	 * could filter them out.
+	 */
+	if (ofpinfo->local_conds)
+		return false;
+
+	/*
+	 * Walk the grouping target.  Grouping columns are sent as they are;
+	 * anything else must either be computable by MonetDB as a whole, or be
+	 * an expression over shippable aggregates we can finish locally.
+	 */
+	i = 0;
+	foreach(lc, grouping_target->exprs)
+	{
+		Expr	   *expr = (Expr *) lfirst(lc);
+		Index		sgref = get_pathtarget_sortgroupref(grouping_target, i);
+
+		if (sgref && get_sortgroupref_clause_noerr(sgref, query->groupClause))
+		{
+			TargetEntry *tle;
+
+			/* MonetDB can only group by plain columns */
+			if (!IsA(expr, Var) ||
+				!monetdbIsForeignExpr(root, grouped_rel, expr))
+				return false;
+
+			tle = makeTargetEntry(expr, list_length(tlist) + 1, NULL, false);
+			tle->ressortgroupref = sgref;
+			tlist = lappend(tlist, tle);
+		}
+		else if (monetdbIsForeignExpr(root, grouped_rel, expr))
+			tlist = add_to_flat_tlist(tlist, list_make1(expr));
+		else
+		{
+			List	   *aggvars;
+
+			aggvars = pull_var_clause((Node *) expr, PVC_INCLUDE_AGGREGATES);
+			if (!monetdbIsForeignExpr(root, grouped_rel, (Expr *) aggvars))
+				return false;
+
+			/* Vars here are grouping columns, already in the tlist */
+			tlist = add_to_flat_tlist(tlist, aggvars);
+		}
+
+		i++;
+	}
+
+	/* Classify the HAVING conditions */
+	if (havingQual)
+	{
+		foreach(lc, (List *) havingQual)
+		{
+			Expr	   *expr = (Expr *) lfirst(lc);
+			RestrictInfo *rinfo;
+
+			rinfo = make_restrictinfo(root,
+									  expr,
+									  true,
+									  false,
+									  false,
+									  root->qual_security_level,
+									  grouped_rel->relids,
+									  NULL,
+									  NULL);
+			if (monetdbIsForeignExpr(root, grouped_rel, expr))
+				fpinfo->remote_conds = lappend(fpinfo->remote_conds, rinfo);
+			else
+				fpinfo->local_conds = lappend(fpinfo->local_conds, rinfo);
+		}
+	}
+
+	/*
+	 * The aggregates the local HAVING conditions use have to be computed
+	 * remotely as well.
+	 */
+	foreach(lc, fpinfo->local_conds)
+	{
+		RestrictInfo *rinfo = lfirst_node(RestrictInfo, lc);
+		List	   *aggvars;
+
+		aggvars = pull_var_clause((Node *) rinfo->clause, PVC_INCLUDE_AGGREGATES);
+		if (!monetdbIsForeignExpr(root, grouped_rel, (Expr *) aggvars))
+			return false;
+		tlist = add_to_flat_tlist(tlist, aggvars);
+	}
+
+	fpinfo->grouped_tlist = tlist;
+
+	return true;
+}
+
+/*
+ * Estimate the number of groups and the cost of having MonetDB compute
+ * them, the way monetdbEstimateRowsImpl does for a scan.
+ *
+ * MonetDB still reads every input row, but only the groups cross the
+ * network, so the transfer cost is charged per group instead of per input
+ * row.  That is what makes the pushed-down path win over aggregating
+ * locally.
+ */
+static void
+monetdbEstimateGroupingImpl(PlannerInfo *root,
+							RelOptInfo *grouped_rel,
+							MonetdbFdwPlanState *fpinfo)
+{
+	MonetdbFdwPlanState *ofpinfo = (MonetdbFdwPlanState *) fpinfo->outerrel->fdw_private;
+	AggClauseCosts aggcosts;
+	QualCost	local_cost;
+	List	   *group_exprs;
+	double		input_rows = ofpinfo->retrieved_rows;
+	double		num_groups;
+	int			num_group_cols = list_length(root->parse->groupClause);
+	Cost		startup_cost;
+	Cost		run_cost;
+
+	MemSet(&aggcosts, 0, sizeof(AggClauseCosts));
+	get_agg_clause_costs(root, AGGSPLIT_SIMPLE, &aggcosts);
+
+	if (fpinfo->use_remote_estimate)
+	{
+		StringInfoData sql;
+
+		initStringInfo(&sql);
+		monetdbDeparseCountSql(&sql, root, grouped_rel, fpinfo->remote_conds);
+		fpinfo->retrieved_rows =
+			clamp_row_est(monetdbGetRemoteRowCount(fpinfo->user, sql.data));
+		num_groups = fpinfo->retrieved_rows;
+	}
+	else
+	{
+		group_exprs = get_sortgrouplist_exprs(root->parse->groupClause,
+											  fpinfo->grouped_tlist);
+		num_groups = estimate_num_groups(root, group_exprs, input_rows,
+										 NULL, NULL);
+		fpinfo->retrieved_rows =
+			clamp_row_est(num_groups *
+						  clauselist_selectivity(root, fpinfo->remote_conds,
+												 0, JOIN_INNER, NULL));
+	}
+
+	grouped_rel->rows =
+		clamp_row_est(fpinfo->retrieved_rows *
+					  clauselist_selectivity(root, fpinfo->local_conds,
+											 0, JOIN_INNER, NULL));
+
+	/* Aggregation done by MonetDB, costed as if we did it */
+	startup_cost = fpinfo->fdw_startup_cost;
+	startup_cost += aggcosts.transCost.startup;
+	startup_cost += aggcosts.transCost.per_tuple * input_rows;
+	startup_cost += aggcosts.finalCost.startup;
+	startup_cost += (cpu_operator_cost * num_group_cols) * input_rows;
+
+	run_cost = (aggcosts.finalCost.per_tuple + cpu_tuple_cost) * num_groups;
+
+	/* Transfer of the groups, and the local HAVING conditions */
+	cost_qual_eval(&local_cost, fpinfo->local_conds, root);
+	startup_cost += local_cost.startup;
+	run_cost += (cpu_tuple_cost + fpinfo->fdw_tuple_cost +
+				 local_cost.per_tuple) * fpinfo->retrieved_rows;
+
+	fpinfo->startup_cost = startup_cost;
+	fpinfo->total_cost = startup_cost + run_cost;
+}
+
+/*
+ * Add a path that has MonetDB do the grouping and aggregation of a query
+ * over a foreign table, or a join of foreign tables pushed down.
+ */
+static void
+add_foreign_grouping_paths(PlannerInfo *root,
+						   RelOptInfo *input_rel,
+						   RelOptInfo *grouped_rel,
+						   GroupPathExtraData *extra)
+{
+	MonetdbFdwPlanState *fpinfo = (MonetdbFdwPlanState *) grouped_rel->fdw_private;
+	Query	   *parse = root->parse;
+	ForeignPath *grouppath;
+
+	/* Only plain aggregation; no partitionwise partial aggregates */
+	if (extra->patype != PARTITIONWISE_AGGREGATE_NONE)
+		return;
+
+	/* Nothing to be done, if there is no grouping or aggregation required */
+	if (!parse->groupClause && !parse->groupingSets && !parse->hasAggs &&
+		!root->hasHavingQual)
+		return;
+
+	if (!foreign_grouping_ok(root, grouped_rel, extra->havingQual))
+		return;
+
+	monetdbEstimateGroupingImpl(root, grouped_rel, fpinfo);
+	fpinfo->pushdown_safe = true;
+
+	grouppath = create_foreign_upper_path(root,
+										  grouped_rel,
+										  grouped_rel->reltarget,
+										  grouped_rel->rows,
+										  fpinfo->startup_cost,
+										  fpinfo->total_cost,
+										  NIL,	/* no pathkeys */
+										  NULL,	/* no extra plan */
+										  NIL);	/* no fdw_private */
+
+	add_path(grouped_rel, (Path *) grouppath);
+}
+
+/*
+ * Estimate the cost of having MonetDB return the rows of rel, a scan, join
+ * or grouped relation, sorted by pathkeys.
+ *
+ * Sorting the groups of a grouped relation is costed like a local sort of
+ * them; limit_tuples allows for a LIMIT above.  For scans and joins we can
+ * only guess, as for their sorted paths.
+ */
+static void
+monetdbEstimateSortedCost(PlannerInfo *root, RelOptInfo *rel,
+						  List *pathkeys, double limit_tuples,
+						  Cost *startup_cost, Cost *total_cost)
+{
+	MonetdbFdwPlanState *fpinfo = (MonetdbFdwPlanState *) rel->fdw_private;
+
+	if (pathkeys == NIL)
+	{
+		*startup_cost = fpinfo->startup_cost;
+		*total_cost = fpinfo->total_cost;
+	}
+	else if (IS_UPPER_REL(rel))
+	{
+		Path		sort_path;
+
+		cost_sort(&sort_path, root, pathkeys, fpinfo->total_cost,
+				  fpinfo->retrieved_rows, rel->reltarget->width,
+				  0.0, work_mem, limit_tuples);
+		*startup_cost = sort_path.startup_cost;
+		*total_cost = sort_path.total_cost;
+	}
+	else
+	{
+		*startup_cost = fpinfo->startup_cost * DEFAULT_FDW_SORT_MULTIPLIER;
+		*total_cost = fpinfo->total_cost * DEFAULT_FDW_SORT_MULTIPLIER;
+	}
+}
+
+/*
+ * Record whether the ORDER BY of the query can be done by MonetDB, and
+ * for a grouped input, add a path that does it.
+ *
+ * A scan or join already has a sorted path for the ORDER BY, since it is
+ * the query's ordering then; the core planner uses that one as it is.
+ * This stage still notes that the ordering was pushable, for the LIMIT.
+ */
+static void
+add_foreign_ordered_paths(PlannerInfo *root,
+						  RelOptInfo *input_rel,
+						  RelOptInfo *ordered_rel)
+{
+	MonetdbFdwPlanState *ifpinfo = (MonetdbFdwPlanState *) input_rel->fdw_private;
+	MonetdbFdwPlanState *fpinfo = (MonetdbFdwPlanState *) ordered_rel->fdw_private;
+	Query	   *parse = root->parse;
+	ListCell   *lc;
+	ForeignPath *ordered_path;
+
+	/* DISTINCT and window functions are done locally, before the sort */
+	if (parse->distinctClause || parse->hasWindowFuncs)
+		return;
+
+	/* Set-returning functions in the target list are evaluated locally */
+	if (parse->hasTargetSRFs)
+		return;
+
+	foreach(lc, root->sort_pathkeys)
+	{
+		if (!monetdbIsForeignPathKey(root, input_rel, (PathKey *) lfirst(lc)))
+			return;
+	}
+
+	fpinfo->local_conds = ifpinfo->local_conds;
+	fpinfo->pushdown_safe = true;
+
+	if (!IS_UPPER_REL(input_rel))
+		return;
+
+	monetdbEstimateSortedCost(root, input_rel, root->sort_pathkeys, -1.0,
+							  &fpinfo->startup_cost, &fpinfo->total_cost);
+	fpinfo->retrieved_rows = ifpinfo->retrieved_rows;
+
+	ordered_path = create_foreign_upper_path(root,
+											 ordered_rel,
+											 root->upper_targets[UPPERREL_ORDERED],
+											 input_rel->rows,
+											 fpinfo->startup_cost,
+											 fpinfo->total_cost,
+											 root->sort_pathkeys,
+											 NULL,	/* no extra plan */
+											 NIL);	/* no fdw_private */
+
+	add_path(ordered_rel, (Path *) ordered_path);
+}
+
+/*
+ * Add a path that has MonetDB apply the query's LIMIT and OFFSET, so that
+ * it stops after the rows we need instead of sending all of them.
+ */
+static void
+add_foreign_final_paths(PlannerInfo *root,
+						RelOptInfo *input_rel,
+						RelOptInfo *final_rel,
+						FinalPathExtraData *extra)
+{
+	MonetdbFdwPlanState *ifpinfo = (MonetdbFdwPlanState *) input_rel->fdw_private;
+	MonetdbFdwPlanState *fpinfo = (MonetdbFdwPlanState *) final_rel->fdw_private;
+	MonetdbFdwPlanState *ofpinfo;
+	Query	   *parse = root->parse;
+	RelOptInfo *outerrel;
+	List	   *pathkeys = NIL;
+	double		rows;
+	double		fetched_rows;
+	Cost		startup_cost;
+	Cost		total_cost;
+	ForeignPath *final_path;
+
+	/* Only a LIMIT is left to push down at this stage */
+	if (!extra->limit_needed)
+		return;
+
+	/* Row locking and set-returning functions happen above the LIMIT */
+	if (parse->commandType != CMD_SELECT || parse->rowMarks ||
+		parse->hasTargetSRFs)
+		return;
+
+	if (parse->limitOption == LIMIT_OPTION_WITH_TIES)
+		return;
+
+	/* MonetDB needs the numbers in the statement */
+	if ((parse->limitCount && !IsA(parse->limitCount, Const)) ||
+		(parse->limitOffset && !IsA(parse->limitOffset, Const)))
+		return;
+
+	/*
+	 * With an ORDER BY, the input is the ordered relation, and the ORDER BY
+	 * must have been pushable too.  Otherwise the input is the scan, join
+	 * or grouped relation itself.
+	 */
+	if (IS_UPPER_REL(input_rel) && ifpinfo->stage == UPPERREL_ORDERED)
+	{
+		outerrel = ifpinfo->outerrel;
+		pathkeys = root->sort_pathkeys;
+	}
+	else if (parse->sortClause == NIL)
+		outerrel = input_rel;
+	else
+		return;
+
+	/* Every row MonetDB sends must be one we return */
+	ofpinfo = (MonetdbFdwPlanState *) outerrel->fdw_private;
+	if (ofpinfo->local_conds)
+		return;
+
+	monetdbEstimateSortedCost(root, outerrel, pathkeys, extra->limit_tuples,
+							  &startup_cost, &total_cost);
+	rows = outerrel->rows;
+	adjust_limit_rows_costs(&rows, &startup_cost, &total_cost,
+							extra->offset_est, extra->count_est);
+
+	/*
+	 * adjust_limit_rows_costs() leaves in the transfer of the rows OFFSET
+	 * skips, as a LIMIT done locally over the scan would need; MonetDB
+	 * doesn't send those.  Nor does it send the rest of the block holding
+	 * the last row returned, which the scan under a local Limit fetches,
+	 * as it reads whole blocks of fetch_size rows.  Take the transfer of
+	 * all of these off.
+	 */
+	if (extra->count_est > 0)
+		fetched_rows = Min(outerrel->rows,
+						   ceil((extra->offset_est + extra->count_est) /
+								(double) ofpinfo->fetch_size) * ofpinfo->fetch_size);
+	else
+		fetched_rows = outerrel->rows;
+	if (fetched_rows > rows)
+		total_cost -= ofpinfo->fdw_tuple_cost * (fetched_rows - rows);
+	total_cost = Max(total_cost, startup_cost);
+
+	fpinfo->outerrel = outerrel;
+	fpinfo->local_conds = NIL;
+	fpinfo->retrieved_rows = rows;
+	fpinfo->startup_cost = startup_cost;
+	fpinfo->total_cost = total_cost;
+	fpinfo->pushdown_safe = true;
+
+	final_path = create_foreign_upper_path(root,
+										   final_rel,
+										   root->upper_targets[UPPERREL_FINAL],
+										   rows,
+										   startup_cost,
+										   total_cost,
+										   pathkeys,
+										   NULL,	/* no extra plan */
+										   NIL);	/* no fdw_private */
+
+	add_path(final_rel, (Path *) final_path);
+}
+
+/*
+ * monetdbGetForeignUpperPaths
+ *
+ * Add paths that have MonetDB do the grouping and aggregation, the final
+ * ORDER BY and the LIMIT of the query.
+ */
+static void
+monetdbGetForeignUpperPaths(PlannerInfo *root,
+							UpperRelationKind stage,
+							RelOptInfo *input_rel,
+							RelOptInfo *output_rel,
+							void *extra)
+{
+	MonetdbFdwPlanState *ifpinfo = (MonetdbFdwPlanState *) input_rel->fdw_private;
+	MonetdbFdwPlanState *fpinfo;
+
+	/*
+	 * If input rel is not safe to push down, or we already added our path,
+	 * there's nothing to do.
+	 */
+	if (ifpinfo == NULL || !ifpinfo->pushdown_safe ||
+		output_rel->fdw_private != NULL)
+		return;
+
+	if (stage != UPPERREL_GROUP_AGG && stage != UPPERREL_ORDERED &&
+		stage != UPPERREL_FINAL)
+		return;
+
+	/*
+	 * The upper relation talks to the same server through the same user
+	 * mapping, with the same options, as the relation it is computed from.
+	 * It stays unsafe to build on until a path for it is found.
+	 */
+	fpinfo = (MonetdbFdwPlanState *) palloc(sizeof(MonetdbFdwPlanState));
+	*fpinfo = *ifpinfo;
+	fpinfo->remote_conds = NIL;
+	fpinfo->local_conds = NIL;
+	fpinfo->attrs_used = NULL;
+	fpinfo->pushdown_safe = false;
+	fpinfo->outerrel = input_rel;
+	fpinfo->innerrel = NULL;
+	fpinfo->joinclauses = NIL;
+	fpinfo->stage = stage;
+	fpinfo->grouped_tlist = NIL;
+	output_rel->fdw_private = fpinfo;
+
+	switch (stage)
+	{
+		case UPPERREL_GROUP_AGG:
+			add_foreign_grouping_paths(root, input_rel, output_rel,
+									   (GroupPathExtraData *) extra);
+			break;
+		case UPPERREL_ORDERED:
+			add_foreign_ordered_paths(root, input_rel, output_rel);
+			break;
+		case UPPERREL_FINAL:
+			add_foreign_final_paths(root, input_rel, output_rel,
+									(FinalPathExtraData *) extra);
+			break;
+		default:
+			break;
+	}
+}
+
+static ForeignScan *
+monetdbGetForeignPlan(PlannerInfo *root,
+		       RelOptInfo *baserel,
+		       Oid foreigntableid,
+		       ForeignPath *best_path,
+		       List *tlist,
+		       List *scan_clauses)
+{
+  MonetdbFdwPlanState *fdw_private = (MonetdbFdwPlanState *) baserel->fdw_private;
+  Index           scan_relid = baserel->relid;
+  List           *remote_conds = NIL;
+  List           *local_exprs = NIL;
+  List           *fdw_scan_tlist = NIL;
+  ListCell       *lc;
+  StringInfoData  sql;
+  StringInfoData  binary_sql;
+  List           *retrieved_attrs;
+  List           *params_list = NIL;
+  List           *fdw_private_list;
+
+  /*
+   * A join or upper relation is computed by MonetDB from its inputs.
+   * There is no relation to scan locally (scanrelid is 0); the plan
+   * produces the target list built for the remote query, and only the
+   * conditions MonetDB can't evaluate are checked here.
+   */
+  if (IS_JOIN_REL(baserel) || IS_UPPER_REL(baserel))
+  {
+	  scan_relid = 0;
+	  fdw_scan_tlist = monetdbBuildTlistToDeparse(baserel);
+	  remote_conds = fdw_private->remote_conds;
+	  local_exprs = extract_actual_clauses(fdw_private->local_conds, false);
+
+	  initStringInfo(&sql);
+	  monetdbDeparseSelectSql(&sql, root, baserel, fdw_scan_tlist,
+							  remote_conds, best_path->path.pathkeys,
+							  IS_UPPER_REL(baserel) &&
+							  fdw_private->stage == UPPERREL_FINAL,
+							  &retrieved_attrs, NULL);
+
+	  return make_foreignscan(tlist,
+							  local_exprs,
+							  scan_relid,
+							  NIL,
+							  lappend(list_make5(makeString(sql.data), retrieved_attrs,
+												 makeInteger(fdw_private->fetch_size),
+												 makeInteger(fdw_private->rescan_cache),
+												 makeInteger(fdw_private->prefetch_depth)),
+									  makeString("")),
+							  fdw_scan_tlist,
+							  NIL,
+							  NULL);
+  }
+
+  /*
+   * Separate the scan_clauses into those that can be executed remotely and
+   * those that can't.  baserestrictinfo clauses that were previously
+   * determined to be safe or unsafe by monetdbClassifyConditions are shown
+   * in remote_conds and local_conds.  Anything else in the scan_clauses
+   * list will be a join clause, which we have to check locally.
+   *
+   * Pseudoconstants are ignored here; they will be handled elsewhere.
+   */
+  foreach(lc, scan_clauses)
+  {
+	  RestrictInfo *rinfo = lfirst_node(RestrictInfo, lc);
+
+	  if (rinfo->pseudoconstant)
+		  continue;
+
+	  if (list_member_ptr(fdw_private->remote_conds, rinfo))
+		  remote_conds = lappend(remote_conds, rinfo);
+	  else if (list_member_ptr(fdw_private->local_conds, rinfo))
+		  local_exprs = lappend(local_exprs, rinfo->clause);
+	  else if (fdw_private->query == NULL &&
+			   monetdbIsForeignExpr(root, baserel, rinfo->clause))
+		  remote_conds = lappend(remote_conds, rinfo);
+	  else
+		  local_exprs = lappend(local_exprs, rinfo->clause);
+  }
+
+  /*
+   * Build the query to be sent to MonetDB.  The join clauses of a
+   * parameterized path refer to outer columns; those become parameters,
+   * whose values the executor computes from fdw_exprs.
+   */
+  initStringInfo(&sql);
+  monetdbDeparseSelectSql(&sql, root, baserel, NIL,
+						  remote_conds, best_path->path.pathkeys, false,
+						  &retrieved_attrs, &params_list);
+  /*
+   * The executor gets the options it needs from the plan, so that running
+   * a prepared statement doesn't have to look them up again.
+   */
+  fdw_private_list = list_make5(makeString(sql.data), retrieved_attrs,
+								makeInteger(fdw_private->fetch_size),
+								makeInteger(fdw_private->rescan_cache),
+								makeInteger(fdw_private->prefetch_depth));
+
+  /*
+   * A big enough scan may have MonetDB send the result in its binary
+   * format instead, if the result needn't come in order and needn't be
+   * split up or repeated with other parameter values; otherwise, and if the
+   * types of the columns aren't ones we read in binary, the text query is
+   * used.  The binary result is held in memory, up to work_mem, so a scan
+   * estimated to be bigger than that is not even tried.
+   */
+  initStringInfo(&binary_sql);
+  if (fdw_private->binary_transfer &&
+	  baserel->rows >= fdw_private->binary_threshold &&
+	  baserel->rows * baserel->reltarget->width <= work_mem * 1024.0 &&
+	  best_path->path.pathkeys == NIL &&
+	  params_list == NIL &&
+	  !best_path->path.parallel_aware)
+  {
+	  RangeTblEntry *rte = planner_rt_fetch(baserel->relid, root);
+	  Relation	rel = table_open(rte->relid, NoLock);
+
+	  if (!monetdbDeparseBinaryCopySql(&binary_sql, rel, sql.data,
+									   retrieved_attrs))
+		  resetStringInfo(&binary_sql);
+	  table_close(rel, NoLock);
+  }
+  fdw_private_list = lappend(fdw_private_list, makeString(binary_sql.data));
+
+  /*
+   * A parallel scan also needs what it takes to restrict the query to one
+   * chunk of the table.
+   */
+  if (best_path->path.parallel_aware)
+  {
+	  AttrNumber  attnum = get_partition_attnum(foreigntableid, fdw_private);
+	  StringInfoData column;
+	  StringInfoData bounds;
+
+	  initStringInfo(&column);
+	  monetdbDeparsePartitionColumn(&column, root, baserel, attnum);
+
+	  initStringInfo(&bounds);
+	  if (fdw_private->partition_by_range)
+		  monetdbDeparseBoundsSql(&bounds, root, baserel, attnum, remote_conds);
+
+	  fdw_private_list = lappend(fdw_private_list, makeString(column.data));
+	  fdw_private_list = lappend(fdw_private_list,
+								 makeInteger(remote_conds != NIL));
+	  fdw_private_list = lappend(fdw_private_list, makeString(bounds.data));
+	  fdw_private_list = lappend(fdw_private_list,
+								 makeInteger(fdw_private->partition_count));
+  }
+
+  /* Create the ForeignScan node */
+  return make_foreignscan(tlist,
+			  local_exprs,
+			  scan_relid,
+			  params_list,
+			  fdw_private_list,
+			  NIL,    /* no custom tlist */
+			  NIL,    /* no remote quals */
+			  NULL);  /* no outer plan */
+}
+
+static void
+monetdbExplainForeignScan(ForeignScanState *node, ExplainState *es)
+{
+  if (es->verbose)
+    {
+	List       *fdw_private = ((ForeignScan *) node->ss.ps.plan)->fdw_private;
+	char       *sql = strVal(list_nth(fdw_private, MonetdbFdwScanPrivateSelectSql));
+
+	ExplainPropertyText("Remote SQL", sql, es);
+
+	sql = strVal(list_nth(fdw_private, MonetdbFdwScanPrivateBinarySql));
+	if (sql[0] != '\0')
+		ExplainPropertyText("Remote Binary SQL", sql, es);
+    }
+
+  if (es->analyze && node->fdw_state)
+    {
+	MonetdbFdwExecutionState *festate = (MonetdbFdwExecutionState *) node->fdw_state;
+
+	Instrumentation *instr = node->ss.ps.instrument;
+
+	if (es->verbose)
+	{
+		ExplainPropertyInteger("Fetch Size", NULL, festate->fetch_size, es);
+		ExplainPropertyInteger("Prefetch Depth", NULL, festate->prefetch_depth, es);
+		ExplainPropertyText("Transfer Mode",
+							festate->used_binary ? "binary" : "text", es);
+	}
+	ExplainPropertyInteger("Remote Round Trips", NULL, festate->round_trips, es);
+	if (festate->round_trips > 0)
+		ExplainPropertyFloat("Rows per Block", NULL,
+							 (double) festate->rows_fetched / festate->round_trips,
+							 1, es);
+
+	/*
+	 * Rows the local conditions removed are the difference; tuplecount
+	 * holds those of a loop that InstrEndLoop() hasn't added up yet.
+	 */
+	ExplainPropertyInteger("Rows Fetched", NULL, festate->rows_fetched, es);
+	if (instr)
+		ExplainPropertyInteger("Rows Returned", NULL,
+							   (int64) (instr->ntuples + instr->tuplecount), es);
+	if (es->verbose)
+		ExplainPropertyInteger("Bytes Received", NULL,
+							   festate->bytes_received, es);
+
+	if (es->timing && festate->track_timing)
+	{
+		ExplainPropertyFloat("Connect Time", "ms",
+							 INSTR_TIME_GET_MILLISEC(festate->connect_time),
+							 3, es);
+		if (festate->got_first_row)
+			ExplainPropertyFloat("Remote Time to First Row", "ms",
+								 INSTR_TIME_GET_MILLISEC(festate->first_row_time),
+								 3, es);
+		ExplainPropertyFloat("Conversion Time", "ms",
+							 INSTR_TIME_GET_MILLISEC(festate->convert_time),
+							 3, es);
+		if (festate->prefetch_depth > 0)
+		{
+			double		stall = festate->prefetch_stall;
+
+			if (festate->prefetch)
+				stall += monetdbPrefetchStallTime(festate->prefetch);
+			ExplainPropertyFloat("Prefetch Stall Time", "ms", stall, 3, es);
+		}
+	}
+    }
+}
+
+static void
+monetdbBeginForeignScan(ForeignScanState *node, int eflags)
+{
+  ForeignScan *plan = (ForeignScan *) node->ss.ps.plan;
+  MonetdbFdwExecutionState *festate;
+  RangeTblEntry *rte;
+  Oid         userid;
+  Index       rtindex;
+
+  /*
+   * A pushed-down aggregate has no scan relation of its own (scanrelid is
+   * 0); the permissions are those of the table it reads.  The options the
+   * scan needs were resolved at plan time, and are in fdw_private.
+   */
+  if (plan->scan.scanrelid > 0)
+	  rtindex = plan->scan.scanrelid;
+  else
+	  rtindex = bms_next_member(plan->fs_relids, -1);
+  rte = exec_rt_fetch(rtindex, node->ss.ps.state);
+
+  /*
+   * Do nothing in EXPLAIN (no ANALYZE) case.  node->fdw_state stays NULL.
+   */
+  if (eflags & EXEC_FLAG_EXPLAIN_ONLY)
+    return;
+
+  /*
+   * Save state in node->fdw_state.  We must save enough information to call
+   * BeginCopyFrom() again.
+   */
+  festate = (MonetdbFdwExecutionState *) palloc(sizeof(MonetdbFdwExecutionState));
+
+  festate->dbh = NULL;
+  festate->hdl = NULL;
+  festate->query = strVal(list_nth(plan->fdw_private,
+								   MonetdbFdwScanPrivateSelectSql));
+  festate->retrieved_attrs = (List *) list_nth(plan->fdw_private,
+											   MonetdbFdwScanPrivateRetrievedAttrs);
+
+  /*
+   * TODO: Open an external table (or resource) here.
+   */
+  festate->track_timing =
+	  (node->ss.ps.state->es_instrument & INSTRUMENT_TIMER) != 0;
+  INSTR_TIME_SET_ZERO(festate->connect_time);
+  INSTR_TIME_SET_ZERO(festate->query_start);
+  INSTR_TIME_SET_ZERO(festate->first_row_time);
+  INSTR_TIME_SET_ZERO(festate->convert_time);
+  festate->got_first_row  = false;
+  festate->rows_fetched   = 0;
+  festate->bytes_received = 0;
+  festate->track_remote   = monetdbStatsEnabled();
+  INSTR_TIME_SET_ZERO(festate->remote_time);
+
+  userid = OidIsValid(rte->checkAsUser) ? rte->checkAsUser : GetUserId();
+  if (festate->track_timing)
+	  INSTR_TIME_SET_CURRENT(festate->connect_time);
+  festate->dbh = monetdbGetConnection(GetUserMapping(userid, plan->fs_server));
+  if (festate->track_timing)
+  {
+	  instr_time  now;
+
+	  INSTR_TIME_SET_CURRENT(now);
+	  INSTR_TIME_SUBTRACT(now, festate->connect_time);
+	  festate->connect_time = now;
+  }
+
+  festate->relname   = get_rel_name(rte->relid);
+  festate->relid     = rte->relid;
+  festate->serverid  = plan->fs_server;
+  festate->linecount = 0;
+
+  /* Rows are shaped like the table, or like fdw_scan_tlist if scanrelid is 0 */
+  festate->tupdesc = node->ss.ss_ScanTupleSlot->tts_tupleDescriptor;
+
+  /* look up the input conversion of each column once, not per row */
+  festate->convs  = monetdbMakeConverters(festate->tupdesc,
+										  festate->retrieved_attrs);
+  festate->nconvs = list_length(festate->retrieved_attrs);
+
+  festate->temp_cxt = AllocSetContextCreate(node->ss.ps.state->es_query_cxt,
+											"monetdb_fdw tuple data",
+											ALLOCSET_DEFAULT_SIZES);
+
+  /* set up the parameters of a parameterized scan */
+  festate->param_exprs = ExecInitExprList(plan->fdw_exprs, (PlanState *) node);
+  festate->econtext = node->ss.ps.ps_ExprContext;
+  festate->prep_id = -1;
+  if (festate->param_exprs != NIL)
+  {
+	  ListCell *lc;
+	  int i = 0;
+
+	  festate->param_types = (Oid *) palloc(sizeof(Oid) * list_length(plan->fdw_exprs));
+	  foreach(lc, plan->fdw_exprs)
+		  festate->param_types[i++] = exprType((Node *) lfirst(lc));
+	  initStringInfo(&festate->exec_query);
+  }
+
+  festate->fetch_size  = intVal(list_nth(plan->fdw_private,
+										 MonetdbFdwScanPrivateFetchSize));
+  festate->prefetch_depth = intVal(list_nth(plan->fdw_private,
+											MonetdbFdwScanPrivatePrefetchDepth));
+  festate->prefetch       = NULL;
+  festate->prefetch_tried = false;
+  festate->prefetch_stall = 0;
+  festate->binary_query   = strVal(list_nth(plan->fdw_private,
+											MonetdbFdwScanPrivateBinarySql));
+  festate->binres         = NULL;
+  festate->binary_failed  = false;
+  festate->used_binary    = false;
+  festate->batch_decode   = monetdb_batch_decode;
+  initStringInfo(&festate->batch_text);
+  festate->batch_offs     = NULL;
+  festate->batch_lens     = NULL;
+  festate->batch_fields   = NULL;
+  festate->batch_values   = NULL;
+  festate->batch_isnull   = NULL;
+  festate->batch_cxt      = AllocSetContextCreate(node->ss.ps.state->es_query_cxt,
+												  "monetdb_fdw batch data",
+												  ALLOCSET_DEFAULT_SIZES);
+  festate->batch_len      = 0;
+  festate->batch_pos      = 0;
+  festate->batch_row      = -1;
+  festate->block_rows  = 0;
+  festate->round_trips = 0;
+  festate->eof         = false;
+
+  /* pstate is set up by the DSM callbacks, if this scan runs in parallel */
+  festate->pstate = NULL;
+  if (plan->scan.plan.parallel_aware)
+  {
+	  festate->partition_column =
+		  strVal(list_nth(plan->fdw_private, MonetdbFdwScanPrivatePartitionColumn));
+	  festate->has_where =
+		  intVal(list_nth(plan->fdw_private, MonetdbFdwScanPrivateHasWhere));
+	  festate->bounds_query =
+		  strVal(list_nth(plan->fdw_private, MonetdbFdwScanPrivateBoundsSql));
+	  festate->partition_count =
+		  intVal(list_nth(plan->fdw_private, MonetdbFdwScanPrivatePartitionCount));
+	  initStringInfo(&festate->chunk_query);
+  }
+
+  /*
+   * A parallel scan can't start over by itself, as its chunks are handed
+   * out only once; it is rescanned through ReInitializeDSMForeignScan.
+   */
+  festate->rewind = (eflags & EXEC_FLAG_REWIND) != 0 &&
+	  !plan->scan.plan.parallel_aware;
+  festate->cache = NULL;
+  festate->cache_complete = false;
+  if (festate->rewind &&
+	  intVal(list_nth(plan->fdw_private, MonetdbFdwScanPrivateRescanCache)))
+  {
+	  festate->cache = tuplestore_begin_heap(false, false, work_mem);
+	  festate->cache_slot = MakeSingleTupleTableSlot(festate->tupdesc,
+													 &TTSOpsMinimalTuple);
+  }
+
+  /*
+   * Under an Append that runs its children asynchronously, send the query
+   * right away: every child is set up before any of them is asked for a
+   * row, so the queries of all of them run on their servers at the same
+   * time.
+   */
+  festate->response_pending = false;
+  if (node->ss.ps.async_capable)
+	  (void) monetdbBeginQuery(festate, true);
+
+  node->fdw_state = (void *) festate;
+}
+
+/*
+ * Add the time since start to the time the scan waited on MonetDB.
+ */
+static inline void
+accum_remote_time(MonetdbFdwExecutionState *festate, instr_time *start)
+{
+	instr_time	now;
+
+	INSTR_TIME_SET_CURRENT(now);
+	INSTR_TIME_ACCUM_DIFF(festate->remote_time, now, *start);
+}
+
+/*
+ * Stop reading ahead the current result, if a thread does, and keep the
+ * time the scan waited for it.
+ */
+static void
+monetdbReleasePrefetch(MonetdbFdwExecutionState *festate)
+{
+	if (festate->prefetch == NULL)
+		return;
+
+	festate->prefetch_stall += monetdbPrefetchStallTime(festate->prefetch);
+	monetdbPrefetchFree(festate->prefetch);
+	festate->prefetch = NULL;
+}
+
+/*
+ * Take the next row of a binary result, which is converted already, in
+ * batches; see binary.c.
+ */
+static bool
+buildTupleBinary(MonetdbFdwExecutionState *festate, Datum *values, bool *isnull)
+{
+	instr_time start;
+
+	if (festate->track_timing)
+		INSTR_TIME_SET_CURRENT(start);
+
+	memset(isnull, true, festate->tupdesc->natts * sizeof(bool));
+	if (!monetdbBinaryNextRow(festate->binres, values, isnull))
+		return false;
+
+	if (festate->track_timing)
+	{
+		instr_time end;
+
+		INSTR_TIME_SET_CURRENT(end);
+		if (!festate->got_first_row)
+		{
+			festate->first_row_time = start;
+			INSTR_TIME_SUBTRACT(festate->first_row_time, festate->query_start);
+			festate->got_first_row = true;
+		}
+		INSTR_TIME_ACCUM_DIFF(festate->convert_time, end, start);
+	}
+
+	festate->linecount++;
+	festate->rows_fetched++;
+
+	return true;
+}
+
+/*
+ * Fetch the next row of the remote result: from the thread reading ahead,
+ * which returns its fields in *pf_values and *pf_lengths, or else from
+ * libmapi, with *pf_values set to NULL; the fields are then read with
+ * mapi_fetch_field().
+ *
+ * Return false at the end of the result set.
+ */
+static bool
+fetchRow(MonetdbFdwExecutionState *festate, char ***pf_values,
+		 size_t **pf_lengths)
+{
+	bool new_block = (festate->block_rows == festate->fetch_size);
+	bool found = false;
+	instr_time start;
+
+	*pf_values = NULL;
+	*pf_lengths = NULL;
+
+	if (festate->prefetch)
+	{
+		switch (monetdbPrefetchNextRow(festate->prefetch, pf_values, pf_lengths))
+		{
+			case MONETDB_PREFETCH_ROW:
+				found = true;
+				break;
+			case MONETDB_PREFETCH_EOF:
+				break;
+			case MONETDB_PREFETCH_ERROR:
+				monetdbReportError(festate->dbh, festate->hdl, festate->relid);
+				break;
+			case MONETDB_PREFETCH_STOPPED:
+				/* someone else needed the connection: go on without it */
+				monetdbReleasePrefetch(festate);
+				break;
+		}
+	}
+
+	/*
+	 * Only the first row past the end of a block waits for MonetDB, to send
+	 * the next block; the other rows are in memory already.
+	 */
+	if (!festate->prefetch)
+	{
+		if (new_block && festate->track_remote)
+			INSTR_TIME_SET_CURRENT(start);
+		found = (mapi_fetch_row(festate->hdl) != 0);
+		if (new_block && festate->track_remote)
+			accum_remote_time(festate, &start);
+	}
+
+	/* end of result set */
+	if (!found)
+		return false;
+
+	if (festate->track_timing && !festate->got_first_row)
+	{
+		INSTR_TIME_SET_CURRENT(festate->first_row_time);
+		INSTR_TIME_SUBTRACT(festate->first_row_time, festate->query_start);
+		festate->got_first_row = true;
+	}
+
+	/* a row past the end of the current block took another round trip */
+	if (new_block)
+	{
+		festate->round_trips++;
+		festate->block_rows = 0;
+	}
+	festate->block_rows++;
+	festate->rows_fetched++;
+
+	return true;
+}
+
+/*
+ * buildTupleImpl()
+ *
+ * Fetch the next row of the remote result and convert its fields straight
+ * into the values/isnull arrays of the scan slot.  Columns the remote
+ * query doesn't return are left NULL.
+ *
+ * Return true if a row was found, false at the end of the result set.
+ */
+static bool
+buildTupleImpl(MonetdbFdwExecutionState *festate, Datum *values, bool *isnull)
+{
+	int i;
+	int num_attrs = festate->tupdesc->natts;
+	char **pf_values;
+	size_t *pf_lengths;
+	instr_time start;
+
+	if (!fetchRow(festate, &pf_values, &pf_lengths))
+		return false;
+
+	if (festate->track_timing)
+		INSTR_TIME_SET_CURRENT(start);
+
+	memset(isnull, true, num_attrs * sizeof(bool));
+
+	for (i = 0; i < festate->nconvs; i++)
+	{
+		MonetdbFdwConverter *conv = &festate->convs[i];
+		char *value;
+		size_t len;
+
+		value = pf_values ? pf_values[i] : mapi_fetch_field(festate->hdl, i);
+#ifdef _DEBUG
+		elog(NOTICE, "buildTupleImpl: mapi_fetch_field -> %s", value);
+#endif
+		if (value == NULL)
+			continue;
+
+		len = pf_values ? pf_lengths[i] : mapi_fetch_field_len(festate->hdl, i);
+		festate->bytes_received += len;
+		values[conv->attnum - 1] = monetdbConvertValue(conv, value, len);
+		isnull[conv->attnum - 1] = false;
+	}
+
+	if (festate->track_timing)
+	{
+		instr_time end;
+
+		INSTR_TIME_SET_CURRENT(end);
+		INSTR_TIME_ACCUM_DIFF(festate->convert_time, end, start);
+	}
+
+    festate->linecount++;
+
+    return true;
+}
+
+/*
+ * Fetch the rows left in the current block of the result, copying the
+ * text of their fields into batch_text, and convert them a column at a
+ * time into the batch arrays.
+ *
+ * Return false at the end of the result set.
+ */
+static bool
+fetchBatch(MonetdbFdwExecutionState *festate)
+{
+	StringInfo text = &festate->batch_text;
+	size_t nslots = (size_t) festate->nconvs * festate->fetch_size;
+	int nrows = 0;
+	size_t slot;
+	int i;
+	MemoryContext oldcontext;
+	instr_time start;
+
+	if (festate->batch_values == NULL)
+	{
+		MemoryContext cxt = GetMemoryChunkContext(festate);
+
+		nslots = Max(nslots, 1);
+		festate->batch_offs   = MemoryContextAllocHuge(cxt, nslots * sizeof(size_t));
+		festate->batch_lens   = MemoryContextAllocHuge(cxt, nslots * sizeof(size_t));
+		festate->batch_fields = MemoryContextAllocHuge(cxt, nslots * sizeof(char *));
+		festate->batch_values = MemoryContextAllocHuge(cxt, nslots * sizeof(Datum));
+		festate->batch_isnull = MemoryContextAllocHuge(cxt, nslots * sizeof(bool));
+	}
+
+	/* the field at row r of column i is at [i * fetch_size + r] */
+	resetStringInfo(text);
+	do
+	{
+		char **pf_values;
+		size_t *pf_lengths;
+
+		if (!fetchRow(festate, &pf_values, &pf_lengths))
+			break;
+
+		/* taking the fields out counts as conversion, as in buildTupleImpl */
+		if (festate->track_timing)
+			INSTR_TIME_SET_CURRENT(start);
+
+		for (i = 0; i < festate->nconvs; i++)
+		{
+			char *value = pf_values ? pf_values[i] : mapi_fetch_field(festate->hdl, i);
+			size_t len;
+
+			slot = (size_t) i * festate->fetch_size + nrows;
+			if (value == NULL)
+			{
+				festate->batch_offs[slot] = SIZE_MAX;
+				continue;
+			}
+
+			len = pf_values ? pf_lengths[i] : mapi_fetch_field_len(festate->hdl, i);
+			festate->bytes_received += len;
+			festate->batch_offs[slot] = text->len;
+			festate->batch_lens[slot] = len;
+			appendBinaryStringInfo(text, value, len);
+			appendStringInfoChar(text, '\0');
+		}
+		nrows++;
+
+		if (festate->track_timing)
+		{
+			instr_time end;
+
+			INSTR_TIME_SET_CURRENT(end);
+			INSTR_TIME_ACCUM_DIFF(festate->convert_time, end, start);
+		}
+	} while (festate->block_rows < festate->fetch_size);
+
+	if (nrows == 0)
+		return false;
+
+	if (festate->track_timing)
+		INSTR_TIME_SET_CURRENT(start);
+
+	/* text may have moved while it grew; point into it now */
+	for (i = 0; i < festate->nconvs; i++)
+	{
+		size_t base = (size_t) i * festate->fetch_size;
+		int r;
+
+		for (r = 0; r < nrows; r++)
+		{
+			slot = base + r;
+			festate->batch_fields[slot] = (festate->batch_offs[slot] == SIZE_MAX) ?
+				NULL : text->data + festate->batch_offs[slot];
+		}
+	}
+
+	MemoryContextReset(festate->batch_cxt);
+	oldcontext = MemoryContextSwitchTo(festate->batch_cxt);
+	for (i = 0; i < festate->nconvs; i++)
+	{
+		size_t base = (size_t) i * festate->fetch_size;
+
+		monetdbConvertColumn(&festate->convs[i],
+							 &festate->batch_fields[base],
+							 &festate->batch_lens[base],
+							 nrows,
+							 &festate->batch_values[base],
+							 &festate->batch_isnull[base],
+							 &festate->batch_row);
+	}
+	festate->batch_row = -1;
+	MemoryContextSwitchTo(oldcontext);
+
+	if (festate->track_timing)
+	{
+		instr_time end;
+
+		INSTR_TIME_SET_CURRENT(end);
+		INSTR_TIME_ACCUM_DIFF(festate->convert_time, end, start);
+	}
+
+	festate->batch_len = nrows;
+	festate->batch_pos = 0;
+
+	return true;
+}
+
+/*
+ * buildTupleBatch()
+ *
+ * Like buildTupleImpl(), but the rows are fetched a block at a time, and
+ * their fields converted a column at a time (see monetdbConvertColumn()),
+ * which keeps the work on the values of a type in a tight loop.  The
+ * values of the row point into the batch, which stays until the next one
+ * is fetched, after the slot has been cleared.
+ */
+static bool
+buildTupleBatch(MonetdbFdwExecutionState *festate, Datum *values, bool *isnull)
+{
+	int i;
+
+	if (festate->batch_pos == festate->batch_len &&
+		!fetchBatch(festate))
+		return false;
+
+	memset(isnull, true, festate->tupdesc->natts * sizeof(bool));
+
+	for (i = 0; i < festate->nconvs; i++)
+	{
+		size_t slot = (size_t) i * festate->fetch_size + festate->batch_pos;
+		int attnum = festate->convs[i].attnum;
+
+		values[attnum - 1] = festate->batch_values[slot];
+		isnull[attnum - 1] = festate->batch_isnull[slot];
+	}
+
+	festate->batch_pos++;
+	festate->linecount++;
+
+	return true;
+}
+
+/*
+ * Return the statement running the query of a parameterized scan with the
+ * current values of its parameters.  The first time, MonetDB prepares the
+ * query, so that the rescans of a nested loop, one per outer row, don't
+ * have it parse and optimize the query again.
+ */
+static const char *
+monetdbBindParams(MonetdbFdwExecutionState *festate)
+{
+	StringInfo	buf = &festate->exec_query;
+	MemoryContext oldcontext;
+	ListCell   *lc;
+	int			i = 0;
+
+	if (festate->prep_id < 0)
+	{
+		char	   *sql = psprintf("PREPARE %s", festate->query);
+		MapiHdl		hdl;
+
+		if ((hdl = mapi_query(festate->dbh, sql)) == NULL ||
+			mapi_error(festate->dbh) != MOK)
+			monetdbReportError(festate->dbh, hdl, festate->relid);
+		festate->prep_id = mapi_get_tableid(hdl);
+		mapi_close_handle(hdl);
+		monetdbRememberPrepared(festate->dbh, festate->prep_id);
+		pfree(sql);
+	}
+
+	resetStringInfo(buf);
+	appendStringInfo(buf, "EXEC %d(", festate->prep_id);
+
+	/* the values are computed in the per-row memory of the scan */
+	oldcontext = MemoryContextSwitchTo(festate->econtext->ecxt_per_tuple_memory);
+	foreach(lc, festate->param_exprs)
+	{
+		ExprState  *expr_state = (ExprState *) lfirst(lc);
+		bool		isnull;
+		Datum		value;
+
+		value = ExecEvalExpr(expr_state, festate->econtext, &isnull);
+
+		if (i > 0)
+			appendStringInfoString(buf, ", ");
+		if (isnull)
+			appendStringInfoString(buf, "NULL");
+		else
+			monetdbDeparseLiteral(buf, value, festate->param_types[i]);
+		i++;
+	}
+	MemoryContextSwitchTo(oldcontext);
+
+	appendStringInfoChar(buf, ')');
+
+	return buf->data;
+}
+
+/*
+ * Close the remote result, if it is open.  No more rows are returned from
+ * it after that.
+ */
+static void
+monetdbCloseResult(MonetdbFdwExecutionState *festate)
+{
+	monetdbReleasePrefetch(festate);
+	if (festate->hdl)
+	{
+		mapi_close_handle(festate->hdl);
+		festate->hdl = NULL;
+	}
+	if (festate->binres)
+	{
+		monetdbBinaryFree(festate->binres);
+		festate->binres = NULL;
+	}
+	festate->batch_len = 0;
+	festate->batch_pos = 0;
+	festate->eof = true;
+}
+
+/*
+ * Append the condition selecting the rows of one chunk of a parallel scan
+ * to buf.
+ *
+ * By modulo, chunk i has the rows whose column value leaves a remainder of
+ * i, or -i for negative values; by range, the chunks split the column's
+ * values between the smallest and the largest into equal ranges, and the
+ * first and last are unbounded so that rows added since the bounds were
+ * found are not missed.  NULLs go to the first chunk.
+ */
+static void
+appendChunkCondition(StringInfo buf, MonetdbFdwExecutionState *festate,
+					 uint32 chunk)
+{
+	MonetdbFdwParallelState *pstate = festate->pstate;
+	const char *col = festate->partition_column;
+	int			n = pstate->nchunks;
+
+	if (n == 1)
+	{
+		appendStringInfoString(buf, "TRUE");
+		return;
+	}
+
+	if (festate->bounds_query[0] == '\0')
+	{
+		if (chunk == 0)
+			appendStringInfo(buf, "(%s %% %d = 0 OR %s IS NULL)", col, n, col);
+		else
+			appendStringInfo(buf, "(%s %% %d = %u OR %s %% %d = -%u)",
+							 col, n, chunk, col, n, chunk);
+	}
+	else
+	{
+		uint64		span = (uint64) pstate->upper - (uint64) pstate->lower;
+		uint64		step = span / n + 1;
+		int64		lo = 0;
+		int64		hi = 0;
+
+		/* chunks past the largest value are empty */
+		if (chunk > 0)
+			lo = (step > span / chunk) ? pstate->upper :
+				(int64) ((uint64) pstate->lower + chunk * step);
+		if (chunk < n - 1)
+			hi = (step > span / (chunk + 1)) ? pstate->upper :
+				(int64) ((uint64) pstate->lower + (chunk + 1) * step);
+
+		if (chunk == 0)
+			appendStringInfo(buf, "(%s < " INT64_FORMAT " OR %s IS NULL)",
+							 col, hi, col);
+		else if (chunk == n - 1)
+			appendStringInfo(buf, "(%s >= " INT64_FORMAT ")", col, lo);
+		else
+			appendStringInfo(buf, "(%s >= " INT64_FORMAT " AND %s < " INT64_FORMAT ")",
+							 col, lo, col, hi);
+	}
+}
+
+/*
+ * Send the query to MonetDB.  In a parallel scan, claim the next chunk of
+ * the table first, and restrict the query to it.  With send_only, don't
+ * wait for the response; it is read before the first row is fetched.
+ *
+ * Return false if there is nothing left to query.
+ */
+static bool
+monetdbBeginQuery(MonetdbFdwExecutionState *festate, bool send_only)
+{
+	const char *query = festate->query;
+	instr_time	start;
+
+	if (festate->pstate)
+	{
+		uint32		chunk = pg_atomic_fetch_add_u32(&festate->pstate->next_chunk, 1);
+
+		if (chunk >= (uint32) festate->pstate->nchunks)
+		{
+			festate->eof = true;
+			return false;
+		}
+
+		resetStringInfo(&festate->chunk_query);
+		appendStringInfo(&festate->chunk_query, "%s%s", festate->query,
+						 festate->has_where ? " AND " : " WHERE ");
+		appendChunkCondition(&festate->chunk_query, festate, chunk);
+		query = festate->chunk_query.data;
+	}
+
+	if (festate->param_exprs != NIL)
+		query = monetdbBindParams(festate);
+
+#ifdef _DEBUG
+	elog(NOTICE, "monetdb_fdw: monetdbBeginQuery: query=%s", query);
+#endif
+
+	/* the connection is shared, so set the block size for every query */
+	monetdbSetFetchSize(festate->dbh, festate->fetch_size);
+
+	if (festate->track_timing && INSTR_TIME_IS_ZERO(festate->query_start))
+		INSTR_TIME_SET_CURRENT(festate->query_start);
+
+	/*
+	 * A binary result comes all at once, and is kept for the rest of the
+	 * scan.  If MonetDB can't send it, the text query is used from then on.
+	 */
+	if (festate->binary_query[0] != '\0' && !festate->binary_failed &&
+		!send_only)
+	{
+		MemoryContext oldcontext;
+
+		if (festate->track_remote)
+			INSTR_TIME_SET_CURRENT(start);
+		oldcontext = MemoryContextSwitchTo(GetMemoryChunkContext(festate));
+		festate->binres = monetdbBinaryQuery(festate->dbh, festate->binary_query,
+											 festate->convs, festate->nconvs,
+											 festate->fetch_size);
+		MemoryContextSwitchTo(oldcontext);
+		if (festate->track_remote)
+			accum_remote_time(festate, &start);
+
+		festate->round_trips++;
+		if (festate->binres)
+		{
+			festate->used_binary = true;
+			festate->bytes_received += monetdbBinaryBytes(festate->binres);
+			return true;
+		}
+		festate->binary_failed = true;
+	}
+
+	if (festate->track_remote)
+		INSTR_TIME_SET_CURRENT(start);
+	if (send_only)
+		festate->hdl = mapi_send(festate->dbh, query);
+	else
+		festate->hdl = mapi_query(festate->dbh, query);
+	if (festate->track_remote)
+		accum_remote_time(festate, &start);
+
+	if (festate->hdl == NULL || mapi_error(festate->dbh) != MOK)
+		monetdbReportError(festate->dbh, festate->hdl, festate->relid);
+	festate->response_pending = send_only;
+	festate->prefetch_tried = false;
+	festate->round_trips++;
+	festate->block_rows = 0;
+
+	return true;
+}
+
+/*
+ * Return the next row of the rescan cache in slot, if there is one left.
+ */
+static bool
+fetch_cached_row(MonetdbFdwExecutionState *festate, TupleTableSlot *slot)
+{
+	TupleTableSlot *cache_slot = festate->cache_slot;
+	int			natts = festate->tupdesc->natts;
+
+	if (tuplestore_ateof(festate->cache) ||
+		!tuplestore_gettupleslot(festate->cache, true, false, cache_slot))
+		return false;
+
+	/* the values point into cache_slot, which keeps them until the next row */
+	slot_getallattrs(cache_slot);
+	memcpy(slot->tts_values, cache_slot->tts_values, natts * sizeof(Datum));
+	memcpy(slot->tts_isnull, cache_slot->tts_isnull, natts * sizeof(bool));
+	ExecStoreVirtualTuple(slot);
+	festate->linecount++;
+
+	return true;
+}
+
+static void
+monetdbErrorCallback(void *arg)
+{
+	MonetdbFdwExecutionState *festate = (MonetdbFdwExecutionState *)arg;
+
+	/* a block being converted is ahead of the rows returned so far */
+	errcontext("relation %s, line %d",
+		   festate->relname,
+		   festate->linecount +
+		   (festate->batch_row >= 0 ? festate->batch_row : 0));
+}
+
+static TupleTableSlot *
+monetdbIterateForeignScan(ForeignScanState *node)
+{
+  MonetdbFdwExecutionState *festate = (MonetdbFdwExecutionState *) node->fdw_state;
+  TupleTableSlot *slot = node->ss.ss_ScanTupleSlot;
+  ErrorContextCallback errcallback;
+  MemoryContext oldcontext;
+
+  /* Set up callback to identify error line number. */
+  errcallback.callback = monetdbErrorCallback;
+  errcallback.arg      = (void *)festate;
+
+  errcallback.previous = error_context_stack;
+  error_context_stack  = &errcallback;
+
+  /*
+   * The protocol for loading a virtual tuple into a slot is first
+   * ExecClearTuple, then fill the values/isnull arrays, then
+   * ExecStoreVirtualTuple.  If there is no other row in the result, we
+   * just skip the last step, leaving the slot empty as required.
+   */
+  ExecClearTuple(slot);
+
+  /*
+   * The previous row is gone from the slot, and with it the last reference
+   * to its data.
+   */
+  MemoryContextReset(festate->temp_cxt);
+
+  /*
+   * After a rescan, the rows of the cache come first; the ones it doesn't
+   * have yet are fetched from MonetDB, and added to it.
+   */
+  if (festate->cache && fetch_cached_row(festate, slot))
+  {
+	  error_context_stack = errcallback.previous;
+	  return slot;
+  }
+
+  /*
+   * A parallel scan goes on with the next chunk when one is used up, so it
+   * may take several queries to find the next row.
+   */
+  while (!festate->eof)
+  {
+	  bool found;
+
+	  if (!festate->hdl && !festate->binres &&
+		  !monetdbBeginQuery(festate, false))
+		  break;
+
+	  if (festate->response_pending)
+	  {
+		  instr_time start;
+		  int        rc;
+
+		  festate->response_pending = false;
+		  if (festate->track_remote)
+			  INSTR_TIME_SET_CURRENT(start);
+		  rc = mapi_read_response(festate->hdl);
+		  if (festate->track_remote)
+			  accum_remote_time(festate, &start);
+		  if (rc != MOK || mapi_result_error(festate->hdl) != NULL)
+			  monetdbReportError(festate->dbh, festate->hdl, festate->relid);
+	  }
+
+	  /*
+	   * Read ahead the rows of the result in a thread, while they are
+	   * converted, if the scan has the connection to itself.
+	   */
+	  if (festate->prefetch_depth > 0 && !festate->prefetch_tried &&
+		  festate->binres == NULL)
+	  {
+		  festate->prefetch_tried = true;
+		  if (monetdbConnectionUsers(festate->dbh) == 1)
+		  {
+			  oldcontext = MemoryContextSwitchTo(GetMemoryChunkContext(festate));
+			  festate->prefetch = monetdbPrefetchStart(festate->dbh, festate->hdl,
+													   festate->nconvs,
+													   festate->fetch_size,
+													   festate->prefetch_depth);
+			  MemoryContextSwitchTo(oldcontext);
+		  }
+	  }
+
+	  oldcontext = MemoryContextSwitchTo(festate->temp_cxt);
+	  if (festate->binres)
+		  found = buildTupleBinary(festate, slot->tts_values, slot->tts_isnull);
+	  else if (festate->batch_decode)
+		  found = buildTupleBatch(festate, slot->tts_values, slot->tts_isnull);
+	  else
+		  found = buildTupleImpl(festate, slot->tts_values, slot->tts_isnull);
+	  MemoryContextSwitchTo(oldcontext);
+
+	  if (found)
+	  {
+		  ExecStoreVirtualTuple(slot);
+		  if (festate->cache)
+			  tuplestore_puttupleslot(festate->cache, slot);
+		  break;
+	  }
+
+	  /* the thread is done with the result, and the connection is free */
+	  monetdbReleasePrefetch(festate);
+
+	  if (festate->pstate)
+	  {
+		  mapi_close_handle(festate->hdl);
+		  festate->hdl = NULL;
+	  }
+	  else if (festate->rewind && !festate->cache)
+	  {
+		  /* keep the result, for a rescan to seek back to its start */
+		  festate->eof = true;
+	  }
+	  else
+	  {
+		  monetdbCloseResult(festate);
+		  festate->cache_complete = (festate->cache != NULL);
+	  }
+  }
+
+  /* Remove error callback. */
+  error_context_stack = errcallback.previous;
+
+  return slot;
+}
+
+static void
+monetdbEndForeignScan(ForeignScanState *node)
+{
+	MonetdbFdwExecutionState *festate = (MonetdbFdwExecutionState *) node->fdw_state;
+	
+	/* if festate is NULL, we are in EXPLAIN; nothing to do */
+	if (festate)
+	{
+		/*
+		 * TODO: Close the external table (resource), and initialize
+		 * FdwExecutionState state.
+		 */
+		monetdbReleasePrefetch(festate);
+        if (festate->hdl)
+			mapi_close_handle(festate->hdl);
+		if (festate->binres)
+			monetdbBinaryFree(festate->binres);
+
+		if (festate->prep_id >= 0)
+		{
+			char	   *sql = psprintf("DEALLOCATE %d", festate->prep_id);
+
+			execute_remote_command(festate->dbh, sql);
+			monetdbForgetPrepared(festate->dbh, festate->prep_id);
+		}
+
+		if (festate->cache)
+		{
+			tuplestore_end(festate->cache);
+			ExecDropSingleTupleTableSlot(festate->cache_slot);
+		}
+
+		monetdbStatsRecordScan(festate->serverid, festate->relid,
+							   festate->rows_fetched, festate->bytes_received,
+							   INSTR_TIME_GET_MILLISEC(festate->remote_time) +
+							   festate->prefetch_stall);
+
+		/* the connection goes back to the cache for the next scan */
+        if (festate->dbh)
+			monetdbReleaseConnection(festate->dbh);
+    }
+}
+
+/*
+ * monetdbShutdownForeignScan
+ *
+ * Called when the executor knows it won't ask for more rows, notably by a
+ * Limit above us that has all it needs.  Closing the result now tells
+ * MonetDB to drop it, instead of leaving the rest of it to be fetched or
+ * discarded when the scan ends.
+ */
+static void
+monetdbShutdownForeignScan(ForeignScanState *node)
+{
+	MonetdbFdwExecutionState *festate = (MonetdbFdwExecutionState *) node->fdw_state;
+
+	if (festate)
+		monetdbCloseResult(festate);
+}
+
+static void
+monetdbReScanForeignScan(ForeignScanState *node)
+{
+  MonetdbFdwExecutionState *festate = (MonetdbFdwExecutionState *) node->fdw_state;
+
+  /*
+   * Unless a parameter the scan depends on has changed, the rows are the
+   * same as last time.  Replay them from the cache, which goes on with the
+   * rest of the result if the last pass stopped early; or seek back to the
+   * first row of the result, if it is still open.  MonetDB keeps the
+   * result until it is closed, so that doesn't run the query again.
+   */
+  if (festate->rewind && node->ss.ps.chgParam == NULL)
+  {
+	  if (festate->cache &&
+		  (festate->cache_complete || festate->hdl != NULL))
+	  {
+		  tuplestore_rescan(festate->cache);
+		  festate->linecount = 0;
+		  return;
+	  }
+
+	  if (!festate->cache && festate->binres)
+	  {
+		  monetdbBinaryRewind(festate->binres);
+		  festate->eof = false;
+		  festate->linecount = 0;
+		  return;
+	  }
+
+	  /* a thread reading ahead would miss the seek; start another one */
+	  if (!festate->cache && festate->hdl && !festate->response_pending)
+		  monetdbReleasePrefetch(festate);
+	  if (!festate->cache && festate->hdl && !festate->response_pending &&
+		  mapi_seek_row(festate->hdl, 0, MAPI_SEEK_SET) == MOK)
+	  {
+		  festate->eof = false;
+		  festate->prefetch_tried = false;
+		  festate->batch_len = 0;
+		  festate->batch_pos = 0;
+		  festate->linecount = 0;
+		  festate->block_rows = 0;
+		  return;
+	  }
+  }
+
+  /*
+   * Drop what is left of the previous result; the next call to
+   * monetdbIterateForeignScan runs the query again, and a parameterized
+   * scan does so with the new values of its parameters.
+   */
+  monetdbCloseResult(festate);
+  festate->eof = false;
+  festate->response_pending = false;
+  festate->linecount = 0;
+  if (festate->cache)
+  {
+	  tuplestore_clear(festate->cache);
+	  festate->cache_complete = false;
+  }
+}
+
+/*
+ * monetdbIsForeignScanParallelSafe
+ *
+ * Every process opens a connection of its own, so a scan can run in a
+ * parallel worker; but the scan is only split between them by a usable
+ * partition_column and partition_count.  Without them, say no, so that
+ * the query is planned without a parallel scan of the table.
+ */
+static bool
+monetdbIsForeignScanParallelSafe(PlannerInfo *root, RelOptInfo *rel,
+								 RangeTblEntry *rte)
+{
+	MonetdbFdwPlanState opts;
+	AttrNumber	attnum;
+	Oid			atttype;
+
+	monetdbGetOptions(rte->relid, &opts);
+	if (opts.partition_column == NULL || opts.partition_count < 2)
+		return false;
+
+	attnum = get_attnum(rte->relid, opts.partition_column);
+	if (attnum == InvalidAttrNumber)
+		return false;
+
+	atttype = get_atttype(rte->relid, attnum);
+	return (atttype == INT2OID || atttype == INT4OID || atttype == INT8OID);
+}
+
+static Size
+monetdbEstimateDSMForeignScan(ForeignScanState *node, ParallelContext *pcxt)
+{
+	return sizeof(MonetdbFdwParallelState);
+}
+
+/*
+ * monetdbInitializeDSMForeignScan
+ *
+ * Set up the chunks of a parallel scan, in the leader.  To split the table
+ * into ranges, ask MonetDB for the smallest and largest value of the
+ * partition column first.
+ */
+static void
+monetdbInitializeDSMForeignScan(ForeignScanState *node, ParallelContext *pcxt,
+								void *coordinate)
+{
+	MonetdbFdwExecutionState *festate = (MonetdbFdwExecutionState *) node->fdw_state;
+	MonetdbFdwParallelState *pstate = (MonetdbFdwParallelState *) coordinate;
+
+	pg_atomic_init_u32(&pstate->next_chunk, 0);
+	pstate->nchunks = festate->partition_count;
+	pstate->lower = 0;
+	pstate->upper = 0;
+
+	if (festate->bounds_query[0] != '\0')
+	{
+		MapiHdl		hdl;
+		char	   *value;
+
+		if ((hdl = mapi_query(festate->dbh, festate->bounds_query)) == NULL ||
+			mapi_error(festate->dbh) != MOK)
+			monetdbReportError(festate->dbh, hdl, festate->relid);
+
+		/* both are NULL if there are no rows, and then any bounds will do */
+		if (mapi_fetch_row(hdl))
+		{
+			if ((value = mapi_fetch_field(hdl, 0)) != NULL)
+				pstate->lower = pg_strtoint64(value);
+			if ((value = mapi_fetch_field(hdl, 1)) != NULL)
+				pstate->upper = pg_strtoint64(value);
+		}
+		mapi_close_handle(hdl);
+	}
+
+	festate->pstate = pstate;
+}
+
+static void
+monetdbReInitializeDSMForeignScan(ForeignScanState *node, ParallelContext *pcxt,
+								  void *coordinate)
+{
+	MonetdbFdwParallelState *pstate = (MonetdbFdwParallelState *) coordinate;
+
+	pg_atomic_write_u32(&pstate->next_chunk, 0);
+}
+
+static void
+monetdbInitializeWorkerForeignScan(ForeignScanState *node, shm_toc *toc,
+								   void *coordinate)
+{
+	MonetdbFdwExecutionState *festate = (MonetdbFdwExecutionState *) node->fdw_state;
+
+	festate->pstate = (MonetdbFdwParallelState *) coordinate;
+}
+
+/*
+ * monetdbIsForeignPathAsyncCapable
+ *
+ * A scan can run asynchronously under an Append if the async_capable
+ * option is set.  A parallel scan can't: its queries are only known once
+ * it claims its chunks.
+ */
+static bool
+monetdbIsForeignPathAsyncCapable(ForeignPath *path)
+{
+	MonetdbFdwPlanState *fpinfo = (MonetdbFdwPlanState *) path->path.parent->fdw_private;
+
+	/* a parameterized scan can't send its query before it has the values */
+	return fpinfo->async_capable && !path->path.parallel_aware &&
+		path->path.param_info == NULL;
+}
+
+/*
+ * monetdbForeignAsyncRequest
+ *
+ * Produce the next row for the Append.  Our query has been running since
+ * the scan began, so this only waits for what MonetDB has not sent yet.
+ *
+ * MAPI doesn't give us its socket to wait on, so we can't tell which
+ * server answers first; the request always completes right away, and the
+ * Append never has to wait for us.
+ */
+static void
+monetdbForeignAsyncRequest(AsyncRequest *areq)
+{
+	PlanState  *node = areq->requestee;
+	TupleTableSlot *slot;
+
+	/*
+	 * ExecAsyncRequest() has started the instrumentation of the node, so
+	 * its ExecProcNode wrapper, which would start it again, is bypassed.
+	 */
+	slot = node->ExecProcNodeReal(node);
+
+	ExecAsyncRequestDone(areq, slot);
+}
+
+/*
+ * monetdbForeignAsyncConfigureWait
+ *
+ * Never called, as no request of ours is left pending.
+ */
+static void
+monetdbForeignAsyncConfigureWait(AsyncRequest *areq)
+{
+	elog(ERROR, "monetdb_fdw: unexpected wait for an asynchronous request");
+}
+
+static void
+monetdbForeignAsyncNotify(AsyncRequest *areq)
+{
+	monetdbForeignAsyncRequest(areq);
+}
+
+
+/*
+ * monetdbIsForeignRelUpdatable
+ *
+ * A foreign table defined by the table option can be modified, but not
+ * the result of a query.  UPDATE and DELETE are only possible when
+ * MonetDB can do them by itself; see monetdbPlanDirectModify.
+ */
+static int
+monetdbIsForeignRelUpdatable(Relation rel)
+{
+	MonetdbFdwPlanState fdw_private;
+
+	monetdbGetOptions(RelationGetRelid(rel), &fdw_private);
+
+	if (fdw_private.query)
+		return 0;
+
+	return (1 << CMD_INSERT) | (1 << CMD_UPDATE) | (1 << CMD_DELETE);
+}
+
+/*
+ * Return the attribute numbers of the columns an INSERT sends: all of
+ * them, so that the rows are stored just as we have them.  That includes
+ * stored generated columns: MonetDB has none, and the executor has
+ * computed their values before the rows get to us.
+ */
+static List *
+get_insert_target_attrs(Relation rel)
+{
+	TupleDesc	tupdesc = RelationGetDescr(rel);
+	List	   *target_attrs = NIL;
+	int			attnum;
+
+	for (attnum = 1; attnum <= tupdesc->natts; attnum++)
+	{
+		Form_pg_attribute attr = TupleDescAttr(tupdesc, attnum - 1);
+
+		if (!attr->attisdropped)
+			target_attrs = lappend_int(target_attrs, attnum);
+	}
+
+	return target_attrs;
+}
+
+/*
+ * Build the statement rows are inserted into rel with; see
+ * MonetdbFdwModifyState.
+ */
+static char *
+deparse_insert_sql(Relation rel, List *target_attrs, bool use_copy)
+{
+	MonetdbFdwPlanState fdw_private;
+	StringInfoData sql;
+
+	monetdbGetOptions(RelationGetRelid(rel), &fdw_private);
+
+	initStringInfo(&sql);
+	if (use_copy)
+		monetdbDeparseCopySql(&sql, rel, &fdw_private, target_attrs);
+	else
+		monetdbDeparseInsertSql(&sql, rel, &fdw_private, target_attrs);
+
+	return sql.data;
+}
+
+/*
+ * monetdbPlanForeignModify
+ *
+ * Build the statement an INSERT sends its rows with.  INSERT ... SELECT
+ * can bring any number of rows, so it goes through MonetDB's bulk loader
+ * with COPY INTO; INSERT ... VALUES, whose rows are all in the statement,
+ * uses INSERT.
+ */
+static List *
+monetdbPlanForeignModify(PlannerInfo *root,
+						 ModifyTable *plan,
+						 Index resultRelation,
+						 int subplan_index)
+{
+	RangeTblEntry *rte = planner_rt_fetch(resultRelation, root);
+	List	   *fromlist = root->parse->jointree->fromlist;
+	Relation	rel;
+	List	   *target_attrs;
+	bool		use_copy;
+	char	   *sql;
+
+	/*
+	 * A MonetDB table has no row identifier we could fetch with the rows
+	 * and find them again by, so an UPDATE or DELETE that
+	 * monetdbPlanDirectModify turned down can't be done row by row either.
+	 */
+	if (plan->operation == CMD_UPDATE || plan->operation == CMD_DELETE)
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("monetdb_fdw: %s on foreign table \"%s\" cannot be executed by MonetDB",
+						plan->operation == CMD_UPDATE ? "UPDATE" : "DELETE",
+						get_rel_name(rte->relid)),
+				 errhint("Only conditions and new values that MonetDB can evaluate are supported, on a foreign table without row triggers.")));
+
+	if (plan->operation != CMD_INSERT)
+		elog(ERROR, "monetdb_fdw: unexpected operation: %d",
+			 (int) plan->operation);
+
+	if (plan->onConflictAction != ONCONFLICT_NONE)
+		elog(ERROR, "monetdb_fdw: ON CONFLICT is not supported");
+
+	/* a VALUES list of several rows is a relation of its own */
+	use_copy = fromlist != NIL &&
+		!(list_length(fromlist) == 1 && IsA(linitial(fromlist), RangeTblRef) &&
+		  planner_rt_fetch(linitial_node(RangeTblRef, fromlist)->rtindex,
+						   root)->rtekind == RTE_VALUES);
+
+	/*
+	 * Core code already has some lock on each rel being planned, so we can
+	 * use NoLock here.
+	 */
+	rel = table_open(rte->relid, NoLock);
+	target_attrs = get_insert_target_attrs(rel);
+	sql = deparse_insert_sql(rel, target_attrs, use_copy);
+	table_close(rel, NoLock);
+
+	/*
+	 * Build the fdw_private list that will be available to the executor.
+	 * Items in the list must match enum MonetdbFdwModifyPrivateIndex.
+	 */
+	return list_make3(makeString(sql), target_attrs, makeInteger(use_copy));
+}
+
+/*
+ * Set up the state of an INSERT, COPY FROM or tuple routing into the
+ * foreign table of resultRelInfo.
+ */
+static MonetdbFdwModifyState *
+create_modify_state(EState *estate, ResultRelInfo *resultRelInfo,
+					char *sql, List *target_attrs, bool use_copy)
+{
+	Relation	rel = resultRelInfo->ri_RelationDesc;
+	MonetdbFdwModifyState *fmstate;
+	MonetdbFdwPlanState fdw_private;
+	RangeTblEntry *rte;
+	Oid			userid;
+
+	monetdbGetOptions(RelationGetRelid(rel), &fdw_private);
+
+	/*
+	 * A partition that tuple routing opened has no range table entry of its
+	 * own; it is accessed as the user of the partitioned table.
+	 */
+	if (resultRelInfo->ri_RangeTableIndex == 0)
+		rte = exec_rt_fetch(resultRelInfo->ri_RootResultRelInfo->ri_RangeTableIndex,
+							estate);
+	else
+		rte = exec_rt_fetch(resultRelInfo->ri_RangeTableIndex, estate);
+	userid = OidIsValid(rte->checkAsUser) ? rte->checkAsUser : GetUserId();
+
+	fmstate = (MonetdbFdwModifyState *) palloc0(sizeof(MonetdbFdwModifyState));
+	fmstate->dbh = monetdbGetConnection(GetUserMapping(userid,
+													   fdw_private.serverid));
+	monetdbBeginRemoteXact(fmstate->dbh);
+	fmstate->relname = RelationGetRelationName(rel);
+	fmstate->tupdesc = RelationGetDescr(rel);
+	fmstate->sql = sql;
+	fmstate->use_copy = use_copy;
+	fmstate->target_attrs = target_attrs;
+	fmstate->batch_size = fdw_private.batch_size;
+	initStringInfo(&fmstate->buf);
+	fmstate->temp_cxt = AllocSetContextCreate(estate->es_query_cxt,
+											  "monetdb_fdw insert data",
+											  ALLOCSET_DEFAULT_SIZES);
+
+	return fmstate;
+}
+
+static void
+monetdbBeginForeignModify(ModifyTableState *mtstate,
+						  ResultRelInfo *resultRelInfo,
+						  List *fdw_private,
+						  int subplan_index,
+						  int eflags)
+{
+	/*
+	 * Do nothing in EXPLAIN (no ANALYZE) case.  resultRelInfo->ri_FdwState
+	 * stays NULL.
+	 */
+	if (eflags & EXEC_FLAG_EXPLAIN_ONLY)
+		return;
+
+	resultRelInfo->ri_FdwState =
+		create_modify_state(mtstate->ps.state, resultRelInfo,
+							strVal(list_nth(fdw_private,
+											MonetdbFdwModifyPrivateUpdateSql)),
+							(List *) list_nth(fdw_private,
+											  MonetdbFdwModifyPrivateTargetAttnums),
+							intVal(list_nth(fdw_private,
+											MonetdbFdwModifyPrivateUseCopy)));
+}
+
+/*
+ * monetdbBeginForeignInsert
+ *
+ * Set up a COPY FROM, or tuple routing of an INSERT or UPDATE, into a
+ * foreign table.  A COPY FROM (there is no plan) is loaded with COPY
+ * INTO.
+ */
+static void
+monetdbBeginForeignInsert(ModifyTableState *mtstate,
+						  ResultRelInfo *resultRelInfo)
+{
+	Relation	rel = resultRelInfo->ri_RelationDesc;
+	List	   *target_attrs = get_insert_target_attrs(rel);
+	bool		use_copy = (mtstate->ps.plan == NULL);
+
+	if (mtstate->ps.plan &&
+		((ModifyTable *) mtstate->ps.plan)->onConflictAction != ONCONFLICT_NONE)
+		elog(ERROR, "monetdb_fdw: ON CONFLICT is not supported");
+
+	resultRelInfo->ri_FdwState =
+		create_modify_state(mtstate->ps.state, resultRelInfo,
+							deparse_insert_sql(rel, target_attrs, use_copy),
+							target_attrs, use_copy);
+}
+
+static TupleTableSlot *
+monetdbExecForeignInsert(EState *estate,
+						 ResultRelInfo *resultRelInfo,
+						 TupleTableSlot *slot,
+						 TupleTableSlot *planSlot)
+{
+	int			numSlots = 1;
+	TupleTableSlot **rslot;
+
+	rslot = monetdbExecForeignBatchInsert(estate, resultRelInfo,
+										  &slot, &planSlot, &numSlots);
+
+	return rslot ? *rslot : NULL;
+}
+
+/*
+ * monetdbExecForeignBatchInsert
+ *
+ * Send numSlots rows to MonetDB in one statement: a multi-row INSERT, or a
+ * COPY INTO followed by the rows as data.
+ *
+ * The rows are stored as we send them, so the slots are returned as they
+ * are, for RETURNING and AFTER ROW triggers.
+ */
+static TupleTableSlot **
+monetdbExecForeignBatchInsert(EState *estate,
+							  ResultRelInfo *resultRelInfo,
+							  TupleTableSlot **slots,
+							  TupleTableSlot **planSlots,
+							  int *numSlots)
+{
+	MonetdbFdwModifyState *fmstate = (MonetdbFdwModifyState *) resultRelInfo->ri_FdwState;
+	StringInfo	buf = &fmstate->buf;
+	MemoryContext oldcontext;
+	MapiHdl		hdl;
+	int			i;
+
+	MemoryContextReset(fmstate->temp_cxt);
+	oldcontext = MemoryContextSwitchTo(fmstate->temp_cxt);
+
+	resetStringInfo(buf);
+	if (fmstate->use_copy)
+		appendStringInfo(buf, "COPY %d RECORDS %s;\n", *numSlots, fmstate->sql);
+	else
+		appendStringInfoString(buf, fmstate->sql);
+
+	for (i = 0; i < *numSlots; i++)
+	{
+		ListCell   *lc;
+		bool		first = true;
+
+		slot_getallattrs(slots[i]);
+
+		if (!fmstate->use_copy)
+			appendStringInfoString(buf, (i == 0) ? " (" : ", (");
+
+		foreach(lc, fmstate->target_attrs)
+		{
+			int			attnum = lfirst_int(lc);
+			Oid			atttype = TupleDescAttr(fmstate->tupdesc, attnum - 1)->atttypid;
+			bool		isnull = slots[i]->tts_isnull[attnum - 1];
+			Datum		value = slots[i]->tts_values[attnum - 1];
+
+			if (!first)
+				appendStringInfoChar(buf, ',');
+			first = false;
+
+			/* an empty field is NULL to COPY INTO */
+			if (fmstate->use_copy)
+			{
+				if (!isnull)
+					monetdbDeparseCopyField(buf, value, atttype);
+			}
+			else if (isnull)
+				appendStringInfoString(buf, "NULL");
+			else
+				monetdbDeparseLiteral(buf, value, atttype);
+		}
+
+		appendStringInfoString(buf, fmstate->use_copy ? "\n" : ")");
+	}
+
+	MemoryContextSwitchTo(oldcontext);
+
+	if ((hdl = mapi_query(fmstate->dbh, buf->data)) == NULL ||
+		mapi_error(fmstate->dbh) != MOK)
+		monetdbReportError(fmstate->dbh, hdl,
+						   RelationGetRelid(resultRelInfo->ri_RelationDesc));
+	mapi_close_handle(hdl);
+
+	return slots;
+}
+
+/*
+ * monetdbGetForeignModifyBatchSize
+ *
+ * Rows are sent batch_size at a time, unless each of them has to be back
+ * from MonetDB before the next is inserted: for RETURNING, or for row
+ * triggers on the foreign table.
+ */
+static int
+monetdbGetForeignModifyBatchSize(ResultRelInfo *resultRelInfo)
+{
+	MonetdbFdwModifyState *fmstate = (MonetdbFdwModifyState *) resultRelInfo->ri_FdwState;
+	int			batch_size;
+
+	/* in EXPLAIN, there is no state to take batch_size from */
+	if (fmstate)
+		batch_size = fmstate->batch_size;
+	else
+	{
+		MonetdbFdwPlanState fdw_private;
+
+		monetdbGetOptions(RelationGetRelid(resultRelInfo->ri_RelationDesc),
+						  &fdw_private);
+		batch_size = fdw_private.batch_size;
+	}
+
+	if (resultRelInfo->ri_projectReturning != NULL ||
+		(resultRelInfo->ri_TrigDesc &&
+		 (resultRelInfo->ri_TrigDesc->trig_insert_before_row ||
+		  resultRelInfo->ri_TrigDesc->trig_insert_after_row)))
+		return 1;
+
+	return batch_size;
+}
+
+static void
+monetdbEndForeignModify(EState *estate, ResultRelInfo *resultRelInfo)
+{
+	MonetdbFdwModifyState *fmstate = (MonetdbFdwModifyState *) resultRelInfo->ri_FdwState;
+
+	/* if fmstate is NULL, we are in EXPLAIN; nothing to do */
+	if (fmstate)
+		monetdbReleaseConnection(fmstate->dbh);
+}
+
+static void
+monetdbEndForeignInsert(EState *estate, ResultRelInfo *resultRelInfo)
+{
+	monetdbEndForeignModify(estate, resultRelInfo);
+}
+
+static void
+monetdbExplainForeignModify(ModifyTableState *mtstate,
+							ResultRelInfo *rinfo,
+							List *fdw_private,
+							int subplan_index,
+							ExplainState *es)
+{
+	if (es->verbose)
+	{
+		char	   *sql = strVal(list_nth(fdw_private,
+											  MonetdbFdwModifyPrivateUpdateSql));
+
+		if (intVal(list_nth(fdw_private, MonetdbFdwModifyPrivateUseCopy)))
+			sql = psprintf("COPY %s", sql);
+		ExplainPropertyText("Remote SQL", sql, es);
+
+		if (rinfo->ri_BatchSize > 1)
+			ExplainPropertyInteger("Batch Size", NULL, rinfo->ri_BatchSize, es);
+	}
+}
+
+/*
+ * monetdbExecForeignUpdate, monetdbExecForeignDelete
+ *
+ * Rows can't be updated or deleted one at a time (monetdbPlanForeignModify
+ * rejects such plans), but the executor only lets a foreign table be the
+ * target of an UPDATE or DELETE if these exist.
+ */
+static TupleTableSlot *
+monetdbExecForeignUpdate(EState *estate,
+						 ResultRelInfo *resultRelInfo,
+						 TupleTableSlot *slot,
+						 TupleTableSlot *planSlot)
+{
+	elog(ERROR, "monetdb_fdw: unexpected row-by-row UPDATE");
+	return NULL;				/* keep compiler quiet */
+}
+
+static TupleTableSlot *
+monetdbExecForeignDelete(EState *estate,
+						 ResultRelInfo *resultRelInfo,
+						 TupleTableSlot *slot,
+						 TupleTableSlot *planSlot)
+{
+	elog(ERROR, "monetdb_fdw: unexpected row-by-row DELETE");
+	return NULL;				/* keep compiler quiet */
+}
+
+/*
+ * Return the ForeignScan that scans the result relation rtindex for a
+ * ModifyTable, or NULL if its subplan is anything else.  With several
+ * result relations, as for an inheritance tree, the scan is one of the
+ * children of an Append, possibly under a Result.
+ */
+static ForeignScan *
+find_modifytable_subplan(ModifyTable *plan, Index rtindex, int subplan_index)
+{
+	Plan	   *subplan = outerPlan(plan);
+	Append	   *appendplan = NULL;
+
+	if (IsA(subplan, Append))
+		appendplan = (Append *) subplan;
+	else if (IsA(subplan, Result) && outerPlan(subplan) != NULL &&
+			 IsA(outerPlan(subplan), Append))
+		appendplan = (Append *) outerPlan(subplan);
+
+	if (appendplan && subplan_index < list_length(appendplan->appendplans))
+		subplan = (Plan *) list_nth(appendplan->appendplans, subplan_index);
+
+	if (IsA(subplan, ForeignScan) &&
+		((ForeignScan *) subplan)->scan.scanrelid == rtindex)
+		return (ForeignScan *) subplan;
+
+	return NULL;
+}
+
+/*
+ * monetdbPlanDirectModify
+ *
+ * Have MonetDB do an UPDATE or DELETE in a single statement, if it can
+ * check all of the conditions and compute all of the new values; if so,
+ * turn the ForeignScan below the ModifyTable into the node that runs the
+ * statement.
+ *
+ * MonetDB has no RETURNING, so for one the rows are fetched by a SELECT
+ * with the same conditions, run first in the same transaction.  For an
+ * UPDATE, that SELECT computes the new values of the columns set, so that
+ * it returns the rows as they will be.
+ */
+static bool
+monetdbPlanDirectModify(PlannerInfo *root,
+						ModifyTable *plan,
+						Index resultRelation,
+						int subplan_index)
+{
+	CmdType		operation = plan->operation;
+	ForeignScan *fscan;
+	RelOptInfo *foreignrel;
+	MonetdbFdwPlanState *fpinfo;
+	List	   *target_attrs = NIL;
+	List	   *target_exprs = NIL;
+	List	   *retrieved_attrs = NIL;
+	StringInfoData sql;
+	StringInfoData returning_sql;
+
+	if (operation != CMD_UPDATE && operation != CMD_DELETE)
+		return false;
+
+	fscan = find_modifytable_subplan(plan, resultRelation, subplan_index);
+	if (fscan == NULL)
+		return false;
+
+	/* there must be no condition left for us to check */
+	if (fscan->scan.plan.qual != NIL)
+		return false;
+
+	foreignrel = find_base_rel(root, resultRelation);
+	fpinfo = (MonetdbFdwPlanState *) foreignrel->fdw_private;
+
+	if (operation == CMD_UPDATE)
+	{
+		List	   *processed_tlist;
+		ListCell   *lc,
+				   *lc2;
+
+		get_translated_update_targetlist(root, resultRelation,
+										 &processed_tlist, &target_attrs);
+		forboth(lc, processed_tlist, lc2, target_attrs)
+		{
+			Expr	   *expr = lfirst_node(TargetEntry, lc)->expr;
+
+			if (lfirst_int(lc2) <= InvalidAttrNumber)
+				return false;
+
+			/*
+			 * MonetDB checks the length of a value stored into a char(n) or
+			 * varchar(n) column itself, so the length coercion of a new
+			 * value needn't be shipped.
+			 */
+			if (IsA(expr, FuncExpr) && exprIsLengthCoercion((Node *) expr, NULL))
+				expr = (Expr *) linitial(((FuncExpr *) expr)->args);
+
+			if (!monetdbIsForeignExpr(root, foreignrel, expr))
+				return false;
+
+			target_exprs = lappend(target_exprs, expr);
+		}
+	}
+
+	initStringInfo(&sql);
+	monetdbDeparseDirectModifySql(&sql, root, foreignrel, operation,
+								  target_attrs, target_exprs,
+								  fpinfo->remote_conds);
 
-  /*
-   * We have no native ability to evaluate restriction clauses, so we just
-   * put all the scan_clauses into the plan node's qual list for the
-   * executor to check.  So all we have to do here is strip RestrictInfo
-   * nodes from the clauses and ignore pseudoconstants (which will be
-   * handled elsewhere).
-   */
-  scan_clauses = extract_actual_clauses(scan_clauses, false);
+	initStringInfo(&returning_sql);
+	if (plan->returningLists)
+	{
+		List	   *returning_list = (List *) list_nth(plan->returningLists,
+													   subplan_index);
+		Bitmapset  *attrs_used = NULL;
 
-  /* Create the ForeignScan node */
-  return make_foreignscan(tlist,
-			  scan_clauses,
-			  scan_relid,
-			  NIL,    /* no expressions to evaluate */
-			  best_path->fdw_private);
-}
+		pull_varattnos((Node *) returning_list, resultRelation, &attrs_used);
+		monetdbDeparseReturningSql(&returning_sql, root, foreignrel, attrs_used,
+								   target_attrs, target_exprs,
+								   fpinfo->remote_conds, &retrieved_attrs);
+	}
 
-static void
-monetdbExplainForeignScan(ForeignScanState *node, ExplainState *es)
-{
-  //  char       *filename;
-  //  List       *options;
+	fscan->operation = operation;
+	fscan->resultRelation = resultRelation;
 
-  /* Fetch options --- we only need filename at this point */
-  //  fileGetOptions(RelationGetRelid(node->ss.ss_currentRelation),
-  //		 &filename, &options);
+	/*
+	 * Items in the list must match enum MonetdbFdwDirectModifyPrivateIndex.
+	 */
+	fscan->fdw_private = list_make4(makeString(sql.data),
+									makeString(returning_sql.data),
+									retrieved_attrs,
+									makeInteger(plan->canSetTag));
 
-  ExplainPropertyText("Foreign File", "monetdb", es);
+	/* a modification is not run asynchronously under an Append */
+	fscan->scan.plan.async_capable = false;
 
-  /* Suppress file size if we're not showing cost details */
-  if (es->costs)
-    {
-	ExplainPropertyLong("Foreign File Size", 8192, es);
-    }
+	return true;
 }
 
 static void
-monetdb_die(Mapi dbh, MapiHdl hdl)
+monetdbBeginDirectModify(ForeignScanState *node, int eflags)
 {
-	char *err;
+	ForeignScan *fsplan = (ForeignScan *) node->ss.ps.plan;
+	EState	   *estate = node->ss.ps.state;
+	MonetdbFdwDirectModifyState *dmstate;
+	RangeTblEntry *rte;
+	Oid			userid;
+	char	   *returning_sql;
 
-	if (mapi_result_error(hdl))
-		err = pstrdup(mapi_result_error(hdl));
-	else if (mapi_error_str(dbh))
-		err = pstrdup(mapi_error_str(dbh));
-	else
-		err = "unknown error.";
-
-	if (hdl != NULL) {
-		mapi_explain_query(hdl, stderr);
-		do {
-			if (mapi_result_error(hdl) != NULL)
-				mapi_explain_result(hdl, stderr);
-		} while (mapi_next_result(hdl) == 1);
-		mapi_close_handle(hdl);
-		mapi_destroy(dbh);
-	} else if (dbh != NULL) {
-		mapi_explain(dbh, stderr);
-		mapi_destroy(dbh);
+	/*
+	 * Do nothing in EXPLAIN (no ANALYZE) case.  node->fdw_state stays NULL.
+	 */
+	if (eflags & EXEC_FLAG_EXPLAIN_ONLY)
+		return;
+
+	rte = exec_rt_fetch(fsplan->scan.scanrelid, estate);
+	userid = OidIsValid(rte->checkAsUser) ? rte->checkAsUser : GetUserId();
+
+	dmstate = (MonetdbFdwDirectModifyState *) palloc0(sizeof(MonetdbFdwDirectModifyState));
+	dmstate->dbh = monetdbGetConnection(GetUserMapping(userid,
+													   fsplan->fs_server));
+	monetdbBeginRemoteXact(dmstate->dbh);
+	dmstate->relname = get_rel_name(rte->relid);
+	dmstate->sql = strVal(list_nth(fsplan->fdw_private,
+								   MonetdbFdwDirectModifyPrivateUpdateSql));
+	returning_sql = strVal(list_nth(fsplan->fdw_private,
+									MonetdbFdwDirectModifyPrivateReturningSql));
+	dmstate->returning_sql = (returning_sql[0] != '\0') ? returning_sql : NULL;
+	dmstate->retrieved_attrs = (List *) list_nth(fsplan->fdw_private,
+												 MonetdbFdwDirectModifyPrivateRetrievedAttrs);
+	dmstate->set_processed = intVal(list_nth(fsplan->fdw_private,
+											 MonetdbFdwDirectModifyPrivateSetProcessed));
+
+	if (dmstate->returning_sql)
+	{
+		TupleDesc	tupdesc = RelationGetDescr(node->ss.ss_currentRelation);
+
+		dmstate->convs = monetdbMakeConverters(tupdesc, dmstate->retrieved_attrs);
+		dmstate->nconvs = list_length(dmstate->retrieved_attrs);
+		dmstate->returning_slot = ExecInitExtraTupleSlot(estate, tupdesc,
+														 &TTSOpsMinimalTuple);
+		dmstate->temp_cxt = AllocSetContextCreate(estate->es_query_cxt,
+												  "monetdb_fdw returning data",
+												  ALLOCSET_DEFAULT_SIZES);
 	}
 
-	elog(ERROR, "monetdb_fdw: %s", err);
+	node->fdw_state = (void *) dmstate;
 }
 
+/*
+ * Fetch the rows for the RETURNING list of a direct modification into a
+ * tuplestore, converted the way a scan converts its rows.
+ */
 static void
-monetdbBeginForeignScan(ForeignScanState *node, int eflags)
+fetch_returning_rows(ForeignScanState *node)
 {
-  ForeignScan *plan = (ForeignScan *) node->ss.ps.plan;
-  MonetdbFdwExecutionState *festate;
-  MonetdbFdwPlanState fdw_private;
-
-  	char *host;
-	char *port;
-	char *user;
-	char *passwd;
-	char *dbname;
-	char *table;
-	char *query;
-	
-	monetdbGetOptions(RelationGetRelid(node->ss.ss_currentRelation),
-					  &host, &port, &user, &passwd, &dbname, &table, &query);
+	MonetdbFdwDirectModifyState *dmstate = (MonetdbFdwDirectModifyState *) node->fdw_state;
+	TupleDesc	tupdesc = RelationGetDescr(node->ss.ss_currentRelation);
+	Datum	   *values = (Datum *) palloc(tupdesc->natts * sizeof(Datum));
+	bool	   *isnull = (bool *) palloc(tupdesc->natts * sizeof(bool));
+	MemoryContext oldcontext;
+	MapiHdl		hdl;
 
-  /*
-   * Do nothing in EXPLAIN (no ANALYZE) case.  node->fdw_state stays NULL.
-   */
-  if (eflags & EXEC_FLAG_EXPLAIN_ONLY)
-    return;
+	if ((hdl = mapi_query(dmstate->dbh, dmstate->returning_sql)) == NULL ||
+		mapi_error(dmstate->dbh) != MOK)
+		monetdbReportError(dmstate->dbh, hdl,
+						   RelationGetRelid(node->ss.ss_currentRelation));
 
-  /*
-   * Save state in node->fdw_state.  We must save enough information to call
-   * BeginCopyFrom() again.
-   */
-  festate = (MonetdbFdwExecutionState *) palloc(sizeof(MonetdbFdwExecutionState));
+	oldcontext = MemoryContextSwitchTo(node->ss.ps.state->es_query_cxt);
+	dmstate->returning_rows = tuplestore_begin_heap(false, false, work_mem);
+	MemoryContextSwitchTo(oldcontext);
 
-  festate->dbh = NULL;
-  festate->hdl = NULL;
+	while (mapi_fetch_row(hdl))
+	{
+		int			i;
 
-  /*
-   * TODO: Open an external table (or resource) here.
-   */
-  festate->dbh = mapi_connect(host, atoi(port), user, passwd, "sql", dbname);
-  if (mapi_error(festate->dbh))
-	  monetdb_die(festate->dbh, festate->hdl);
+		MemoryContextReset(dmstate->temp_cxt);
+		oldcontext = MemoryContextSwitchTo(dmstate->temp_cxt);
 
-  festate->rel       = node->ss.ss_currentRelation;
-  festate->linecount = 0;
+		memset(isnull, true, tupdesc->natts * sizeof(bool));
+		for (i = 0; i < dmstate->nconvs; i++)
+		{
+			MonetdbFdwConverter *conv = &dmstate->convs[i];
+			char	   *value = mapi_fetch_field(hdl, i);
 
-  node->fdw_state = (void *) festate;
+			if (value == NULL)
+				continue;
+
+			values[conv->attnum - 1] =
+				monetdbConvertValue(conv, value, mapi_fetch_field_len(hdl, i));
+			isnull[conv->attnum - 1] = false;
+		}
+
+		MemoryContextSwitchTo(oldcontext);
+
+		/* the tuplestore copies the row into its own memory */
+		tuplestore_putvalues(dmstate->returning_rows, tupdesc, values, isnull);
+	}
+
+	mapi_close_handle(hdl);
 }
 
 /*
- * buildTupleImpl()
- *
- * TODO: Implement this function to build a single tuple.
- *
- * Read data from an external table, and pack them into
- * a tuple (a Datum array) with using XXXGetDatum().
- * See include/postgres.h for more infomation about
- * XXXGetDatum() functions.
- *
- * Also FdwExecutionState needs to be updated here.
- *
- * Return true if a tuple is found (or available),
- * false if not available (or end of the scan).
+ * Run the UPDATE or DELETE, after fetching the rows for RETURNING if there
+ * is one.  MonetDB runs a transaction on a snapshot, so the SELECT and the
+ * statement find the same rows: both run in the remote transaction begun
+ * in monetdbBeginDirectModify.
  */
-//static bool
-static HeapTuple
-buildTupleImpl(MonetdbFdwExecutionState *festate)
+static void
+execute_direct_modify(ForeignScanState *node)
 {
-	int i;
-	char **values;
-	HeapTuple tuple;
-	int num_attrs = RelationGetDescr(festate->rel)->natts;
+	MonetdbFdwDirectModifyState *dmstate = (MonetdbFdwDirectModifyState *) node->fdw_state;
+	MapiHdl		hdl;
 
-	values = (char **)palloc( sizeof(char *) * num_attrs );
+	if (dmstate->returning_sql)
+		fetch_returning_rows(node);
 
-//	elog(NOTICE, "buildTupleImpl: num_attrs=%d", num_attrs);
+	if ((hdl = mapi_query(dmstate->dbh, dmstate->sql)) == NULL ||
+		mapi_error(dmstate->dbh) != MOK)
+		monetdbReportError(dmstate->dbh, hdl,
+						   RelationGetRelid(node->ss.ss_currentRelation));
+	dmstate->num_tuples = mapi_rows_affected(hdl);
+	mapi_close_handle(hdl);
 
-	/* end of result set */
-	if ( !mapi_fetch_row(festate->hdl) )
-		return NULL;
+	dmstate->executed = true;
+}
 
-	for (i=0 ; i<num_attrs ; i++)
+/*
+ * monetdbIterateDirectModify
+ *
+ * Run the statement on the first call.  Without RETURNING, report the rows
+ * modified all at once, and return no row; with RETURNING, return the rows
+ * one at a time, for ExecProcessReturning.
+ */
+static TupleTableSlot *
+monetdbIterateDirectModify(ForeignScanState *node)
+{
+	MonetdbFdwDirectModifyState *dmstate = (MonetdbFdwDirectModifyState *) node->fdw_state;
+	EState	   *estate = node->ss.ps.state;
+	ResultRelInfo *resultRelInfo = node->resultRelInfo;
+	TupleTableSlot *slot = dmstate->returning_slot;
+
+	if (!dmstate->executed)
+		execute_direct_modify(node);
+
+	if (dmstate->returning_sql == NULL)
 	{
-		values[i] = mapi_fetch_field(festate->hdl, i);
+		Instrumentation *instr = node->ss.ps.instrument;
 
-#ifdef _DEBUG
-		elog(NOTICE, "buildTupleImpl: mapi_fetch_field -> %s", values[i]);
-#endif
+		if (dmstate->set_processed)
+			estate->es_processed += dmstate->num_tuples;
+
+		/* count the rows for EXPLAIN ANALYZE too */
+		if (instr)
+			instr->tuplecounter += dmstate->num_tuples;
+
+		return ExecClearTuple(node->ss.ss_ScanTupleSlot);
 	}
 
-	tuple = BuildTupleFromCStrings(TupleDescGetAttInMetadata(festate->rel->rd_att), values);
+	if (!tuplestore_gettupleslot(dmstate->returning_rows, true, false, slot))
+		return slot;
 
-    festate->linecount++;
+	slot->tts_tableOid = RelationGetRelid(node->ss.ss_currentRelation);
+	if (dmstate->set_processed)
+		estate->es_processed += 1;
 
-    return tuple;
+	/* ExecProcessReturning computes the RETURNING list from this row */
+	resultRelInfo->ri_projectReturning->pi_exprContext->ecxt_scantuple = slot;
+
+	return slot;
 }
 
 static void
-monetdbErrorCallback(void *arg)
+monetdbEndDirectModify(ForeignScanState *node)
 {
-	MonetdbFdwExecutionState *festate = (MonetdbFdwExecutionState *)arg;
+	MonetdbFdwDirectModifyState *dmstate = (MonetdbFdwDirectModifyState *) node->fdw_state;
 
-	errcontext("relation %s, line %d",
-		   NameStr(festate->rel->rd_rel->relname),
-		   festate->linecount);
+	/* if dmstate is NULL, we are in EXPLAIN; nothing to do */
+	if (dmstate == NULL)
+		return;
+
+	if (dmstate->returning_rows)
+		tuplestore_end(dmstate->returning_rows);
+	monetdbReleaseConnection(dmstate->dbh);
 }
 
-static TupleTableSlot *
-monetdbIterateForeignScan(ForeignScanState *node)
+static void
+monetdbExplainDirectModify(ForeignScanState *node, ExplainState *es)
 {
-  MonetdbFdwExecutionState *festate = (MonetdbFdwExecutionState *) node->fdw_state;
-  TupleTableSlot *slot = node->ss.ss_ScanTupleSlot;
-  bool            found;
-  ErrorContextCallback errcallback;
+	if (es->verbose)
+	{
+		List	   *fdw_private = ((ForeignScan *) node->ss.ps.plan)->fdw_private;
+		char	   *returning_sql = strVal(list_nth(fdw_private,
+													MonetdbFdwDirectModifyPrivateReturningSql));
 
-  /* Set up callback to identify error line number. */
-  errcallback.callback = monetdbErrorCallback;
-  errcallback.arg      = (void *)festate;
+		ExplainPropertyText("Remote SQL",
+							strVal(list_nth(fdw_private,
+											MonetdbFdwDirectModifyPrivateUpdateSql)),
+							es);
+		if (returning_sql[0] != '\0')
+			ExplainPropertyText("Remote Returning SQL", returning_sql, es);
+	}
+}
 
-  errcallback.previous = error_context_stack;
-  error_context_stack  = &errcallback;
+/*
+ * monetdbAnalyzeForeignTable
+ *
+ * MonetDB has no notion of pages; report one, so that the planner goes by
+ * the row count ANALYZE stores.
+ */
+static bool
+monetdbAnalyzeForeignTable(Relation relation,
+						   AcquireSampleRowsFunc *func,
+						   BlockNumber *totalpages)
+{
+	*func = monetdbAcquireSampleRowsFunc;
+	*totalpages = 1;
 
-  if (!festate->hdl)
-  {
-	  char *host;
-	  char *port;
-	  char *user;
-	  char *passwd;
-	  char *dbname;
-	  char *table;
-	  char *query;
-
-	  char q[1024];
-	  
-	  monetdbGetOptions(RelationGetRelid(node->ss.ss_currentRelation),
-						&host, &port, &user, &passwd, &dbname, &table, &query);
-	  
-	  if ( !query )
-		  snprintf(q, sizeof(q), "SELECT * FROM %s", table);
-	  else
-		  strncpy(q, query, sizeof(q));
+	return true;
+}
 
-#ifdef _DEBUG
-	  elog(NOTICE, "monetdb_fdw: monetdbIterateForeignScan: query=%s", query);
-#endif
+/*
+ * monetdbAcquireSampleRowsFunc
+ *
+ * Acquire a random sample of rows from a foreign table, and count its rows
+ * on MonetDB for reltuples.
+ *
+ * Fetching the whole of a large table would take far too long, so unless
+ * analyze_sampling is off, MonetDB picks about targrows rows for us: with
+ * its SAMPLE clause, or with a filter on rand() that keeps each row with
+ * the right probability.  The rows we get are reservoir-sampled as in
+ * acquire_sample_rows(), in case there are more than targrows of them.
+ */
+static int
+monetdbAcquireSampleRowsFunc(Relation relation, int elevel,
+							 HeapTuple *rows, int targrows,
+							 double *totalrows,
+							 double *totaldeadrows)
+{
+	MonetdbFdwPlanState fdw_private;
+	TupleDesc	tupdesc = RelationGetDescr(relation);
+	UserMapping *user;
+	StringInfoData count_sql;
+	StringInfoData sql;
+	List	   *retrieved_attrs;
+	MonetdbFdwConverter *convs;
+	int			nconvs;
+	Datum	   *values;
+	bool	   *nulls;
+	MemoryContext anl_cxt = CurrentMemoryContext;
+	MemoryContext temp_cxt;
+	ReservoirStateData rstate;
+	double		reltuples = -1;
+	double		samplerows = 0;
+	double		rowstoskip = -1;
+	int			numrows = 0;
+	Mapi		dbh;
+	volatile MapiHdl hdl = NULL;
 
-	  if ((festate->hdl = mapi_query(festate->dbh, q)) == NULL ||
-		  mapi_error(festate->dbh) != MOK)
-	  {
-		  monetdb_die(festate->dbh, festate->hdl);
-	  }
+	monetdbGetOptions(RelationGetRelid(relation), &fdw_private);
+	user = GetUserMapping(relation->rd_rel->relowner, fdw_private.serverid);
 
-#ifdef _DEBUG
-	  elog(NOTICE, "monetdb_fdw: monetdbIterateForeignScan: mapi_query done.");
-#endif
-  }
+	initStringInfo(&count_sql);
+	initStringInfo(&sql);
+	monetdbDeparseAnalyzeSql(&count_sql, &sql, relation, &fdw_private,
+							 &retrieved_attrs);
 
-  /*
-   * The protocol for loading a virtual tuple into a slot is first
-   * ExecClearTuple, then fill the values/isnull arrays, then
-   * ExecStoreVirtualTuple.  If we don't find another row in the file, we
-   * just skip the last step, leaving the slot empty as required.
-   *
-   * We can pass ExprContext = NULL because we read all columns from the
-   * file, so no need to evaluate default expressions.
-   *
-   * We can also pass tupleOid = NULL because we don't allow oids for
-   * foreign tables.
-   */
-  ExecClearTuple(slot);
-  //  found = NextCopyFrom(festate->cstate, NULL,
-  //		       slot->tts_values, slot->tts_isnull,
-  //		       NULL);
+	/* there is nothing to sample if the table is small enough */
+	if (fdw_private.analyze_sampling != MONETDB_SAMPLE_OFF)
+	{
+		reltuples = monetdbGetRemoteRowCount(user, count_sql.data);
+		if (reltuples <= targrows)
+			fdw_private.analyze_sampling = MONETDB_SAMPLE_OFF;
+	}
 
-  {
-    TupleDesc	tupDesc = RelationGetDescr(festate->rel);
-    int num_phys_attrs =  tupDesc->natts;
-	HeapTuple tup;
+	switch (fdw_private.analyze_sampling)
+	{
+		case MONETDB_SAMPLE_OFF:
+			break;
+		case MONETDB_SAMPLE_SAMPLE:
+			appendStringInfo(&sql, " SAMPLE %d", targrows);
+			break;
+		case MONETDB_SAMPLE_RANDOM:
+			{
+				/* ask for 10% more, so that we come short only rarely */
+				double		sample_frac = Min(1.0, 1.1 * targrows / reltuples);
+
+				/* rand() returns an int in [0, INT_MAX] */
+				appendStringInfo(&sql, " WHERE rand() < %.0f",
+								 sample_frac * INT_MAX);
+			}
+			break;
+	}
 
-    MemSet(slot->tts_values, 0, num_phys_attrs * sizeof(Datum));
-    MemSet(slot->tts_isnull, true, num_phys_attrs * sizeof(bool));
+	convs = monetdbMakeConverters(tupdesc, retrieved_attrs);
+	nconvs = list_length(retrieved_attrs);
+	values = (Datum *) palloc(tupdesc->natts * sizeof(Datum));
+	nulls = (bool *) palloc(tupdesc->natts * sizeof(bool));
+	temp_cxt = AllocSetContextCreate(CurrentMemoryContext,
+									 "monetdb_fdw analyze",
+									 ALLOCSET_SMALL_SIZES);
+	reservoir_init_selection_state(&rstate, targrows);
 
-    tup = buildTupleImpl(festate);
+	ereport(elevel,
+			(errmsg("\"%s\": remote query: %s",
+					RelationGetRelationName(relation), sql.data)));
 
-	if (tup)
-		ExecStoreTuple(tup, slot, InvalidBuffer, false);
-  }
+	dbh = monetdbGetConnection(user);
 
-  /* Remove error callback. */
-  error_context_stack = errcallback.previous;
+	/*
+	 * On an error or a cancel, close the result and give the connection
+	 * back, so that it stays in the cache; see monetdb_xact_callback().
+	 */
+	PG_TRY();
+	{
+		monetdbSetFetchSize(dbh, fdw_private.fetch_size);
 
-  return slot;
-}
+		if ((hdl = mapi_query(dbh, sql.data)) == NULL || mapi_error(dbh) != MOK)
+		{
+			MapiHdl		failed = hdl;
 
-static void
-monetdbEndForeignScan(ForeignScanState *node)
-{
-	MonetdbFdwExecutionState *festate = (MonetdbFdwExecutionState *) node->fdw_state;
-	
-	/* if festate is NULL, we are in EXPLAIN; nothing to do */
-	if (festate)
+			/* monetdbReportError closes it */
+			hdl = NULL;
+			monetdbReportError(dbh, failed, RelationGetRelid(relation));
+		}
+
+		while (mapi_fetch_row(hdl))
+		{
+			int			pos;
+			int			i;
+
+			vacuum_delay_point();
+			samplerows += 1;
+
+			/*
+			 * The first targrows rows fill the sample; after that, each row
+			 * replaces a random one of the sample with decreasing
+			 * probability.
+			 */
+			if (numrows < targrows)
+				pos = numrows++;
+			else
+			{
+				if (rowstoskip < 0)
+					rowstoskip = reservoir_get_next_S(&rstate, samplerows,
+													  targrows);
+
+				if (rowstoskip <= 0)
+				{
+					pos = (int) (targrows *
+								 sampler_random_fract(&rstate.randstate));
+					heap_freetuple(rows[pos]);
+				}
+				else
+					pos = -1;
+
+				rowstoskip -= 1;
+			}
+
+			if (pos < 0)
+				continue;
+
+			MemoryContextReset(temp_cxt);
+			MemoryContextSwitchTo(temp_cxt);
+
+			memset(nulls, true, tupdesc->natts * sizeof(bool));
+			for (i = 0; i < nconvs; i++)
+			{
+				MonetdbFdwConverter *conv = &convs[i];
+				char	   *value = mapi_fetch_field(hdl, i);
+
+				if (value == NULL)
+					continue;
+
+				values[conv->attnum - 1] =
+					monetdbConvertValue(conv, value,
+										mapi_fetch_field_len(hdl, i));
+				nulls[conv->attnum - 1] = false;
+			}
+
+			MemoryContextSwitchTo(anl_cxt);
+			rows[pos] = heap_form_tuple(tupdesc, values, nulls);
+		}
+	}
+	PG_FINALLY();
 	{
-		/*
-		 * TODO: Close the external table (resource), and initialize
-		 * FdwExecutionState state.
-		 */
-        if (festate->hdl)
-			mapi_close_handle(festate->hdl);
+		if (hdl != NULL)
+			mapi_close_handle(hdl);
+		monetdbReleaseConnection(dbh);
+	}
+	PG_END_TRY();
 
-        if (festate->dbh)
-			mapi_destroy(festate->dbh);
-    }
-}
+	MemoryContextDelete(temp_cxt);
 
-static void
-monetdbReScanForeignScan(ForeignScanState *node)
-{
-  MonetdbFdwExecutionState *festate = (MonetdbFdwExecutionState *) node->fdw_state;
+	/* without the count, all the rows we saw are all there are */
+	*totalrows = (reltuples >= 0) ? reltuples : samplerows;
+	*totaldeadrows = 0;
 
-  /*
-   * TODO: Close external resource here.
-   */
+	ereport(elevel,
+			(errmsg("\"%s\": table contains %.0f rows, %d rows in sample",
+					RelationGetRelationName(relation),
+					*totalrows, numrows)));
 
-  /*
-   * TODO: Re-open the external table (resource) here.
-   */
-  festate->linecount = 0;
+	return numrows;
 }
 
 
@@ -716,6 +4500,20 @@ monetdb_fdw_validator(PG_FUNCTION_ARGS)
   char       *query = NULL;
   char       *monetdb_opt6 = NULL;
   ListCell   *cell;
+  bool        use_remote_estimate_set = false;
+  bool        async_capable_set = false;
+  bool        rescan_cache_set = false;
+  bool        fdw_startup_cost_set = false;
+  bool        fdw_tuple_cost_set = false;
+  bool        fetch_size_set = false;
+  bool        partition_count_set = false;
+  bool        batch_size_set = false;
+  bool        prefetch_depth_set = false;
+  bool        binary_threshold_set = false;
+  char       *partition_column = NULL;
+  char       *partition_method = NULL;
+  char       *analyze_sampling = NULL;
+  char       *transfer_mode = NULL;
 
   /*
    * Only superusers are allowed to set options of a file_fdw foreign table.
@@ -826,6 +4624,149 @@ monetdb_fdw_validator(PG_FUNCTION_ARGS)
 		  
 		  query = defGetString(def);
 	  }
+      else if (strcmp(def->defname, "use_remote_estimate") == 0 ||
+			   strcmp(def->defname, "async_capable") == 0 ||
+			   strcmp(def->defname, "rescan_cache") == 0)
+	  {
+		  bool	   *seen = (strcmp(def->defname, "use_remote_estimate") == 0) ?
+			  &use_remote_estimate_set :
+			  (strcmp(def->defname, "async_capable") == 0) ?
+			  &async_capable_set : &rescan_cache_set;
+
+		  if (*seen)
+			  ereport(ERROR,
+					  (errcode(ERRCODE_SYNTAX_ERROR),
+					   errmsg("conflicting or redundant options")));
+
+		  /* defGetBoolean() complains about anything that isn't a boolean */
+		  (void) defGetBoolean(def);
+		  *seen = true;
+	  }
+      else if (strcmp(def->defname, "fdw_startup_cost") == 0 ||
+			   strcmp(def->defname, "fdw_tuple_cost") == 0)
+	  {
+		  bool	   *seen = (strcmp(def->defname, "fdw_startup_cost") == 0) ?
+			  &fdw_startup_cost_set : &fdw_tuple_cost_set;
+		  char	   *value = defGetString(def);
+		  char	   *endp;
+		  double	  cost;
+
+		  if (*seen)
+			  ereport(ERROR,
+					  (errcode(ERRCODE_SYNTAX_ERROR),
+					   errmsg("conflicting or redundant options")));
+
+		  cost = strtod(value, &endp);
+		  if (endp == value || *endp != '\0' || cost < 0)
+			  ereport(ERROR,
+					  (errcode(ERRCODE_SYNTAX_ERROR),
+					   errmsg("%s requires a non-negative numeric value",
+							  def->defname)));
+		  *seen = true;
+	  }
+      else if (strcmp(def->defname, "fetch_size") == 0 ||
+			   strcmp(def->defname, "partition_count") == 0 ||
+			   strcmp(def->defname, "batch_size") == 0)
+	  {
+		  bool	   *seen = (strcmp(def->defname, "fetch_size") == 0) ?
+			  &fetch_size_set :
+			  (strcmp(def->defname, "partition_count") == 0) ?
+			  &partition_count_set : &batch_size_set;
+		  char	   *value = defGetString(def);
+		  char	   *endp;
+		  long		count;
+
+		  if (*seen)
+			  ereport(ERROR,
+					  (errcode(ERRCODE_SYNTAX_ERROR),
+					   errmsg("conflicting or redundant options")));
+
+		  errno = 0;
+		  count = strtol(value, &endp, 10);
+		  if (endp == value || *endp != '\0' || errno != 0 ||
+			  count <= 0 || count > INT_MAX)
+			  ereport(ERROR,
+					  (errcode(ERRCODE_SYNTAX_ERROR),
+					   errmsg("%s requires a positive integer value",
+							  def->defname)));
+		  *seen = true;
+	  }
+      else if (strcmp(def->defname, "prefetch_depth") == 0 ||
+			   strcmp(def->defname, "binary_threshold") == 0)
+	  {
+		  bool	   *seen = (strcmp(def->defname, "prefetch_depth") == 0) ?
+			  &prefetch_depth_set : &binary_threshold_set;
+		  char	   *value = defGetString(def);
+		  char	   *endp;
+		  long		count;
+
+		  if (*seen)
+			  ereport(ERROR,
+					  (errcode(ERRCODE_SYNTAX_ERROR),
+					   errmsg("conflicting or redundant options")));
+
+		  errno = 0;
+		  count = strtol(value, &endp, 10);
+		  if (endp == value || *endp != '\0' || errno != 0 ||
+			  count < 0 || count > INT_MAX)
+			  ereport(ERROR,
+					  (errcode(ERRCODE_SYNTAX_ERROR),
+					   errmsg("%s requires a non-negative integer value",
+							  def->defname)));
+		  *seen = true;
+	  }
+      else if (strcmp(def->defname, "transfer_mode") == 0)
+	  {
+		  if (transfer_mode)
+			  ereport(ERROR,
+					  (errcode(ERRCODE_SYNTAX_ERROR),
+					   errmsg("conflicting or redundant options")));
+
+		  transfer_mode = defGetString(def);
+		  if (strcmp(transfer_mode, "text") != 0 &&
+			  strcmp(transfer_mode, "binary") != 0)
+			  ereport(ERROR,
+					  (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					   errmsg("transfer_mode must be \"text\" or \"binary\"")));
+	  }
+      else if (strcmp(def->defname, "partition_column") == 0)
+	  {
+		  if (partition_column)
+			  ereport(ERROR,
+					  (errcode(ERRCODE_SYNTAX_ERROR),
+					   errmsg("conflicting or redundant options")));
+
+		  partition_column = defGetString(def);
+	  }
+      else if (strcmp(def->defname, "analyze_sampling") == 0)
+	  {
+		  if (analyze_sampling)
+			  ereport(ERROR,
+					  (errcode(ERRCODE_SYNTAX_ERROR),
+					   errmsg("conflicting or redundant options")));
+
+		  analyze_sampling = defGetString(def);
+		  if (strcmp(analyze_sampling, "off") != 0 &&
+			  strcmp(analyze_sampling, "sample") != 0 &&
+			  strcmp(analyze_sampling, "random") != 0)
+			  ereport(ERROR,
+					  (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					   errmsg("analyze_sampling must be \"off\", \"sample\" or \"random\"")));
+	  }
+      else if (strcmp(def->defname, "partition_method") == 0)
+	  {
+		  if (partition_method)
+			  ereport(ERROR,
+					  (errcode(ERRCODE_SYNTAX_ERROR),
+					   errmsg("conflicting or redundant options")));
+
+		  partition_method = defGetString(def);
+		  if (strcmp(partition_method, "modulo") != 0 &&
+			  strcmp(partition_method, "range") != 0)
+			  ereport(ERROR,
+					  (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					   errmsg("partition_method must be \"modulo\" or \"range\"")));
+	  }
 #ifdef NOT_USED
       else if (strcmp(def->defname, "monetdb_opt6") == 0)
 	  {
@@ -842,33 +4783,13 @@ monetdb_fdw_validator(PG_FUNCTION_ARGS)
   /*
    * TODO: Check required option(s) here.
    */
+  /*
+   * Connection options (host, port, dbname on the server; user and passwd
+   * on the user mapping) are checked when connecting, since they can be
+   * added one ALTER at a time.
+   */
   if (catalog == ForeignTableRelationId)
   {
-	  if (host == NULL)
-		  ereport(ERROR,
-				  (errcode(ERRCODE_FDW_DYNAMIC_PARAMETER_VALUE_NEEDED),
-				   errmsg("host is required for monetdb_fdw foreign tables")));
-	  
-	  if (port == NULL)
-		  ereport(ERROR,
-				  (errcode(ERRCODE_FDW_DYNAMIC_PARAMETER_VALUE_NEEDED),
-				   errmsg("port is required for monetdb_fdw foreign tables")));
-
-	  if (user == NULL)
-		  ereport(ERROR,
-				  (errcode(ERRCODE_FDW_DYNAMIC_PARAMETER_VALUE_NEEDED),
-				   errmsg("user is required for monetdb_fdw foreign tables")));
-
-	  if (passwd == NULL)
-		  ereport(ERROR,
-				  (errcode(ERRCODE_FDW_DYNAMIC_PARAMETER_VALUE_NEEDED),
-				   errmsg("passwd is required for monetdb_fdw foreign tables")));
-
-	  if (dbname == NULL)
-		  ereport(ERROR,
-				  (errcode(ERRCODE_FDW_DYNAMIC_PARAMETER_VALUE_NEEDED),
-				   errmsg("dbname is required for monetdb_fdw foreign tables")));
-
 	  if (table == NULL && query == NULL)
 		  ereport(ERROR,
 				  (errcode(ERRCODE_FDW_DYNAMIC_PARAMETER_VALUE_NEEDED),
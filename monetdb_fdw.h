@@ -0,0 +1,343 @@
+/*-------------------------------------------------------------------------
+ *
+ * monetdb_fdw.h
+ *                a monetdb foreign-data wrapper
+ *
+ * Copyright (c) 2010-2013, PostgreSQL Global Development Group
+ * Copyright (c) 2013, Satoshi Nagayasu
+ *
+ * IDENTIFICATION
+ *                contrib/monetdb_fdw/monetdb_fdw.h
+ *
+ *-------------------------------------------------------------------------
+ */
+#ifndef MONETDB_FDW_H
+#define MONETDB_FDW_H
+
+#include "access/tupdesc.h"
+#include "foreign/foreign.h"
+#include "lib/stringinfo.h"
+#include "nodes/pathnodes.h"
+#include "utils/relcache.h"
+
+#include <stdio.h>
+#include <mapi.h>
+
+/*
+ * How ANALYZE has MonetDB pick the rows of its sample (analyze_sampling).
+ */
+typedef enum MonetdbFdwSampleMethod
+{
+	MONETDB_SAMPLE_OFF,			/* fetch every row, and sample locally */
+	MONETDB_SAMPLE_SAMPLE,		/* MonetDB's SAMPLE clause */
+	MONETDB_SAMPLE_RANDOM		/* a WHERE clause on rand() */
+} MonetdbFdwSampleMethod;
+
+/*
+ * Planner information for a foreign table, kept in baserel->fdw_private
+ * between GetForeignRelSize() and GetForeignPlan().
+ */
+typedef struct MonetdbFdwPlanState
+{
+	Oid serverid;        /* foreign server */
+	UserMapping *user;   /* user mapping to connect with */
+	char *table;         /* target table name */
+	char *query;         /* pre-defined query */
+	char *monetdb_opt6;              /* required option 2 */
+	List *options;                    /* other options */
+
+	bool use_remote_estimate;   /* ask MonetDB for row counts? */
+	double fdw_startup_cost;    /* cost of starting up a remote query */
+	double fdw_tuple_cost;      /* cost of transferring one row */
+	int fetch_size;             /* rows per block fetched from MonetDB */
+	int batch_size;             /* rows sent per INSERT */
+	bool async_capable;         /* may run asynchronously under an Append? */
+	bool rescan_cache;          /* replay rescans from a local copy? */
+	int prefetch_depth;         /* blocks read ahead by a thread, or 0 */
+	bool binary_transfer;       /* transfer_mode is 'binary'? */
+	int binary_threshold;       /* rows estimated for it to be used */
+	MonetdbFdwSampleMethod analyze_sampling;  /* how ANALYZE samples rows */
+
+	/*
+	 * Parallel scans: the column the table is split into chunks by, how it
+	 * is split (by value modulo the chunk count, or into ranges between its
+	 * smallest and largest value), and into how many chunks.
+	 */
+	char *partition_column;
+	bool partition_by_range;
+	int partition_count;
+
+	/*
+	 * baserestrictinfo split into the clauses MonetDB can evaluate
+	 * (remote_conds) and the ones we have to check locally (local_conds).
+	 */
+	List *remote_conds;
+	List *local_conds;
+
+	/* Bitmap of attr numbers we need to fetch from MonetDB */
+	Bitmapset *attrs_used;
+
+	/*
+	 * True if operations above this relation (joins and aggregation) may be
+	 * done by MonetDB; false for tables defined by the "query" option.
+	 */
+	bool pushdown_safe;
+
+	/*
+	 * Join relations: the two sides, the join type and the conditions of
+	 * the ON clause.  Upper relations: outerrel is the relation being
+	 * grouped, or the relation whose query an ordered or final (LIMIT)
+	 * relation adds ORDER BY and LIMIT to.
+	 */
+	RelOptInfo *outerrel;
+	RelOptInfo *innerrel;
+	JoinType jointype;
+	List *joinclauses;
+
+	/* Upper relations only: the planning stage and the grouped target list */
+	UpperRelationKind stage;
+	List *grouped_tlist;
+
+	BlockNumber pages;                      /* estimate of file's physical size */
+	double          ntuples;                /* estimate of number of rows in file */
+
+	/* Estimates of the scan; rows and width are in the RelOptInfo */
+	double retrieved_rows;      /* rows sent by MonetDB, before local_conds */
+	Cost startup_cost;
+	Cost total_cost;
+} MonetdbFdwPlanState;
+
+/*
+ * Indexes of the items in the fdw_private list of a ForeignScan plan node.
+ */
+enum MonetdbFdwScanPrivateIndex
+{
+	/* SQL statement to execute remotely (as a String node) */
+	MonetdbFdwScanPrivateSelectSql,
+	/* Integer list of attribute numbers retrieved by the SELECT */
+	MonetdbFdwScanPrivateRetrievedAttrs,
+	/* Rows per block fetched from MonetDB (Integer) */
+	MonetdbFdwScanPrivateFetchSize,
+	/* Whether rescans replay a local copy of the rows (Integer) */
+	MonetdbFdwScanPrivateRescanCache,
+	/* Blocks read ahead while rows are converted, or 0 (Integer) */
+	MonetdbFdwScanPrivatePrefetchDepth,
+	/* Statement sending the result in binary, or "" for none (String) */
+	MonetdbFdwScanPrivateBinarySql,
+
+	/*
+	 * Parallel scans only.  The deparsed partition column (String), whether
+	 * the SELECT has a WHERE clause (Integer), the query finding the
+	 * column's smallest and largest value (String, empty unless the table
+	 * is split by range), and the number of chunks (Integer).
+	 */
+	MonetdbFdwScanPrivatePartitionColumn,
+	MonetdbFdwScanPrivateHasWhere,
+	MonetdbFdwScanPrivateBoundsSql,
+	MonetdbFdwScanPrivatePartitionCount
+};
+
+/*
+ * Indexes of the items in the fdw_private list of a ModifyTable plan node
+ * for an INSERT.
+ */
+enum MonetdbFdwModifyPrivateIndex
+{
+	/* INSERT up to VALUES, or COPY INTO after "COPY n RECORDS" (String) */
+	MonetdbFdwModifyPrivateUpdateSql,
+	/* Integer list of the attribute numbers of the columns sent */
+	MonetdbFdwModifyPrivateTargetAttnums,
+	/* Whether the rows are loaded with COPY INTO (Integer) */
+	MonetdbFdwModifyPrivateUseCopy
+};
+
+/*
+ * Indexes of the items in the fdw_private list of a ForeignScan plan node
+ * that does an UPDATE or DELETE by itself.
+ */
+enum MonetdbFdwDirectModifyPrivateIndex
+{
+	/* UPDATE or DELETE statement to execute remotely (String) */
+	MonetdbFdwDirectModifyPrivateUpdateSql,
+	/* SELECT of the rows for RETURNING (String), empty without RETURNING */
+	MonetdbFdwDirectModifyPrivateReturningSql,
+	/* Integer list of attribute numbers retrieved by that SELECT */
+	MonetdbFdwDirectModifyPrivateRetrievedAttrs,
+	/* Whether the rows modified count for the command tag (Integer) */
+	MonetdbFdwDirectModifyPrivateSetProcessed
+};
+
+/*
+ * How a column of a remote result is turned into a Datum; see convert.c.
+ */
+typedef enum MonetdbFdwConvKind
+{
+	MONETDB_CONV_INPUT_FUNC,	/* call the type's input function */
+	MONETDB_CONV_INT2,
+	MONETDB_CONV_INT4,
+	MONETDB_CONV_INT8,
+	MONETDB_CONV_FLOAT4,
+	MONETDB_CONV_FLOAT8,
+	MONETDB_CONV_NUMERIC,
+	MONETDB_CONV_DATE,
+	MONETDB_CONV_TIMESTAMP,
+	MONETDB_CONV_TEXT
+} MonetdbFdwConvKind;
+
+typedef struct MonetdbFdwConverter
+{
+	MonetdbFdwConvKind kind;
+	int attnum;                 /* attribute the column is stored into */
+	int32 typmod;
+	Oid typioparam;             /* for the input function fallback */
+	FmgrInfo infunc;
+} MonetdbFdwConverter;
+
+/*
+ * Rows of a result read ahead by a helper thread; see prefetch.c.
+ */
+typedef struct MonetdbPrefetch MonetdbPrefetch;
+
+typedef enum MonetdbPrefetchStatus
+{
+	MONETDB_PREFETCH_ROW,		/* here is the next row */
+	MONETDB_PREFETCH_EOF,		/* no rows left */
+	MONETDB_PREFETCH_ERROR,		/* fetching them failed */
+	MONETDB_PREFETCH_STOPPED	/* fetch the next row with mapi_fetch_row() */
+} MonetdbPrefetchStatus;
+
+/*
+ * A result MonetDB sent in its binary format; see binary.c.
+ */
+typedef struct MonetdbBinaryResult MonetdbBinaryResult;
+
+/* in connection.c */
+extern Mapi monetdbGetConnection(UserMapping *user);
+extern void monetdbReleaseConnection(Mapi conn);
+extern void monetdbSetFetchSize(Mapi conn, int fetch_size);
+extern void monetdbBeginRemoteXact(Mapi conn);
+extern void monetdbRememberPrepared(Mapi conn, int prep_id);
+extern void monetdbForgetPrepared(Mapi conn, int prep_id);
+extern int	monetdbConnectionUsers(Mapi conn);
+extern void monetdbSetConnectionPrefetch(Mapi conn, MonetdbPrefetch *pf);
+extern void monetdbReportError(Mapi dbh, MapiHdl hdl,
+							   Oid relid) pg_attribute_noreturn();
+
+/* in convert.c */
+extern MonetdbFdwConverter *monetdbMakeConverters(TupleDesc tupdesc,
+												  List *retrieved_attrs);
+extern Datum monetdbConvertValue(MonetdbFdwConverter *conv,
+								 char *value, size_t len);
+extern void monetdbConvertColumn(MonetdbFdwConverter *conv, char **fields,
+								 size_t *lens, int nrows, Datum *values,
+								 bool *isnull, int *row);
+
+/* in prefetch.c */
+extern MonetdbPrefetch *monetdbPrefetchStart(Mapi dbh, MapiHdl hdl,
+											 int nfields, int block_rows,
+											 int depth);
+extern MonetdbPrefetchStatus monetdbPrefetchNextRow(MonetdbPrefetch *pf,
+													char ***values,
+													size_t **lengths);
+extern double monetdbPrefetchStallTime(MonetdbPrefetch *pf);
+extern void monetdbPrefetchStop(MonetdbPrefetch *pf);
+extern void monetdbPrefetchFree(MonetdbPrefetch *pf);
+
+/* in binary.c */
+extern const char *monetdbBinaryRemoteType(Oid typid);
+extern MonetdbBinaryResult *monetdbBinaryQuery(Mapi dbh, const char *sql,
+											   MonetdbFdwConverter *convs,
+											   int nconvs, int batch_rows);
+extern bool monetdbBinaryNextRow(MonetdbBinaryResult *res,
+								 Datum *values, bool *isnull);
+extern void monetdbBinaryRewind(MonetdbBinaryResult *res);
+extern int64 monetdbBinaryBytes(MonetdbBinaryResult *res);
+extern void monetdbBinaryFree(MonetdbBinaryResult *res);
+
+/* in shippable.c */
+extern char *monetdbRemoteFunction(Oid serverid, Oid funcid);
+extern char *monetdbRemoteOperator(Oid serverid, Oid opno);
+
+/* in stats.c */
+extern void monetdbStatsInit(void);
+extern bool monetdbStatsEnabled(void);
+extern void monetdbStatsRecordScan(Oid serverid, Oid relid,
+								   int64 rows_fetched, int64 bytes_received,
+								   double remote_time);
+extern void monetdbStatsRecordConnection(Oid serverid, bool opened);
+extern void monetdbStatsRecordError(Oid serverid, Oid relid,
+									const char *message);
+
+/* in deparse.c */
+extern void monetdbClassifyConditions(PlannerInfo *root,
+									  RelOptInfo *baserel,
+									  List *input_conds,
+									  List **remote_conds,
+									  List **local_conds);
+extern bool monetdbIsForeignExpr(PlannerInfo *root,
+								 RelOptInfo *baserel,
+								 Expr *expr);
+extern void monetdbDeparseSelectSql(StringInfo buf,
+									PlannerInfo *root,
+									RelOptInfo *foreignrel,
+									List *tlist,
+									List *remote_conds,
+									List *pathkeys,
+									bool has_limit,
+									List **retrieved_attrs,
+									List **params_list);
+extern bool monetdbIsForeignPathKey(PlannerInfo *root,
+									RelOptInfo *rel,
+									PathKey *pathkey);
+extern void monetdbDeparseCountSql(StringInfo buf,
+								   PlannerInfo *root,
+								   RelOptInfo *foreignrel,
+								   List *remote_conds);
+extern void monetdbDeparseAnalyzeSql(StringInfo count_buf,
+									 StringInfo buf,
+									 Relation rel,
+									 MonetdbFdwPlanState *fdw_private,
+									 List **retrieved_attrs);
+extern void monetdbDeparseInsertSql(StringInfo buf,
+									Relation rel,
+									MonetdbFdwPlanState *fdw_private,
+									List *target_attrs);
+extern void monetdbDeparseCopySql(StringInfo buf,
+								  Relation rel,
+								  MonetdbFdwPlanState *fdw_private,
+								  List *target_attrs);
+extern bool monetdbDeparseBinaryCopySql(StringInfo buf,
+										Relation rel,
+										const char *sql,
+										List *retrieved_attrs);
+extern void monetdbDeparseDirectModifySql(StringInfo buf,
+										  PlannerInfo *root,
+										  RelOptInfo *foreignrel,
+										  CmdType operation,
+										  List *target_attrs,
+										  List *target_exprs,
+										  List *remote_conds);
+extern void monetdbDeparseReturningSql(StringInfo buf,
+									   PlannerInfo *root,
+									   RelOptInfo *foreignrel,
+									   Bitmapset *attrs_used,
+									   List *target_attrs,
+									   List *target_exprs,
+									   List *remote_conds,
+									   List **retrieved_attrs);
+extern void monetdbDeparseLiteral(StringInfo buf, Datum value, Oid type);
+extern void monetdbDeparseCopyField(StringInfo buf, Datum value, Oid type);
+extern void monetdbDeparsePartitionColumn(StringInfo buf,
+										  PlannerInfo *root,
+										  RelOptInfo *baserel,
+										  AttrNumber attnum);
+extern void monetdbDeparseBoundsSql(StringInfo buf,
+									PlannerInfo *root,
+									RelOptInfo *baserel,
+									AttrNumber attnum,
+									List *remote_conds);
+extern List *monetdbBuildTlistToDeparse(RelOptInfo *foreignrel);
+extern const char *monetdbGetJoinTypeName(JoinType jointype);
+extern void monetdbDeparseStringLiteral(StringInfo buf, const char *val);
+
+#endif							/* MONETDB_FDW_H */
@@ -0,0 +1,448 @@
+/*-------------------------------------------------------------------------
+ *
+ * prefetch.c
+ *                read ahead the rows of a MonetDB result in a helper thread
+ *
+ * libmapi has no asynchronous way to fetch a result: mapi_fetch_row()
+ * reads the next block from the socket when the rows of the current one
+ * are used up, so a scan alternates between waiting on MonetDB and
+ * converting rows, and the network sits idle while the backend converts.
+ * With prefetch_depth set, a helper thread calls mapi_fetch_row() instead,
+ * and copies the text of the fields of each block into one of
+ * prefetch_depth + 1 buffers, while the scan converts the rows of a block
+ * fetched earlier.
+ *
+ * The helper thread only ever calls libmapi and malloc; it never touches
+ * anything of PostgreSQL's, and it runs with all signals blocked, so that
+ * they are handled by the backend as usual.  While it runs, the connection
+ * is the thread's alone: a scan only starts one if no other scan of the
+ * query uses the connection, and anything else that wants the connection
+ * (monetdbGetConnection(), the end of the transaction) stops it first.  A
+ * stopped thread leaves the rows it fetched in the buffers, and the scan
+ * goes on with mapi_fetch_row() itself once they are used up.
+ *
+ * Copyright (c) 2010-2013, PostgreSQL Global Development Group
+ * Copyright (c) 2013, Satoshi Nagayasu
+ *
+ * IDENTIFICATION
+ *                contrib/monetdb_fdw/prefetch.c
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include "monetdb_fdw.h"
+
+#include "portability/instr_time.h"
+#include "utils/memutils.h"
+
+#include <pthread.h>
+#include <signal.h>
+
+/*
+ * The rows of one block.  The text of their fields is stored one after
+ * the other in data, each followed by a zero byte; offs and lens give the
+ * position and length of field j of row i at [i * nfields + j], with offs
+ * set to SIZE_MAX for a NULL.
+ */
+typedef struct RawBlock
+{
+	int			nrows;
+	size_t	   *offs;
+	size_t	   *lens;
+	char	   *data;
+	size_t		data_used;
+	size_t		data_size;
+} RawBlock;
+
+struct MonetdbPrefetch
+{
+	MemoryContext cxt;			/* holds this struct */
+	Mapi		dbh;
+	MapiHdl		hdl;
+	int			nfields;		/* fields per row */
+	int			block_rows;		/* rows per buffer */
+	int			nbufs;			/* prefetch_depth + 1 */
+	RawBlock   *bufs;
+
+	/*
+	 * Shared with the thread, under lock.  The thread fills bufs[fill_pos]
+	 * and the ones after it; the scan reads bufs[read_pos]; nfull of them,
+	 * starting at read_pos, are filled.
+	 */
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int			fill_pos;
+	int			read_pos;
+	int			nfull;
+	bool		eof;			/* the last row has been fetched */
+	bool		failed;			/* fetching the rows failed */
+	bool		stop;			/* the scan asks the thread to exit */
+	bool		exited;			/* the thread is done */
+
+	/* the scan's side only */
+	bool		initialized;	/* lock and cond set up */
+	pthread_t	thread;
+	bool		running;		/* thread started and not joined yet */
+	bool		holding;		/* is bufs[read_pos] being read? */
+	int			read_row;		/* next row of it */
+	char	  **values;			/* fields of the current row */
+	size_t	   *lengths;
+	instr_time	stall_time;		/* waiting for the thread to fill a block */
+
+	MemoryContextCallback cleanup;	/* stops the thread on error */
+};
+
+static void *prefetch_main(void *arg);
+static bool fill_block(MonetdbPrefetch *pf, RawBlock *b);
+static bool append_field(RawBlock *b, int pos, const char *value, size_t len);
+static void release_buffers(MonetdbPrefetch *pf);
+static void prefetch_cleanup(void *arg);
+
+
+/*
+ * Start reading ahead the rows of hdl, whose response has been read, in
+ * blocks of block_rows rows with nfields fields each.  depth blocks are
+ * fetched ahead of the one the scan reads.  The state is kept in a
+ * context of its own under CurrentMemoryContext, which must live as long
+ * as the scan; if it goes away first, on error, the thread is stopped.
+ *
+ * Return NULL if the thread couldn't be started; the scan then fetches the
+ * rows itself.
+ */
+MonetdbPrefetch *
+monetdbPrefetchStart(Mapi dbh, MapiHdl hdl, int nfields, int block_rows,
+					 int depth)
+{
+	MemoryContext cxt;
+	MonetdbPrefetch *pf;
+	sigset_t	all;
+	sigset_t	old;
+	int			i;
+	int			rc;
+
+	cxt = AllocSetContextCreate(CurrentMemoryContext,
+								"monetdb_fdw prefetch",
+								ALLOCSET_SMALL_SIZES);
+	pf = (MonetdbPrefetch *) MemoryContextAllocZero(cxt, sizeof(MonetdbPrefetch));
+	pf->cxt = cxt;
+	pf->dbh = dbh;
+	pf->hdl = hdl;
+	pf->nfields = nfields;
+	pf->block_rows = block_rows;
+	pf->nbufs = depth + 1;
+	pf->bufs = (RawBlock *) MemoryContextAllocZero(cxt, pf->nbufs * sizeof(RawBlock));
+	pf->values = (char **) MemoryContextAlloc(cxt, Max(nfields, 1) * sizeof(char *));
+	pf->lengths = (size_t *) MemoryContextAlloc(cxt, Max(nfields, 1) * sizeof(size_t));
+	INSTR_TIME_SET_ZERO(pf->stall_time);
+
+	/*
+	 * The buffers are filled by the thread, so they are malloc'd; it grows
+	 * the text part as needed.
+	 */
+	for (i = 0; i < pf->nbufs; i++)
+	{
+		RawBlock   *b = &pf->bufs[i];
+		size_t		nslots = (size_t) block_rows * Max(nfields, 1);
+
+		b->offs = malloc(nslots * sizeof(size_t));
+		b->lens = malloc(nslots * sizeof(size_t));
+		b->data_size = nslots * 16;
+		b->data = malloc(b->data_size);
+		if (!b->offs || !b->lens || !b->data)
+		{
+			pf->nbufs = i + 1;
+			monetdbPrefetchFree(pf);
+			return NULL;
+		}
+	}
+
+	pthread_mutex_init(&pf->lock, NULL);
+	pthread_cond_init(&pf->cond, NULL);
+	pf->initialized = true;
+
+	/* the thread inherits the signal mask: have none of them go to it */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	rc = pthread_create(&pf->thread, NULL, prefetch_main, pf);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	if (rc != 0)
+	{
+		elog(DEBUG1, "monetdb_fdw: could not start prefetch thread: %s",
+			 strerror(rc));
+		monetdbPrefetchFree(pf);
+		return NULL;
+	}
+	pf->running = true;
+
+	/* if the scan fails, the thread goes away with the scan's memory */
+	pf->cleanup.func = prefetch_cleanup;
+	pf->cleanup.arg = pf;
+	MemoryContextRegisterResetCallback(cxt, &pf->cleanup);
+
+	monetdbSetConnectionPrefetch(dbh, pf);
+
+	return pf;
+}
+
+/*
+ * Main function of the thread: fill the free buffers one after the other,
+ * until the result is used up, or the scan asks it to stop.
+ */
+static void *
+prefetch_main(void *arg)
+{
+	MonetdbPrefetch *pf = (MonetdbPrefetch *) arg;
+
+	pthread_mutex_lock(&pf->lock);
+	for (;;)
+	{
+		RawBlock   *b;
+		bool		failed;
+		bool		eof;
+
+		while (!pf->stop && pf->nfull == pf->nbufs)
+			pthread_cond_wait(&pf->cond, &pf->lock);
+		if (pf->stop)
+			break;
+
+		b = &pf->bufs[pf->fill_pos];
+		pthread_mutex_unlock(&pf->lock);
+
+		/* a short block ends the result, which may have been an error */
+		failed = !fill_block(pf, b);
+		eof = (b->nrows < pf->block_rows);
+		if (eof && !failed)
+			failed = (mapi_error(pf->dbh) != MOK ||
+					  mapi_result_error(pf->hdl) != NULL);
+
+		pthread_mutex_lock(&pf->lock);
+		pf->fill_pos = (pf->fill_pos + 1) % pf->nbufs;
+		pf->nfull++;
+		pf->eof = eof;
+		pf->failed = failed;
+		pthread_cond_signal(&pf->cond);
+		if (eof || failed)
+			break;
+	}
+	pf->exited = true;
+	pthread_cond_signal(&pf->cond);
+	pthread_mutex_unlock(&pf->lock);
+
+	return NULL;
+}
+
+/*
+ * Fetch up to block_rows rows into b.  Return false if out of memory; the
+ * rows fetched so far are kept.
+ */
+static bool
+fill_block(MonetdbPrefetch *pf, RawBlock *b)
+{
+	b->nrows = 0;
+	b->data_used = 0;
+
+	while (b->nrows < pf->block_rows && mapi_fetch_row(pf->hdl))
+	{
+		int			pos = b->nrows * pf->nfields;
+		int			i;
+
+		for (i = 0; i < pf->nfields; i++)
+		{
+			char	   *value = mapi_fetch_field(pf->hdl, i);
+
+			if (value == NULL)
+			{
+				b->offs[pos + i] = SIZE_MAX;
+				b->lens[pos + i] = 0;
+			}
+			else if (!append_field(b, pos + i, value,
+								   mapi_fetch_field_len(pf->hdl, i)))
+				return false;
+		}
+		b->nrows++;
+	}
+
+	return true;
+}
+
+/*
+ * Copy the text of a field into b->data.  Return false if out of memory.
+ */
+static bool
+append_field(RawBlock *b, int pos, const char *value, size_t len)
+{
+	if (b->data_used + len + 1 > b->data_size)
+	{
+		size_t		newsize = Max(b->data_size * 2, b->data_used + len + 1);
+		char	   *newdata = realloc(b->data, newsize);
+
+		if (newdata == NULL)
+			return false;
+		b->data = newdata;
+		b->data_size = newsize;
+	}
+
+	memcpy(b->data + b->data_used, value, len);
+	b->data[b->data_used + len] = '\0';
+	b->offs[pos] = b->data_used;
+	b->lens[pos] = len;
+	b->data_used += len + 1;
+
+	return true;
+}
+
+/*
+ * Return the next row in *values and *lengths, a NULL field being a NULL
+ * pointer.  They are valid until the next call.
+ *
+ * The result is MONETDB_PREFETCH_ROW if there is one, MONETDB_PREFETCH_EOF
+ * at the end of the result, MONETDB_PREFETCH_ERROR if fetching the rows
+ * failed, and MONETDB_PREFETCH_STOPPED if the thread was stopped and its
+ * rows are used up: the next row is to be fetched with mapi_fetch_row().
+ */
+MonetdbPrefetchStatus
+monetdbPrefetchNextRow(MonetdbPrefetch *pf, char ***values, size_t **lengths)
+{
+	RawBlock   *b;
+	int			pos;
+	int			i;
+
+	for (;;)
+	{
+		MonetdbPrefetchStatus status;
+
+		if (pf->holding)
+		{
+			if (pf->read_row < pf->bufs[pf->read_pos].nrows)
+				break;
+
+			/* the block is used up: give it back to the thread */
+			pthread_mutex_lock(&pf->lock);
+			pf->read_pos = (pf->read_pos + 1) % pf->nbufs;
+			pf->nfull--;
+			pthread_cond_signal(&pf->cond);
+			pthread_mutex_unlock(&pf->lock);
+			pf->holding = false;
+		}
+
+		pthread_mutex_lock(&pf->lock);
+		if (pf->nfull == 0 && !pf->exited)
+		{
+			instr_time	start;
+			instr_time	end;
+
+			INSTR_TIME_SET_CURRENT(start);
+			while (pf->nfull == 0 && !pf->exited)
+				pthread_cond_wait(&pf->cond, &pf->lock);
+			INSTR_TIME_SET_CURRENT(end);
+			INSTR_TIME_ACCUM_DIFF(pf->stall_time, end, start);
+		}
+		if (pf->nfull > 0)
+		{
+			pthread_mutex_unlock(&pf->lock);
+			pf->holding = true;
+			pf->read_row = 0;
+			continue;
+		}
+		status = pf->failed ? MONETDB_PREFETCH_ERROR :
+			pf->eof ? MONETDB_PREFETCH_EOF : MONETDB_PREFETCH_STOPPED;
+		pthread_mutex_unlock(&pf->lock);
+
+		return status;
+	}
+
+	b = &pf->bufs[pf->read_pos];
+	pos = pf->read_row * pf->nfields;
+	for (i = 0; i < pf->nfields; i++)
+	{
+		if (b->offs[pos + i] == SIZE_MAX)
+			pf->values[i] = NULL;
+		else
+			pf->values[i] = b->data + b->offs[pos + i];
+		pf->lengths[i] = b->lens[pos + i];
+	}
+	pf->read_row++;
+
+	*values = pf->values;
+	*lengths = pf->lengths;
+	return MONETDB_PREFETCH_ROW;
+}
+
+/*
+ * Time the scan spent waiting for the thread.
+ */
+double
+monetdbPrefetchStallTime(MonetdbPrefetch *pf)
+{
+	return INSTR_TIME_GET_MILLISEC(pf->stall_time);
+}
+
+/*
+ * Stop the thread, once it is done with the block it is fetching.  The
+ * rows it fetched can still be read.
+ */
+void
+monetdbPrefetchStop(MonetdbPrefetch *pf)
+{
+	if (!pf->running)
+		return;
+
+	pthread_mutex_lock(&pf->lock);
+	pf->stop = true;
+	pthread_cond_signal(&pf->cond);
+	pthread_mutex_unlock(&pf->lock);
+
+	pthread_join(pf->thread, NULL);
+	pf->running = false;
+
+	monetdbSetConnectionPrefetch(pf->dbh, NULL);
+}
+
+/*
+ * Stop the thread, and release everything of pf.
+ */
+void
+monetdbPrefetchFree(MonetdbPrefetch *pf)
+{
+	release_buffers(pf);
+	MemoryContextDelete(pf->cxt);
+}
+
+/*
+ * Stop the thread, and release what isn't in pf->cxt.
+ */
+static void
+release_buffers(MonetdbPrefetch *pf)
+{
+	int			i;
+
+	if (pf->nbufs == 0)
+		return;
+
+	monetdbPrefetchStop(pf);
+	if (pf->initialized)
+	{
+		pthread_cond_destroy(&pf->cond);
+		pthread_mutex_destroy(&pf->lock);
+		pf->initialized = false;
+	}
+
+	for (i = 0; i < pf->nbufs; i++)
+	{
+		free(pf->bufs[i].offs);
+		free(pf->bufs[i].lens);
+		free(pf->bufs[i].data);
+		pf->bufs[i].offs = NULL;
+		pf->bufs[i].lens = NULL;
+		pf->bufs[i].data = NULL;
+	}
+	pf->nbufs = 0;
+}
+
+static void
+prefetch_cleanup(void *arg)
+{
+	release_buffers((MonetdbPrefetch *) arg);
+}
@@ -0,0 +1,477 @@
+/*-------------------------------------------------------------------------
+ *
+ * shippable.c
+ *                functions and operators monetdb_fdw translates for MonetDB
+ *
+ * The deparser sends the few operators MonetDB spells and evaluates as we
+ * do by name.  Any other function or operator can only be pushed down if
+ * we know the MonetDB expression computing the same thing: its
+ * translation, a template in which $1, $2, ... stand for the arguments,
+ * such as "CAST($1 AS BIGINT)" for int8(integer).
+ *
+ * A few translations are built in.  More can be added, or the built-in
+ * ones replaced, by rows of the table monetdb_fdw_pushdown, which the
+ * extension creates in its schema: the table is looked up in the schema
+ * of the handler function of the foreign-data wrapper.  Each backend reads
+ * the translations once; a trigger on the table invalidates its relcache
+ * entry when the table changes, so that the backends read them again.
+ *
+ * Copyright (c) 2010-2013, PostgreSQL Global Development Group
+ * Copyright (c) 2013, Satoshi Nagayasu
+ *
+ * IDENTIFICATION
+ *                contrib/monetdb_fdw/shippable.c
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include <ctype.h>
+
+#include "monetdb_fdw.h"
+
+#include "access/htup_details.h"
+#include "access/table.h"
+#include "access/tableam.h"
+#include "catalog/namespace.h"
+#include "catalog/pg_operator.h"
+#include "catalog/pg_proc.h"
+#include "catalog/pg_type.h"
+#include "commands/trigger.h"
+#include "executor/tuptable.h"
+#include "fmgr.h"
+#include "nodes/value.h"
+#include "parser/parse_func.h"
+#include "utils/builtins.h"
+#include "utils/hsearch.h"
+#include "utils/inval.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/regproc.h"
+#include "utils/snapmgr.h"
+#include "utils/syscache.h"
+
+/* the table of translations added by the DBA, and its columns */
+#define PUSHDOWN_TABLE_NAME		"monetdb_fdw_pushdown"
+#define Anum_pushdown_func		1
+#define Anum_pushdown_oper		2
+#define Anum_pushdown_remote	3
+
+/*
+ * A built-in translation.  Functions are looked up in pg_catalog by name
+ * and argument types; an operator with only a right argument has
+ * InvalidOid as its first argument type.
+ */
+typedef struct BuiltinTranslation
+{
+	bool		is_oper;
+	const char *name;
+	int			nargs;
+	Oid			argtypes[2];
+	const char *remote;
+} BuiltinTranslation;
+
+/*
+ * The functions and operators MonetDB computes as we do, under another
+ * name.  Division is only translated for double precision: MonetDB picks
+ * a different result scale for decimals.
+ */
+static const BuiltinTranslation builtin_translations[] = {
+	/* strings */
+	{false, "lower", 1, {TEXTOID}, "lower($1)"},
+	{false, "upper", 1, {TEXTOID}, "upper($1)"},
+	{false, "btrim", 1, {TEXTOID}, "trim($1)"},
+	{false, "ltrim", 1, {TEXTOID}, "ltrim($1)"},
+	{false, "rtrim", 1, {TEXTOID}, "rtrim($1)"},
+
+	/* numbers */
+	{false, "abs", 1, {INT2OID}, "abs($1)"},
+	{false, "abs", 1, {INT4OID}, "abs($1)"},
+	{false, "abs", 1, {INT8OID}, "abs($1)"},
+	{false, "abs", 1, {FLOAT4OID}, "abs($1)"},
+	{false, "abs", 1, {FLOAT8OID}, "abs($1)"},
+	{false, "abs", 1, {NUMERICOID}, "abs($1)"},
+	{true, "/", 2, {FLOAT8OID, FLOAT8OID}, "($1 / $2)"},
+	{true, "%", 2, {INT4OID, INT4OID}, "($1 % $2)"},
+	{true, "%", 2, {INT8OID, INT8OID}, "($1 % $2)"},
+
+	/* date and time */
+	{false, "date_trunc", 2, {TEXTOID, TIMESTAMPOID}, "date_trunc($1, $2)"},
+
+	/* casts */
+	{false, "int4", 1, {INT2OID}, "CAST($1 AS INT)"},
+	{false, "int8", 1, {INT2OID}, "CAST($1 AS BIGINT)"},
+	{false, "int8", 1, {INT4OID}, "CAST($1 AS BIGINT)"},
+	{false, "float8", 1, {INT4OID}, "CAST($1 AS DOUBLE)"},
+	{false, "float8", 1, {INT8OID}, "CAST($1 AS DOUBLE)"},
+	{false, "float8", 1, {FLOAT4OID}, "CAST($1 AS DOUBLE)"},
+	{false, "date", 1, {TIMESTAMPOID}, "CAST($1 AS DATE)"},
+	{false, "timestamp", 1, {DATEOID}, "CAST($1 AS TIMESTAMP)"}
+};
+
+typedef struct TranslationKey
+{
+	Oid			classid;		/* ProcedureRelationId or OperatorRelationId */
+	Oid			objid;			/* the function or operator */
+} TranslationKey;
+
+typedef struct TranslationEntry
+{
+	TranslationKey key;			/* hash key (must be first) */
+	char	   *remote;			/* template of the MonetDB expression */
+} TranslationEntry;
+
+/*
+ * The translations of the backend, for the monetdb_fdw_pushdown table of
+ * TranslationNamespace.  They are read again when TranslationsValid is
+ * cleared, or translations for another schema are asked for.
+ */
+static HTAB *TranslationHash = NULL;
+static MemoryContext TranslationContext = NULL;
+static bool TranslationsValid = false;
+static uint64 TranslationInvalidations = 0;
+static Oid	TranslationNamespace = InvalidOid;
+static Oid	TranslationRelid = InvalidOid;
+
+/* The schema the last server looked up keeps its table in */
+static Oid	LastServerid = InvalidOid;
+static Oid	LastServerNamespace = InvalidOid;
+
+PG_FUNCTION_INFO_V1(monetdb_fdw_pushdown_trigger);
+
+static void translation_relcache_callback(Datum arg, Oid relid);
+static void translation_syscache_callback(Datum arg, int cacheid,
+										  uint32 hashvalue);
+static Oid	server_namespace(Oid serverid);
+static void load_translations(Oid nspid);
+static void add_translation(Oid classid, Oid objid, const char *remote);
+static char *lookup_translation(Oid serverid, Oid classid, Oid objid);
+static int	template_max_arg(const char *remote);
+
+
+/*
+ * Return the template of the MonetDB expression computing the function
+ * funcid, or NULL if it has none, for the foreign server serverid.  The
+ * result is palloc'd in the current memory context.
+ */
+char *
+monetdbRemoteFunction(Oid serverid, Oid funcid)
+{
+	return lookup_translation(serverid, ProcedureRelationId, funcid);
+}
+
+/*
+ * The same for the operator opno.
+ */
+char *
+monetdbRemoteOperator(Oid serverid, Oid opno)
+{
+	return lookup_translation(serverid, OperatorRelationId, opno);
+}
+
+static char *
+lookup_translation(Oid serverid, Oid classid, Oid objid)
+{
+	TranslationKey key;
+	TranslationEntry *entry;
+	Oid			nspid = server_namespace(serverid);
+
+	if (!TranslationsValid || nspid != TranslationNamespace)
+		load_translations(nspid);
+
+	memset(&key, 0, sizeof(key));
+	key.classid = classid;
+	key.objid = objid;
+	entry = hash_search(TranslationHash, &key, HASH_FIND, NULL);
+
+	/* copied, since the hash may be read again while the caller uses it */
+	return entry ? pstrdup(entry->remote) : NULL;
+}
+
+/*
+ * The schema of the handler function of the wrapper of a server, which is
+ * where the extension created its table.
+ */
+static Oid
+server_namespace(Oid serverid)
+{
+	static bool callbacks_registered = false;
+	ForeignServer *server;
+	ForeignDataWrapper *fdw;
+
+	if (!callbacks_registered)
+	{
+		CacheRegisterRelcacheCallback(translation_relcache_callback,
+									  (Datum) 0);
+		CacheRegisterSyscacheCallback(FOREIGNSERVEROID,
+									  translation_syscache_callback,
+									  (Datum) 0);
+		CacheRegisterSyscacheCallback(FOREIGNDATAWRAPPEROID,
+									  translation_syscache_callback,
+									  (Datum) 0);
+		callbacks_registered = true;
+	}
+
+	if (OidIsValid(LastServerid) && serverid == LastServerid)
+		return LastServerNamespace;
+
+	server = GetForeignServer(serverid);
+	fdw = GetForeignDataWrapper(server->fdwid);
+	LastServerNamespace = OidIsValid(fdw->fdwhandler) ?
+		get_func_namespace(fdw->fdwhandler) : InvalidOid;
+	LastServerid = serverid;
+
+	return LastServerNamespace;
+}
+
+static void
+translation_relcache_callback(Datum arg, Oid relid)
+{
+	/*
+	 * InvalidOid means all relations.  Without a table, the one being
+	 * created may be the one to read.
+	 */
+	if (!OidIsValid(relid) || !OidIsValid(TranslationRelid) ||
+		relid == TranslationRelid)
+	{
+		TranslationsValid = false;
+		TranslationInvalidations++;
+	}
+}
+
+static void
+translation_syscache_callback(Datum arg, int cacheid, uint32 hashvalue)
+{
+	LastServerid = InvalidOid;
+}
+
+/*
+ * Fill the hash with the built-in translations, and those of the table in
+ * the schema nspid, if there is one.
+ */
+static void
+load_translations(Oid nspid)
+{
+	HASHCTL		ctl;
+	Relation	rel;
+	TableScanDesc scan;
+	TupleTableSlot *slot;
+	Snapshot	snapshot;
+	uint64		invalidations = TranslationInvalidations;
+	int			i;
+
+	/*
+	 * The translations only become valid once they are all read, so that an
+	 * error halfway has them read again.  Opening the table may process
+	 * invalidations; if one concerns it, they are read again the next time
+	 * too.
+	 */
+	TranslationsValid = false;
+	TranslationNamespace = nspid;
+	TranslationRelid = OidIsValid(nspid) ?
+		get_relname_relid(PUSHDOWN_TABLE_NAME, nspid) : InvalidOid;
+
+	if (TranslationContext == NULL)
+		TranslationContext = AllocSetContextCreate(CacheMemoryContext,
+												   "monetdb_fdw translations",
+												   ALLOCSET_SMALL_SIZES);
+	else
+		MemoryContextReset(TranslationContext);
+
+	ctl.keysize = sizeof(TranslationKey);
+	ctl.entrysize = sizeof(TranslationEntry);
+	ctl.hcxt = TranslationContext;
+	TranslationHash = hash_create("monetdb_fdw translations", 64, &ctl,
+								  HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+
+	for (i = 0; i < lengthof(builtin_translations); i++)
+	{
+		const BuiltinTranslation *b = &builtin_translations[i];
+		List	   *name = list_make2(makeString("pg_catalog"),
+									  makeString(pstrdup(b->name)));
+
+		if (b->is_oper)
+		{
+			Oid			left = (b->nargs == 2) ? b->argtypes[0] : InvalidOid;
+			Oid			right = b->argtypes[b->nargs - 1];
+
+			add_translation(OperatorRelationId,
+							OpernameGetOprid(name, left, right), b->remote);
+		}
+		else
+			add_translation(ProcedureRelationId,
+							LookupFuncName(name, b->nargs, b->argtypes, true),
+							b->remote);
+	}
+
+	if (!OidIsValid(TranslationRelid))
+	{
+		TranslationsValid = (invalidations == TranslationInvalidations);
+		return;
+	}
+
+	/* the rows of the table replace the built-in translations */
+	rel = table_open(TranslationRelid, AccessShareLock);
+	snapshot = RegisterSnapshot(GetLatestSnapshot());
+	scan = table_beginscan(rel, snapshot, 0, NULL);
+	slot = table_slot_create(rel, NULL);
+
+	while (table_scan_getnextslot(scan, ForwardScanDirection, slot))
+	{
+		bool		func_null;
+		bool		oper_null;
+		bool		remote_null;
+		Datum		func = slot_getattr(slot, Anum_pushdown_func, &func_null);
+		Datum		oper = slot_getattr(slot, Anum_pushdown_oper, &oper_null);
+		Datum		remote = slot_getattr(slot, Anum_pushdown_remote,
+										  &remote_null);
+		char	   *remote_str;
+
+		if (remote_null || func_null == oper_null)
+			continue;
+
+		remote_str = TextDatumGetCString(remote);
+		if (!func_null)
+			add_translation(ProcedureRelationId, DatumGetObjectId(func),
+							remote_str);
+		else
+			add_translation(OperatorRelationId, DatumGetObjectId(oper),
+							remote_str);
+		pfree(remote_str);
+	}
+
+	ExecDropSingleTupleTableSlot(slot);
+	table_endscan(scan);
+	UnregisterSnapshot(snapshot);
+	table_close(rel, AccessShareLock);
+
+	TranslationsValid = (invalidations == TranslationInvalidations);
+}
+
+static void
+add_translation(Oid classid, Oid objid, const char *remote)
+{
+	TranslationKey key;
+	TranslationEntry *entry;
+
+	if (!OidIsValid(objid))
+		return;
+
+	memset(&key, 0, sizeof(key));
+	key.classid = classid;
+	key.objid = objid;
+	entry = hash_search(TranslationHash, &key, HASH_ENTER, NULL);
+	entry->remote = MemoryContextStrdup(TranslationContext, remote);
+}
+
+/*
+ * The highest argument number a template refers to, or -1 if one of them
+ * is out of range.
+ */
+static int
+template_max_arg(const char *remote)
+{
+	const char *p;
+	int			max_arg = 0;
+
+	for (p = remote; *p; p++)
+	{
+		int			n = 0;
+
+		if (*p != '$' || !isdigit((unsigned char) p[1]))
+			continue;
+
+		while (isdigit((unsigned char) p[1]))
+		{
+			n = n * 10 + (*++p - '0');
+			if (n > FUNC_MAX_ARGS)
+				return -1;
+		}
+		if (n == 0)
+			return -1;
+		max_arg = Max(max_arg, n);
+	}
+
+	return max_arg;
+}
+
+/*
+ * Trigger of the monetdb_fdw_pushdown table.  Fired for each row before an
+ * INSERT or UPDATE, it checks that the template only refers to arguments
+ * the function or operator has.  Fired after each statement, it tells all
+ * backends to read the translations again.
+ */
+Datum
+monetdb_fdw_pushdown_trigger(PG_FUNCTION_ARGS)
+{
+	TriggerData *trigdata = (TriggerData *) fcinfo->context;
+	HeapTuple	tuple;
+	TupleDesc	tupdesc;
+	bool		func_null;
+	bool		oper_null;
+	bool		remote_null;
+	Datum		func;
+	Datum		oper;
+	Datum		remote;
+	char	   *remote_str;
+	char	   *objname;
+	int			nargs;
+	int			max_arg;
+
+	if (!CALLED_AS_TRIGGER(fcinfo))
+		elog(ERROR, "monetdb_fdw_pushdown_trigger: not called by trigger manager");
+
+	if (TRIGGER_FIRED_FOR_STATEMENT(trigdata->tg_event))
+	{
+		CacheInvalidateRelcache(trigdata->tg_relation);
+		return PointerGetDatum(NULL);
+	}
+
+	if (TRIGGER_FIRED_BY_UPDATE(trigdata->tg_event))
+		tuple = trigdata->tg_newtuple;
+	else
+		tuple = trigdata->tg_trigtuple;
+	tupdesc = RelationGetDescr(trigdata->tg_relation);
+
+	func = heap_getattr(tuple, Anum_pushdown_func, tupdesc, &func_null);
+	oper = heap_getattr(tuple, Anum_pushdown_oper, tupdesc, &oper_null);
+	remote = heap_getattr(tuple, Anum_pushdown_remote, tupdesc, &remote_null);
+
+	/* the table's constraints complain about these */
+	if (remote_null || func_null == oper_null)
+		return PointerGetDatum(tuple);
+
+	if (!func_null)
+	{
+		Oid			funcid = DatumGetObjectId(func);
+
+		nargs = get_func_nargs(funcid);
+		objname = format_procedure(funcid);
+	}
+	else
+	{
+		Oid			opno = DatumGetObjectId(oper);
+		HeapTuple	optup;
+
+		optup = SearchSysCache1(OPEROID, ObjectIdGetDatum(opno));
+		if (!HeapTupleIsValid(optup))
+			elog(ERROR, "cache lookup failed for operator %u", opno);
+		nargs = OidIsValid(((Form_pg_operator) GETSTRUCT(optup))->oprleft) ?
+			2 : 1;
+		ReleaseSysCache(optup);
+		objname = format_operator(opno);
+	}
+
+	remote_str = TextDatumGetCString(remote);
+	max_arg = template_max_arg(remote_str);
+	if (max_arg < 0 || max_arg > nargs)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("translation \"%s\" of %s refers to an argument it does not have",
+						remote_str, objname),
+				 errdetail_plural("%s has %d argument.",
+								  "%s has %d arguments.",
+								  nargs, objname, nargs)));
+
+	return PointerGetDatum(tuple);
+}
@@ -8,12 +8,30 @@ RETURNS void
 AS 'monetdb_fdw'
 LANGUAGE C STRICT;
 
+CREATE FUNCTION monetdb_fdw_get_connections (OUT server_name text,
+    OUT user_name text, OUT valid boolean)
+RETURNS SETOF record
+AS 'monetdb_fdw'
+LANGUAGE C STRICT;
+
+CREATE FUNCTION monetdb_fdw_disconnect (text)
+RETURNS bool
+AS 'monetdb_fdw'
+LANGUAGE C STRICT;
+
+CREATE FUNCTION monetdb_fdw_disconnect_all ()
+RETURNS bool
+AS 'monetdb_fdw'
+LANGUAGE C STRICT;
+
 CREATE FOREIGN DATA WRAPPER monetdb_fdw
   HANDLER monetdb_fdw_handler
   VALIDATOR monetdb_fdw_validator;
 
-CREATE SERVER monetdb_server FOREIGN DATA WRAPPER monetdb_fdw;
-CREATE USER MAPPING FOR current_user SERVER monetdb_server;
+CREATE SERVER monetdb_server FOREIGN DATA WRAPPER monetdb_fdw
+  OPTIONS (host 'localhost', port '50000', dbname 'dbt3');
+CREATE USER MAPPING FOR current_user SERVER monetdb_server
+  OPTIONS (user 'monetdb', passwd 'monetdb');
 
 CREATE FOREIGN TABLE nation (
         "n_nationkey" INTEGER,
@@ -21,62 +39,475 @@ CREATE FOREIGN TABLE nation (
         "n_regionkey" INTEGER,
         "n_comment"   VARCHAR(152)
 ) SERVER monetdb_server
-OPTIONS (host 'localhost', port '50000', user 'monetdb', passwd 'monetdb', dbname 'dbt3', table 'nation')
+OPTIONS (table 'nation')
 ;
 
 SELECT * FROM nation ORDER BY 1;
 
-CREATE FOREIGN TABLE nation1 (
+-- WHERE clause pushdown
+EXPLAIN (VERBOSE, COSTS OFF)
+SELECT * FROM nation WHERE n_regionkey = 1 AND n_name LIKE 'B%';
+SELECT * FROM nation WHERE n_regionkey = 1 AND n_name LIKE 'B%';
+EXPLAIN (VERBOSE, COSTS OFF)
+SELECT * FROM nation WHERE n_nationkey IN (1, 3, 5) AND n_comment IS NOT NULL AND length(n_comment) > 30;
+SELECT * FROM nation WHERE n_nationkey IN (1, 3, 5) AND n_comment IS NOT NULL AND length(n_comment) > 30 ORDER BY 1;
+EXPLAIN (VERBOSE, COSTS OFF)
+SELECT n_nationkey FROM nation WHERE n_nationkey::float8 IN (1, 'NaN');
+
+-- functions and operators translated for MonetDB
+EXPLAIN (VERBOSE, COSTS OFF)
+SELECT n_nationkey FROM nation WHERE lower(n_comment) LIKE '%final%' AND abs(n_regionkey - 2) = 0;
+SELECT n_nationkey FROM nation WHERE abs(n_regionkey - 2) = 0 ORDER BY 1;
+CREATE TABLE monetdb_fdw_pushdown (
+    func regprocedure UNIQUE,
+    oper regoperator UNIQUE,
+    remote text NOT NULL,
+    CHECK ((func IS NULL) <> (oper IS NULL))
+);
+CREATE FUNCTION monetdb_fdw_pushdown_trigger ()
+RETURNS trigger
+AS 'monetdb_fdw'
+LANGUAGE C;
+CREATE TRIGGER monetdb_fdw_pushdown_check
+  BEFORE INSERT OR UPDATE ON monetdb_fdw_pushdown
+  FOR EACH ROW EXECUTE FUNCTION monetdb_fdw_pushdown_trigger();
+CREATE TRIGGER monetdb_fdw_pushdown_changed
+  AFTER INSERT OR UPDATE OR DELETE OR TRUNCATE ON monetdb_fdw_pushdown
+  FOR EACH STATEMENT EXECUTE FUNCTION monetdb_fdw_pushdown_trigger();
+CREATE FUNCTION twice(integer) RETURNS integer
+  AS 'BEGIN RETURN $1 * 2; END' LANGUAGE plpgsql IMMUTABLE;
+EXPLAIN (VERBOSE, COSTS OFF)
+SELECT n_nationkey FROM nation WHERE twice(n_regionkey) = 4;
+INSERT INTO monetdb_fdw_pushdown (func, remote) VALUES ('twice(integer)', '($1 * 2)');
+EXPLAIN (VERBOSE, COSTS OFF)
+SELECT n_nationkey FROM nation WHERE twice(n_regionkey) = 4;
+SELECT n_nationkey FROM nation WHERE twice(n_regionkey) = 4 ORDER BY 1;
+UPDATE monetdb_fdw_pushdown SET remote = '($2 * 2)';
+DROP TABLE monetdb_fdw_pushdown;
+DROP FUNCTION twice(integer);
+
+-- date_trunc is only sent with a unit MonetDB knows, in its spelling
+CREATE FOREIGN TABLE orders (o_orderkey INTEGER, o_orderdate DATE)
+  SERVER monetdb_server OPTIONS (table 'orders');
+EXPLAIN (VERBOSE, COSTS OFF)
+SELECT o_orderkey FROM orders WHERE date_trunc('MONTH', o_orderdate::timestamp) = '1995-03-01';
+EXPLAIN (VERBOSE, COSTS OFF)
+SELECT o_orderkey FROM orders WHERE date_trunc('mons', o_orderdate::timestamp) = '1995-03-01';
+-- date arithmetic isn't the same in MonetDB
+EXPLAIN (VERBOSE, COSTS OFF)
+SELECT o_orderkey FROM orders WHERE o_orderdate - DATE '1995-01-01' > 30 AND o_orderdate + 7 < DATE '1995-03-01';
+DROP FOREIGN TABLE orders;
+
+-- projection pushdown
+EXPLAIN (VERBOSE, COSTS OFF)
+SELECT n_name FROM nation WHERE n_regionkey = 1;
+SELECT n_name FROM nation WHERE n_regionkey = 1 ORDER BY 1;
+EXPLAIN (VERBOSE, COSTS OFF)
+SELECT count(*) FROM nation;
+SELECT count(*) FROM nation;
+
+CREATE FOREIGN TABLE nation_renamed (
+        "key"  INTEGER OPTIONS (column_name 'n_nationkey'),
+        "name" CHAR(25) OPTIONS (column_name 'n_name')
+) SERVER monetdb_server
+OPTIONS (table 'nation')
+;
+
+EXPLAIN (VERBOSE, COSTS OFF)
+SELECT name FROM nation_renamed WHERE key = 7;
+SELECT name FROM nation_renamed WHERE key = 7;
+DROP FOREIGN TABLE nation_renamed;
+
+-- aggregate pushdown
+EXPLAIN (VERBOSE, COSTS OFF)
+SELECT n_regionkey, count(*), sum(n_nationkey), max(n_nationkey) FROM nation GROUP BY n_regionkey ORDER BY 1;
+SELECT n_regionkey, count(*), sum(n_nationkey), max(n_nationkey) FROM nation GROUP BY n_regionkey ORDER BY 1;
+EXPLAIN (VERBOSE, COSTS OFF)
+SELECT n_regionkey, count(*) FILTER (WHERE n_nationkey > 10) AS big, count(DISTINCT n_name) AS names
+  FROM nation GROUP BY n_regionkey HAVING sum(n_nationkey) > 50 ORDER BY 1;
+SELECT n_regionkey, count(*) FILTER (WHERE n_nationkey > 10) AS big, count(DISTINCT n_name) AS names
+  FROM nation GROUP BY n_regionkey HAVING sum(n_nationkey) > 50 ORDER BY 1;
+EXPLAIN (VERBOSE, COSTS OFF)
+SELECT avg(n_nationkey) FROM nation;
+SELECT avg(n_nationkey) FROM nation;
+
+-- join pushdown
+CREATE FOREIGN TABLE region (
+        "r_regionkey" INTEGER,
+        "r_name"      CHAR(25),
+        "r_comment"   VARCHAR(152)
+) SERVER monetdb_server
+OPTIONS (table 'region')
+;
+EXPLAIN (VERBOSE, COSTS OFF)
+SELECT n_name, r_name FROM nation JOIN region ON n_regionkey = r_regionkey WHERE r_name = 'EUROPE' ORDER BY n_name;
+SELECT n_name, r_name FROM nation JOIN region ON n_regionkey = r_regionkey WHERE r_name = 'EUROPE' ORDER BY n_name;
+EXPLAIN (VERBOSE, COSTS OFF)
+SELECT r_name, n_name FROM region LEFT JOIN nation ON r_regionkey = n_regionkey AND n_nationkey > 20 ORDER BY 1, 2;
+SELECT r_name, n_name FROM region LEFT JOIN nation ON r_regionkey = n_regionkey AND n_nationkey > 20 ORDER BY 1, 2;
+EXPLAIN (VERBOSE, COSTS OFF)
+SELECT r_name, count(*) FROM nation JOIN region ON n_regionkey = r_regionkey GROUP BY r_name ORDER BY 1;
+SELECT r_name, count(*) FROM nation JOIN region ON n_regionkey = r_regionkey GROUP BY r_name ORDER BY 1;
+DROP FOREIGN TABLE region;
+
+-- ORDER BY and LIMIT pushdown
+EXPLAIN (VERBOSE, COSTS OFF)
+SELECT n_nationkey, n_name FROM nation ORDER BY n_regionkey DESC, n_nationkey LIMIT 5 OFFSET 2;
+SELECT n_nationkey, n_name FROM nation ORDER BY n_regionkey DESC, n_nationkey LIMIT 5 OFFSET 2;
+EXPLAIN (VERBOSE, COSTS OFF)
+SELECT n_name FROM nation LIMIT 3;
+EXPLAIN (VERBOSE, COSTS OFF)
+SELECT n_regionkey, count(*) FROM nation GROUP BY n_regionkey ORDER BY n_regionkey DESC LIMIT 2;
+SELECT n_regionkey, count(*) FROM nation GROUP BY n_regionkey ORDER BY n_regionkey DESC LIMIT 2;
+-- a LIMIT done locally still stops the remote result early
+ALTER FOREIGN TABLE nation OPTIONS (ADD fetch_size '5');
+EXPLAIN (ANALYZE, COSTS OFF, TIMING OFF, SUMMARY OFF)
+SELECT n_name FROM nation WHERE length(n_comment) > 10 LIMIT 1;
+ALTER FOREIGN TABLE nation OPTIONS (DROP fetch_size);
+
+-- parameterized scans: a nested loop sends MonetDB the keys of its outer rows
+CREATE TABLE wanted_keys (key integer);
+INSERT INTO wanted_keys VALUES (3), (7), (99);
+ANALYZE wanted_keys;
+ALTER FOREIGN TABLE nation OPTIONS (ADD fdw_startup_cost '0');
+EXPLAIN (VERBOSE, COSTS OFF)
+SELECT w.key, n.n_name FROM wanted_keys w JOIN nation n ON n.n_nationkey = w.key;
+SELECT w.key, n.n_name FROM wanted_keys w JOIN nation n ON n.n_nationkey = w.key ORDER BY 1;
+ALTER FOREIGN TABLE nation OPTIONS (DROP fdw_startup_cost);
+DROP TABLE wanted_keys;
+
+-- rescans: the inner side of a nested loop returns its rows on every pass
+CREATE TABLE outer_rows (k integer);
+INSERT INTO outer_rows VALUES (1), (2);
+SET enable_hashjoin = off;
+SET enable_mergejoin = off;
+SET enable_material = off;
+SET enable_seqscan = off;
+EXPLAIN (COSTS OFF)
+SELECT o.k, n.n_name FROM outer_rows o, nation n WHERE n.n_nationkey < 2;
+SELECT o.k, n.n_name FROM outer_rows o, nation n WHERE n.n_nationkey < 2 ORDER BY 1, 2;
+ALTER FOREIGN TABLE nation OPTIONS (ADD rescan_cache 'true');
+SELECT o.k, n.n_name FROM outer_rows o, nation n WHERE n.n_nationkey < 2 ORDER BY 1, 2;
+ALTER FOREIGN TABLE nation OPTIONS (SET rescan_cache 'often');
+ALTER FOREIGN TABLE nation OPTIONS (DROP rescan_cache);
+RESET enable_hashjoin;
+RESET enable_mergejoin;
+RESET enable_material;
+RESET enable_seqscan;
+DROP TABLE outer_rows;
+
+-- parallel scan, split by the value of a column
+SET max_parallel_workers_per_gather = 2;
+SET parallel_setup_cost = 0;
+SET parallel_tuple_cost = 0;
+ALTER FOREIGN TABLE nation OPTIONS (ADD partition_column 'n_nationkey', ADD partition_count '4', ADD fdw_startup_cost '1');
+EXPLAIN (COSTS OFF)
+SELECT count(*), sum(n_nationkey) FROM nation WHERE length(n_comment) > 0;
+SELECT count(*), sum(n_nationkey) FROM nation WHERE length(n_comment) > 0;
+ALTER FOREIGN TABLE nation OPTIONS (ADD partition_method 'range');
+EXPLAIN (COSTS OFF)
+SELECT count(*), sum(n_nationkey) FROM nation WHERE length(n_comment) > 0;
+SELECT count(*), sum(n_nationkey) FROM nation WHERE length(n_comment) > 0;
+ALTER FOREIGN TABLE nation OPTIONS (SET partition_method 'hash');
+ALTER FOREIGN TABLE nation OPTIONS (SET partition_count '0');
+-- a column the table can't be split by: no parallel scan, and no error
+ALTER FOREIGN TABLE nation OPTIONS (SET partition_column 'n_name');
+EXPLAIN (COSTS OFF)
+SELECT count(*), sum(n_nationkey) FROM nation WHERE length(n_comment) > 0;
+ALTER FOREIGN TABLE nation OPTIONS (DROP partition_column, DROP partition_count, DROP partition_method, DROP fdw_startup_cost);
+RESET max_parallel_workers_per_gather;
+RESET parallel_setup_cost;
+RESET parallel_tuple_cost;
+
+-- asynchronous execution of an Append over foreign tables
+CREATE TABLE nation_by_region (
+        "n_nationkey" INTEGER,
+        "n_name"      CHAR(25),
+        "n_regionkey" INTEGER,
+        "n_comment"   VARCHAR(152)
+) PARTITION BY RANGE (n_regionkey);
+CREATE FOREIGN TABLE nation_r01 PARTITION OF nation_by_region
+  FOR VALUES FROM (0) TO (2) SERVER monetdb_server
+  OPTIONS (query 'SELECT * FROM nation WHERE n_regionkey < 2');
+CREATE FOREIGN TABLE nation_r24 PARTITION OF nation_by_region
+  FOR VALUES FROM (2) TO (5) SERVER monetdb_server
+  OPTIONS (query 'SELECT * FROM nation WHERE n_regionkey >= 2');
+ALTER SERVER monetdb_server OPTIONS (ADD async_capable 'true');
+EXPLAIN (COSTS OFF) SELECT * FROM nation_by_region;
+EXPLAIN (ANALYZE, COSTS OFF, TIMING OFF, SUMMARY OFF) SELECT * FROM nation_by_region;
+SELECT n_regionkey, count(*) FROM nation_by_region GROUP BY 1 ORDER BY 1;
+ALTER FOREIGN TABLE nation_r01 OPTIONS (ADD async_capable 'sometimes');
+ALTER SERVER monetdb_server OPTIONS (DROP async_capable);
+DROP TABLE nation_by_region;
+
+-- cost estimation options
+ALTER SERVER monetdb_server OPTIONS (ADD fdw_startup_cost '50', ADD fdw_tuple_cost '0.05');
+ALTER FOREIGN TABLE nation OPTIONS (ADD use_remote_estimate 'true');
+EXPLAIN (COSTS OFF) SELECT * FROM nation WHERE n_regionkey = 3;
+SELECT count(*) FROM nation WHERE n_regionkey = 3;
+ALTER FOREIGN TABLE nation OPTIONS (ADD fdw_tuple_cost 'cheap');
+ALTER FOREIGN TABLE nation OPTIONS (DROP use_remote_estimate);
+ALTER SERVER monetdb_server OPTIONS (DROP fdw_startup_cost, DROP fdw_tuple_cost);
+
+-- batched fetching
+ALTER FOREIGN TABLE nation OPTIONS (ADD fetch_size '10');
+EXPLAIN (ANALYZE, COSTS OFF, TIMING OFF, SUMMARY OFF)
+SELECT * FROM nation;
+ALTER FOREIGN TABLE nation OPTIONS (DROP fetch_size);
+EXPLAIN (ANALYZE, COSTS OFF, TIMING OFF, SUMMARY OFF)
+SELECT * FROM nation;
+ALTER FOREIGN TABLE nation OPTIONS (ADD fetch_size '0');
+ALTER SERVER monetdb_server OPTIONS (ADD fetch_size 'many');
+
+-- reading ahead in a thread returns the same rows
+ALTER FOREIGN TABLE nation OPTIONS (ADD fetch_size '10', ADD prefetch_depth '2');
+SELECT count(*), sum(n_nationkey) FROM (SELECT * FROM nation OFFSET 0) s;
+ALTER FOREIGN TABLE nation OPTIONS (DROP fetch_size, DROP prefetch_depth);
+ALTER SERVER monetdb_server OPTIONS (ADD prefetch_depth '-1');
+
+-- binary transfer, or text if the server can't do it
+ALTER FOREIGN TABLE nation OPTIONS (ADD transfer_mode 'binary', ADD binary_threshold '0');
+EXPLAIN (VERBOSE, COSTS OFF)
+SELECT n_nationkey, n_regionkey FROM nation WHERE n_regionkey = 1;
+SELECT count(*), sum(n_nationkey), sum(n_regionkey)
+  FROM (SELECT n_nationkey, n_regionkey FROM nation WHERE n_regionkey = 1 OFFSET 0) s;
+ALTER FOREIGN TABLE nation OPTIONS (DROP transfer_mode, DROP binary_threshold);
+ALTER SERVER monetdb_server OPTIONS (ADD transfer_mode 'columnar');
+
+-- converting a row at a time returns the same rows as a block at a time
+SET monetdb_fdw.batch_decode = off;
+SELECT count(*), sum(n_nationkey) FROM (SELECT * FROM nation OFFSET 0) s;
+RESET monetdb_fdw.batch_decode;
+
+-- datum conversion
+CREATE FOREIGN TABLE monetdb_types (
+        i2  SMALLINT,
+        i4  INTEGER,
+        i8  BIGINT,
+        f4  REAL,
+        f8  DOUBLE PRECISION,
+        n   NUMERIC(10,2),
+        d   DATE,
+        ts  TIMESTAMP,
+        t   TEXT,
+        vc  VARCHAR(3),
+        nul INTEGER
+) SERVER monetdb_server
+OPTIONS (query 'SELECT CAST(-2 AS SMALLINT), 4, CAST(8 AS BIGINT), CAST(0.5 AS REAL), CAST(1.25 AS DOUBLE), CAST(123.4 AS DECIMAL(10,1)), DATE ''2000-02-29'', TIMESTAMP ''2013-01-02 03:04:05.123456'', ''text'', ''abc'', CAST(NULL AS INTEGER)')
+;
+
+SET datestyle = ISO;
+SELECT * FROM monetdb_types;
+RESET datestyle;
+DROP FOREIGN TABLE monetdb_types;
+
+-- the columns of a query are taken by position, leaving out dropped ones
+CREATE FOREIGN TABLE query_dropped (k INTEGER, gone INTEGER, name CHAR(25)) SERVER monetdb_server
+OPTIONS (query 'SELECT n_nationkey, n_name FROM nation WHERE n_nationkey < 3')
+;
+ALTER FOREIGN TABLE query_dropped DROP COLUMN gone;
+SELECT * FROM query_dropped ORDER BY k;
+ANALYZE query_dropped;
+DROP FOREIGN TABLE query_dropped;
+
+-- per-row memory is released as the scan goes: the peak memory of the
+-- whole backend during a scan doesn't grow with the rows fetched
+CREATE FOREIGN TABLE series_small ("value" INTEGER) SERVER monetdb_server
+OPTIONS (query 'SELECT * FROM sys.generate_series(1, 1001)')
+;
+CREATE FOREIGN TABLE series_large ("value" INTEGER) SERVER monetdb_server
+OPTIONS (query 'SELECT * FROM sys.generate_series(1, 50001)')
+;
+CREATE FUNCTION monetdb_scan_memory() RETURNS bigint AS $$
+  SELECT sum(total_bytes)::bigint FROM pg_backend_memory_contexts
+$$ LANGUAGE sql VOLATILE;
+CREATE TEMP TABLE scan_memory (nrows int, peak bigint);
+INSERT INTO scan_memory SELECT count(*), max(monetdb_scan_memory()) FROM series_small;
+INSERT INTO scan_memory SELECT count(*), max(monetdb_scan_memory()) FROM series_large;
+SELECT nrows FROM scan_memory ORDER BY nrows;
+SELECT max(peak) - min(peak) < 1024 * 1024 AS bounded FROM scan_memory;
+DROP TABLE scan_memory;
+DROP FUNCTION monetdb_scan_memory();
+DROP FOREIGN TABLE series_small;
+DROP FOREIGN TABLE series_large;
+
+-- ANALYZE, with the rows sampled by MonetDB
+ANALYZE nation;
+SELECT relpages, reltuples FROM pg_class WHERE relname = 'nation';
+SELECT attname, n_distinct FROM pg_stats WHERE tablename = 'nation' ORDER BY attname;
+ALTER FOREIGN TABLE nation OPTIONS (ADD analyze_sampling 'random');
+ANALYZE nation;
+SELECT relpages, reltuples FROM pg_class WHERE relname = 'nation';
+ALTER FOREIGN TABLE nation OPTIONS (SET analyze_sampling 'system');
+ALTER FOREIGN TABLE nation OPTIONS (DROP analyze_sampling);
+CREATE FOREIGN TABLE series_analyze ("value" INTEGER) SERVER monetdb_server
+OPTIONS (query 'SELECT * FROM sys.generate_series(1, 302)')
+;
+-- 300 rows to sample: fewer than the table has
+ALTER FOREIGN TABLE series_analyze ALTER COLUMN "value" SET STATISTICS 1;
+ANALYZE VERBOSE series_analyze;
+ALTER FOREIGN TABLE series_analyze OPTIONS (ADD analyze_sampling 'random');
+ANALYZE VERBOSE series_analyze;
+ALTER FOREIGN TABLE series_analyze OPTIONS (SET analyze_sampling 'off');
+ANALYZE VERBOSE series_analyze;
+SELECT reltuples FROM pg_class WHERE relname = 'series_analyze';
+DROP FOREIGN TABLE series_analyze;
+
+-- INSERT, one row per statement or in batches
+CREATE FOREIGN TABLE monetdb_ddl ("dummy" INTEGER) SERVER monetdb_server
+OPTIONS (query 'CREATE TABLE fdw_nation AS SELECT * FROM nation WITH NO DATA')
+;
+SELECT * FROM monetdb_ddl;
+CREATE FOREIGN TABLE nation_copy (
         "n_nationkey" INTEGER,
         "n_name"      CHAR(25),
         "n_regionkey" INTEGER,
         "n_comment"   VARCHAR(152)
 ) SERVER monetdb_server
-OPTIONS (host 'nosuchhost', port '50000', user 'monetdb', passwd 'monetdb', dbname 'dbt3', table 'nation')
+OPTIONS (table 'fdw_nation')
+;
+INSERT INTO nation_copy VALUES (100, 'ATLANTIS', 5, 'sunk'), (101, 'LEMURIA', 5, NULL);
+INSERT INTO nation_copy VALUES (102, 'MU', 5, 'also sunk') RETURNING n_nationkey, n_name;
+ALTER FOREIGN TABLE nation_copy OPTIONS (ADD batch_size '10');
+EXPLAIN (VERBOSE, COSTS OFF) INSERT INTO nation_copy SELECT * FROM nation;
+INSERT INTO nation_copy SELECT * FROM nation;
+COPY nation_copy FROM STDIN;
+103	HY-BRASIL	5	\N
+104	THULE	5	far north, "they say"
+\.
+SELECT count(*), count(n_comment) FROM nation_copy;
+SELECT * FROM nation_copy WHERE n_regionkey = 5 ORDER BY 1;
+ALTER FOREIGN TABLE nation_copy OPTIONS (SET batch_size '0');
+-- UPDATE and DELETE, done by MonetDB in a single statement
+EXPLAIN (VERBOSE, COSTS OFF)
+UPDATE nation_copy SET n_regionkey = n_regionkey + 1 WHERE n_regionkey = 5;
+UPDATE nation_copy SET n_regionkey = n_regionkey + 1 WHERE n_regionkey = 5;
+UPDATE nation_copy SET n_comment = n_comment || ' again' WHERE n_nationkey IN (100, 102)
+  RETURNING n_nationkey, n_regionkey, n_comment;
+EXPLAIN (VERBOSE, COSTS OFF)
+DELETE FROM nation_copy WHERE n_regionkey = 6 AND n_comment IS NULL RETURNING n_name;
+DELETE FROM nation_copy WHERE n_regionkey = 6 AND n_comment IS NULL RETURNING n_nationkey, n_name;
+DELETE FROM nation_copy WHERE n_regionkey = 6;
+SELECT count(*) FROM nation_copy;
+-- a new value MonetDB can't compute the same way
+UPDATE nation_copy SET n_regionkey = n_regionkey / 2;
+-- the changes are made in a remote transaction, which ends with ours
+BEGIN;
+INSERT INTO nation_copy VALUES (200, 'AVALON', 7, NULL);
+DELETE FROM nation_copy WHERE n_regionkey = 0;
+SELECT count(*) FROM nation_copy;
+ROLLBACK;
+SELECT count(*) FROM nation_copy;
+BEGIN;
+INSERT INTO nation_copy VALUES (200, 'AVALON', 7, NULL);
+SAVEPOINT before_delete;
+DELETE FROM nation_copy WHERE n_regionkey = 0;
+ROLLBACK TO SAVEPOINT before_delete;
+COMMIT;
+SELECT count(*) FROM nation_copy;
+-- an error once some batches were sent
+INSERT INTO nation_copy
+  SELECT n_nationkey + 300, n_name, 7 + 1 / (n_nationkey - 20), n_comment
+    FROM nation ORDER BY n_nationkey;
+SELECT count(*) FROM nation_copy WHERE n_nationkey >= 300;
+ALTER FOREIGN TABLE monetdb_ddl OPTIONS (SET query 'DROP TABLE fdw_nation');
+SELECT * FROM monetdb_ddl;
+DROP FOREIGN TABLE nation_copy;
+-- stored generated columns are computed here and stored like the others
+ALTER FOREIGN TABLE monetdb_ddl OPTIONS (SET query 'CREATE TABLE fdw_generated (a INT, b INT)');
+SELECT * FROM monetdb_ddl;
+CREATE FOREIGN TABLE generated_copy (
+        "a" INTEGER,
+        "b" INTEGER GENERATED ALWAYS AS (a * 2) STORED
+) SERVER monetdb_server
+OPTIONS (table 'fdw_generated')
+;
+INSERT INTO generated_copy (a) VALUES (1), (2) RETURNING a, b;
+SELECT * FROM generated_copy ORDER BY a;
+ALTER FOREIGN TABLE monetdb_ddl OPTIONS (SET query 'DROP TABLE fdw_generated');
+SELECT * FROM monetdb_ddl;
+DROP FOREIGN TABLE generated_copy;
+DROP FOREIGN TABLE monetdb_ddl;
+
+-- connection cache
+SELECT server_name, valid FROM monetdb_fdw_get_connections() ORDER BY 1;
+SELECT monetdb_fdw_disconnect('monetdb_server');
+SELECT server_name, valid FROM monetdb_fdw_get_connections() ORDER BY 1;
+SELECT count(*) FROM nation;
+SELECT server_name, valid FROM monetdb_fdw_get_connections() ORDER BY 1;
+SELECT monetdb_fdw_disconnect_all();
+
+CREATE SERVER nosuchhost_server FOREIGN DATA WRAPPER monetdb_fdw
+  OPTIONS (host 'nosuchhost', port '50000', dbname 'dbt3');
+CREATE USER MAPPING FOR current_user SERVER nosuchhost_server
+  OPTIONS (user 'monetdb', passwd 'monetdb');
+CREATE FOREIGN TABLE nation1 (
+        "n_nationkey" INTEGER,
+        "n_name"      CHAR(25),
+        "n_regionkey" INTEGER,
+        "n_comment"   VARCHAR(152)
+) SERVER nosuchhost_server
+OPTIONS (table 'nation')
 ;
 
 SELECT * FROM nation1;
 
+CREATE SERVER badport_server FOREIGN DATA WRAPPER monetdb_fdw
+  OPTIONS (host 'localhost', port '50001', dbname 'dbt3');
+CREATE USER MAPPING FOR current_user SERVER badport_server
+  OPTIONS (user 'monetdb', passwd 'monetdb');
 CREATE FOREIGN TABLE nation2 (
         "n_nationkey" INTEGER,
         "n_name"      CHAR(25),
         "n_regionkey" INTEGER,
         "n_comment"   VARCHAR(152)
-) SERVER monetdb_server
-OPTIONS (host 'localhost', port '50001', user 'monetdb', passwd 'monetdb', dbname 'dbt3', table 'nation')
+) SERVER badport_server
+OPTIONS (table 'nation')
 ;
 
 SELECT * FROM nation2;
 
+CREATE SERVER nosuchuser_server FOREIGN DATA WRAPPER monetdb_fdw
+  OPTIONS (host 'localhost', port '50000', dbname 'dbt3');
+CREATE USER MAPPING FOR current_user SERVER nosuchuser_server
+  OPTIONS (user 'nosuchuser', passwd 'monetdb');
 CREATE FOREIGN TABLE nation3 (
         "n_nationkey" INTEGER,
         "n_name"      CHAR(25),
         "n_regionkey" INTEGER,
         "n_comment"   VARCHAR(152)
-) SERVER monetdb_server
-OPTIONS (host 'localhost', port '50000', user 'nosuchuser', passwd 'monetdb', dbname 'dbt3', table 'nation')
+) SERVER nosuchuser_server
+OPTIONS (table 'nation')
 ;
 
 SELECT * FROM nation3;
 
+CREATE SERVER wrongpass_server FOREIGN DATA WRAPPER monetdb_fdw
+  OPTIONS (host 'localhost', port '50000', dbname 'dbt3');
+CREATE USER MAPPING FOR current_user SERVER wrongpass_server
+  OPTIONS (user 'monetdb', passwd 'wrongpass');
 CREATE FOREIGN TABLE nation4 (
         "n_nationkey" INTEGER,
         "n_name"      CHAR(25),
         "n_regionkey" INTEGER,
         "n_comment"   VARCHAR(152)
-) SERVER monetdb_server
-OPTIONS (host 'localhost', port '50000', user 'monetdb', passwd 'wrongpass', dbname 'dbt3', table 'nation')
+) SERVER wrongpass_server
+OPTIONS (table 'nation')
 ;
 
 SELECT * FROM nation4;
 
+CREATE SERVER nosuchdb_server FOREIGN DATA WRAPPER monetdb_fdw
+  OPTIONS (host 'localhost', port '50000', dbname 'nosuchdb');
+CREATE USER MAPPING FOR current_user SERVER nosuchdb_server
+  OPTIONS (user 'monetdb', passwd 'monetdb');
 CREATE FOREIGN TABLE nation5 (
         "n_nationkey" INTEGER,
         "n_name"      CHAR(25),
         "n_regionkey" INTEGER,
         "n_comment"   VARCHAR(152)
-) SERVER monetdb_server
-OPTIONS (host 'localhost', port '50000', user 'monetdb', passwd 'monetdb', dbname 'nosuchdb', table 'nation')
+) SERVER nosuchdb_server
+OPTIONS (table 'nation')
 ;
 
 SELECT * FROM nation5;
@@ -87,7 +518,7 @@ CREATE FOREIGN TABLE nation6 (
         "n_regionkey" INTEGER,
         "n_comment"   VARCHAR(152)
 ) SERVER monetdb_server
-OPTIONS (host 'localhost', port '50000', user 'monetdb', passwd 'monetdb', dbname 'dbt3', table 'nosuchtable')
+OPTIONS (table 'nosuchtable')
 ;
 
 SELECT * FROM nation6;
@@ -98,7 +529,7 @@ CREATE FOREIGN TABLE nation7 (
         "n_regionkey" INTEGER,
         "n_comment"   VARCHAR(152)
 ) SERVER monetdb_server
-OPTIONS (host 'localhost', port '50000', user 'monetdb', passwd 'monetdb', dbname 'dbt3', table 'select * fro nation')
+OPTIONS (table 'select * fro nation')
 ;
 
 SELECT * FROM nation7;
@@ -109,7 +540,7 @@ CREATE FOREIGN TABLE nation8 (
         "n_regionkey" INTEGER,
         "n_comment"   VARCHAR(152)
 ) SERVER monetdb_server
-OPTIONS (host 'localhost', port '50000', user 'monetdb', passwd 'monetdb', dbname 'dbt3', query 'select * fro nation')
+OPTIONS (query 'select * fro nation')
 ;
 
 SELECT * FROM nation8;
@@ -123,4 +554,15 @@ DROP FOREIGN TABLE nation6;
 DROP FOREIGN TABLE nation7;
 DROP FOREIGN TABLE nation8;
 
+DROP USER MAPPING FOR current_user SERVER nosuchhost_server;
+DROP USER MAPPING FOR current_user SERVER badport_server;
+DROP USER MAPPING FOR current_user SERVER nosuchuser_server;
+DROP USER MAPPING FOR current_user SERVER wrongpass_server;
+DROP USER MAPPING FOR current_user SERVER nosuchdb_server;
+DROP SERVER nosuchhost_server;
+DROP SERVER badport_server;
+DROP SERVER nosuchuser_server;
+DROP SERVER wrongpass_server;
+DROP SERVER nosuchdb_server;
+
 \d
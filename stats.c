@@ -0,0 +1,400 @@
+/*-------------------------------------------------------------------------
+ *
+ * stats.c
+ *                cumulative statistics of the MonetDB traffic of monetdb_fdw
+ *
+ * Every backend adds what its foreign scans fetched, how long they waited
+ * on MonetDB, the connections it opened or reused and the errors MonetDB
+ * reported to a hash table in shared memory, so that the expensive foreign
+ * tables and servers can be found across all sessions.  The statistics
+ * are kept per database, foreign server and foreign table; connections
+ * and the errors of statements that are not about one table are counted
+ * in an entry of the server alone, whose relid is InvalidOid.
+ *
+ * Shared memory can only be set aside while the server starts, so this
+ * needs monetdb_fdw in shared_preload_libraries; without it, nothing is
+ * recorded.
+ *
+ * Copyright (c) 2010-2013, PostgreSQL Global Development Group
+ * Copyright (c) 2013, Satoshi Nagayasu
+ *
+ * IDENTIFICATION
+ *                contrib/monetdb_fdw/stats.c
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include "monetdb_fdw.h"
+
+#include "funcapi.h"
+#include "mb/pg_wchar.h"
+#include "miscadmin.h"
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "storage/spin.h"
+#include "utils/builtins.h"
+#include "utils/guc.h"
+#include "utils/hsearch.h"
+#include "utils/timestamp.h"
+
+/* longest error message kept, including the terminating zero */
+#define MONETDB_STATS_ERROR_LEN		256
+
+typedef struct MonetdbStatsKey
+{
+	Oid			dbid;			/* database the statistics are from */
+	Oid			serverid;		/* foreign server */
+	Oid			relid;			/* foreign table, or InvalidOid */
+} MonetdbStatsKey;
+
+typedef struct MonetdbStatsEntry
+{
+	MonetdbStatsKey key;		/* hash key (must be first) */
+	slock_t		mutex;			/* protects the fields below */
+	int64		scans;			/* foreign scans run */
+	int64		rows_fetched;	/* rows received from MonetDB */
+	int64		bytes_received; /* length of the text of their fields */
+	int64		conns_opened;	/* connections established */
+	int64		conns_reused;	/* cached connections used again */
+	double		remote_time;	/* ms spent waiting on MonetDB */
+	int64		errors;			/* errors MonetDB reported */
+	TimestampTz last_error_time;
+	char		last_error[MONETDB_STATS_ERROR_LEN];
+} MonetdbStatsEntry;
+
+typedef struct MonetdbStatsShared
+{
+	LWLock	   *lock;			/* protects the hash table's entries */
+} MonetdbStatsShared;
+
+/* maximum number of entries (monetdb_fdw.stat_max) */
+static int	stat_max = 1000;
+
+static MonetdbStatsShared *stats_shared = NULL;
+static HTAB *stats_hash = NULL;
+
+static shmem_request_hook_type prev_shmem_request_hook = NULL;
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+
+PG_FUNCTION_INFO_V1(monetdb_fdw_stat_tables);
+PG_FUNCTION_INFO_V1(monetdb_fdw_stat_reset);
+
+static void monetdb_stats_shmem_request(void);
+static void monetdb_stats_shmem_startup(void);
+static Size monetdb_stats_memsize(void);
+static MonetdbStatsEntry *get_stats_entry(Oid serverid, Oid relid);
+
+
+/*
+ * Set up the statistics, if monetdb_fdw is being preloaded.  Called from
+ * _PG_init().
+ */
+void
+monetdbStatsInit(void)
+{
+	if (!process_shared_preload_libraries_in_progress)
+		return;
+
+	DefineCustomIntVariable("monetdb_fdw.stat_max",
+							"Sets the maximum number of foreign tables and servers tracked by monetdb_fdw.",
+							NULL,
+							&stat_max,
+							1000,
+							100,
+							INT_MAX / 2,
+							PGC_POSTMASTER,
+							0,
+							NULL,
+							NULL,
+							NULL);
+
+	MarkGUCPrefixReserved("monetdb_fdw");
+
+	prev_shmem_request_hook = shmem_request_hook;
+	shmem_request_hook = monetdb_stats_shmem_request;
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = monetdb_stats_shmem_startup;
+}
+
+static void
+monetdb_stats_shmem_request(void)
+{
+	if (prev_shmem_request_hook)
+		prev_shmem_request_hook();
+
+	RequestAddinShmemSpace(monetdb_stats_memsize());
+	RequestNamedLWLockTranche("monetdb_fdw", 1);
+}
+
+static Size
+monetdb_stats_memsize(void)
+{
+	return add_size(MAXALIGN(sizeof(MonetdbStatsShared)),
+					hash_estimate_size(stat_max, sizeof(MonetdbStatsEntry)));
+}
+
+static void
+monetdb_stats_shmem_startup(void)
+{
+	bool		found;
+	HASHCTL		ctl;
+
+	if (prev_shmem_startup_hook)
+		prev_shmem_startup_hook();
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+	stats_shared = ShmemInitStruct("monetdb_fdw stats",
+								   sizeof(MonetdbStatsShared),
+								   &found);
+	if (!found)
+		stats_shared->lock = &(GetNamedLWLockTranche("monetdb_fdw"))->lock;
+
+	ctl.keysize = sizeof(MonetdbStatsKey);
+	ctl.entrysize = sizeof(MonetdbStatsEntry);
+	stats_hash = ShmemInitHash("monetdb_fdw stats hash",
+							   stat_max, stat_max,
+							   &ctl,
+							   HASH_ELEM | HASH_BLOBS);
+
+	LWLockRelease(AddinShmemInitLock);
+}
+
+/*
+ * Is there anywhere to record statistics?  Callers use this to skip
+ * measuring what nothing will record.
+ */
+bool
+monetdbStatsEnabled(void)
+{
+	return stats_hash != NULL;
+}
+
+/*
+ * Find the entry of a foreign table, or of a server with relid InvalidOid,
+ * creating it if needed.  Return NULL if the table is full; the statistics
+ * are then lost until it is reset.
+ *
+ * The caller must hold the lock in shared mode, and still holds it on
+ * return.
+ */
+static MonetdbStatsEntry *
+get_stats_entry(Oid serverid, Oid relid)
+{
+	MonetdbStatsKey key;
+	MonetdbStatsEntry *entry;
+	bool		found;
+
+	/* Assume no pad bytes in key struct */
+	key.dbid = MyDatabaseId;
+	key.serverid = serverid;
+	key.relid = relid;
+
+	entry = hash_search(stats_hash, &key, HASH_FIND, NULL);
+	if (entry)
+		return entry;
+
+	/* adding an entry needs the lock in exclusive mode */
+	LWLockRelease(stats_shared->lock);
+	LWLockAcquire(stats_shared->lock, LW_EXCLUSIVE);
+
+	entry = hash_search(stats_hash, &key, HASH_ENTER_NULL, &found);
+	if (entry && !found)
+	{
+		memset((char *) entry + sizeof(MonetdbStatsKey), 0,
+			   sizeof(MonetdbStatsEntry) - sizeof(MonetdbStatsKey));
+		SpinLockInit(&entry->mutex);
+	}
+
+	LWLockRelease(stats_shared->lock);
+	LWLockAcquire(stats_shared->lock, LW_SHARED);
+
+	/* a reset may have removed the entry while the lock was released */
+	if (entry)
+		entry = hash_search(stats_hash, &key, HASH_FIND, NULL);
+
+	return entry;
+}
+
+/*
+ * Add the figures of a foreign scan that has ended to its table.
+ */
+void
+monetdbStatsRecordScan(Oid serverid, Oid relid, int64 rows_fetched,
+					   int64 bytes_received, double remote_time)
+{
+	MonetdbStatsEntry *entry;
+
+	if (!stats_hash)
+		return;
+
+	LWLockAcquire(stats_shared->lock, LW_SHARED);
+	entry = get_stats_entry(serverid, relid);
+	if (entry)
+	{
+		SpinLockAcquire(&entry->mutex);
+		entry->scans++;
+		entry->rows_fetched += rows_fetched;
+		entry->bytes_received += bytes_received;
+		entry->remote_time += remote_time;
+		SpinLockRelease(&entry->mutex);
+	}
+	LWLockRelease(stats_shared->lock);
+}
+
+/*
+ * Count a connection to a server that was established, or taken from the
+ * backend's cache.
+ */
+void
+monetdbStatsRecordConnection(Oid serverid, bool opened)
+{
+	MonetdbStatsEntry *entry;
+
+	if (!stats_hash)
+		return;
+
+	LWLockAcquire(stats_shared->lock, LW_SHARED);
+	entry = get_stats_entry(serverid, InvalidOid);
+	if (entry)
+	{
+		SpinLockAcquire(&entry->mutex);
+		if (opened)
+			entry->conns_opened++;
+		else
+			entry->conns_reused++;
+		SpinLockRelease(&entry->mutex);
+	}
+	LWLockRelease(stats_shared->lock);
+}
+
+/*
+ * Count an error MonetDB reported, against the foreign table the statement
+ * was about, or the server alone if relid is InvalidOid.
+ *
+ * This is called on the way to an ERROR, so it must not throw one itself.
+ */
+void
+monetdbStatsRecordError(Oid serverid, Oid relid, const char *message)
+{
+	MonetdbStatsEntry *entry;
+	TimestampTz now;
+	int			len;
+
+	if (!stats_hash)
+		return;
+
+	now = GetCurrentTimestamp();
+
+	/* don't cut a multibyte character in half */
+	len = pg_mbcliplen(message, strlen(message), MONETDB_STATS_ERROR_LEN - 1);
+
+	LWLockAcquire(stats_shared->lock, LW_SHARED);
+	entry = get_stats_entry(serverid, relid);
+	if (entry)
+	{
+		SpinLockAcquire(&entry->mutex);
+		entry->errors++;
+		entry->last_error_time = now;
+		memcpy(entry->last_error, message, len);
+		entry->last_error[len] = '\0';
+		SpinLockRelease(&entry->mutex);
+	}
+	LWLockRelease(stats_shared->lock);
+}
+
+/*
+ * Return the statistics of all databases, one row per foreign table, and
+ * one per server for its connections and other errors.
+ */
+Datum
+monetdb_fdw_stat_tables(PG_FUNCTION_ARGS)
+{
+#define MONETDB_FDW_STAT_TABLES_COLS	12
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	HASH_SEQ_STATUS scan;
+	MonetdbStatsEntry *entry;
+
+	if (!stats_hash)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("monetdb_fdw must be loaded via shared_preload_libraries")));
+
+	InitMaterializedSRF(fcinfo, 0);
+
+	LWLockAcquire(stats_shared->lock, LW_SHARED);
+
+	hash_seq_init(&scan, stats_hash);
+	while ((entry = (MonetdbStatsEntry *) hash_seq_search(&scan)))
+	{
+		Datum		values[MONETDB_FDW_STAT_TABLES_COLS];
+		bool		nulls[MONETDB_FDW_STAT_TABLES_COLS];
+		MonetdbStatsEntry tmp;
+		int			i = 0;
+
+		memset(values, 0, sizeof(values));
+		memset(nulls, 0, sizeof(nulls));
+
+		/* copy the counters, so the spinlock is held only briefly */
+		SpinLockAcquire(&entry->mutex);
+		tmp = *entry;
+		SpinLockRelease(&entry->mutex);
+
+		values[i++] = ObjectIdGetDatum(tmp.key.dbid);
+		values[i++] = ObjectIdGetDatum(tmp.key.serverid);
+		if (OidIsValid(tmp.key.relid))
+			values[i++] = ObjectIdGetDatum(tmp.key.relid);
+		else
+			nulls[i++] = true;
+		values[i++] = Int64GetDatum(tmp.scans);
+		values[i++] = Int64GetDatum(tmp.rows_fetched);
+		values[i++] = Int64GetDatum(tmp.bytes_received);
+		values[i++] = Int64GetDatum(tmp.conns_opened);
+		values[i++] = Int64GetDatum(tmp.conns_reused);
+		values[i++] = Float8GetDatum(tmp.remote_time);
+		values[i++] = Int64GetDatum(tmp.errors);
+		if (tmp.errors > 0)
+		{
+			values[i++] = CStringGetTextDatum(tmp.last_error);
+			values[i++] = TimestampTzGetDatum(tmp.last_error_time);
+		}
+		else
+		{
+			nulls[i++] = true;
+			nulls[i++] = true;
+		}
+
+		tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc, values, nulls);
+	}
+
+	LWLockRelease(stats_shared->lock);
+
+	PG_RETURN_VOID();
+}
+
+/*
+ * Discard all the statistics.
+ */
+Datum
+monetdb_fdw_stat_reset(PG_FUNCTION_ARGS)
+{
+	HASH_SEQ_STATUS scan;
+	MonetdbStatsEntry *entry;
+
+	if (!stats_hash)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("monetdb_fdw must be loaded via shared_preload_libraries")));
+
+	LWLockAcquire(stats_shared->lock, LW_EXCLUSIVE);
+
+	hash_seq_init(&scan, stats_hash);
+	while ((entry = (MonetdbStatsEntry *) hash_seq_search(&scan)))
+		hash_search(stats_hash, &entry->key, HASH_REMOVE, NULL);
+
+	LWLockRelease(stats_shared->lock);
+
+	PG_RETURN_VOID();
+}
@@ -40,9 +40,11 @@ EOF
 psql ${PSQL_OPTS} ${DBNAME} <<EOF
 \timing
 
-CREATE SERVER monetdb_server FOREIGN DATA WRAPPER monetdb_fdw;
+CREATE SERVER monetdb_server FOREIGN DATA WRAPPER monetdb_fdw
+  OPTIONS (host 'localhost', port '50000', dbname 'dbt3');
 
-CREATE USER MAPPING FOR current_user SERVER monetdb_server;
+CREATE USER MAPPING FOR current_user SERVER monetdb_server
+  OPTIONS (user 'monetdb', passwd 'monetdb');
 
 --
 -- customer
@@ -53,7 +55,7 @@ CREATE FOREIGN TABLE nation (
         "n_regionkey" INTEGER,
         "n_comment"   VARCHAR(152)
 ) SERVER monetdb_server
-OPTIONS (host 'localhost', port '50000', user 'monetdb', passwd 'monetdb', dbname 'dbt3', table 'nation')
+OPTIONS (table 'nation')
 ;
 
 SELECT * FROM nation;
@@ -64,7 +66,7 @@ SELECT * FROM nation;
 CREATE FOREIGN TABLE customer (
         count      text
 ) SERVER monetdb_server
-OPTIONS (host 'localhost', port '50000', user 'monetdb', passwd 'monetdb', dbname 'dbt3', query 'select count(*) from customer')
+OPTIONS (query 'select count(*) from customer')
 ;
 
 SELECT * FROM customer;
@@ -78,7 +80,7 @@ CREATE FOREIGN TABLE q12 (
         high_line_count bigint,
         low_line_count bigint
 ) SERVER monetdb_server
-OPTIONS (host 'localhost', port '50000', user 'monetdb', passwd 'monetdb', dbname 'dbt3', query '
+OPTIONS (query '
 select l_shipmode,
         sum(case when o_orderpriority = ''1-URGENT'' or o_orderpriority = ''2-HIGH'' then 1 else 0 end) as high_line_count,
         sum(case when o_orderpriority <> ''1-URGENT'' and o_orderpriority <> ''2-HIGH'' then 1 else 0 end) as low_line_count